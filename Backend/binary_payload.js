@@ -0,0 +1,116 @@
+/**
+ * @file binary_payload.js
+ * @brief Decoder for the readers' CBOR event payloads
+ * @author Development Team
+ * @version 1.0.0
+ * @date October 2025
+ *
+ * Has no dependencies, so scripts/payload-bench.js can time it without a
+ * database or a broker.
+ */
+
+// Binary event payloads. Readers built with EVENT_PAYLOAD_CBOR send
+// self-described CBOR (tag 55799) instead of JSON; the layout is
+// documented in the firmware's event_encoder.h. JSON always starts with
+// '{', so the first three bytes pick the decoder. Decoded events take the
+// same shape as the JSON ones, so everything after this is shared. A
+// batch is an array of events, in either format.
+const BINARY_PAYLOAD_MARKER = Buffer.from([0xd9, 0xd9, 0xf7]);
+const BINARY_PAYLOAD_VERSION = 1;
+const BINARY_EVENT_TYPES = ['check_in', 'check_out', 'denied', 'alert'];
+const ROLE_NAMES = ['Unknown', 'Guest', 'Manager', 'Maintenance', 'Housekeeping', 'Security'];
+// Readers stamp local time; this must match their GMT_OFFSET_SEC
+const READER_UTC_OFFSET_MS = Number(process.env.READER_UTC_OFFSET_SEC || 19800) * 1000;
+
+// Minimal CBOR reader: unsigned ints, byte strings, arrays and tags, which
+// is all the readers send. Throws on anything else or on truncation.
+function readCbor(buf, pos) {
+  if (pos >= buf.length) throw new Error('truncated CBOR');
+  const major = buf[pos] >> 5;
+  const info = buf[pos] & 0x1f;
+  pos++;
+  let arg = info;
+  if (info >= 24) {
+    const width = info === 24 ? 1 : info === 25 ? 2 : info === 26 ? 4 : info === 27 ? 8 : 0;
+    if (width === 0 || pos + width > buf.length) throw new Error('bad CBOR argument');
+    arg = width === 8 ? Number(buf.readBigUInt64BE(pos)) : buf.readUIntBE(pos, width);
+    pos += width;
+  }
+
+  switch (major) {
+    case 0:
+      return { value: arg, pos };
+    case 2:
+      if (pos + arg > buf.length) throw new Error('truncated CBOR bytes');
+      return { value: buf.subarray(pos, pos + arg), pos: pos + arg };
+    case 4: {
+      const items = [];
+      for (let i = 0; i < arg; i++) {
+        const item = readCbor(buf, pos);
+        items.push(item.value);
+        pos = item.pos;
+      }
+      return { value: items, pos };
+    }
+    case 6:
+      return readCbor(buf, pos);
+    default:
+      throw new Error(`unsupported CBOR major type ${major}`);
+  }
+}
+
+function isBinaryPayload(payload) {
+  return payload.length > 3 && payload.subarray(0, 3).equals(BINARY_PAYLOAD_MARKER);
+}
+
+// Same text the readers put in their JSON: local time, 1970 before NTP
+function formatReaderTime(ms) {
+  if (ms < 16 * 3600 * 1000) return '1970-01-01 00:00:00.000';
+  return new Date(ms + READER_UTC_OFFSET_MS).toISOString().replace('T', ' ').slice(0, 23);
+}
+
+// A single event, or an array of them for a batch
+function decodeBinaryPayload(payload) {
+  const fields = readCbor(payload, 0).value;
+  if (!Array.isArray(fields)) throw new Error('binary payload is not an array');
+  return Array.isArray(fields[0]) ? fields.map(binaryEvent) : binaryEvent(fields);
+}
+
+function binaryEvent(fields) {
+  if (!Array.isArray(fields) || fields.length < 6) throw new Error('short binary event');
+  const [version, type, seq, uid, role, timeMs, count] = fields;
+  if (version !== BINARY_PAYLOAD_VERSION) throw new Error(`unknown binary event version ${version}`);
+
+  const data = { card_uid: Buffer.from(uid).toString('hex').toUpperCase(), role: ROLE_NAMES[role] || 'Unknown', seq };
+  const time = formatReaderTime(timeMs);
+  switch (BINARY_EVENT_TYPES[type]) {
+    case 'check_in':
+      data.check_in = time;
+      break;
+    case 'check_out':
+      data.check_out = time;
+      data.duration = count;
+      break;
+    case 'denied':
+      data.denial_reason = 'Unauthorized card';
+      data.attempted_at = time;
+      data.attempts = count;
+      break;
+    case 'alert':
+      data.alert_message = 'Repeated unauthorized access attempts';
+      data.triggered_at = time;
+      data.attempts = count;
+      break;
+    default:
+      throw new Error(`unknown binary event type ${type}`);
+  }
+  return data;
+}
+
+module.exports = {
+  READER_UTC_OFFSET_MS,
+  readCbor,
+  isBinaryPayload,
+  formatReaderTime,
+  decodeBinaryPayload,
+};
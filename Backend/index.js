@@ -52,9 +52,18 @@ const http = require('http');
 const aedes = require('aedes')();
 const WebSocket = require('ws');
 const net = require('net');
+const crypto = require('crypto');
 const mongoose = require('mongoose');
 const cors = require('cors');
 require('dotenv').config();
+// After dotenv: it reads READER_UTC_OFFSET_SEC
+const {
+  READER_UTC_OFFSET_MS,
+  readCbor,
+  isBinaryPayload,
+  decodeBinaryPayload,
+} = require('./binary_payload');
+const { sendPage } = require('./paging');
 
 const app = express();
 
@@ -76,7 +85,8 @@ app.use(cors({
   origin: corsOrigins,
   credentials: true,
   methods: ['GET', 'POST', 'PUT', 'DELETE', 'OPTIONS'],
-  allowedHeaders: ['Content-Type', 'Authorization']
+  allowedHeaders: ['Content-Type', 'Authorization'],
+  exposedHeaders: ['X-Next-Cursor']
 }));
 
 
@@ -134,17 +144,14 @@ app.get('/api/events/:hotelId', (req, res) => {
     res.write(initialMessage);
     console.log(`📡 SSE client connected for hotel ${hotelId}`);
 
-    // Store client for broadcasting
-    const clientId = `${Date.now()}-${Math.random().toString(36).substr(2, 9)}`;
-    if (!global.sseClients) {
-      global.sseClients = new Map();
-    }
-    global.sseClients.set(clientId, { res, hotelId, connected: true });
+    // An SSE stream is already scoped to one hotel
+    const client = new SseDashboard(res, hotelId);
+    addDashboard(client);
 
     // Send periodic heartbeat to keep connection alive
     const heartbeat = setInterval(() => {
       try {
-        if (res.writable && global.sseClients && global.sseClients.has(clientId)) {
+        if (res.writable && dashboards.has(client)) {
           res.write(`: heartbeat\n\n`);
         } else {
           clearInterval(heartbeat);
@@ -152,9 +159,7 @@ app.get('/api/events/:hotelId', (req, res) => {
       } catch (error) {
         console.error('Heartbeat error:', error.message);
         clearInterval(heartbeat);
-        if (global.sseClients) {
-          global.sseClients.delete(clientId);
-        }
+        removeDashboard(client);
       }
     }, 30000); // Send heartbeat every 30 seconds
 
@@ -162,9 +167,7 @@ app.get('/api/events/:hotelId', (req, res) => {
     req.on('close', () => {
       console.log(`📡 SSE client disconnected for hotel ${hotelId}`);
       clearInterval(heartbeat);
-      if (global.sseClients) {
-        global.sseClients.delete(clientId);
-      }
+      removeDashboard(client);
     });
 
     req.on('error', (err) => {
@@ -173,9 +176,7 @@ app.get('/api/events/:hotelId', (req, res) => {
         console.error('SSE client error:', err.message);
       }
       clearInterval(heartbeat);
-      if (global.sseClients) {
-        global.sseClients.delete(clientId);
-      }
+      removeDashboard(client);
     });
 
     // Handle response errors
@@ -184,9 +185,7 @@ app.get('/api/events/:hotelId', (req, res) => {
         console.error('SSE response error:', err.message);
       }
       clearInterval(heartbeat);
-      if (global.sseClients) {
-        global.sseClients.delete(clientId);
-      }
+      removeDashboard(client);
     });
     
   } catch (error) {
@@ -239,6 +238,7 @@ const hotelSchema = new mongoose.Schema({
   image: String,
   status: String,
   lastActivity: String,
+  aclVersion: { type: Number, default: 0 },
   manager: {
     name: String,
     phone: String,
@@ -266,26 +266,41 @@ const attendanceSchema = new mongoose.Schema({
   check_out: String,
   duration: Number,
   room: String,
+  seq: Number,
 }, { timestamps: true });
 
+// Event lists are read newest first, per hotel and per room, a page at a time
+attendanceSchema.index({ hotelId: 1, createdAt: -1, _id: -1 });
+attendanceSchema.index({ hotelId: 1, room: 1, createdAt: -1, _id: -1 });
+
 const alertSchema = new mongoose.Schema({
   hotelId: String,
   card_uid: String,
   role: String,
   alert_message: String,
   triggered_at: String,
+  attempts: Number,
   room: String,
+  seq: Number,
 }, { timestamps: true });
 
+alertSchema.index({ hotelId: 1, createdAt: -1, _id: -1 });
+alertSchema.index({ hotelId: 1, room: 1, createdAt: -1, _id: -1 });
+
 const deniedSchema = new mongoose.Schema({
   hotelId: String,
   card_uid: String,
   role: String,
   denial_reason: String,
   attempted_at: String,
+  attempts: Number,
   room: String,
+  seq: Number,
 }, { timestamps: true });
 
+deniedSchema.index({ hotelId: 1, createdAt: -1, _id: -1 });
+deniedSchema.index({ hotelId: 1, room: 1, createdAt: -1, _id: -1 });
+
 const userSchema = new mongoose.Schema({
   hotelId: String,
   id: String,
@@ -300,6 +315,8 @@ const userSchema = new mongoose.Schema({
 const cardSchema = new mongoose.Schema({
   hotelId: String,
   id: String,
+  uid: String,
+  role: String,
   roomNumber: String,
   guestName: String,
   status: String,
@@ -307,6 +324,28 @@ const cardSchema = new mongoose.Schema({
   lastUsed: String,
 }, { timestamps: true });
 
+// Periodic reader performance report. Each metric is a log2 histogram
+// {n, sum, b}: b[0] counts zeros, b[i] counts values in [2^(i-1), 2^i)
+const telemetrySchema = new mongoose.Schema({
+  hotelId: String,
+  building: String,
+  room: String,
+  uptime: Number,
+  heap: [Number],                           // Free, minimum free, largest free block (bytes)
+  metrics: mongoose.Schema.Types.Mixed,
+  counters: mongoose.Schema.Types.Mixed,
+}, { timestamps: true });
+telemetrySchema.index({ hotelId: 1, room: 1, createdAt: -1 });
+
+// One row per card changed in a card list version; readers catch up from
+// these as deltas, built from where each card stands now
+const aclChangeSchema = new mongoose.Schema({
+  hotelId: String,
+  version: Number,
+  uid: String,
+}, { timestamps: true });
+aclChangeSchema.index({ hotelId: 1, version: 1 });
+
 const activitySchema = new mongoose.Schema({
   hotelId: String,
   id: String,
@@ -315,6 +354,22 @@ const activitySchema = new mongoose.Schema({
   user: String,
   time: String,
 }, { timestamps: true });
+activitySchema.index({ hotelId: 1, createdAt: -1, _id: -1 });
+
+// Time spent in each room per role, per local hour and per local day,
+// kept up to date at ingest so analytics never scan the attendance rows.
+// A stay adds its seconds to every bucket it overlaps.
+const occupancySchema = new mongoose.Schema({
+  hotelId: String,
+  room: String,
+  role: String,
+  period: String,                           // 'hour' or 'day'
+  start: Date,                              // Bucket start, reader local time boundaries
+  dwell: { type: Number, default: 0 },      // Seconds of presence in the bucket
+  checkIns: { type: Number, default: 0 },
+  checkOuts: { type: Number, default: 0 },
+});
+occupancySchema.index({ hotelId: 1, period: 1, start: 1, room: 1, role: 1 }, { unique: true });
 
 const Hotel = mongoose.model('Hotel', hotelSchema);
 const Room = mongoose.model('Room', roomSchema);
@@ -323,7 +378,10 @@ const Alert = mongoose.model('Alert', alertSchema);
 const Denied = mongoose.model('Denied', deniedSchema);
 const User = mongoose.model('User', userSchema);
 const Card = mongoose.model('Card', cardSchema);
+const AclChange = mongoose.model('AclChange', aclChangeSchema);
+const Telemetry = mongoose.model('Telemetry', telemetrySchema);
 const Activity = mongoose.model('Activity', activitySchema);
+const Occupancy = mongoose.model('Occupancy', occupancySchema);
 
 // Initialize Hotel Data (your exact function)
 async function initializeHotels() {
@@ -566,6 +624,9 @@ function getRoomCountForHotel(hotelId) {
 mongoose.connection.once('open', async () => {
   await initializeHotels();
   await initializeRooms();
+  setInterval(() => {
+    sweepExpiredCards().catch((err) => console.error('Error sweeping expired cards:', err));
+  }, ACL_EXPIRY_SWEEP_MS);
 });
 
 
@@ -578,6 +639,189 @@ const mqttWsServer = new WebSocket.Server({
   path: '/mqtt' // WebSocket endpoint at /mqtt for ESP32
 });
 
+// ---- Dashboard fan-out ----
+// A dashboard only receives the hotels it shows. Each broadcast is serialized
+// once, not once per client, and a client that falls behind gets the latest
+// state of each room instead of an ever-growing socket buffer.
+const DASHBOARD_BUFFER_LIMIT = parseInt(process.env.DASHBOARD_BUFFER_LIMIT || '262144', 10);
+const DASHBOARD_QUEUE_LIMIT = parseInt(process.env.DASHBOARD_QUEUE_LIMIT || '100', 10);
+
+const fanoutStats = { broadcasts: 0, deliveries: 0, bytes: 0, coalesced: 0, dropped: 0, cpuUs: 0 };
+
+// One broadcast, encoded on first use in the form each transport sends
+class Frame {
+  constructor(event, data) {
+    this.event = event;
+    this.data = data;
+    this.text = null;
+    this.sseText = null;
+  }
+
+  json() {
+    if (this.text === null) this.text = Buffer.from(JSON.stringify({ event: this.event, data: this.data }));
+    return this.text;
+  }
+
+  sse() {
+    if (this.sseText === null) this.sseText = Buffer.concat([Buffer.from('data: '), this.json(), Buffer.from('\n\n')]);
+    return this.sseText;
+  }
+}
+
+class DashboardClient {
+  constructor(hotels) {
+    this.hotels = hotels;      // null: every hotel
+    this.events = null;        // null: every event kind
+    this.congested = false;
+    this.rooms = new Map();    // event -> roomNum -> latest update, while congested
+    this.queue = [];           // other broadcasts held while congested
+  }
+
+  wants(kind) {
+    return this.events === null || this.events.has(kind);
+  }
+
+  deliver(kind, frame) {
+    if (!this.congested) {
+      this.send(frame);
+      return;
+    }
+    if (kind === 'roomUpdate') {
+      if (!this.rooms.has(frame.event)) this.rooms.set(frame.event, new Map());
+      const rooms = this.rooms.get(frame.event);
+      [].concat(frame.data).forEach((update) => {
+        const previous = rooms.get(update.roomNum);
+        if (previous) fanoutStats.coalesced++;
+        rooms.set(update.roomNum, previous ? { ...previous, ...update } : update);
+      });
+      return;
+    }
+    this.queue.push({ kind, frame });
+    if (this.queue.length > DASHBOARD_QUEUE_LIMIT) {
+      this.queue.shift();
+      fanoutStats.dropped++;
+    }
+  }
+
+  // The transport caught up: send what was held back, oldest kinds last
+  flush() {
+    const rooms = this.rooms;
+    const queue = this.queue;
+    this.congested = false;
+    this.rooms = new Map();
+    this.queue = [];
+    rooms.forEach((updates, event) => this.deliver('roomUpdate', new Frame(event, Array.from(updates.values()))));
+    queue.forEach(({ kind, frame }) => this.deliver(kind, frame));
+  }
+}
+
+class WsDashboard extends DashboardClient {
+  constructor(ws) {
+    super(null);
+    this.ws = ws;
+    this.unsent = 0;
+  }
+
+  send(frame) {
+    if (this.ws.readyState !== WebSocket.OPEN) return;
+    const text = frame.json();
+    this.unsent += text.length;
+    fanoutStats.deliveries++;
+    fanoutStats.bytes += text.length;
+    this.ws.send(text, { binary: false }, (error) => {
+      this.unsent -= text.length;
+      if (!error && this.congested && this.unsent < DASHBOARD_BUFFER_LIMIT / 2) this.flush();
+    });
+    if (this.unsent > DASHBOARD_BUFFER_LIMIT) this.congested = true;
+  }
+}
+
+class SseDashboard extends DashboardClient {
+  constructor(res, hotelId) {
+    super(new Set([hotelId]));
+    this.res = res;
+    this.onDrain = () => this.flush();
+  }
+
+  send(frame) {
+    if (!this.res.writable) return;
+    const text = frame.sse();
+    fanoutStats.deliveries++;
+    fanoutStats.bytes += text.length;
+    try {
+      if (!this.res.write(text)) {
+        this.congested = true;
+        this.res.once('drain', this.onDrain);
+      }
+    } catch (error) {
+      if (error.code !== 'ECONNRESET' && error.code !== 'EPIPE' && error.code !== 'ERR_STREAM_WRITE_AFTER_END') {
+        console.error('Error broadcasting to SSE client:', error.message);
+      }
+    }
+  }
+}
+
+const dashboards = new Set();
+const dashboardGroups = new Map(); // hotelId -> clients showing that hotel
+const everyHotel = new Set();      // /ws clients that never subscribed
+
+function addDashboard(client) {
+  dashboards.add(client);
+  if (client.hotels === null) {
+    everyHotel.add(client);
+    return;
+  }
+  client.hotels.forEach((hotelId) => {
+    if (!dashboardGroups.has(hotelId)) dashboardGroups.set(hotelId, new Set());
+    dashboardGroups.get(hotelId).add(client);
+  });
+}
+
+function removeDashboard(client) {
+  dashboards.delete(client);
+  everyHotel.delete(client);
+  if (client.hotels === null) return;
+  client.hotels.forEach((hotelId) => {
+    const group = dashboardGroups.get(hotelId);
+    if (!group) return;
+    group.delete(client);
+    if (group.size === 0) dashboardGroups.delete(hotelId);
+  });
+}
+
+// {"action":"subscribe","hotels":["1","2"],"events":["roomUpdate"]}
+function subscribeDashboard(client, message) {
+  const hotels = Array.isArray(message.hotels) ? message.hotels.map(String) : [];
+  if (hotels.length === 0 || !hotels.every((hotelId) => /^[1-9][0-9]*$/.test(hotelId))) return false;
+  removeDashboard(client);
+  client.hotels = new Set(hotels);
+  client.events = Array.isArray(message.events) ? new Set(message.events.map(String)) : null;
+  addDashboard(client);
+  return true;
+}
+
+function broadcastToClients(event, data) {
+  const started = process.cpuUsage();
+  const separator = event.indexOf(':');
+  const kind = separator < 0 ? event : event.slice(0, separator);
+  const frame = new Frame(event, data);
+  const deliver = (client) => {
+    if (client.wants(kind)) client.deliver(kind, frame);
+  };
+
+  if (separator < 0) {
+    dashboards.forEach(deliver);
+  } else {
+    const group = dashboardGroups.get(event.slice(separator + 1));
+    if (group) group.forEach(deliver);
+    everyHotel.forEach(deliver);
+  }
+
+  const used = process.cpuUsage(started);
+  fanoutStats.broadcasts++;
+  fanoutStats.cpuUs += used.user + used.system;
+}
+
 // 🔧 Frontend WebSocket server for real-time updates
 const frontendWsServer = new WebSocket.Server({
   server,
@@ -588,9 +832,6 @@ const frontendWsServer = new WebSocket.Server({
   }
 });
 
-// Store frontend clients separately
-const frontendClients = new Set();
-
 // Handle frontend WebSocket connections
 frontendWsServer.on('connection', function(ws, req) {
   const clientIP = req.socket.remoteAddress;
@@ -604,7 +845,8 @@ frontendWsServer.on('connection', function(ws, req) {
     }
   }, 300000); // 5 minutes timeout
   
-  frontendClients.add(ws);
+  const client = new WsDashboard(ws);
+  addDashboard(client);
   
   try {
     // Send initial connection confirmation
@@ -614,7 +856,7 @@ frontendWsServer.on('connection', function(ws, req) {
     }));
   } catch (error) {
     console.error('Error sending initial WebSocket message:', error.message);
-    frontendClients.delete(ws);
+    removeDashboard(client);
     clearTimeout(connectionTimeout);
     return;
   }
@@ -628,13 +870,25 @@ frontendWsServer.on('connection', function(ws, req) {
         console.error('WebSocket ping error:', error.message);
         clearInterval(pingInterval);
         clearTimeout(connectionTimeout);
-        frontendClients.delete(ws);
+        removeDashboard(client);
       }
     } else {
       clearInterval(pingInterval);
     }
   }, 30000); // Ping every 30 seconds
   
+  ws.on('message', (raw) => {
+    let message;
+    try {
+      message = JSON.parse(raw.toString());
+    } catch (error) {
+      return;
+    }
+    if (message && message.action === 'subscribe' && !subscribeDashboard(client, message)) {
+      console.warn('Ignoring invalid dashboard subscription:', raw.toString().slice(0, 200));
+    }
+  });
+
   ws.on('pong', () => {
     // Reset timeout on pong response
     clearTimeout(connectionTimeout);
@@ -644,7 +898,7 @@ frontendWsServer.on('connection', function(ws, req) {
     console.log(`📡 Frontend WebSocket client disconnected: ${code} ${reason?.toString() || 'No reason'}`);
     clearInterval(pingInterval);
     clearTimeout(connectionTimeout);
-    frontendClients.delete(ws);
+    removeDashboard(client);
   });
   
   ws.on('error', (error) => {
@@ -654,7 +908,7 @@ frontendWsServer.on('connection', function(ws, req) {
     }
     clearInterval(pingInterval);
     clearTimeout(connectionTimeout);
-    frontendClients.delete(ws);
+    removeDashboard(client);
   });
 });
 
@@ -665,66 +919,10 @@ frontendWsServer.on('error', (error) => {
 
 console.log('🔧 Frontend WebSocket server initialized on /ws endpoint');
 
-// 🔧 FIX 6: Updated broadcastToClients function for frontend clients (WebSocket + SSE)
-function broadcastToClients(event, data) {
-  const message = JSON.stringify({ event, data });
-  console.log(`Broadcasting to ${frontendClients.size} WebSocket clients and ${global.sseClients ? global.sseClients.size : 0} SSE clients:`, { event, data });
-  
-  // Broadcast to WebSocket clients with improved error handling
-  const disconnectedWsClients = [];
-  frontendClients.forEach((client) => {
-    if (client.readyState === WebSocket.OPEN) {
-      try {
-        client.send(message);
-      } catch (error) {
-        // Only log non-connection errors
-        if (error.code !== 'ECONNRESET' && error.code !== 'EPIPE') {
-          console.error('Error broadcasting to WebSocket client:', error.message);
-        }
-        disconnectedWsClients.push(client);
-      }
-    } else {
-      disconnectedWsClients.push(client);
-    }
-  });
-  
-  // Clean up disconnected WebSocket clients
-  disconnectedWsClients.forEach(client => frontendClients.delete(client));
-
-  // Broadcast to SSE clients with improved error handling
-  if (global.sseClients && global.sseClients.size > 0) {
-    const sseMessage = `data: ${message}\n\n`;
-    const disconnectedSseClients = [];
-    
-    global.sseClients.forEach((client, clientId) => {
-      try {
-        // Check if response is still writable
-        if (client.res && client.res.writable && client.connected !== false) {
-          client.res.write(sseMessage);
-        } else {
-          disconnectedSseClients.push(clientId);
-        }
-      } catch (error) {
-        // Only log non-connection errors
-        if (error.code !== 'ECONNRESET' && error.code !== 'EPIPE' && error.code !== 'ERR_STREAM_WRITE_AFTER_END') {
-          console.error('Error broadcasting to SSE client:', error.message);
-        }
-        disconnectedSseClients.push(clientId);
-      }
-    });
-    
-    // Clean up disconnected SSE clients
-    disconnectedSseClients.forEach(clientId => {
-      if (global.sseClients) {
-        global.sseClients.delete(clientId);
-      }
-    });
-  }
-}
-
 mqttWsServer.on('connection', function(ws, req) {
   try {
-    const stream = WebSocket.createWebSocketStream(ws, { encoding: 'utf8' });
+    // MQTT control packets are binary; a text encoding would corrupt them
+    const stream = WebSocket.createWebSocketStream(ws);
     aedes.handle(stream);
     console.log('🔗 MQTT client connected via WebSocket');
     
@@ -751,111 +949,543 @@ if (process.env.NODE_ENV !== 'production') {
   console.log('🚫 TCP MQTT server disabled in production (Render limitation)');
 }
 
+// Journal sequence numbers recently seen per reader. The ESP32 replays
+// every event it has no PUBACK for after a reconnect, so a PUBACK lost on
+// the way back produces a second copy of an event we already stored. A seq
+// is marked when its event is taken in, so a copy that arrives while the
+// first is still being written is dropped too; forgetEvent() unmarks it
+// if the write fails, so the next resend is stored.
+const RECENT_SEQ_LIMIT = 256;
+const recentSeqs = new Map();
+
+function isDuplicateEvent(readerKey, seq) {
+  if (typeof seq !== 'number' || seq <= 0) return false;
+
+  let seen = recentSeqs.get(readerKey);
+  if (!seen) {
+    seen = new Set();
+    recentSeqs.set(readerKey, seen);
+  }
+  if (seen.has(seq)) return true;
+
+  seen.add(seq);
+  if (seen.size > RECENT_SEQ_LIMIT) {
+    // Sets iterate in insertion order; drop the oldest
+    seen.delete(seen.values().next().value);
+  }
+  return false;
+}
+
+function forgetEvent(readerKey, seq) {
+  const seen = recentSeqs.get(readerKey);
+  if (seen) seen.delete(seq);
+}
+
+// Topic type of an event inside a batch
+function eventTopicType(data) {
+  if (data.check_in || data.check_out) return 'attendance';
+  if (data.alert_message) return 'alerts';
+  if (data.denial_reason) return 'denied_access';
+  return null;
+}
+
+// Card list sync. Each reader holds its room's list in RAM: the room's
+// guests plus the hotel's staff, active and not expired. It reports its
+// list version (and how many cards it can hold) on
+// campus/acl/{hotel}/{building}/{room}/sync after every connect, and gets a
+// binary snapshot or delta back on campus/acl/{hotel}/{building}/{room}.
+// Later changes go to the same topic of every reader that has synced.
+// Chunk layout is documented in the firmware's card_acl.h.
+const ACL_ROLE_CODES = { Guest: 1, Manager: 2, Maintenance: 3, Housekeeping: 4, Security: 5 };
+const ACL_CHUNK_CARDS = 64;   // Keeps every chunk under the reader's ACL_FRAME_SIZE
+const ACL_DELTA_LIMIT = 512;  // Past this many changes a snapshot is smaller
+const ACL_UID_PATTERN = /^([0-9A-F]{8}|[0-9A-F]{14}|[0-9A-F]{20})$/;
+const ACL_EXPIRY_SWEEP_MS = 60 * 1000;
+
+// Readers that have synced, per hotel: room topic -> room number
+const aclReaders = new Map();
+
+function cardExpired(card, now) {
+  if (!card.expiryDate) return false;
+  const expiry = Date.parse(card.expiryDate);
+  return !Number.isNaN(expiry) && expiry <= now;
+}
+
+// Role a card has on the given room's reader, or null if it must not open it
+function aclScopedRole(card, roomNum, now) {
+  if (!card || card.status !== 'active' || !card.uid || !ACL_UID_PATTERN.test(card.uid)) return null;
+  if (cardExpired(card, now)) return null;
+  const role = card.role || 'Guest';
+  if (role === 'Guest' && card.roomNumber !== roomNum) return null;
+  return role;
+}
+
+function aclRecord(uid, role) {
+  return { uid: Buffer.from(uid, 'hex'), role: role ? ACL_ROLE_CODES[role] || 0 : 0 };
+}
+
+// The room's current entry for each changed UID: an add, or a revoke
+async function aclScopedChanges(hotelId, uids) {
+  const cards = await Card.find({ hotelId, uid: { $in: uids } });
+  const byUid = new Map();
+  cards.forEach((card) => {
+    if (!byUid.has(card.uid) || card.status === 'active') byUid.set(card.uid, card);
+  });
+  const now = Date.now();
+  return (roomNum) => uids
+    .filter((uid) => ACL_UID_PATTERN.test(uid))
+    .map((uid) => aclRecord(uid, aclScopedRole(byUid.get(uid), roomNum, now)));
+}
+
+function encodeAclChunks(kind, baseVersion, version, records) {
+  const count = Math.max(1, Math.ceil(records.length / ACL_CHUNK_CARDS));
+  const chunks = [];
+  for (let i = 0; i < count; i++) {
+    const slice = records.slice(i * ACL_CHUNK_CARDS, (i + 1) * ACL_CHUNK_CARDS);
+    const chunk = Buffer.alloc(13 + slice.reduce((n, r) => n + 2 + r.uid.length, 0));
+    chunk.write(kind, 0, 'latin1');
+    chunk.writeUInt32LE(baseVersion, 1);
+    chunk.writeUInt32LE(version, 5);
+    chunk.writeUInt16LE(i, 9);
+    chunk.writeUInt16LE(count, 11);
+    let offset = 13;
+    for (const r of slice) {
+      chunk[offset++] = r.role;
+      chunk[offset++] = r.uid.length;
+      r.uid.copy(chunk, offset);
+      offset += r.uid.length;
+    }
+    chunks.push(chunk);
+  }
+  return chunks;
+}
+
+function publishAclChunks(topic, chunks) {
+  for (const payload of chunks) {
+    aedes.publish({ topic, payload, qos: 0, retain: false }, (err) => {
+      if (err) console.error(`Error publishing card list to ${topic}:`, err);
+    });
+  }
+}
+
+async function handleAclSync(hotelId, building, roomNum, payload) {
+  const { version, capacity } = JSON.parse(payload.toString());
+  const topic = `campus/acl/${hotelId}/${building}/${roomNum}`;
+  if (!aclReaders.has(hotelId)) aclReaders.set(hotelId, new Map());
+  aclReaders.get(hotelId).set(topic, roomNum);
+
+  const hotel = await Hotel.findOne({ id: hotelId });
+  const current = hotel && hotel.aclVersion ? hotel.aclVersion : 0;
+
+  // Hotels whose cards were never managed here keep the compiled-in list
+  if (current === 0 || version === current) return;
+
+  let chunks = null;
+  if (version > 0 && version < current) {
+    const changes = await AclChange.find({ hotelId, version: { $gt: version } }).sort({ version: 1 });
+    if (changes.length <= ACL_DELTA_LIMIT) {
+      // Only where each changed card stands now matters
+      const uids = [...new Set(changes.map((c) => c.uid))];
+      const records = (await aclScopedChanges(hotelId, uids))(roomNum);
+      chunks = encodeAclChunks('D', version, current, records);
+    }
+  }
+  if (!chunks) {
+    const now = Date.now();
+    const cards = await Card.find({ hotelId, status: 'active', uid: { $exists: true, $ne: null } });
+    const records = cards
+      .map((card) => [card.uid, aclScopedRole(card, roomNum, now)])
+      .filter(([, role]) => role)
+      .map(([uid, role]) => aclRecord(uid, role));
+    // The reader would refuse it whole; it keeps its list until this is fixed
+    if (capacity && records.length > capacity) {
+      console.error(`Card list for room ${roomNum} in hotel ${hotelId} has ${records.length} cards, reader holds ${capacity}`);
+      return;
+    }
+    chunks = encodeAclChunks('S', 0, current, records);
+  }
+
+  publishAclChunks(topic, chunks);
+  console.log(`Sent card list v${current} to room ${roomNum} in hotel ${hotelId} (${chunks.length} chunks, had v${version})`);
+}
+
+// Record card list changes under a new version and push each synced
+// reader of the hotel what they mean for its room. Readers with nothing
+// to change still get the empty delta, which keeps their version in step.
+async function publishAclChanges(hotelId, uids) {
+  if (uids.length === 0) return;
+  const hotel = await Hotel.findOneAndUpdate(
+    { id: hotelId },
+    { $inc: { aclVersion: 1 } },
+    { new: true, upsert: true }
+  );
+  const version = hotel.aclVersion;
+  await AclChange.insertMany(uids.map((uid) => ({ hotelId, version, uid })));
+
+  const readers = aclReaders.get(hotelId);
+  if (!readers) return;
+  const recordsFor = await aclScopedChanges(hotelId, uids);
+  readers.forEach((roomNum, topic) => {
+    publishAclChunks(topic, encodeAclChunks('D', version - 1, version, recordsFor(roomNum)));
+  });
+}
+
+// Cards past their expiry date are revoked on every reader
+async function sweepExpiredCards() {
+  const now = Date.now();
+  const cards = await Card.find({ status: 'active', expiryDate: { $exists: true, $nin: [null, ''] } });
+  const expired = cards.filter((card) => cardExpired(card, now));
+  if (expired.length === 0) return;
+
+  await Card.updateMany({ _id: { $in: expired.map((card) => card._id) } }, { status: 'expired' });
+  const byHotel = new Map();
+  expired.forEach((card) => {
+    if (!card.uid) return;
+    if (!byHotel.has(card.hotelId)) byHotel.set(card.hotelId, []);
+    byHotel.get(card.hotelId).push(card.uid);
+  });
+  for (const [hotelId, uids] of byHotel) await publishAclChanges(hotelId, uids);
+  console.log(`Expired ${expired.length} cards`);
+}
+
+// Event ingest. Every path that stores reader events (MQTT and the two
+// HTTP fallbacks) queues them here. Events arriving within
+// INGEST_BATCH_WINDOW_MS are written together: one insertMany per
+// collection and one ordered bulkWrite for room state. Each hotel then
+// gets one roomUpdate and one activityUpdate broadcast per batch, whose
+// data is an array in event order.
+const INGEST_BATCH_WINDOW_MS = Number(process.env.INGEST_BATCH_WINDOW_MS || 20);
+const INGEST_BATCH_MAX = 500;
+const EVENT_MODELS = { attendance: Attendance, alerts: Alert, denied_access: Denied };
+
+let ingestQueue = [];
+let ingestTimer = null;
+let ingestTail = Promise.resolve();
+
+// Resolves once the event is stored and broadcast
+function ingestEvent(event) {
+  return new Promise((resolve, reject) => {
+    ingestQueue.push({ event, resolve, reject });
+    if (ingestQueue.length >= INGEST_BATCH_MAX) flushIngest();
+    else if (!ingestTimer) ingestTimer = setTimeout(flushIngest, INGEST_BATCH_WINDOW_MS);
+  });
+}
+
+function flushIngest() {
+  clearTimeout(ingestTimer);
+  ingestTimer = null;
+  const batch = ingestQueue;
+  ingestQueue = [];
+  if (batch.length === 0) return;
+
+  // One batch at a time, so room state changes land in the order they came;
+  // events arriving meanwhile simply make the next batch bigger
+  ingestTail = ingestTail.then(() => writeBatch(batch));
+}
+
+function roomStateUpdate(data) {
+  const update = data.check_in
+    ? { status: data.role === 'Maintenance' ? 'maintenance' : 'occupied', occupantType: data.role.toLowerCase(), powerStatus: 'on' }
+    : { status: 'vacant', occupantType: null, powerStatus: 'off' };
+  if (data.role === 'Manager') update.hasMasterKey = !!data.check_in;
+  return update;
+}
+
+function eventActivity(type, data, id) {
+  // Readers fold repeated attempts by one card into a single report
+  const attempts = data.attempts > 1 ? ` (${data.attempts} attempts)` : '';
+  switch (type) {
+    case 'attendance':
+      return {
+        hotelId: data.hotelId,
+        id,
+        type: data.check_in ? 'checkin' : 'checkout',
+        action: `${data.role} checked ${data.check_in ? 'in' : 'out'} to Room ${data.room}`,
+        user: data.role,
+        time: data.check_in || data.check_out,
+      };
+    case 'alerts':
+      return {
+        hotelId: data.hotelId,
+        id,
+        type: 'security',
+        action: `Alert: ${data.alert_message} for ${data.role} in Room ${data.room}${attempts}`,
+        user: 'System',
+        time: data.triggered_at,
+      };
+    case 'denied_access':
+      return {
+        hotelId: data.hotelId,
+        id,
+        type: 'security',
+        action: `Denied access to ${data.role}: ${data.denial_reason} for Room ${data.room}${attempts}`,
+        user: data.role,
+        time: data.attempted_at,
+      };
+  }
+  return null;
+}
+
+// Occupancy rollups. Buckets follow the readers' local time, so a day
+// bucket is a calendar day at the hotel. A stay counts once it ends: the
+// check-out brings its duration, which is spread over every hour and day
+// it covered.
+const HOUR_MS = 3600 * 1000;
+const DAY_MS = 24 * HOUR_MS;
+const ROLLUP_PERIODS = { hour: HOUR_MS, day: DAY_MS };
+const ROLLUP_MAX_STAY_MS = 31 * DAY_MS;     // Longer durations are clipped
+
+// Reader time back to epoch ms; null while the reader had no NTP time
+function readerTimeMs(text) {
+  const ms = Date.parse(`${String(text).replace(' ', 'T')}Z`);
+  if (!Number.isFinite(ms) || ms < 16 * HOUR_MS) return null;
+  return ms - READER_UTC_OFFSET_MS;
+}
+
+function bucketStart(ms, size) {
+  return Math.floor((ms + READER_UTC_OFFSET_MS) / size) * size - READER_UTC_OFFSET_MS;
+}
+
+function addRollup(totals, data, role, period, startMs, field, amount) {
+  const key = `${data.hotelId}/${data.room}/${role}/${period}/${startMs}`;
+  let entry = totals.get(key);
+  if (!entry) {
+    entry = { filter: { hotelId: data.hotelId, room: data.room, role, period, start: new Date(startMs) }, inc: {} };
+    totals.set(key, entry);
+  }
+  entry.inc[field] = (entry.inc[field] || 0) + amount;
+}
+
+// Adds one attendance event to the batch's bucket totals
+function rollupAttendance(totals, data, receivedMs) {
+  const role = data.role || 'Unknown';
+  const atMs = readerTimeMs(data.check_in || data.check_out) ?? receivedMs;
+  const stayMs = Math.min(Math.max(Number(data.duration) || 0, 0) * 1000, ROLLUP_MAX_STAY_MS);
+
+  for (const [period, size] of Object.entries(ROLLUP_PERIODS)) {
+    if (data.check_in) {
+      addRollup(totals, data, role, period, bucketStart(atMs, size), 'checkIns', 1);
+      continue;
+    }
+    addRollup(totals, data, role, period, bucketStart(atMs, size), 'checkOuts', 1);
+    for (let fromMs = atMs - stayMs; fromMs < atMs;) {
+      const startMs = bucketStart(fromMs, size);
+      const toMs = Math.min(startMs + size, atMs);
+      addRollup(totals, data, role, period, startMs, 'dwell', (toMs - fromMs) / 1000);
+      fromMs = toMs;
+    }
+  }
+}
+
+function rollupOps(totals) {
+  return [...totals.values()].map(({ filter, inc }) => ({
+    updateOne: { filter, update: { $inc: inc }, upsert: true },
+  }));
+}
+
+function telemetryRecord(building, data) {
+  // Histograms are objects, counters plain numbers
+  const metrics = {};
+  const counters = {};
+  for (const [key, value] of Object.entries(data)) {
+    if (value && typeof value === 'object' && Array.isArray(value.b)) metrics[key] = value;
+    else if (typeof value === 'number' && key !== 'uptime') counters[key] = value;
+  }
+  return { hotelId: data.hotelId, building, room: data.room, uptime: data.uptime, heap: data.heap, metrics, counters };
+}
+
+function pushPerHotel(map, hotelId, item) {
+  if (!map.has(hotelId)) map.set(hotelId, []);
+  map.get(hotelId).push(item);
+}
+
+async function writeBatch(batch) {
+  const startMs = Date.now();
+  const records = { attendance: [], alerts: [], denied_access: [] };
+  const telemetry = [];
+  const roomOps = [];
+  const roomUpdates = new Map();
+  const rollups = new Map();
+  const activities = [];
+
+  batch.forEach(({ event }, i) => {
+    const { building, hotelId, roomNum, type } = event;
+    const data = { ...event.data, room: roomNum, hotelId };
+    if (type === 'telemetry') {
+      telemetry.push(telemetryRecord(building, data));
+      return;
+    }
+    if (!records[type]) return;
+
+    records[type].push(data);
+    if (type === 'attendance') {
+      const update = roomStateUpdate(data);
+      roomOps.push({ updateOne: { filter: { hotelId, number: roomNum }, update, upsert: true } });
+      pushPerHotel(roomUpdates, hotelId, { roomNum, ...update });
+      rollupAttendance(rollups, data, startMs);
+    }
+    activities.push(eventActivity(type, data, `${startMs}-${i}`));
+  });
+
+  try {
+    const writes = Object.entries(records)
+      .filter(([, docs]) => docs.length > 0)
+      .map(([type, docs]) => EVENT_MODELS[type].insertMany(docs, { ordered: false }));
+    if (telemetry.length > 0) writes.push(Telemetry.insertMany(telemetry, { ordered: false }));
+    if (roomOps.length > 0) writes.push(Room.bulkWrite(roomOps, { ordered: true }));
+    if (rollups.size > 0) writes.push(Occupancy.bulkWrite(rollupOps(rollups), { ordered: false }));
+    const [savedActivities] = await Promise.all([
+      activities.length > 0 ? Activity.insertMany(activities) : [],
+      ...writes,
+    ]);
+
+    const activityUpdates = new Map();
+    savedActivities.forEach((activity) => pushPerHotel(activityUpdates, activity.hotelId, activity));
+    roomUpdates.forEach((updates, hotelId) => broadcastToClients(`roomUpdate:${hotelId}`, updates));
+    activityUpdates.forEach((list, hotelId) => broadcastToClients(`activityUpdate:${hotelId}`, list));
+
+    console.log(`Ingested ${batch.length} events in ${Date.now() - startMs} ms ` +
+      `(${records.attendance.length} attendance, ${records.alerts.length} alerts, ` +
+      `${records.denied_access.length} denied, ${telemetry.length} telemetry)`);
+    batch.forEach(({ resolve }) => resolve());
+  } catch (err) {
+    console.error(`Error storing a batch of ${batch.length} events:`, err);
+    batch.forEach(({ reject }) => reject(err));
+  }
+}
+
+// Event signatures. Readers built with EVENT_SIGNING append the first 16
+// bytes of HMAC-SHA256(key, topic + '\0' + payload) to each publish: a
+// newline and 32 hex digits after JSON, a 16-byte CBOR byte string after
+// binary. Each hotel has its own key, derived from READER_SIGNING_SECRET
+// (see event_encoder.h in the firmware). Unsigned publishes are accepted
+// unless REQUIRE_SIGNED_EVENTS is set.
+const READER_SIGNING_SECRET = process.env.READER_SIGNING_SECRET || '';
+const REQUIRE_SIGNED_EVENTS = process.env.REQUIRE_SIGNED_EVENTS === 'true';
+const SIGNATURE_SIZE = 16;
+const signingKeys = new Map();
+
+function signingKey(building, hotelId) {
+  const scope = `${building}/${hotelId}`;
+  let key = signingKeys.get(scope);
+  if (!key) {
+    key = crypto.createHmac('sha256', READER_SIGNING_SECRET).update(scope).digest();
+    signingKeys.set(scope, key);
+  }
+  return key;
+}
+
+// Splits a publish into payload and signature; signature is null if unsigned
+function splitSignature(raw) {
+  if (isBinaryPayload(raw)) {
+    const end = readCbor(raw, 0).pos;
+    if (end === raw.length) return { payload: raw, signature: null };
+    if (raw.length - end !== SIGNATURE_SIZE + 1 || raw[end] !== (0x40 | SIGNATURE_SIZE)) {
+      throw new Error('bytes after the binary payload are not a signature');
+    }
+    return { payload: raw.subarray(0, end), signature: raw.subarray(end + 1) };
+  }
+  const at = raw.length - (2 * SIGNATURE_SIZE + 1);
+  if (at <= 0 || raw[at] !== 0x0a) return { payload: raw, signature: null };
+  const hex = raw.subarray(at + 1).toString();
+  if (!/^[0-9a-f]+$/.test(hex)) return { payload: raw, signature: null };
+  return { payload: raw.subarray(0, at), signature: Buffer.from(hex, 'hex') };
+}
+
+// The payload without its signature, or null if the publish must be dropped
+function verifiedPayload(topic, building, hotelId, raw) {
+  const { payload, signature } = splitSignature(raw);
+  if (!signature) return REQUIRE_SIGNED_EVENTS ? null : payload;
+  if (!READER_SIGNING_SECRET) return REQUIRE_SIGNED_EVENTS ? null : payload;
+
+  const expected = crypto.createHmac('sha256', signingKey(building, hotelId))
+    .update(topic).update(Buffer.from([0])).update(payload)
+    .digest().subarray(0, SIGNATURE_SIZE);
+  return crypto.timingSafeEqual(expected, signature) ? payload : null;
+}
+
 // Handle MQTT publishes from ESP32 (your exact code)
+async function handleRoomPublish(topic, rawPayload) {
+  const [, , building, floor, roomNum, type] = topic.split('/');
+
+  // Validate MQTT data
+  if (!floor || !roomNum || !type) {
+    console.error('Invalid MQTT topic format:', topic);
+    return;
+  }
+
+  const verified = verifiedPayload(topic, building, floor, rawPayload);
+  if (!verified) {
+    console.error(`Dropping ${type} publish from room ${roomNum} in hotel ${floor}: bad or missing signature`);
+    return;
+  }
+
+  const payload = isBinaryPayload(verified)
+    ? decodeBinaryPayload(verified)
+    : JSON.parse(verified.toString());
+
+  // Readers send events of one room that came close together as a batch
+  const events = type === 'batch'
+    ? payload.map((data) => ({ type: eventTopicType(data), data }))
+    : [{ type, data: payload }];
+
+  const readerKey = `${building}/${floor}/${roomNum}`;
+  const fresh = events.filter(({ data }) => {
+    if (!isDuplicateEvent(readerKey, data.seq)) return true;
+    console.log(`Skipping replayed event ${data.seq} from room ${roomNum} in hotel ${floor}`);
+    return false;
+  });
+
+  // floor maps to hotelId
+  await Promise.all(fresh.map(({ type, data }) =>
+    ingestEvent({ building, hotelId: floor, roomNum, type, data }).catch((err) => {
+      forgetEvent(readerKey, data.seq);
+      throw err;
+    })));
+}
+
+// An edge gateway forwards the publishes of many readers as one envelope:
+// the binary marker, then an array of [topic, payload] byte strings
+async function handleGatewayEnvelope(gatewayId, payload) {
+  if (!isBinaryPayload(payload)) throw new Error('gateway envelope is not binary');
+  const records = readCbor(payload, 0).value;
+  if (!Array.isArray(records)) throw new Error('gateway envelope is not an array');
+
+  for (const record of records) {
+    if (!Array.isArray(record) || record.length < 2) throw new Error('short gateway record');
+    const topic = Buffer.from(record[0]).toString();
+    if (!topic.startsWith('campus/room/')) {
+      console.error(`Gateway ${gatewayId} forwarded unexpected topic:`, topic);
+      continue;
+    }
+    try {
+      await handleRoomPublish(topic, Buffer.from(record[1]));
+    } catch (err) {
+      console.error(`Error processing record from gateway ${gatewayId}:`, err);
+    }
+  }
+}
+
 aedes.on('publish', async (packet, client) => {
   if (packet.topic.startsWith('campus/room/')) {
     try {
-      const data = JSON.parse(packet.payload.toString());
-      const [, , building, floor, roomNum, type] = packet.topic.split('/');
-      
-      // Validate MQTT data
-      if (!floor || !roomNum || !type) {
-        console.error('Invalid MQTT topic format:', packet.topic);
-        return;
-      }
-      
-      data.room = roomNum;
-      data.hotelId = floor; // Map floor to hotelId
-
-      let newActivity = null;
-
-      if (type === 'attendance') {
-        await new Attendance(data).save();
-        console.log(`Saved attendance for room ${roomNum} in hotel ${data.hotelId}:`, data);
-
-        // Update room status
-        let update = {};
-        let hasMasterKeyUpdate = {};
-        if (data.check_in) {
-          const status = data.role === 'Maintenance' ? 'maintenance' : 'occupied';
-          update = {
-            status,
-            occupantType: data.role.toLowerCase(),
-            powerStatus: 'on',
-          };
-          if (data.role === 'Manager') {
-            hasMasterKeyUpdate = { hasMasterKey: true };
-          }
-        } else {
-          update = {
-            status: 'vacant',
-            occupantType: null,
-            powerStatus: 'off',
-          };
-          if (data.role === 'Manager') {
-            hasMasterKeyUpdate = { hasMasterKey: false };
-          }
-        }
-        const fullUpdate = { ...update, ...hasMasterKeyUpdate };
-        const updatedRoom = await Room.findOneAndUpdate(
-          { hotelId: data.hotelId, number: roomNum },
-          fullUpdate,
-          { upsert: true, new: true }
-        );
-        broadcastToClients(`roomUpdate:${data.hotelId}`, { roomNum, ...fullUpdate });
-
-        // Create activity
-        const activityType = data.check_in ? 'checkin' : 'checkout';
-        const action = `${data.role} checked ${data.check_in ? 'in' : 'out'} to Room ${data.room}`;
-        const time = data.check_in || data.check_out;
-        newActivity = {
-          hotelId: data.hotelId,
-          id: new Date().getTime().toString(),
-          type: activityType,
-          action,
-          user: data.role,
-          time,
-        };
-      } else if (type === 'alerts') {
-        await new Alert(data).save();
-        console.log(`Saved alert for room ${roomNum} in hotel ${data.hotelId}:`, data);
-
-        // Create activity
-        const activityType = 'security';
-        const action = `Alert: ${data.alert_message} for ${data.role} in Room ${data.room}`;
-        const time = data.triggered_at;
-        newActivity = {
-          hotelId: data.hotelId,
-          id: new Date().getTime().toString(),
-          type: activityType,
-          action,
-          user: 'System',
-          time,
-        };
-      } else if (type === 'denied_access') {
-        await new Denied(data).save();
-        console.log(`Saved denied access for room ${roomNum} in hotel ${data.hotelId}:`, data);
-
-        // Create activity
-        const action = `Denied access to ${data.role}: ${data.denial_reason} for Room ${data.room}`;
-        const time = data.attempted_at;
-        newActivity = {
-          hotelId: data.hotelId,
-          id: new Date().getTime().toString(),
-          type: 'security',
-          action,
-          user: data.role,
-          time,
-        };
-      }
-
-      if (newActivity) {
-        const savedActivity = await new Activity(newActivity).save();
-        broadcastToClients(`activityUpdate:${data.hotelId}`, savedActivity);
-      }
+      await handleRoomPublish(packet.topic, packet.payload);
     } catch (err) {
       console.error('Error processing MQTT message:', err);
     }
+  } else if (packet.topic.startsWith('campus/gateway/')) {
+    try {
+      await handleGatewayEnvelope(packet.topic.split('/')[2], packet.payload);
+    } catch (err) {
+      console.error('Error processing gateway envelope:', err);
+    }
+  } else if (packet.topic.startsWith('campus/acl/') && packet.topic.endsWith('/sync')) {
+    try {
+      const [, , hotelId, building, roomNum] = packet.topic.split('/');
+      await handleAclSync(hotelId, building, roomNum, packet.payload);
+    } catch (err) {
+      console.error('Error processing card list sync:', err);
+    }
   }
 });
 
@@ -916,10 +1546,16 @@ app.get('/api/rooms/:hotelId', validateHotelId, async (req, res) => {
   }
 });
 
+// Event lists: one page at a time, newest first (see paging.js)
+function roomFilter(req) {
+  const filter = { hotelId: req.params.hotelId };
+  if (req.query.room) filter.room = String(req.query.room);
+  return filter;
+}
+
 app.get('/api/attendance/:hotelId', validateHotelId, async (req, res) => {
   try {
-    const data = await Attendance.find({ hotelId: req.params.hotelId }).sort({ createdAt: -1 });
-    res.json(data);
+    await sendPage(req, res, Attendance, roomFilter(req));
   } catch (error) {
     console.error('Error fetching attendance:', error);
     res.status(500).json({ error: 'Internal server error' });
@@ -928,8 +1564,7 @@ app.get('/api/attendance/:hotelId', validateHotelId, async (req, res) => {
 
 app.get('/api/alerts/:hotelId', validateHotelId, async (req, res) => {
   try {
-    const data = await Alert.find({ hotelId: req.params.hotelId }).sort({ createdAt: -1 });
-    res.json(data);
+    await sendPage(req, res, Alert, roomFilter(req));
   } catch (error) {
     console.error('Error fetching alerts:', error);
     res.status(500).json({ error: 'Internal server error' });
@@ -938,14 +1573,42 @@ app.get('/api/alerts/:hotelId', validateHotelId, async (req, res) => {
 
 app.get('/api/denied_access/:hotelId', validateHotelId, async (req, res) => {
   try {
-    const data = await Denied.find({ hotelId: req.params.hotelId }).sort({ createdAt: -1 });
-    res.json(data);
+    await sendPage(req, res, Denied, roomFilter(req));
   } catch (error) {
     console.error('Error fetching denied access:', error);
     res.status(500).json({ error: 'Internal server error' });
   }
 });
 
+// Dwell rollups: ?period=hour|day, ?from= and ?to= (ISO dates; the last
+// 48 hours or 30 days by default), optional ?room= and ?role=
+app.get('/api/occupancy/:hotelId', validateHotelId, async (req, res) => {
+  try {
+    const period = req.query.period || 'day';
+    if (!ROLLUP_PERIODS[period]) {
+      return res.status(400).json({ error: 'period must be hour or day' });
+    }
+    const to = req.query.to ? new Date(req.query.to) : new Date();
+    const from = req.query.from
+      ? new Date(req.query.from)
+      : new Date(to.getTime() - (period === 'hour' ? 48 * HOUR_MS : 30 * DAY_MS));
+    if (Number.isNaN(from.getTime()) || Number.isNaN(to.getTime())) {
+      return res.status(400).json({ error: 'Invalid from or to date' });
+    }
+
+    const filter = { hotelId: req.params.hotelId, period, start: { $gte: from, $lt: to } };
+    if (req.query.room) filter.room = String(req.query.room);
+    if (req.query.role) filter.role = String(req.query.role);
+    const data = await Occupancy.find(filter, { _id: 0, __v: 0, hotelId: 0, period: 0 })
+      .sort({ start: 1 })
+      .lean();
+    res.json(data);
+  } catch (error) {
+    console.error('Error fetching occupancy:', error);
+    res.status(500).json({ error: 'Internal server error' });
+  }
+});
+
 app.get('/api/users/:hotelId', validateHotelId, async (req, res) => {
   try {
     const data = await User.find({ hotelId: req.params.hotelId });
@@ -966,10 +1629,79 @@ app.get('/api/cards/:hotelId', validateHotelId, async (req, res) => {
   }
 });
 
-app.get('/api/activity/:hotelId', validateHotelId, async (req, res) => {
+// Create or update a key card; the change is pushed to the hotel's readers
+app.put('/api/cards/:hotelId/:cardId', validateHotelId, async (req, res) => {
+  try {
+    const { hotelId, cardId } = req.params;
+    const uid = req.body.uid ? String(req.body.uid).toUpperCase() : undefined;
+    if (uid && !ACL_UID_PATTERN.test(uid)) {
+      return res.status(400).json({ error: 'Card UID must be 4, 7 or 10 bytes of hex' });
+    }
+    if (req.body.role && !ACL_ROLE_CODES[req.body.role]) {
+      return res.status(400).json({ error: 'Invalid card role' });
+    }
+
+    const previous = await Card.findOne({ hotelId, id: cardId });
+    const update = { ...req.body, hotelId, id: cardId };
+    if (uid) update.uid = uid;
+    const card = await Card.findOneAndUpdate({ hotelId, id: cardId }, update, { upsert: true, new: true });
+
+    // A new room, role, status or expiry moves the card between room lists
+    const uids = [];
+    if (previous && previous.uid && previous.uid !== card.uid) uids.push(previous.uid);
+    if (card.uid) uids.push(card.uid);
+    await publishAclChanges(hotelId, uids);
+    res.json(card);
+  } catch (error) {
+    console.error('Error updating card:', error);
+    res.status(500).json({ error: 'Internal server error' });
+  }
+});
+
+// Revoke a key card; the record is kept so readers can be sent the revoke
+app.delete('/api/cards/:hotelId/:cardId', validateHotelId, async (req, res) => {
+  try {
+    const { hotelId, cardId } = req.params;
+    const card = await Card.findOneAndUpdate({ hotelId, id: cardId }, { status: 'revoked' }, { new: true });
+    if (!card) {
+      return res.status(404).json({ error: 'Card not found' });
+    }
+    if (card.uid) await publishAclChanges(hotelId, [card.uid]);
+    res.json({ message: 'Card revoked successfully' });
+  } catch (error) {
+    console.error('Error revoking card:', error);
+    res.status(500).json({ error: 'Internal server error' });
+  }
+});
+
+// Cost of the dashboard fan-out since start
+app.get('/api/fanout-stats', (req, res) => {
+  let congested = 0;
+  dashboards.forEach((client) => { if (client.congested) congested++; });
+  res.json({
+    ...fanoutStats,
+    clients: dashboards.size,
+    unsubscribed: everyHotel.size,
+    hotels: dashboardGroups.size,
+    congested,
+  });
+});
+
+app.get('/api/telemetry/:hotelId', validateHotelId, async (req, res) => {
   try {
-    const data = await Activity.find({ hotelId: req.params.hotelId }).sort({ createdAt: -1 });
+    const filter = { hotelId: req.params.hotelId };
+    if (req.query.room) filter.room = String(req.query.room);
+    const data = await Telemetry.find(filter).sort({ createdAt: -1 }).limit(100);
     res.json(data);
+  } catch (error) {
+    console.error('Error fetching telemetry:', error);
+    res.status(500).json({ error: 'Internal server error' });
+  }
+});
+
+app.get('/api/activity/:hotelId', validateHotelId, async (req, res) => {
+  try {
+    await sendPage(req, res, Activity, { hotelId: req.params.hotelId });
   } catch (error) {
     console.error('Error fetching activity:', error);
     res.status(500).json({ error: 'Internal server error' });
@@ -992,100 +1724,7 @@ app.post('/api/mqtt-data', async (req, res) => {
     }
 
     const [, , building, floor, roomNum, type] = topicParts;
-    
-    // Add room and hotelId to data
-    const processedData = {
-      ...data,
-      room: roomNum,
-      hotelId: floor
-    };
-
-    let newActivity = null;
-
-    if (type === 'attendance') {
-      await new Attendance(processedData).save();
-      console.log(`Saved attendance for room ${roomNum} in hotel ${processedData.hotelId}:`, processedData);
-
-      // Update room status
-      let update = {};
-      let hasMasterKeyUpdate = {};
-      if (processedData.check_in) {
-        const status = processedData.role === 'Maintenance' ? 'maintenance' : 'occupied';
-        update = {
-          status,
-          occupantType: processedData.role.toLowerCase(),
-          powerStatus: 'on',
-        };
-        if (processedData.role === 'Manager') {
-          hasMasterKeyUpdate = { hasMasterKey: true };
-        }
-      } else {
-        update = {
-          status: 'vacant',
-          occupantType: null,
-          powerStatus: 'off',
-        };
-        if (processedData.role === 'Manager') {
-          hasMasterKeyUpdate = { hasMasterKey: false };
-        }
-      }
-      const fullUpdate = { ...update, ...hasMasterKeyUpdate };
-      await Room.findOneAndUpdate(
-        { hotelId: processedData.hotelId, number: roomNum },
-        fullUpdate,
-        { upsert: true, new: true }
-      );
-      broadcastToClients(`roomUpdate:${processedData.hotelId}`, { roomNum, ...fullUpdate });
-
-      // Create activity
-      const activityType = processedData.check_in ? 'checkin' : 'checkout';
-      const action = `${processedData.role} checked ${processedData.check_in ? 'in' : 'out'} to Room ${processedData.room}`;
-      const time = processedData.check_in || processedData.check_out;
-      newActivity = {
-        hotelId: processedData.hotelId,
-        id: new Date().getTime().toString(),
-        type: activityType,
-        action,
-        user: processedData.role,
-        time,
-      };
-    } else if (type === 'alerts') {
-      await new Alert(processedData).save();
-      console.log(`Saved alert for room ${roomNum} in hotel ${processedData.hotelId}:`, processedData);
-
-      // Create activity
-      const activityType = 'security';
-      const action = `Alert: ${processedData.alert_message} for ${processedData.role} in Room ${processedData.room}`;
-      const time = processedData.triggered_at;
-      newActivity = {
-        hotelId: processedData.hotelId,
-        id: new Date().getTime().toString(),
-        type: activityType,
-        action,
-        user: 'System',
-        time,
-      };
-    } else if (type === 'denied_access') {
-      await new Denied(processedData).save();
-      console.log(`Saved denied access for room ${roomNum} in hotel ${processedData.hotelId}:`, processedData);
-
-      // Create activity
-      const action = `Denied access to ${processedData.role}: ${processedData.denial_reason} for Room ${processedData.room}`;
-      const time = processedData.attempted_at;
-      newActivity = {
-        hotelId: processedData.hotelId,
-        id: new Date().getTime().toString(),
-        type: 'security',
-        action,
-        user: processedData.role,
-        time,
-      };
-    }
-
-    if (newActivity) {
-      const savedActivity = await new Activity(newActivity).save();
-      broadcastToClients(`activityUpdate:${processedData.hotelId}`, savedActivity);
-    }
+    await ingestEvent({ building, hotelId: floor, roomNum, type, data });
 
     res.json({ success: true, message: 'Data processed successfully' });
   } catch (error) {
@@ -1115,87 +1754,7 @@ app.post('/api/simulate-mqtt', async (req, res) => {
     const topicParts = topic.split('/');
     if (topicParts.length >= 6) {
       const [, , building, floor, roomNum, type] = topicParts;
-      
-      data.room = roomNum;
-      data.hotelId = floor;
-
-      let newActivity = null;
-
-      if (type === 'attendance') {
-        await new Attendance(data).save();
-        console.log(`Simulated MQTT - Saved attendance for room ${roomNum}:`, data);
-        
-        // Update room status (same logic as MQTT handler)
-        let update = {};
-        if (data.check_in) {
-          const status = data.role === 'Maintenance' ? 'maintenance' : 'occupied';
-          update = {
-            status,
-            occupantType: data.role.toLowerCase(),
-            powerStatus: 'on',
-          };
-          if (data.role === 'Manager') {
-            update.hasMasterKey = true;
-          }
-        } else {
-          update = {
-            status: 'vacant',
-            occupantType: null,
-            powerStatus: 'off',
-          };
-          if (data.role === 'Manager') {
-            update.hasMasterKey = false;
-          }
-        }
-        
-        await Room.findOneAndUpdate(
-          { hotelId: data.hotelId, number: roomNum },
-          update,
-          { upsert: true, new: true }
-        );
-        broadcastToClients(`roomUpdate:${data.hotelId}`, { roomNum, ...update });
-
-        const activityType = data.check_in ? 'checkin' : 'checkout';
-        const action = `${data.role} checked ${data.check_in ? 'in' : 'out'} to Room ${data.room}`;
-        const time = data.check_in || data.check_out;
-        newActivity = {
-          hotelId: data.hotelId,
-          id: new Date().getTime().toString(),
-          type: activityType,
-          action,
-          user: data.role,
-          time,
-        };
-      } else if (type === 'alerts') {
-        await new Alert(data).save();
-        console.log(`Simulated MQTT - Saved alert for room ${roomNum}:`, data);
-        
-        newActivity = {
-          hotelId: data.hotelId,
-          id: new Date().getTime().toString(),
-          type: 'security',
-          action: `Alert: ${data.alert_message} for ${data.role} in Room ${data.room}`,
-          user: 'System',
-          time: data.triggered_at,
-        };
-      } else if (type === 'denied_access') {
-        await new Denied(data).save();
-        console.log(`Simulated MQTT - Saved denied access for room ${roomNum}:`, data);
-        
-        newActivity = {
-          hotelId: data.hotelId,
-          id: new Date().getTime().toString(),
-          type: 'security',
-          action: `Denied access to ${data.role}: ${data.denial_reason} for Room ${data.room}`,
-          user: data.role,
-          time: data.attempted_at,
-        };
-      }
-
-      if (newActivity) {
-        const savedActivity = await new Activity(newActivity).save();
-        broadcastToClients(`activityUpdate:${data.hotelId}`, savedActivity);
-      }
+      await ingestEvent({ building, hotelId: floor, roomNum, type, data });
     }
 
     res.json({ success: true, message: 'MQTT simulation processed successfully' });
@@ -0,0 +1,61 @@
+/**
+ * @file paging.js
+ * @brief Keyset paging of the event lists
+ * @author Development Team
+ * @version 1.0.0
+ * @date October 2025
+ *
+ * Attendance, alerts, denied access and activity are served newest first,
+ * ?limit= rows a page (default PAGE_DEFAULT, at most PAGE_MAX). There is
+ * no unpaged form: a caller that wants more follows the X-Next-Cursor
+ * header, which holds the ?before= value for the next page and is absent
+ * on the last one. Keyset paging on (createdAt, _id) walks the hotel
+ * index, so a deep page costs the same as the first.
+ *
+ * Has no dependencies, so test/paging.test.js can drive it with an
+ * in-memory model.
+ */
+
+const PAGE_DEFAULT = 200;
+const PAGE_MAX = 1000;
+const OBJECT_ID = /^[0-9a-f]{24}$/i;
+
+function encodeCursor(doc) {
+  return Buffer.from(`${doc.createdAt.getTime()}:${doc._id}`).toString('base64url');
+}
+
+// The _id stays a hex string; Mongoose casts it with the rest of the filter
+function decodeCursor(text) {
+  const [ms, id] = Buffer.from(String(text), 'base64url').toString().split(':');
+  const createdAt = new Date(Number(ms));
+  if (!ms || Number.isNaN(createdAt.getTime()) || !OBJECT_ID.test(id || '')) return null;
+  return { createdAt, _id: id };
+}
+
+async function sendPage(req, res, model, filter) {
+  const limit = Math.min(Math.max(parseInt(req.query.limit, 10) || PAGE_DEFAULT, 1), PAGE_MAX);
+  const query = { ...filter };
+  if (req.query.before) {
+    const cursor = decodeCursor(req.query.before);
+    if (!cursor) return res.status(400).json({ error: 'Invalid cursor' });
+    query.$or = [
+      { createdAt: { $lt: cursor.createdAt } },
+      { createdAt: cursor.createdAt, _id: { $lt: cursor._id } },
+    ];
+  }
+
+  const data = await model.find(query).sort({ createdAt: -1, _id: -1 }).limit(limit + 1).lean();
+  if (data.length > limit) {
+    data.length = limit;
+    res.set('X-Next-Cursor', encodeCursor(data[limit - 1]));
+  }
+  res.json(data);
+}
+
+module.exports = {
+  PAGE_DEFAULT,
+  PAGE_MAX,
+  encodeCursor,
+  decodeCursor,
+  sendPage,
+};
@@ -0,0 +1,136 @@
+/**
+ * @file paging.test.js
+ * @brief The event list handler against the default page size
+ *
+ * sendPage() runs as the /api/attendance route calls it, on an in-memory
+ * model that answers find().sort().limit().lean() with the same filter
+ * and order as MongoDB. Several rows share a createdAt, as a batch of
+ * events written together does, so pages must break ties on _id.
+ *
+ *   cd Backend && npm test
+ */
+
+const test = require('node:test');
+const assert = require('node:assert');
+const { PAGE_DEFAULT, PAGE_MAX, sendPage } = require('../paging');
+
+// ---- In-memory model ----
+function matches(row, query) {
+  return Object.entries(query).every(([key, want]) => {
+    if (key === '$or') return want.some((q) => matches(row, q));
+    const value = row[key];
+    if (want && typeof want === 'object' && '$lt' in want) {
+      const bound = want.$lt;
+      return bound instanceof Date ? value.getTime() < bound.getTime() : value < bound;
+    }
+    return want instanceof Date ? value.getTime() === want.getTime() : value === want;
+  });
+}
+
+function model(rows) {
+  return {
+    find(query) {
+      let found = rows.filter((row) => matches(row, query));
+      const chain = {
+        sort(spec) {
+          assert.deepStrictEqual(spec, { createdAt: -1, _id: -1 });
+          found.sort((a, b) => b.createdAt - a.createdAt || (a._id < b._id ? 1 : a._id > b._id ? -1 : 0));
+          return chain;
+        },
+        limit(n) {
+          found = found.slice(0, n);
+          return chain;
+        },
+        lean: async () => found.map((row) => ({ ...row })),
+      };
+      return chain;
+    },
+  };
+}
+
+// 24 hex digits in insertion order, like ObjectIds from one process
+function objectId(n) {
+  return n.toString(16).padStart(24, '0');
+}
+
+// Four rows a second, so every page boundary falls inside a tie
+function attendance(count, rooms = 1) {
+  const rows = [];
+  for (let n = 0; n < count; n++) {
+    rows.push({
+      _id: objectId(n + 1),
+      hotelId: '1',
+      room: String(101 + (n % rooms)),
+      createdAt: new Date(1735381800000 + Math.floor(n / 4) * 1000),
+    });
+  }
+  return rows;
+}
+
+// ---- Express stand-ins ----
+async function get(rows, query = {}, filter = { hotelId: '1' }) {
+  const res = {
+    statusCode: 200,
+    headers: {},
+    body: undefined,
+    set(name, value) { this.headers[name] = value; return this; },
+    status(code) { this.statusCode = code; return this; },
+    json(body) { this.body = body; return this; },
+  };
+  await sendPage({ query, params: { hotelId: '1' } }, res, model(rows), filter);
+  return res;
+}
+
+// ---- Cases ----
+test('a request without paging parameters gets PAGE_DEFAULT rows, newest first', async () => {
+  const rows = attendance(PAGE_DEFAULT * 2 + 50);
+  const res = await get(rows);
+  assert.strictEqual(res.statusCode, 200);
+  assert.strictEqual(res.body.length, PAGE_DEFAULT);
+  assert.strictEqual(res.body[0]._id, objectId(rows.length));
+  assert.ok(res.headers['X-Next-Cursor']);
+});
+
+test('following X-Next-Cursor returns every row once, in order', async () => {
+  const rows = attendance(PAGE_DEFAULT * 2 + 50);
+  const seen = [];
+  let before;
+  let pages = 0;
+  do {
+    const res = await get(rows, before ? { before } : {});
+    assert.strictEqual(res.statusCode, 200);
+    seen.push(...res.body.map((row) => row._id));
+    before = res.headers['X-Next-Cursor'];
+    pages++;
+  } while (before);
+
+  assert.strictEqual(pages, 3);
+  assert.deepStrictEqual(seen, rows.map((row) => row._id).reverse());
+});
+
+test('a list that fits in one page has no cursor', async () => {
+  const res = await get(attendance(PAGE_DEFAULT));
+  assert.strictEqual(res.body.length, PAGE_DEFAULT);
+  assert.strictEqual(res.headers['X-Next-Cursor'], undefined);
+});
+
+test('limit is clamped to 1..PAGE_MAX and falls back to PAGE_DEFAULT', async () => {
+  const rows = attendance(PAGE_MAX + 100);
+  assert.strictEqual((await get(rows, { limit: String(PAGE_MAX * 5) })).body.length, PAGE_MAX);
+  assert.strictEqual((await get(rows, { limit: '-3' })).body.length, 1);
+  assert.strictEqual((await get(rows, { limit: 'all' })).body.length, PAGE_DEFAULT);
+  assert.strictEqual((await get(rows, { limit: '25' })).body.length, 25);
+});
+
+test('a room filter pages within the room', async () => {
+  const rows = attendance(PAGE_DEFAULT * 3, 2);
+  const res = await get(rows, {}, { hotelId: '1', room: '102' });
+  assert.strictEqual(res.body.length, PAGE_DEFAULT);
+  assert.ok(res.body.every((row) => row.room === '102'));
+});
+
+test('a damaged cursor is refused', async () => {
+  const rows = attendance(10);
+  assert.strictEqual((await get(rows, { before: 'bm90IGEgY3Vyc29y' })).statusCode, 400);
+  assert.strictEqual((await get(rows, { before: Buffer.from('123:xyz').toString('base64url') })).statusCode, 400);
+});
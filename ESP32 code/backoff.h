@@ -0,0 +1,69 @@
+/**
+ * @file backoff.h
+ * @brief Jittered exponential backoff for reconnect attempts
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section backoff_overview Overview
+ *
+ * The first retry after a drop comes quickly, because most drops are a
+ * single lost connection and the backend is still there. Each further
+ * failure doubles the ceiling up to capMs. The actual delay is drawn from
+ * the upper half of the ceiling ("equal jitter"), so a fleet of readers
+ * that lost the backend together does not reconnect in lockstep.
+ */
+
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+class Backoff {
+public:
+  /**
+   * @param seed Any per-device value (e.g. esp_random()); 0 is replaced
+   */
+  Backoff(uint32_t baseMs, uint32_t capMs, uint32_t seed)
+    : baseMs_(baseMs), capMs_(capMs), ceilingMs_(baseMs), attempts_(0),
+      state_(seed != 0 ? seed : 0x9E3779B9u) {}
+
+  /**
+   * @brief Delay before the next attempt; grows the ceiling for the one after
+   */
+  uint32_t next() {
+    uint32_t half = ceilingMs_ / 2;
+    uint32_t delay = half + random() % (ceilingMs_ - half + 1);
+
+    ceilingMs_ = ceilingMs_ > capMs_ / 2 ? capMs_ : ceilingMs_ * 2;
+    attempts_++;
+    return delay;
+  }
+
+  /**
+   * @brief Connection established; the next drop starts from baseMs again
+   */
+  void reset() {
+    ceilingMs_ = baseMs_;
+    attempts_ = 0;
+  }
+
+  uint32_t attempts() const { return attempts_; }
+
+private:
+  // xorshift32
+  uint32_t random() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+
+  uint32_t baseMs_;
+  uint32_t capMs_;
+  uint32_t ceilingMs_;
+  uint32_t attempts_;
+  uint32_t state_;
+};
+
+#endif // BACKOFF_H
@@ -0,0 +1,45 @@
+/**
+ * @file alloc_counter.cpp
+ * @brief Counting replacements of the global operator new
+ */
+
+#include "alloc_counter.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+void* allocate(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+} // namespace
+
+uint64_t benchAllocations() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
@@ -0,0 +1,25 @@
+/**
+ * @file alloc_counter.h
+ * @brief Heap allocation count for host benchmarks and tests
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section alloc_counter_overview Overview
+ *
+ * Linking alloc_counter.cpp into a program replaces the global operator
+ * new with one that counts its calls. Comparing the count before and
+ * after a piece of firmware code shows whether it touched the heap.
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Calls to operator new since the program started
+ */
+uint64_t benchAllocations();
+
+#endif // ALLOC_COUNTER_H
@@ -0,0 +1,87 @@
+/**
+ * @file bench_support.h
+ * @brief Cycle and heap counters shared by the host benchmarks
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section bench_support_overview Overview
+ *
+ * The benchmarks in bench/ run on Google Benchmark and time with
+ * UseManualTime(), so only the code under test is measured. Around it they
+ * read two counters: the time stamp counter, and the number of heap
+ * allocations from alloc_counter.h. The firmware never allocates on the
+ * event path, so anything but zero allocations is a finding.
+ */
+
+#ifndef BENCH_SUPPORT_H
+#define BENCH_SUPPORT_H
+
+#include <stdint.h>
+#include <chrono>
+#include <benchmark/benchmark.h>
+#include "alloc_counter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief CPU cycles on x86, nanoseconds elsewhere
+ */
+inline uint64_t benchCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief Cycles, allocations and wall time of the measured regions of one benchmark
+ *
+ * @code
+ * BenchProbe probe;
+ * for (auto _ : state) {
+ *   probe.start();
+ *   ...code under test...
+ *   probe.stop(state);
+ * }
+ * probe.report(state);
+ * @endcode
+ */
+class BenchProbe {
+public:
+  void start() {
+    allocations_ = benchAllocations();
+    startTime_ = std::chrono::steady_clock::now();
+    startCycles_ = benchCycles();
+  }
+
+  void stop(benchmark::State& state) {
+    uint64_t cycles = benchCycles() - startCycles_;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime_;
+    cycles_ += cycles;
+    allocs_ += benchAllocations() - allocations_;
+    state.SetIterationTime(elapsed.count());
+  }
+
+  /**
+   * @brief Adds "cycles" and "allocs", averaged per iteration
+   */
+  void report(benchmark::State& state) const {
+    using benchmark::Counter;
+    state.counters["cycles"] = Counter((double)cycles_, Counter::kAvgIterations);
+    state.counters["allocs"] = Counter((double)allocs_, Counter::kAvgIterations);
+  }
+
+private:
+  std::chrono::steady_clock::time_point startTime_;
+  uint64_t startCycles_ = 0;
+  uint64_t allocations_ = 0;
+  uint64_t cycles_ = 0;
+  uint64_t allocs_ = 0;
+};
+
+#endif // BENCH_SUPPORT_H
@@ -0,0 +1,90 @@
+/**
+ * @file event_encoder_bench.cpp
+ * @brief Cycles and allocations to encode each event type
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section event_encoder_bench_overview Overview
+ *
+ * What the publish path spends turning an event into its topic and
+ * payload: the timestamp, then encodeTopic() and encodePayload() into
+ * EVENT_FRAME_SIZE stack buffers, or encodeBinaryPayload() for CBOR.
+ * The argument picks the payload: 0 is JSON, 1 is CBOR. The "bytes"
+ * counter is the payload size.
+ *
+ *   ./build/event_encoder_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "bench_support.h"
+#include "config.h"
+#include "event_encoder.h"
+
+namespace {
+
+const DeviceContext ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+const CardUid       card = cardUid({0x04, 0x52, 0x9A, 0x12, 0x6B, 0x5C, 0x80});
+
+CheckInEvent  makeEvent(CheckInEvent*, const char* ts, uint32_t n) {
+  return {card, Role::Guest, ts, 1735381800000ull + n, n};
+}
+CheckOutEvent makeEvent(CheckOutEvent*, const char* ts, uint32_t n) {
+  return {card, Role::Guest, ts, 1735381800000ull + n, 5400, n};
+}
+DeniedEvent   makeEvent(DeniedEvent*, const char* ts, uint32_t n) {
+  return {card, "Unauthorized card", ts, 1735381800000ull + n, 1, n};
+}
+AlertEvent    makeEvent(AlertEvent*, const char* ts, uint32_t n) {
+  return {card, "Multiple failed access attempts", ts, 1735381800000ull + n, 5, n};
+}
+
+template <typename Event>
+void encode(benchmark::State& state) {
+  bool binary = state.range(0) != 0;
+  char timestamp[TIMESTAMP_SIZE];
+  char topic[EVENT_FRAME_SIZE];
+  uint8_t payload[EVENT_FRAME_SIZE];
+  BenchProbe probe;
+  uint32_t n = 0;
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    n++;
+    probe.start();
+    formatTimestamp(1735381800 + n / 1000, (uint16_t)(n % 1000), timestamp, sizeof(timestamp));
+    Event event = makeEvent((Event*)nullptr, timestamp, n);
+    size_t topicLength = encodeTopic(ctx, eventType(event), topic, sizeof(topic));
+    size_t length = binary ? encodeBinaryPayload(event, payload, sizeof(payload))
+                           : encodePayload(ctx, event, (char*)payload, sizeof(payload));
+    benchmark::DoNotOptimize(payload);
+    probe.stop(state);
+    if (topicLength == 0 || length == 0) state.SkipWithError("did not fit");
+    bytes = length;
+  }
+  probe.report(state);
+  state.counters["bytes"] = (double)bytes;
+}
+
+void timestamp(benchmark::State& state) {
+  char buf[TIMESTAMP_SIZE];
+  BenchProbe probe;
+  uint32_t n = 0;
+  for (auto _ : state) {
+    n++;
+    probe.start();
+    formatTimestamp(1735381800 + n / 1000, (uint16_t)(n % 1000), buf, sizeof(buf));
+    benchmark::DoNotOptimize(buf);
+    probe.stop(state);
+  }
+  probe.report(state);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(encode, CheckInEvent)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(encode, CheckOutEvent)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(encode, DeniedEvent)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK_TEMPLATE(encode, AlertEvent)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK(timestamp)->UseManualTime();
@@ -0,0 +1,185 @@
+/**
+ * @file hot_path_bench.cpp
+ * @brief Cycles and allocations per check-in, check-out and denied event
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section hot_path_bench_overview Overview
+ *
+ * One read cycle of the firmware, from the inventory a reader returns to
+ * the MQTT frame on the socket: PresenceTracker decides, the card list
+ * looks the card up, EventPublisher encodes and publishes into a
+ * SimSocket. Only the cycle that produces the event is timed; the cycles
+ * that set it up, and the broker's PUBACK, run between measurements.
+ *
+ * The argument picks the payload: 0 is JSON, 1 is CBOR. Events are
+ * published directly, as with no journal partition; the journal adds a
+ * flash write that the host cannot stand in for.
+ *
+ *   ./build/hot_path_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+
+#include "bench_support.h"
+#include "card_acl.h"
+#include "config.h"
+#include "event_publisher.h"
+#include "presence.h"
+#include "sim_transport.h"
+
+namespace {
+
+// ---- Reader ----
+// The firmware's read cycle with its callbacks as plain functions, as on
+// the device
+
+const size_t ISSUED_CARDS = 500;         ///< Cards on the list besides the guest
+
+struct Reader;
+Reader* reader = nullptr;
+
+Role readerLookup(const uint8_t* uid, uint8_t size);
+void readerEmit(const JournalEntry& entry);
+
+struct Reader {
+  DeviceContext   ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+  SimLink         link;
+  SimSocket       socket;
+  MqttClient      mqtt;
+  EventPublisher  publisher;
+  CardAcl         acl;
+  PresenceTracker presence;
+  uint64_t        nowUs = 1000000;
+  uint32_t        events = 0;
+
+  explicit Reader(PayloadFormat format)
+    : socket(link),
+      mqtt(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, SimSocket::send),
+      publisher(ctx, mqtt),
+      presence(readerLookup, readerEmit, CARD_ABSENT_THRESHOLD) {
+    reader = this;
+    socket.attach(mqtt);
+    mqtt.onAck(ack);
+    publisher.setPayloadFormat(format);
+
+    static UserAuth users[ISSUED_CARDS + 1];
+    for (size_t i = 0; i < ISSUED_CARDS; i++) {
+      users[i].uid = cardUid({0x10, (uint8_t)(i >> 8), (uint8_t)i, 0x5A});
+      users[i].role = (Role)(1 + i % 4);
+    }
+    users[ISSUED_CARDS] = {guest(), Role::Guest};
+    acl.load(users, ISSUED_CARDS + 1);
+
+    link.setUp(true);
+    mqtt.connect(nowMs());
+    settle();
+  }
+
+  static CardUid guest() { return cardUid({0xB2, 0xF9, 0x7C, 0x00}); }
+  static void ack(uint16_t packetId) { reader->publisher.onAck(packetId); }
+
+  uint32_t nowMs() const { return (uint32_t)(nowUs / 1000); }
+
+  void poll(const CardUid* uids, size_t count) {
+    presence.update(uids, count, nowUs, EventTime{1735381800, (uint16_t)(nowMs() % 1000)});
+    nowUs += CARD_READ_DELAY * 1000;
+  }
+
+  /**
+   * @brief Let the broker's replies in
+   */
+  void settle() {
+    socket.deliver(nowMs());
+    mqtt.loop(nowMs());
+  }
+};
+
+Role readerLookup(const uint8_t* uid, uint8_t size) {
+  return reader->acl.lookup(uid, size);
+}
+
+void readerEmit(const JournalEntry& entry) {
+  reader->events++;
+  reader->publisher.record(entry, reader->nowMs());
+}
+
+// ---- Benchmarks ----
+
+void checkIn(benchmark::State& state) {
+  Reader r((PayloadFormat)state.range(0));
+  CardUid card = Reader::guest();
+  BenchProbe probe;
+  for (auto _ : state) {
+    uint32_t before = r.events;
+    probe.start();
+    r.poll(&card, 1);
+    probe.stop(state);
+    if (r.events != before + 1) state.SkipWithError("no check-in");
+
+    r.settle();
+    for (int i = 0; i < CARD_ABSENT_THRESHOLD; i++) r.poll(nullptr, 0);
+    r.settle();
+  }
+  probe.report(state);
+}
+
+void checkOut(benchmark::State& state) {
+  Reader r((PayloadFormat)state.range(0));
+  CardUid card = Reader::guest();
+  BenchProbe probe;
+  for (auto _ : state) {
+    r.poll(&card, 1);
+    r.settle();
+    for (int i = 1; i < CARD_ABSENT_THRESHOLD; i++) r.poll(nullptr, 0);
+
+    uint32_t before = r.events;
+    probe.start();
+    r.poll(nullptr, 0);
+    probe.stop(state);
+    if (r.events != before + 1) state.SkipWithError("no check-out");
+    r.settle();
+  }
+  probe.report(state);
+}
+
+// A new card every time, as in a scan of random UIDs; the oldest tracked
+// card makes room for it
+void denied(benchmark::State& state) {
+  Reader r((PayloadFormat)state.range(0));
+  uint32_t serial = 0;
+  BenchProbe probe;
+  for (auto _ : state) {
+    serial++;
+    CardUid card = cardUid({0xDE, (uint8_t)(serial >> 16), (uint8_t)(serial >> 8), (uint8_t)serial});
+    uint32_t before = r.events;
+    probe.start();
+    r.poll(&card, 1);
+    probe.stop(state);
+    if (r.events != before + 1) state.SkipWithError("no denied event");
+    r.settle();
+  }
+  probe.report(state);
+}
+
+// An inventory with nobody at the door: what every other poll costs
+void idlePoll(benchmark::State& state) {
+  Reader r(PayloadFormat::Json);
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    r.poll(nullptr, 0);
+    probe.stop(state);
+  }
+  probe.report(state);
+}
+
+} // namespace
+
+BENCHMARK(checkIn)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK(checkOut)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK(denied)->ArgName("cbor")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK(idlePoll)->UseManualTime();
@@ -0,0 +1,140 @@
+/**
+ * @file logger_bench.cpp
+ * @brief Cost of one log call on the hot path, and of printing it later
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section logger_bench_overview Overview
+ *
+ * Each iteration logs LINES lines through the LOG_* macros and is timed
+ * as a whole; the ring is drained between iterations, untimed, so no line
+ * is dropped. The counters are per line. The arguments are those of the
+ * firmware's check-in line: static strings, integers, and logText() for
+ * the card UID, which is the one argument that gets copied.
+ *
+ * formatted is what the old Serial.printf() did before the UART even
+ * started: snprintf of the same line. At 115200 baud the UART then needs
+ * about 87 us per byte, which no host figure includes. compiledOut is
+ * a LOG_DEBUG line of a category whose DEBUG_* flag is off. drain is the
+ * log task's side: formatting queued lines to a sink.
+ *
+ *   ./build/logger_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+
+#include "bench_support.h"
+#include "logger.h"
+
+namespace {
+
+const int LINES = LOG_RING_SIZE / 2;
+
+size_t sunk = 0;
+void sink(const char*, size_t length) { sunk += length; }
+
+const char* room = "202";
+const char* role = "Guest";
+char        uidText[] = "B2F97C00";
+
+void perLine(benchmark::State& state, const BenchProbe& probe) {
+  using benchmark::Counter;
+  probe.report(state);
+  state.counters["cycles"] = Counter(state.counters["cycles"].value / LINES, Counter::kAvgIterations);
+  state.counters["allocs"] = Counter(state.counters["allocs"].value / LINES, Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * LINES);
+}
+
+void staticLine(benchmark::State& state) {
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    for (int i = 0; i < LINES; i++) LOG_INFO(Rfid, "Ready to read cards...");
+    probe.stop(state);
+    logger.drain(sink);
+  }
+  perLine(state, probe);
+}
+
+void checkInLine(benchmark::State& state) {
+  uint32_t timestamp = 1735381800;
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    for (int i = 0; i < LINES; i++) {
+      LOG_INFO(Rfid, "Room %s: %s Checked IN at %u", room, role, (unsigned)timestamp++);
+    }
+    probe.stop(state);
+    logger.drain(sink);
+  }
+  perLine(state, probe);
+}
+
+void deniedLine(benchmark::State& state) {
+  uint32_t timestamp = 1735381800;
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    for (int i = 0; i < LINES; i++) {
+      LOG_INFO(Rfid, "Room %s: DENIED ACCESS: Unknown card %s at %u", room, logText(uidText),
+               (unsigned)timestamp++);
+    }
+    probe.stop(state);
+    logger.drain(sink);
+  }
+  perLine(state, probe);
+}
+
+void compiledOut(benchmark::State& state) {
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    for (int i = 0; i < LINES; i++) LOG_DEBUG(Rfid, "Poll %d: no card", i);
+    probe.stop(state);
+  }
+  perLine(state, probe);
+}
+
+void formatted(benchmark::State& state) {
+  char line[LOG_LINE_SIZE];
+  uint32_t timestamp = 1735381800;
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    for (int i = 0; i < LINES; i++) {
+      int n = snprintf(line, sizeof(line), "Room %s: DENIED ACCESS: Unknown card %s at %u\n", room,
+                       uidText, (unsigned)timestamp++);
+      benchmark::DoNotOptimize(n);
+    }
+    probe.stop(state);
+  }
+  perLine(state, probe);
+}
+
+void drain(benchmark::State& state) {
+  uint32_t timestamp = 1735381800;
+  BenchProbe probe;
+  for (auto _ : state) {
+    for (int i = 0; i < LINES; i++) {
+      LOG_INFO(Rfid, "Room %s: DENIED ACCESS: Unknown card %s at %u", room, logText(uidText),
+               (unsigned)timestamp++);
+    }
+    probe.start();
+    size_t lines = logger.drain(sink);
+    probe.stop(state);
+    if (lines != (size_t)LINES) state.SkipWithError("lines lost");
+  }
+  perLine(state, probe);
+}
+
+} // namespace
+
+BENCHMARK(staticLine)->UseManualTime();
+BENCHMARK(checkInLine)->UseManualTime();
+BENCHMARK(deniedLine)->UseManualTime();
+BENCHMARK(compiledOut)->UseManualTime();
+BENCHMARK(formatted)->UseManualTime();
+BENCHMARK(drain)->UseManualTime();
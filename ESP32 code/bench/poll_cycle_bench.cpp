@@ -0,0 +1,108 @@
+/**
+ * @file poll_cycle_bench.cpp
+ * @brief Poll-cycle time with 1 to 8 cards in the field
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section poll_cycle_bench_overview Overview
+ *
+ * One cycle of rfidTask() for one reader: the inventory from a
+ * SimCardReader, then PresenceTracker::update() with the card list lookup
+ * behind it. The argument is the number of cards in the field, up to
+ * MAX_PRESENT_CARDS.
+ *
+ * tracked is the cycle that runs most of the time: every card is already
+ * checked in and only has its absence counter reset. arrival is the cycle
+ * in which all the cards appear together, each looked up and checked in;
+ * they are taken away and checked out between measurements. Events go to
+ * a counter, not to the publisher, whose cost hot_path_bench reports.
+ * The simulated inventory is a copy under a mutex; on the device the SPI
+ * frames dominate, and card_detect_test counts those.
+ *
+ *   ./build/poll_cycle_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "bench_support.h"
+#include "card_acl.h"
+#include "card_reader.h"
+#include "config.h"
+#include "presence.h"
+
+namespace {
+
+CardAcl  acl;
+uint32_t events = 0;
+
+Role lookup(const uint8_t* uid, uint8_t size) { return acl.lookup(uid, size); }
+void emit(const JournalEntry&) { events++; }
+
+// A guest, housekeeping and the others a busy doorway might see at once
+CardUid fieldCard(size_t i) {
+  return cardUid({0x5C, 0xA1, (uint8_t)(i * 37), (uint8_t)i});
+}
+
+struct Cycle {
+  SimCardReader   reader;
+  PresenceTracker presence;
+  uint64_t        nowUs = 1000000;
+
+  Cycle() : reader(false), presence(lookup, emit, CARD_ABSENT_THRESHOLD) {
+    static UserAuth users[500];
+    for (size_t i = 0; i < 500; i++) {
+      users[i] = {i < MAX_PRESENT_CARDS ? fieldCard(i) : cardUid({0x10, (uint8_t)(i >> 8), (uint8_t)i, 0x5A}),
+                  (Role)(1 + i % 4)};
+    }
+    acl.load(users, 500);
+  }
+
+  size_t poll() {
+    CardUid uids[MAX_PRESENT_CARDS];
+    size_t count = reader.readCards(uids, MAX_PRESENT_CARDS);
+    presence.update(uids, count, nowUs, EventTime{1735381800, 0});
+    nowUs += CARD_READ_DELAY * 1000;
+    return count;
+  }
+};
+
+void tracked(benchmark::State& state) {
+  size_t cards = (size_t)state.range(0);
+  Cycle c;
+  for (size_t i = 0; i < cards; i++) c.reader.placeCard(fieldCard(i));
+  c.poll();
+  if (c.presence.present() != cards) state.SkipWithError("cards not checked in");
+
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    size_t seen = c.poll();
+    probe.stop(state);
+    if (seen != cards) state.SkipWithError("inventory short");
+  }
+  probe.report(state);
+}
+
+void arrival(benchmark::State& state) {
+  size_t cards = (size_t)state.range(0);
+  Cycle c;
+  BenchProbe probe;
+  for (auto _ : state) {
+    for (size_t i = 0; i < cards; i++) c.reader.placeCard(fieldCard(i));
+    uint32_t before = events;
+    probe.start();
+    c.poll();
+    probe.stop(state);
+    if (events != before + cards) state.SkipWithError("missing check-in");
+
+    c.reader.clear();
+    for (int i = 0; i < CARD_ABSENT_THRESHOLD; i++) c.poll();
+  }
+  probe.report(state);
+}
+
+} // namespace
+
+BENCHMARK(tracked)->ArgName("cards")->DenseRange(1, MAX_PRESENT_CARDS)->UseManualTime();
+BENCHMARK(arrival)->ArgName("cards")->DenseRange(1, MAX_PRESENT_CARDS)->UseManualTime();
@@ -0,0 +1,155 @@
+/**
+ * @file spsc_queue_bench.cpp
+ * @brief Event queue throughput and hand-off latency between two threads
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section spsc_queue_bench_overview Overview
+ *
+ * The benchmark thread is the RFID task and pushes card events; a
+ * PinnedTask on the other core pops them as the network task does.
+ *
+ * throughput pushes as fast as the consumer takes, waiting when the ring
+ * is full, at the firmware's EVENT_QUEUE_SIZE and at a larger ring.
+ * handoff pushes one event at a time into an empty queue and reports
+ * percentiles of the time until the consumer has it (p50_ns, p99_ns,
+ * p999_ns, max_ns). The consumer polls without sleeping here; in the
+ * firmware it sleeps until the next scheduler tick, which bounds the
+ * hand-off at SCHEDULER_TICK_MS instead.
+ *
+ * On a host with one core both threads share it and the figures are
+ * the scheduler's time slice, not the queue.
+ *
+ *   ./build/spsc_queue_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "event_journal.h"
+#include "pinned_task.h"
+#include "spsc_queue.h"
+
+namespace {
+
+struct StampedEntry {
+  JournalEntry entry;
+  uint64_t     sentNs;
+};
+
+uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int consumerCore() {
+  return std::thread::hardware_concurrency() >= 2 ? 0 : -1;
+}
+
+// ---- Consumer ----
+// Pops until told to stop, recording how long each entry waited
+
+struct Consumer {
+  void*                 queue = nullptr;
+  bool                  (*pop)(void* queue, StampedEntry& item) = nullptr;
+  std::atomic<bool>     stop{false};
+  std::atomic<uint64_t> taken{0};
+  std::vector<uint32_t> waitedNs;
+};
+
+void consume(void* arg) {
+  Consumer* c = static_cast<Consumer*>(arg);
+  StampedEntry item;
+  for (;;) {
+    if (c->pop(c->queue, item)) {
+      if (c->waitedNs.size() < c->waitedNs.capacity()) {
+        c->waitedNs.push_back((uint32_t)std::min<uint64_t>(nowNs() - item.sentNs, UINT32_MAX));
+      }
+      c->taken.fetch_add(1, std::memory_order_release);
+    } else if (c->stop.load(std::memory_order_acquire)) {
+      break;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+template <size_t Capacity>
+bool popFrom(void* queue, StampedEntry& item) {
+  return static_cast<SpscQueue<StampedEntry, Capacity>*>(queue)->pop(item);
+}
+
+StampedEntry cardEvent(uint32_t seq) {
+  StampedEntry item = {{seq, EventType::CheckIn, Role::Guest, cardUid({0xB2, 0xF9, 0x7C, (uint8_t)seq}),
+                        1735381800, 0, 250, 0}, 0};
+  return item;
+}
+
+// ---- Benchmarks ----
+
+template <size_t Capacity>
+void throughput(benchmark::State& state) {
+  static SpscQueue<StampedEntry, Capacity> queue;
+  Consumer consumer;
+  consumer.queue = &queue;
+  consumer.pop = popFrom<Capacity>;
+  PinnedTask task;
+  task.start("network", consume, &consumer, 0, 0, consumerCore());
+
+  uint32_t seq = 0;
+  uint64_t full = 0;
+  for (auto _ : state) {
+    StampedEntry item = cardEvent(++seq);
+    while (!queue.push(item)) {
+      full++;
+      std::this_thread::yield();
+    }
+  }
+  consumer.stop.store(true, std::memory_order_release);
+  task.join();
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["full"] = benchmark::Counter((double)full, benchmark::Counter::kAvgIterations);
+}
+
+void handoff(benchmark::State& state) {
+  static SpscQueue<StampedEntry, EVENT_QUEUE_SIZE> queue;
+  Consumer consumer;
+  consumer.queue = &queue;
+  consumer.pop = popFrom<EVENT_QUEUE_SIZE>;
+  consumer.waitedNs.reserve(1 << 20);
+  PinnedTask task;
+  task.start("network", consume, &consumer, 0, 0, consumerCore());
+
+  uint32_t seq = 0;
+  for (auto _ : state) {
+    StampedEntry item = cardEvent(++seq);
+    item.sentNs = nowNs();
+    queue.push(item);
+    while (consumer.taken.load(std::memory_order_acquire) != seq) std::this_thread::yield();
+  }
+  consumer.stop.store(true, std::memory_order_release);
+  task.join();
+
+  std::vector<uint32_t>& waited = consumer.waitedNs;
+  if (waited.empty()) return;
+  std::sort(waited.begin(), waited.end());
+  auto at = [&waited](double p) { return (double)waited[(size_t)(p * (double)(waited.size() - 1))]; };
+  state.counters["p50_ns"] = at(0.50);
+  state.counters["p99_ns"] = at(0.99);
+  state.counters["p999_ns"] = at(0.999);
+  state.counters["max_ns"] = (double)waited.back();
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(throughput, EVENT_QUEUE_SIZE)->UseRealTime();
+BENCHMARK_TEMPLATE(throughput, 1024)->UseRealTime();
+BENCHMARK(handoff)->UseRealTime();
@@ -0,0 +1,123 @@
+/**
+ * @file telemetry_bench.cpp
+ * @brief What the telemetry instrumentation costs per loop iteration
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section telemetry_bench_overview Overview
+ *
+ * record and count are single calls into Telemetry, with values spread
+ * over every bucket. rfidIteration is one idle iteration of rfidLoop()
+ * for one reader, the one that runs ten times a second all day: the
+ * inventory, PresenceTracker::update() and, with the argument set, the
+ * instrumentation around it (two clock reads, the RfidRead and
+ * RfidJitter samples). The difference between the two rows is the
+ * per-iteration overhead. The host clock read stands in for micros().
+ *
+ * report is the network task's side, once per MEMORY_CHECK_INTERVAL:
+ * collect the deltas and encode the JSON payload.
+ *
+ *   ./build/telemetry_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+#include "bench_support.h"
+#include "card_reader.h"
+#include "config.h"
+#include "event_encoder.h"
+#include "presence.h"
+#include "telemetry.h"
+
+namespace {
+
+Telemetry telemetry;
+
+uint32_t micros() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Role lookup(const uint8_t*, uint8_t) { return Role::Guest; }
+void emit(const JournalEntry&) {}
+
+void record(benchmark::State& state) {
+  uint32_t value = 1;
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    telemetry.record(Metric::WsSend, value);
+    probe.stop(state);
+    value = value * 3 + 1;
+  }
+  probe.report(state);
+}
+
+void count(benchmark::State& state) {
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    telemetry.count(Stat::Published);
+    probe.stop(state);
+  }
+  probe.report(state);
+}
+
+void rfidIteration(benchmark::State& state) {
+  bool instrumented = state.range(0) != 0;
+  SimCardReader reader(false);
+  PresenceTracker presence(lookup, emit, CARD_ABSENT_THRESHOLD);
+  uint64_t nowUs = 1000000;
+  uint32_t dueUs = micros();
+
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    if (instrumented) {
+      int32_t lateUs = (int32_t)(micros() - dueUs);
+      telemetry.record(Metric::RfidJitter, lateUs > 0 ? lateUs : 0);
+    }
+    uint32_t startUs = instrumented ? micros() : 0;
+    CardUid uids[MAX_PRESENT_CARDS];
+    size_t found = reader.readCards(uids, MAX_PRESENT_CARDS);
+    if (instrumented) telemetry.record(Metric::RfidRead, micros() - startUs);
+    presence.update(uids, found, nowUs, EventTime{1735381800, 0});
+    probe.stop(state);
+    nowUs += CARD_READ_DELAY * 1000;
+    dueUs = micros();
+  }
+  probe.report(state);
+}
+
+void report(benchmark::State& state) {
+  DeviceContext ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+  char payload[TELEMETRY_FRAME_SIZE];
+  uint32_t nowMs = 0;
+  size_t length = 0;
+  BenchProbe probe;
+  for (auto _ : state) {
+    for (uint32_t i = 0; i < 64; i++) telemetry.record(Metric::RfidRead, i * 37);
+    telemetry.count(Stat::EventsQueued, 3);
+    nowMs += MEMORY_CHECK_INTERVAL;
+
+    probe.start();
+    TelemetryReport out;
+    telemetry.report(out, nowMs);
+    out.heapFree = out.heapMin = out.heapLargest = 180000;
+    length = encodeTelemetry(ctx, out, payload, sizeof(payload));
+    probe.stop(state);
+    if (length == 0) state.SkipWithError("payload did not fit");
+  }
+  state.counters["bytes"] = (double)length;
+  probe.report(state);
+}
+
+} // namespace
+
+BENCHMARK(record)->UseManualTime();
+BENCHMARK(count)->UseManualTime();
+BENCHMARK(rfidIteration)->ArgName("instrumented")->Arg(0)->Arg(1)->UseManualTime();
+BENCHMARK(report)->UseManualTime();
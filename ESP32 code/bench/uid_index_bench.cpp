@@ -0,0 +1,118 @@
+/**
+ * @file uid_index_bench.cpp
+ * @brief UidIndex lookup against the linear users[] scan it replaced
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section uid_index_bench_overview Overview
+ *
+ * Looks up cards on lists of 10, 1000 and 10000 cards, once as an issued
+ * card (hit) and once as a card nobody issued (miss, the denied path).
+ * linearScan is getUserIndex() as it was: memcmp over 4-byte UIDs in
+ * list order. The index is sized as a reader would be, at most half full.
+ * Cards are looked up in a scrambled order so neither side is helped by a
+ * pattern.
+ *
+ *   ./build/uid_index_bench
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <string.h>
+#include <vector>
+
+#include "uid_index.h"
+
+namespace {
+
+// Random-looking 4-byte UIDs, as NXP issues them
+CardUid issuedCard(uint32_t n) {
+  uint32_t x = n * 2654435761u + 0x9E3779B9u;
+  x ^= x >> 15;
+  return cardUid({(uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x});
+}
+
+// ---- Linear scan ----
+// The users[] table and getUserIndex() before the index
+
+struct ScanUser {
+  uint8_t     uid[4];
+  const char* role;
+};
+
+int scanIndex(const std::vector<ScanUser>& users, const uint8_t* uid, uint8_t length) {
+  if (length != 4) return -1;
+  for (size_t i = 0; i < users.size(); i++) {
+    if (memcmp(uid, users[i].uid, 4) == 0) return (int)i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Cards to look up: issued ones for hits, others for misses
+ */
+std::vector<CardUid> probes(size_t cards, bool hit) {
+  std::vector<CardUid> out;
+  for (size_t i = 0; i < 4096; i++) {
+    size_t n = (i * 7919) % cards;
+    out.push_back(issuedCard(hit ? (uint32_t)n : (uint32_t)(cards + i)));
+  }
+  return out;
+}
+
+void linearScan(benchmark::State& state) {
+  size_t cards = (size_t)state.range(0);
+  bool hit = state.range(1) != 0;
+  std::vector<ScanUser> users(cards);
+  for (size_t i = 0; i < cards; i++) {
+    CardUid uid = issuedCard((uint32_t)i);
+    memcpy(users[i].uid, uid.bytes, 4);
+    users[i].role = "Guest";
+  }
+  std::vector<CardUid> lookups = probes(cards, hit);
+
+  size_t next = 0;
+  size_t wrong = 0;
+  for (auto _ : state) {
+    const CardUid& uid = lookups[next++ & 4095];
+    int index = scanIndex(users, uid.bytes, uid.size);
+    benchmark::DoNotOptimize(index);
+    wrong += (index >= 0) != hit;
+  }
+  if (wrong > 0) state.SkipWithError("wrong answer");
+}
+
+// ---- Hash index ----
+
+template <size_t Capacity>
+void hashedLookup(benchmark::State& state) {
+  size_t cards = (size_t)state.range(0);
+  bool hit = state.range(1) != 0;
+  static UidIndex<Capacity> index;
+  index.clear();
+  for (size_t i = 0; i < cards; i++) index.insert(issuedCard((uint32_t)i), Role::Guest);
+  std::vector<CardUid> lookups = probes(cards, hit);
+
+  size_t next = 0;
+  size_t wrong = 0;
+  for (auto _ : state) {
+    const CardUid& uid = lookups[next++ & 4095];
+    Role role = index.lookup(uid.bytes, uid.size);
+    benchmark::DoNotOptimize(role);
+    wrong += (role != Role::Unknown) != hit;
+  }
+  if (wrong > 0) state.SkipWithError("wrong answer");
+}
+
+} // namespace
+
+BENCHMARK(linearScan)->ArgNames({"cards", "hit"})
+  ->Args({10, 1})->Args({10, 0})->Args({1000, 1})->Args({1000, 0})
+  ->Args({10000, 1})->Args({10000, 0});
+BENCHMARK_TEMPLATE(hashedLookup, 32)->ArgNames({"cards", "hit"})
+  ->Args({10, 1})->Args({10, 0});
+BENCHMARK_TEMPLATE(hashedLookup, 2048)->ArgNames({"cards", "hit"})
+  ->Args({1000, 1})->Args({1000, 0});
+BENCHMARK_TEMPLATE(hashedLookup, 16384)->ArgNames({"cards", "hit"})
+  ->Args({10000, 1})->Args({10000, 0});
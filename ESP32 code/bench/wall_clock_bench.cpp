@@ -0,0 +1,107 @@
+/**
+ * @file wall_clock_bench.cpp
+ * @brief Cost of timestamping an event, now and with getTimestamp()
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section wall_clock_bench_overview Overview
+ *
+ * stamp is what the RFID task pays per event: one WallClock::stamp() of
+ * the cycle's esp_timer reading. format is what the network task pays
+ * when it publishes the event: formatTimestamp() into a stack buffer,
+ * the date part cached. stampAndFormat is both.
+ *
+ * getTimestamp is the old helper: the system clock, localtime_r(),
+ * strftime() and a heap string, once per call. It ran two or three times
+ * per event. The host clock stands in for getLocalTime().
+ *
+ *   ./build/wall_clock_bench --benchmark_counters_tabular=true
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <time.h>
+
+#include <string>
+
+#include "bench_support.h"
+#include "event_encoder.h"
+#include "wall_clock.h"
+
+namespace {
+
+const uint64_t EPOCH_US = 1735381800ull * 1000000;
+
+void stamp(benchmark::State& state) {
+  WallClock clock(1);
+  clock.set(EPOCH_US, 0);
+  uint64_t monoUs = 0;
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    EventTime time = clock.stamp(monoUs);
+    benchmark::DoNotOptimize(time);
+    probe.stop(state);
+    monoUs += 1237;
+  }
+  probe.report(state);
+}
+
+void format(benchmark::State& state) {
+  char timestamp[TIMESTAMP_SIZE];
+  uint32_t n = 0;
+  BenchProbe probe;
+  for (auto _ : state) {
+    n++;
+    probe.start();
+    formatTimestamp(1735381800 + n / 1000, (uint16_t)(n % 1000), timestamp, sizeof(timestamp));
+    benchmark::DoNotOptimize(timestamp);
+    probe.stop(state);
+  }
+  probe.report(state);
+}
+
+void stampAndFormat(benchmark::State& state) {
+  WallClock clock(1);
+  clock.set(EPOCH_US, 0);
+  char timestamp[TIMESTAMP_SIZE];
+  uint64_t monoUs = 0;
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    EventTime time = clock.stamp(monoUs);
+    formatTimestamp(time.timestamp, time.millis, timestamp, sizeof(timestamp));
+    benchmark::DoNotOptimize(timestamp);
+    probe.stop(state);
+    monoUs += 1237;
+  }
+  probe.report(state);
+}
+
+std::string getTimestamp() {
+  time_t now = time(nullptr);
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+  char buffer[20];
+  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
+  return std::string(buffer);
+}
+
+void getTimestampCall(benchmark::State& state) {
+  BenchProbe probe;
+  for (auto _ : state) {
+    probe.start();
+    std::string timestamp = getTimestamp();
+    benchmark::DoNotOptimize(timestamp.data());
+    probe.stop(state);
+  }
+  probe.report(state);
+}
+
+} // namespace
+
+BENCHMARK(stamp)->UseManualTime();
+BENCHMARK(format)->UseManualTime();
+BENCHMARK(stampAndFormat)->UseManualTime();
+BENCHMARK(getTimestampCall)->Name("getTimestamp")->UseManualTime();
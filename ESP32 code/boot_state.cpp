@@ -0,0 +1,41 @@
+/**
+ * @file boot_state.cpp
+ * @brief Reader state kept in RTC memory across warm resets
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "boot_state.h"
+#include <stddef.h>
+
+namespace {
+
+const uint32_t BOOT_STATE_MAGIC = 0x52464944;   // "RFID"
+
+// FNV-1a
+uint32_t checksum(const BootState& state) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&state);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(BootState, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+void sealBootState(BootState& state) {
+  state.magic = BOOT_STATE_MAGIC;
+  state.checksum = checksum(state);
+}
+
+bool bootStateValid(const BootState& state) {
+  if (state.magic != BOOT_STATE_MAGIC || state.checksum != checksum(state)) return false;
+  if (state.readers > MAX_RFID_READERS) return false;
+  for (size_t i = 0; i < state.readers; i++) {
+    if (state.presence[i].count > MAX_PRESENT_CARDS) return false;
+    if (state.presence[i].deniedCount > DENIED_TRACK_SLOTS) return false;
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+/**
+ * @file boot_state.h
+ * @brief Reader state kept in RTC memory across warm resets
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section boot_state_overview Overview
+ *
+ * The firmware keeps one BootState in RTC_NOINIT memory, which keeps its
+ * contents through software, panic and watchdog resets (and brown-outs
+ * that leave the RTC domain powered), but not through power-on. The RFID
+ * task reseals it after every read cycle with cards present. At boot a
+ * block with the right magic and checksum gives back the checked-in and
+ * rate limited cards of every reader and whether the system clock had
+ * been set by NTP; anything else, or a block written for a different
+ * reader table, is a cold start.
+ */
+
+#ifndef BOOT_STATE_H
+#define BOOT_STATE_H
+
+#include <stdint.h>
+#include "presence.h"
+
+struct BootState {
+  uint32_t         magic;
+  uint8_t          bootId;       ///< WallClock boot id of the boot that wrote it
+  uint8_t          clockSynced;  ///< System clock was set by NTP
+  uint32_t         savedAtEpoch; ///< Unix time of the snapshot, 0 if unknown
+  uint8_t          readers;      ///< Rows of RFID_READERS when it was written
+  PresenceSnapshot presence[MAX_RFID_READERS];
+  uint32_t         checksum;     ///< Over every byte before it
+};
+
+/**
+ * @brief Stamp magic and checksum after changing the block
+ */
+void sealBootState(BootState& state);
+
+/**
+ * @brief Written by sealBootState() and not damaged since
+ */
+bool bootStateValid(const BootState& state);
+
+#endif // BOOT_STATE_H
@@ -0,0 +1,48 @@
+/**
+ * @file card_acl.cpp
+ * @brief Authorized card list kept in sync with the backend
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "card_acl.h"
+
+#include <string.h>
+
+namespace {
+
+uint16_t readLe16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t readLe32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+} // namespace
+
+bool parseAclHeader(const uint8_t* data, size_t length, AclHeader& header) {
+  if (length < ACL_HEADER_SIZE) return false;
+
+  header.kind    = data[0];
+  header.base    = readLe32(data + 1);
+  header.version = readLe32(data + 5);
+  header.index   = readLe16(data + 9);
+  header.count   = readLe16(data + 11);
+  return (header.kind == ACL_KIND_SNAPSHOT || header.kind == ACL_KIND_DELTA) &&
+         header.index < header.count;
+}
+
+const uint8_t* parseAclRecord(const uint8_t* p, const uint8_t* end, AclRecord& record) {
+  if (end - p < 2) return nullptr;
+  record.role = p[0];
+  record.size = p[1];
+  const uint8_t* uid = p + 2;
+  if ((record.size != 4 && record.size != 7 && record.size != 10) || end - uid < record.size ||
+      record.role > (uint8_t)Role::Security) {
+    return nullptr;
+  }
+  memcpy(record.uid, uid, record.size);
+  return uid + record.size;
+}
@@ -0,0 +1,245 @@
+/**
+ * @file card_acl.h
+ * @brief Authorized card list kept in sync with the backend
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section card_acl_overview Overview
+ *
+ * Every reader keeps the card list of its own room: the room's guests and
+ * the hotel's staff, active and not expired. It boots with the list
+ * compiled into the firmware (version 0) and then follows the backend's
+ * versioned list. After every MQTT connect it publishes its version on
+ * the room's sync topic; the backend answers with either a snapshot of
+ * the whole list or a delta of adds and revokes since that version. Later
+ * changes, expiries included, are pushed to the room topic as deltas.
+ *
+ * Two UidIndex tables are kept. Lookups from the RFID task always read the
+ * active one and never wait. The network task builds each update in the
+ * other table and publishes it with a single atomic swap, so a reader sees
+ * either the old list or the new one, never a half-applied mix.
+ *
+ * The spare table then lags one update behind. The records of the last
+ * delta are kept (up to ACL_LOG_SIZE) and replayed onto it before the next
+ * update is built there, so a delta costs its own records twice, not a
+ * copy of the table. After a snapshot, or a delta too long for the log,
+ * the next update starts with a full copy.
+ *
+ * A list holds at most Capacity - 1 cards (UID_INDEX_CAPACITY for the
+ * firmware). The reader reports that limit with its version; an update
+ * that does not fit is refused as a whole with AclResult::Full and the
+ * live list stays as it was.
+ *
+ * @section card_acl_format Update format
+ *
+ * Every update arrives as one or more binary chunks, little endian:
+ *
+ * | Offset | Size | Field                                               |
+ * |--------|------|-----------------------------------------------------|
+ * | 0      | 1    | 'S' snapshot or 'D' delta                           |
+ * | 1      | 4    | Version the delta applies to (0 for snapshots)      |
+ * | 5      | 4    | Version after the update                            |
+ * | 9      | 2    | Chunk index                                         |
+ * | 11     | 2    | Chunk count                                         |
+ * | 13     | ...  | Records: role (1), UID size (1), UID bytes          |
+ *
+ * A record with role 0 revokes the card. Chunks must arrive in order; the
+ * update goes live when the last one has been applied.
+ */
+
+#ifndef CARD_ACL_H
+#define CARD_ACL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "config.h"
+#include "uid_index.h"
+
+#define ACL_KIND_SNAPSHOT 'S'
+#define ACL_KIND_DELTA    'D'
+#define ACL_HEADER_SIZE   13
+
+enum class AclResult : uint8_t {
+  Partial,                         ///< Chunk staged, more to come
+  Applied,                         ///< Update complete and live
+  Stale,                           ///< Delta does not start at the current version
+  Invalid,                         ///< Malformed or out-of-order chunk
+  Full                             ///< Update does not fit the table
+};
+
+struct AclHeader {
+  uint8_t  kind;
+  uint32_t base;
+  uint32_t version;
+  uint16_t index;
+  uint16_t count;
+};
+
+struct AclRecord {
+  uint8_t role;                    ///< 0 revokes
+  uint8_t size;
+  uint8_t uid[CARD_UID_MAX_SIZE];
+};
+
+/**
+ * @brief Read a chunk header
+ * @return false if the chunk is too short or the header is malformed
+ */
+bool parseAclHeader(const uint8_t* data, size_t length, AclHeader& header);
+
+/**
+ * @brief Read the record at p
+ * @return The next record, or nullptr if this one is malformed
+ */
+const uint8_t* parseAclRecord(const uint8_t* p, const uint8_t* end, AclRecord& record);
+
+template <size_t Capacity>
+class BasicCardAcl {
+public:
+  BasicCardAcl()
+    : tables_(), active_(0), readers_(), version_(0), spare_(Spare::Copy), logged_(0),
+      staged_(false), stagedKind_(0), stagedVersion_(0), nextChunk_(0), chunkCount_(0) {}
+
+  /**
+   * @brief Load the compiled-in list as version 0
+   *
+   * Call before the RFID task starts.
+   */
+  void load(const UserAuth* users, size_t count) {
+    Table& table = tables_[active_.load()];
+    table.clear();
+    for (size_t i = 0; i < count; i++) table.insert(users[i].uid, users[i].role);
+    version_ = 0;
+    spare_ = Spare::Copy;
+  }
+
+  /**
+   * @brief Look up a card; safe from any task and never blocks
+   */
+  Role lookup(const uint8_t* uid, uint8_t size) const {
+    for (;;) {
+      uint8_t i = active_.load();
+      readers_[i].fetch_add(1);
+
+      // A swap between the load and the increment means the writer may
+      // already be reusing this table; retry on the new one
+      if (active_.load() == i) {
+        Role role = tables_[i].lookup(uid, size);
+        readers_[i].fetch_sub(1);
+        return role;
+      }
+      readers_[i].fetch_sub(1);
+    }
+  }
+
+  /**
+   * @brief Apply one update chunk (network task only)
+   *
+   * Any failure drops the staged update; the live list is left untouched.
+   */
+  AclResult apply(const uint8_t* data, size_t length) {
+    AclHeader header;
+    if (!parseAclHeader(data, length, header)) return abort(AclResult::Invalid);
+
+    uint8_t staging = active_.load() ^ 1;
+    Table&  table = tables_[staging];
+
+    if (header.index == 0) {
+      if (header.kind == ACL_KIND_DELTA && header.base != version_) return abort(AclResult::Stale);
+
+      // Lookups that picked this table before the last swap finish in well
+      // under a microsecond
+      while (readers_[staging].load() != 0) {}
+
+      if (header.kind == ACL_KIND_SNAPSHOT) {
+        table.clear();
+      } else if (spare_ == Spare::Replay) {
+        for (size_t i = 0; i < logged_; i++) write(table, log_[i]);
+      } else {
+        table = tables_[staging ^ 1];
+      }
+      // Until the swap, the spare table holds half an update
+      spare_ = Spare::Copy;
+      logged_ = 0;
+      staged_ = true;
+      stagedKind_ = header.kind;
+      stagedVersion_ = header.version;
+      nextChunk_ = 0;
+      chunkCount_ = header.count;
+    } else if (!staged_ || header.kind != stagedKind_ || header.version != stagedVersion_ ||
+               header.index != nextChunk_ || header.count != chunkCount_) {
+      return abort(AclResult::Invalid);
+    }
+
+    const uint8_t* p = data + ACL_HEADER_SIZE;
+    const uint8_t* end = data + length;
+    while (p < end) {
+      AclRecord record;
+      p = parseAclRecord(p, end, record);
+      if (p == nullptr) return abort(AclResult::Invalid);
+      if (!write(table, record)) return abort(AclResult::Full);
+      if (logged_ < ACL_LOG_SIZE) log_[logged_] = record;
+      logged_++;
+    }
+
+    if (++nextChunk_ < chunkCount_) return AclResult::Partial;
+
+    active_.store(staging);
+    version_ = stagedVersion_;
+    staged_ = false;
+    // The table just retired is one update behind the live one
+    spare_ = stagedKind_ == ACL_KIND_DELTA && logged_ <= ACL_LOG_SIZE ? Spare::Replay : Spare::Copy;
+    return AclResult::Applied;
+  }
+
+  uint32_t version() const { return version_; }
+  size_t   size() const { return tables_[active_.load()].size(); }
+
+  /**
+   * @brief Most cards a list may hold
+   */
+  static constexpr size_t capacity() { return Capacity - 1; }
+
+private:
+  typedef UidIndex<Capacity> Table;
+
+  /// What the spare table needs before the next delta can be built in it
+  enum class Spare : uint8_t { Replay, Copy };
+
+  static bool write(Table& table, const AclRecord& record) {
+    if (record.role == (uint8_t)Role::Unknown) {
+      table.remove(record.uid, record.size);
+      return true;
+    }
+    return table.insert(record.uid, record.size, (Role)record.role);
+  }
+
+  AclResult abort(AclResult result) {
+    staged_ = false;
+    return result;
+  }
+
+  Table                         tables_[2];
+  std::atomic<uint8_t>          active_;
+  mutable std::atomic<uint32_t> readers_[2];  ///< Lookups in progress per table
+  uint32_t                      version_;
+
+  // ---- Spare table catch-up ----
+  Spare     spare_;
+  AclRecord log_[ACL_LOG_SIZE];      ///< Records of the last delta
+  size_t    logged_;                 ///< May exceed ACL_LOG_SIZE: log overflowed
+
+  // ---- Staged update ----
+  bool     staged_;
+  uint8_t  stagedKind_;
+  uint32_t stagedVersion_;
+  uint16_t nextChunk_;
+  uint16_t chunkCount_;
+};
+
+/// One room's card list as the firmware keeps it
+typedef BasicCardAcl<UID_INDEX_CAPACITY> CardAcl;
+
+#endif // CARD_ACL_H
@@ -0,0 +1,108 @@
+/**
+ * @file card_auth.cpp
+ * @brief Checks that a card on the card list is the card that was issued
+ */
+
+#include "card_auth.h"
+#include <string.h>
+
+const char* authResultName(AuthResult result) {
+  switch (result) {
+    case AuthResult::Ok:            return "ok";
+    case AuthResult::NoKey:         return "no key for role";
+    case AuthResult::ReadFailed:    return "credential not readable";
+    case AuthResult::BadCredential: return "bad credential";
+    case AuthResult::Refused:       return "refused recently";
+  }
+  return "unknown";
+}
+
+CardAuth::CardAuth()
+  : keys_(),
+    hasKey_(),
+    rejected_(),
+    verified_(0),
+    failed_(0),
+    unread_(0),
+    refused_(0) {}
+
+bool CardAuth::setCredentialKey(const char* hexKey) {
+  return mac_.setHexKey(hexKey);
+}
+
+void CardAuth::setSectorKey(Role role, const uint8_t key[CARD_KEY_SIZE]) {
+  size_t index = (size_t)role;
+  if (index >= CARD_ROLE_COUNT) return;
+  memcpy(keys_[index], key, CARD_KEY_SIZE);
+  hasKey_[index] = true;
+}
+
+AuthResult CardAuth::verify(CardReader& reader, const CardUid& uid, Role role, uint32_t nowMs) {
+  for (size_t i = 0; i < CARD_AUTH_REJECT_SLOTS; i++) {
+    Rejected& r = rejected_[i];
+    if (!r.used || !sameCard(r.uid, uid)) continue;
+    if (nowMs - r.atMs < CARD_AUTH_RETRY_MS) {
+      refused_++;
+      return AuthResult::Refused;
+    }
+    r.used = false;
+  }
+
+  size_t index = (size_t)role;
+  if (index >= CARD_ROLE_COUNT || !hasKey_[index] || !mac_.ready()) {
+    return reject(uid, nowMs, AuthResult::NoKey);
+  }
+
+  // One retry: a card swiped past the reader can leave mid-read. If both
+  // go unanswered nothing is decided; the next poll reads it again
+  uint8_t block[CARD_BLOCK_SIZE];
+  if (!reader.readBlock(uid, CARD_AUTH_BLOCK, keys_[index], block) &&
+      !reader.readBlock(uid, CARD_AUTH_BLOCK, keys_[index], block)) {
+    unread_++;
+    return AuthResult::ReadFailed;
+  }
+  if (!checkCredential(uid, role, block)) return reject(uid, nowMs, AuthResult::BadCredential);
+
+  verified_++;
+  return AuthResult::Ok;
+}
+
+bool CardAuth::checkCredential(const CardUid& uid, Role role, const uint8_t block[CARD_BLOCK_SIZE]) {
+  if (block[0] != CARD_CREDENTIAL_VERSION || block[1] != (uint8_t)role || !mac_.ready()) return false;
+  uint8_t expected[HMAC_SHA256_SIZE];
+  macOf(uid, block, expected);
+  return HmacSha256::equal(expected, block + 4, CARD_CREDENTIAL_MAC_SIZE);
+}
+
+bool CardAuth::makeCredential(const CardUid& uid, Role role, uint8_t keyGeneration,
+                              uint8_t out[CARD_BLOCK_SIZE]) {
+  if (!mac_.ready()) return false;
+  out[0] = CARD_CREDENTIAL_VERSION;
+  out[1] = (uint8_t)role;
+  out[2] = keyGeneration;
+  out[3] = 0;
+  uint8_t mac[HMAC_SHA256_SIZE];
+  macOf(uid, out, mac);
+  memcpy(out + 4, mac, CARD_CREDENTIAL_MAC_SIZE);
+  return true;
+}
+
+void CardAuth::macOf(const CardUid& uid, const uint8_t header[4], uint8_t out[HMAC_SHA256_SIZE]) {
+  mac_.begin();
+  mac_.update(&uid.size, 1);
+  mac_.update(uid.bytes, uid.size);
+  mac_.update(header, 4);
+  mac_.finish(out);
+}
+
+AuthResult CardAuth::reject(const CardUid& uid, uint32_t nowMs, AuthResult result) {
+  failed_++;
+  // Take a free slot, or the oldest
+  Rejected* slot = &rejected_[0];
+  for (size_t i = 1; i < CARD_AUTH_REJECT_SLOTS && slot->used; i++) {
+    Rejected& r = rejected_[i];
+    if (!r.used || nowMs - r.atMs > nowMs - slot->atMs) slot = &r;
+  }
+  *slot = {uid, nowMs, true};
+  return result;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file card_auth.h
+ * @brief Checks that a card on the card list is the card that was issued
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section card_auth_overview Overview
+ *
+ * The card list says which UIDs may enter, but a UID can be copied onto a
+ * blank card in seconds. With CARD_AUTH, issuing a card also writes a
+ * credential into block CARD_AUTH_BLOCK, in a sector whose key A is the
+ * key of the card's role:
+ *
+ * @code
+ * byte 0      CARD_CREDENTIAL_VERSION
+ * byte 1      Role
+ * byte 2      key generation, for rotating CARD_CREDENTIAL_KEY
+ * byte 3      0
+ * bytes 4-15  first 12 bytes of HMAC-SHA256(CARD_CREDENTIAL_KEY,
+ *             UID size, UID, bytes 0-3)
+ * @endcode
+ *
+ * When a card arrives, verify() reads that one block with the role's key
+ * and checks the MAC against the UID the card answered with. A clone
+ * without the sector key gets no answer, and a copied block does not match
+ * another UID.
+ *
+ * The sector keys and the HMAC key schedule stay in RAM, so a check is one
+ * authenticated read plus one short MAC, and the presence logic only asks
+ * when a card arrives, not on every poll. A card that fails the check is
+ * remembered for CARD_AUTH_RETRY_MS, so a clone held at the door costs no
+ * reads while it is refused.
+ *
+ * A card that gives no answer to the key is not refused: a genuine card
+ * swiped past too fast, or colliding with a second one, looks the same.
+ * verify() reports ReadFailed without remembering it, and the caller asks
+ * again on the next poll (ROLE_UNDECIDED in presence.h). A clone still
+ * holding the factory key is therefore never checked in, but it is read
+ * on every poll it answers and raises no denied event.
+ *
+ * RFID task only.
+ */
+
+#ifndef CARD_AUTH_H
+#define CARD_AUTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "card_reader.h"
+#include "config.h"
+#include "hmac_sha256.h"
+#include "uid_index.h"
+
+#define CARD_CREDENTIAL_VERSION 1
+#define CARD_CREDENTIAL_MAC_SIZE 12
+#define CARD_ROLE_COUNT 6            ///< Role values, Unknown to Security
+
+enum class AuthResult : uint8_t {
+  Ok,
+  NoKey,           ///< No sector key for the role
+  ReadFailed,      ///< No answer to the key, or the card left; not remembered
+  BadCredential,   ///< Wrong version, role or MAC
+  Refused          ///< Failed within CARD_AUTH_RETRY_MS; not read again
+};
+
+const char* authResultName(AuthResult result);
+
+class CardAuth {
+public:
+  CardAuth();
+
+  /**
+   * @brief Key the credential MACs are made with (hex)
+   */
+  bool setCredentialKey(const char* hexKey);
+
+  /**
+   * @brief Key A of the credential sector on cards of this role
+   */
+  void setSectorKey(Role role, const uint8_t key[CARD_KEY_SIZE]);
+
+  /**
+   * @brief Read and check the credential of a card that just arrived
+   * @param role What the card list says the card is
+   */
+  AuthResult verify(CardReader& reader, const CardUid& uid, Role role, uint32_t nowMs);
+
+  /**
+   * @brief Check a credential block already read from the card
+   */
+  bool checkCredential(const CardUid& uid, Role role, const uint8_t block[CARD_BLOCK_SIZE]);
+
+  /**
+   * @brief The credential an encoding station writes when issuing a card
+   */
+  bool makeCredential(const CardUid& uid, Role role, uint8_t keyGeneration,
+                      uint8_t out[CARD_BLOCK_SIZE]);
+
+  uint32_t verified() const { return verified_; }   ///< Cards that passed
+  uint32_t failed() const { return failed_; }       ///< Cards read and refused
+  uint32_t unread() const { return unread_; }       ///< Credential reads that got no answer
+  uint32_t refused() const { return refused_; }     ///< Refused again without a read
+
+private:
+  struct Rejected {
+    CardUid  uid;
+    uint32_t atMs;
+    bool     used;
+  };
+
+  void macOf(const CardUid& uid, const uint8_t header[4], uint8_t out[HMAC_SHA256_SIZE]);
+  AuthResult reject(const CardUid& uid, uint32_t nowMs, AuthResult result);
+
+  HmacSha256 mac_;
+  uint8_t    keys_[CARD_ROLE_COUNT][CARD_KEY_SIZE];
+  bool       hasKey_[CARD_ROLE_COUNT];
+  Rejected   rejected_[CARD_AUTH_REJECT_SLOTS];
+  uint32_t   verified_;
+  uint32_t   failed_;
+  uint32_t   unread_;
+  uint32_t   refused_;
+};
+
+#endif // CARD_AUTH_H
@@ -0,0 +1,278 @@
+/**
+ * @file card_reader.cpp
+ * @brief RFID reader abstraction with interrupt-driven card detection
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "card_reader.h"
+#include "config.h"
+#include <string.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+#if defined(ARDUINO)
+
+namespace {
+
+// Given by the ISR, taken by waitForCard(); one IRQ reader per board
+SemaphoreHandle_t irqSemaphore = nullptr;
+
+void IRAM_ATTR onReaderIrq() {
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(irqSemaphore, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+} // namespace
+
+Mfrc522Reader::Mfrc522Reader(uint8_t ssPin, uint8_t rstPin, int irqPin)
+  : chip_(ssPin, rstPin), irqPin_(irqPin) {}
+
+bool Mfrc522Reader::begin() {
+  chip_.PCD_Init();
+
+  // The timer starts when a request has been sent and runs at 40 kHz
+  // (TPrescaler 169, set by PCD_Init); a card answers within ~100 us
+  const uint16_t reload = RFID_RX_TIMEOUT_US / 25;
+  chip_.PCD_WriteRegister(MFRC522::TReloadRegH, reload >> 8);
+  chip_.PCD_WriteRegister(MFRC522::TReloadRegL, reload & 0xFF);
+
+  if (irqPin_ < 0) return true;
+
+  irqSemaphore = xSemaphoreCreateBinary();
+  if (irqSemaphore == nullptr) {
+    irqPin_ = -1;
+    return false;
+  }
+
+  pinMode(irqPin_, INPUT_PULLUP);
+  // IRqInv: IRQ pin is active low; RxIEn: raise it when a frame is received
+  chip_.PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0);
+  clearIrq();
+  attachInterrupt(digitalPinToInterrupt(irqPin_), onReaderIrq, FALLING);
+  return true;
+}
+
+size_t Mfrc522Reader::readCards(CardUid* uids, size_t max) {
+  size_t count = 0;
+
+  // WUPA also wakes the cards halted by the previous inventory
+  MFRC522::PICC_Command request = MFRC522::PICC_CMD_WUPA;
+  while (count < max) {
+    byte bufferATQA[2];
+    byte bufferSize = sizeof(bufferATQA);
+    MFRC522::StatusCode result = chip_.PICC_REQA_or_WUPA(request, bufferATQA, &bufferSize);
+    // Several cards answering at once collide in the ATQA; anticollision sorts them out
+    if (result != MFRC522::STATUS_OK && result != MFRC522::STATUS_COLLISION) break;
+    request = MFRC522::PICC_CMD_REQA;
+
+    if (!chip_.PICC_ReadCardSerial()) break;
+
+    CardUid uid = {};
+    uid.size = chip_.uid.size;
+    memcpy(uid.bytes, chip_.uid.uidByte, chip_.uid.size);
+
+    // A card that ignored HLTA would answer forever
+    bool repeated = false;
+    for (size_t i = 0; i < count; i++) {
+      if (sameCard(uids[i], uid)) repeated = true;
+    }
+    if (repeated) break;
+
+    uids[count++] = uid;
+    // Halted cards stay silent to REQA until the next inventory's WUPA
+    chip_.PICC_HaltA();
+  }
+
+  return count;
+}
+
+bool Mfrc522Reader::waitForCard(uint32_t timeoutMs) {
+  if (irqPin_ < 0) {
+    vTaskDelay(pdMS_TO_TICKS(timeoutMs));
+    CardUid ignored;
+    return readCards(&ignored, 1) > 0;
+  }
+
+  // Full reads raise RxIRq too; forget those before arming
+  xSemaphoreTake(irqSemaphore, 0);
+  armReceiveIrq();
+
+  bool fired = xSemaphoreTake(irqSemaphore, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+  chip_.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+  clearIrq();
+  return fired;
+}
+
+bool Mfrc522Reader::readBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                              uint8_t out[CARD_BLOCK_SIZE]) {
+  // The inventory left the card halted: wake it and select it by its UID
+  byte bufferATQA[2];
+  byte bufferSize = sizeof(bufferATQA);
+  MFRC522::StatusCode result = chip_.PICC_WakeupA(bufferATQA, &bufferSize);
+  if (result != MFRC522::STATUS_OK && result != MFRC522::STATUS_COLLISION) return false;
+
+  MFRC522::Uid target = {};
+  target.size = uid.size;
+  memcpy(target.uidByte, uid.bytes, uid.size);
+  if (chip_.PICC_Select(&target, uid.size * 8) != MFRC522::STATUS_OK) return false;
+
+  MFRC522::MIFARE_Key sectorKey;
+  memcpy(sectorKey.keyByte, key, CARD_KEY_SIZE);
+  bool ok = chip_.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, block, &sectorKey, &target) ==
+            MFRC522::STATUS_OK;
+  if (ok) {
+    byte buffer[CARD_BLOCK_SIZE + 2];   // Data and CRC
+    byte size = sizeof(buffer);
+    ok = chip_.MIFARE_Read(block, buffer, &size) == MFRC522::STATUS_OK;
+    if (ok) memcpy(out, buffer, CARD_BLOCK_SIZE);
+  }
+
+  // Back to the state the inventory leaves cards in
+  chip_.PICC_HaltA();
+  chip_.PCD_StopCrypto1();
+  return ok;
+}
+
+void Mfrc522Reader::armReceiveIrq() {
+  // Send one REQA; an answering card completes the receive and fires RxIRq
+  clearIrq();
+  chip_.PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+  chip_.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+  chip_.PCD_WriteRegister(MFRC522::BitFramingReg, 0x87); // StartSend, 7-bit frame
+}
+
+void Mfrc522Reader::clearIrq() {
+  chip_.PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+}
+
+#else
+
+SimCardReader::SimCardReader(bool interruptDriven)
+  : interruptDriven_(interruptDriven),
+    cards_(),
+    halted_(),
+    count_(0),
+    blocks_(),
+    blockCount_(0),
+    blockReads_(0),
+    fullReads_(0),
+    selects_(0),
+    kicks_(0),
+    interrupts_(0) {}
+
+size_t SimCardReader::readCards(CardUid* uids, size_t max) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fullReads_++;
+  size_t count = count_ < max ? count_ : max;
+  for (size_t i = 0; i < count; i++) {
+    uids[i] = cards_[i];
+    halted_[i] = true;
+  }
+  selects_ += (uint32_t)count;
+  return count;
+}
+
+bool SimCardReader::waitForCard(uint32_t timeoutMs) {
+  if (!interruptDriven_) {
+    // Polling does not notice a card until the delay is over
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    CardUid ignored;
+    return readCards(&ignored, 1) > 0;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  kicks_++;
+  // A zero timeout only asks whether a card answers the kick; REQA leaves halted cards silent
+  auto answered = [this] {
+    for (size_t i = 0; i < count_; i++) {
+      if (!halted_[i]) return true;
+    }
+    return false;
+  };
+  bool fired = answered() ||
+               (timeoutMs > 0 && changed_.wait_for(lock, std::chrono::milliseconds(timeoutMs), answered));
+  if (fired) interrupts_++;
+  return fired;
+}
+
+bool SimCardReader::readBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                              uint8_t out[CARD_BLOCK_SIZE]) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  blockReads_++;
+  bool present = false;
+  for (size_t i = 0; i < count_; i++) {
+    if (sameCard(cards_[i], uid)) present = true;
+  }
+  if (!present) return false;
+
+  for (size_t i = 0; i < blockCount_; i++) {
+    const Block& b = blocks_[i];
+    if (b.block != block || !sameCard(b.uid, uid)) continue;
+    // A wrong key gets no answer, the same as a card that left
+    if (memcmp(b.key, key, CARD_KEY_SIZE) != 0) return false;
+    memcpy(out, b.data, CARD_BLOCK_SIZE);
+    return true;
+  }
+  return false;
+}
+
+bool SimCardReader::writeBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                               const uint8_t data[CARD_BLOCK_SIZE]) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Block* target = nullptr;
+  for (size_t i = 0; i < blockCount_; i++) {
+    if (blocks_[i].block == block && sameCard(blocks_[i].uid, uid)) target = &blocks_[i];
+  }
+  if (target == nullptr) {
+    if (blockCount_ == SIM_READER_MAX_BLOCKS) return false;
+    target = &blocks_[blockCount_++];
+  }
+  target->uid = uid;
+  target->block = block;
+  memcpy(target->key, key, CARD_KEY_SIZE);
+  memcpy(target->data, data, CARD_BLOCK_SIZE);
+  return true;
+}
+
+bool SimCardReader::placeCard(const CardUid& uid) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < count_; i++) {
+      if (sameCard(cards_[i], uid)) return true;
+    }
+    if (count_ == SIM_READER_MAX_CARDS) return false;
+    halted_[count_] = false;
+    cards_[count_++] = uid;
+  }
+  changed_.notify_all();
+  return true;
+}
+
+void SimCardReader::removeCard(const CardUid& uid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < count_; i++) {
+    if (sameCard(cards_[i], uid)) {
+      count_--;
+      cards_[i] = cards_[count_];
+      halted_[i] = halted_[count_];
+      return;
+    }
+  }
+}
+
+void SimCardReader::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  count_ = 0;
+}
+
+#endif
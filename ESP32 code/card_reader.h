@@ -0,0 +1,186 @@
+/**
+ * @file card_reader.h
+ * @brief RFID reader abstraction with interrupt-driven card detection
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section card_reader_overview Overview
+ *
+ * The presence logic talks to the reader only through CardReader:
+ * - readCards() is the full inventory used while cards are in the field,
+ *   once every CARD_READ_DELAY. WUPA wakes every card, then each round of
+ *   ISO14443A anticollision selects one card and halts it, and REQA asks
+ *   the remaining idle cards again until none answers.
+ * - waitForCard() is the cheap idle-time detection. In interrupt mode it
+ *   arms a single REQA with the MFRC522 receive interrupt enabled and
+ *   sleeps until the IRQ line fires or the timeout passes. The CPU and SPI
+ *   bus stay idle in between instead of spinning on ComIrqReg.
+ *
+ * The MFRC522 has no autonomous low-power card detection (unlike its
+ * CLRC663 successor), so in interrupt mode the reader is still kicked once
+ * per CARD_DETECT_INTERVAL, but a kick costs four register writes rather
+ * than a complete polling transceive.
+ *
+ * Several Mfrc522Readers can share the SPI bus, each with its own chip
+ * select. Only one of them can use the IRQ line. begin() shortens the
+ * receive timeout to RFID_RX_TIMEOUT_US, so a reader with an empty field
+ * answers a request in about a millisecond instead of 25 ms; that is what
+ * keeps a sweep over all readers short.
+ *
+ * readBlock() is the authenticated read behind CARD_AUTH (card_auth.h):
+ * wake the halted card, select it by its UID, authenticate one MIFARE
+ * Classic sector with a key and read one block. It costs about four more
+ * frame exchanges than the inventory and only runs when a card arrives.
+ *
+ * On Linux, SimCardReader stands in for the hardware so the presence
+ * logic can be driven and measured without an MFRC522.
+ */
+
+#ifndef CARD_READER_H
+#define CARD_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "uid_index.h"
+
+#define CARD_BLOCK_SIZE 16   ///< MIFARE Classic block
+#define CARD_KEY_SIZE 6      ///< MIFARE Classic sector key
+
+#if defined(ARDUINO)
+#include <MFRC522.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+class CardReader {
+public:
+  virtual ~CardReader() {}
+
+  virtual bool begin() = 0;
+
+  /**
+   * @brief Full inventory: UIDs of every card in the field, up to max
+   * @return Number of cards written to uids
+   */
+  virtual size_t readCards(CardUid* uids, size_t max) = 0;
+
+  /**
+   * @brief Idle-time detection; returns early when a card may have entered
+   * @return true if a card answered before timeoutMs, false on timeout
+   */
+  virtual bool waitForCard(uint32_t timeoutMs) = 0;
+
+  /**
+   * @brief Whether waitForCard() is backed by the IRQ line
+   */
+  virtual bool interruptDriven() const = 0;
+
+  /**
+   * @brief Read one block of a card found by readCards(), authenticated with key A
+   * @return false if the card is gone, refuses the key or the read fails
+   */
+  virtual bool readBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                         uint8_t out[CARD_BLOCK_SIZE]) = 0;
+};
+
+#if defined(ARDUINO)
+
+class Mfrc522Reader : public CardReader {
+public:
+  /**
+   * @param ssPin  GPIO wired to the MFRC522 SDA (chip select) pin
+   * @param rstPin GPIO wired to the MFRC522 RST pin
+   * @param irqPin GPIO wired to the MFRC522 IRQ pin, or -1 to poll
+   */
+  Mfrc522Reader(uint8_t ssPin, uint8_t rstPin, int irqPin);
+
+  bool   begin() override;
+  size_t readCards(CardUid* uids, size_t max) override;
+  bool   waitForCard(uint32_t timeoutMs) override;
+  bool   interruptDriven() const override { return irqPin_ >= 0; }
+  bool   readBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                   uint8_t out[CARD_BLOCK_SIZE]) override;
+
+private:
+  void armReceiveIrq();
+  void clearIrq();
+
+  MFRC522 chip_;
+  int     irqPin_;
+};
+
+#else
+
+#define SIM_READER_MAX_CARDS 8
+#define SIM_READER_MAX_BLOCKS 16
+
+/**
+ * @brief Scripted stand-in for the MFRC522
+ *
+ * Another thread places and removes up to SIM_READER_MAX_CARDS cards;
+ * waitForCard() wakes as soon as one is placed, the way the IRQ line
+ * would. readCards() halts the cards it selects, and a halted card does
+ * not answer the kick until it has left the field and come back. The
+ * counters record how much reader traffic each detection mode costs.
+ * Cards keep the blocks written with writeBlock() while they are out of
+ * the field, like the real ones.
+ */
+class SimCardReader : public CardReader {
+public:
+  explicit SimCardReader(bool interruptDriven);
+
+  bool   begin() override { return true; }
+  size_t readCards(CardUid* uids, size_t max) override;
+  bool   waitForCard(uint32_t timeoutMs) override;
+  bool   interruptDriven() const override { return interruptDriven_; }
+  bool   readBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                   uint8_t out[CARD_BLOCK_SIZE]) override;
+
+  /**
+   * @brief Give a card a block protected by key A
+   * @return false if SIM_READER_MAX_BLOCKS are already written
+   */
+  bool writeBlock(const CardUid& uid, uint8_t block, const uint8_t key[CARD_KEY_SIZE],
+                  const uint8_t data[CARD_BLOCK_SIZE]);
+
+  /**
+   * @return false if SIM_READER_MAX_CARDS are already in the field
+   */
+  bool placeCard(const CardUid& uid);
+  void removeCard(const CardUid& uid);
+  void clear();
+
+  uint32_t fullReads() const { return fullReads_; }   ///< readCards() calls
+  uint32_t selects() const { return selects_; }       ///< Cards selected and halted
+  uint32_t kicks() const { return kicks_; }           ///< Armed REQAs
+  uint32_t interrupts() const { return interrupts_; } ///< IRQs raised
+  uint32_t blockReads() const { return blockReads_; } ///< readBlock() calls
+
+private:
+  struct Block {
+    CardUid uid;
+    uint8_t block;
+    uint8_t key[CARD_KEY_SIZE];
+    uint8_t data[CARD_BLOCK_SIZE];
+  };
+
+  bool     interruptDriven_;
+  CardUid  cards_[SIM_READER_MAX_CARDS];
+  bool     halted_[SIM_READER_MAX_CARDS];  ///< Selected since it was placed; only WUPA wakes it
+  size_t   count_;
+  Block    blocks_[SIM_READER_MAX_BLOCKS];
+  size_t   blockCount_;
+  uint32_t blockReads_;
+  uint32_t fullReads_;
+  uint32_t selects_;
+  uint32_t kicks_;
+  uint32_t interrupts_;
+  std::mutex              mutex_;
+  std::condition_variable changed_;
+};
+
+#endif
+
+#endif // CARD_READER_H
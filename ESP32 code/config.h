@@ -41,6 +41,7 @@
 #define WEBSOCKET_PORT 443
 #define WEBSOCKET_PATH "/mqtt"
 #define WEBSOCKET_PROTOCOL "wss"
+#define WEBSOCKET_TLS true          ///< false when WEBSOCKET_HOST is an edge_gateway on the LAN
 
 // ============================================================================
 // ROOM CONFIGURATION
@@ -85,11 +86,33 @@
  * MOSI       GPIO 23 (default SPI)
  * MISO       GPIO 19 (default SPI)
  * SCK        GPIO 18 (default SPI)
+ * IRQ        GPIO 27 (optional, see ENABLE_CARD_IRQ)
  * 3.3V       3.3V
  * GND        GND
  */
 #define RFID_RST_PIN 22             ///< Reset pin for MFRC522
 #define RFID_SS_PIN 21              ///< Slave Select pin for MFRC522
+#define RFID_IRQ_PIN 27             ///< IRQ pin for MFRC522 card detection
+
+/**
+ * @brief MFRC522 readers on the shared SPI bus, one row per door
+ * @details READER(room, SDA/SS pin, RST pin, IRQ pin or -1)
+ *
+ * Every reader shares SCK, MOSI and MISO and has its own SDA (chip
+ * select). RST may be shared. All rooms belong to this board's hotel
+ * (FLOOR_NUMBER) and building, and share its connection and card list.
+ * With one reader the IRQ line is used as configured; with several, the
+ * readers are polled in turn every CARD_READ_DELAY.
+ *
+ * Example, three doors on one board:
+ * #define RFID_READERS(READER) \
+ *   READER("201", 21, 22, -1) \
+ *   READER("202", 5, 22, -1)  \
+ *   READER("203", 17, 22, -1)
+ */
+#define RFID_READERS(READER) \
+  READER(ROOM_NUMBER, RFID_SS_PIN, RFID_RST_PIN, RFID_IRQ_PIN)
+#define MAX_RFID_READERS 8          ///< Rows allowed in RFID_READERS
 #define LED_PIN 2                   ///< Built-in LED pin
 #define BUZZER_PIN 4                ///< Buzzer pin (optional)
 
@@ -102,7 +125,11 @@
  */
 #define CARD_ABSENT_THRESHOLD 5     ///< Readings before considering card absent
 #define CARD_READ_DELAY 100         ///< Delay between RFID readings (ms)
-#define MAX_USERS 50                ///< Maximum number of authorized users
+#define CARD_DETECT_INTERVAL 50     ///< Idle REQA interval in IRQ mode (ms)
+#define RFID_RX_TIMEOUT_US 1000     ///< Card answer timeout; an empty field costs this per request (library default 25 ms)
+#define MAX_PRESENT_CARDS 8         ///< Cards tracked in the field at once
+#define MAX_USERS 50                ///< Maximum number of compiled-in users
+#define UID_INDEX_CAPACITY 512      ///< Card list slots per reader (power of two, > MAX_USERS); holds 511 cards
 
 // ============================================================================
 // NTP TIME CONFIGURATION
@@ -118,6 +145,9 @@
 #define GMT_OFFSET_SEC 19800        ///< IST +5:30 hours in seconds
 #define DAYLIGHT_OFFSET_SEC 0       ///< Daylight saving offset
 #define NTP_SYNC_INTERVAL 3600000   ///< Time sync interval (1 hour)
+#define NTP_RETRY_INTERVAL 500      ///< Poll interval while a sync is pending (ms)
+#define NTP_SYNC_TIMEOUT 10000      ///< Restart a sync that has not completed (ms)
+#define NTP_HOLD_TIMEOUT 15000      ///< Longest journal replay waits online for the clock (ms)
 
 // ============================================================================
 // WEBSOCKET CONFIGURATION
@@ -126,10 +156,12 @@
 /**
  * @brief WebSocket connection parameters
  */
-#define WS_RECONNECT_INTERVAL 5000  ///< Reconnection attempt interval (ms)
+#define WS_RECONNECT_MIN 250        ///< First reconnect delay after a drop (ms, jittered)
+#define WS_RECONNECT_MAX 30000      ///< Reconnect delay ceiling after repeated failures (ms)
 #define WS_HEARTBEAT_INTERVAL 15000 ///< Heartbeat ping interval (ms)
 #define WS_HEARTBEAT_TIMEOUT 3000   ///< Heartbeat timeout (ms)
 #define WS_MAX_RETRY_COUNT 2        ///< Maximum reconnection attempts
+#define WS_LOOP_INTERVAL 10         ///< WebSocket/MQTT service interval (ms)
 
 // ============================================================================
 // DEBUG CONFIGURATION
@@ -143,6 +175,9 @@
 #define DEBUG_RFID false            ///< Enable RFID debug messages
 #define DEBUG_WEBSOCKET true        ///< Enable WebSocket debug messages
 #define DEBUG_MQTT true             ///< Enable MQTT debug messages
+#define LOG_LEVEL 4                 ///< Highest level compiled in (1 error, 2 warn, 3 info, 4 debug)
+#define LOG_RING_SIZE 64            ///< Queued log lines before new ones are dropped (power of two)
+#define LOG_DRAIN_INTERVAL 20       ///< Log task Serial flush interval (ms)
 
 // ============================================================================
 // DEVICE IDENTIFICATION
@@ -162,8 +197,35 @@
 /**
  * @brief Security settings
  */
-#define ENABLE_ENCRYPTION false     ///< Enable data encryption (future use)
-#define MAX_FAILED_ATTEMPTS 5       ///< Max failed card attempts before alert
+#define MAX_FAILED_ATTEMPTS 5       ///< Failed attempts of one card within DENIED_WINDOW_MS before an alert
+#define DENIED_WINDOW_MS 60000      ///< Repeat denials of a card fold into one report per window (ms)
+#define DENIED_TRACK_SLOTS 8        ///< Unknown cards rate limited at once
+
+/**
+ * @brief Authenticated card reads (card_auth.h)
+ * @details A UID alone is easy to clone. With CARD_AUTH a card on the card
+ * list must also hold a credential block, written at issue time, in a
+ * sector locked with its role's key. Cards of a role without a key are
+ * refused. Keys are per hotel; these defaults are placeholders.
+ */
+#define CARD_AUTH false             ///< Check the credential block of each arriving card
+#define CARD_AUTH_BLOCK 4           ///< Credential block (sector 1, block 0)
+#define CARD_AUTH_RETRY_MS 1000     ///< A card that failed is not read again for this long (ms)
+#define CARD_AUTH_REJECT_SLOTS 4    ///< Failed cards remembered at once
+#define CARD_CREDENTIAL_KEY "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff"
+#define CARD_KEY_GUEST        {0x47, 0x55, 0x45, 0x53, 0x54, 0x31}
+#define CARD_KEY_MANAGER      {0x4D, 0x41, 0x4E, 0x41, 0x47, 0x31}
+#define CARD_KEY_MAINTENANCE  {0x4D, 0x41, 0x49, 0x4E, 0x54, 0x31}
+#define CARD_KEY_HOUSEKEEPING {0x48, 0x4F, 0x55, 0x53, 0x45, 0x31}
+
+/**
+ * @brief Event signatures
+ * @details Every publish carries an HMAC-SHA256 of its topic and payload
+ * (event_encoder.h). The key is the hotel's: the backend derives it from
+ * READER_SIGNING_SECRET as HMAC-SHA256(secret, "{building}/{hotel}").
+ */
+#define EVENT_SIGNING false         ///< Sign event and telemetry publishes
+#define EVENT_SIGNING_KEY "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff"
 
 // ============================================================================
 // MQTT TOPIC CONFIGURATION
@@ -179,8 +241,62 @@
  * - denied_access: Unauthorized access attempts
  */
 #define MQTT_TOPIC_BASE "campus/room"
-#define MQTT_QOS 0                  ///< MQTT Quality of Service level
+#define MQTT_QOS 1                  ///< MQTT Quality of Service level (0 or 1)
 #define MQTT_RETAIN false           ///< MQTT retain flag
+#define MQTT_KEEPALIVE WS_HEARTBEAT_INTERVAL ///< Idle time before PINGREQ (ms)
+#define MQTT_MAX_INFLIGHT 4         ///< QoS 1 publishes awaiting PUBACK
+#define MQTT_RETRY_TIMEOUT 10000    ///< Resend unacknowledged publish after (ms)
+#define EVENT_FRAME_SIZE 384        ///< Stack buffer for one encoded event (bytes)
+#define EVENT_PAYLOAD_CBOR false    ///< Send events as compact CBOR instead of JSON (backend decodes both)
+#define TELEMETRY_FRAME_SIZE 1024   ///< Stack buffer for one telemetry report (bytes)
+#define MQTT_RX_BUFFER_SIZE 1088    ///< Largest incoming PUBLISH (topic + ACL_FRAME_SIZE)
+
+// ============================================================================
+// CARD LIST SYNC CONFIGURATION
+// ============================================================================
+
+/**
+ * @brief Versioned card list pushed by the backend, one per reader
+ * @details Topics: campus/acl/{hotel}/{building}/{room} for the room's
+ * snapshots and deltas, and campus/acl/{hotel}/{building}/{room}/sync to
+ * report the local version. Each reader keeps two tables of
+ * UID_INDEX_CAPACITY 12-byte slots (12 KB together) and ACL_LOG_SIZE records.
+ */
+#define ACL_TOPIC_BASE "campus/acl"
+#define ACL_FRAME_SIZE 1024         ///< Largest card list chunk the backend sends (bytes)
+#define ACL_LOG_SIZE 128            ///< Delta records replayed onto the spare table; longer deltas copy it
+
+// ============================================================================
+// EVENT JOURNAL CONFIGURATION
+// ============================================================================
+
+/**
+ * @brief Store-and-forward journal for events raised while offline
+ * @details Needs a data partition with this label (see partitions.csv). At
+ *          32 bytes an event, the 384 KB partition holds about 12k events, a
+ *          30-minute outage of a busy multi-reader board; past that the
+ *          oldest are dropped.
+ */
+#define JOURNAL_PARTITION "journal"  ///< Flash partition holding the journal
+#define JOURNAL_DRAIN_BATCH 8       ///< Max journal publishes per loop
+#define PUBLISH_BATCH_WINDOW 50     ///< Events within this window share one publish (ms, 0 = off)
+#define PUBLISH_BATCH_MAX 8         ///< Most events in one batched publish
+#define BATCH_FRAME_SIZE 1024       ///< Stack buffer for one batched publish (bytes)
+
+// ============================================================================
+// FIELD TRACE CONFIGURATION
+// ============================================================================
+
+/**
+ * @brief Binary trace of polls, lookups, events and link changes (reader_trace.h)
+ * @details Needs a data partition with this label (see partitions.csv); read it
+ *          back with esptool and replay it with tools/trace_replay
+ */
+#define ENABLE_TRACE false          ///< Record the trace; costs a flash page write every few seconds
+#define TRACE_PARTITION "trace"     ///< Flash partition holding the trace ring
+#define TRACE_QUEUE_SIZE 32         ///< RFID -> network trace record slots (power of two)
+#define TRACE_DRAIN_INTERVAL 50     ///< Network task trace queue drain interval (ms)
+#define TRACE_FLUSH_INTERVAL 5000   ///< Longest a partial page waits in RAM (ms)
 
 // ============================================================================
 // PERFORMANCE CONFIGURATION
@@ -190,8 +306,22 @@
  * @brief Performance and timing parameters
  */
 #define MAIN_LOOP_DELAY 100         ///< Main loop delay (ms)
+#define SCHEDULER_TICK_MS 10        ///< Timer wheel resolution (ms)
+#define SCHEDULER_WHEEL_SLOTS 64    ///< Timer wheel buckets
+#define SCHEDULER_MAX_TASKS 8       ///< Maximum scheduled tasks
+#define EVENT_QUEUE_SIZE 16         ///< RFID -> network event slots (power of two)
+#define EVENT_DRAIN_INTERVAL 10     ///< Network task event queue drain interval (ms)
+#define RFID_TASK_CORE 1            ///< Core running card detection
+#define RFID_TASK_STACK 4096        ///< RFID task stack (bytes)
+#define RFID_TASK_PRIORITY 2        ///< RFID task FreeRTOS priority
+#define NETWORK_TASK_CORE 0         ///< Core running WiFi, TLS and MQTT (shared with the WiFi stack)
+#define NETWORK_TASK_STACK 8192     ///< Network task stack (bytes, TLS needs the headroom)
+#define NETWORK_TASK_PRIORITY 1     ///< Network task FreeRTOS priority
+#define LOG_TASK_CORE 0             ///< Core formatting and printing log lines
+#define LOG_TASK_STACK 3072         ///< Log task stack (bytes)
+#define LOG_TASK_PRIORITY 0         ///< Log task FreeRTOS priority (idle: only prints when nothing else runs)
 #define WATCHDOG_TIMEOUT 30000      ///< Watchdog timer timeout (ms)
-#define MEMORY_CHECK_INTERVAL 60000 ///< Memory usage check interval (ms)
+#define MEMORY_CHECK_INTERVAL 60000 ///< Memory check and telemetry report interval (ms)
 
 // ============================================================================
 // ERROR HANDLING
@@ -214,6 +344,8 @@
 #define ENABLE_LED_FEEDBACK true    ///< Enable LED status indicators
 #define ENABLE_DEEP_SLEEP false     ///< Enable deep sleep mode (not recommended)
 #define ENABLE_OTA_UPDATES false    ///< Enable Over-The-Air updates
+#define ENABLE_CARD_IRQ true        ///< Detect cards via the MFRC522 IRQ line (polls if false)
+#define ENABLE_TELEMETRY true       ///< Publish latency histograms and counters on the telemetry topic
 
 // ============================================================================
 // VALIDATION MACROS
@@ -230,10 +362,46 @@
 #error "WiFi credentials must be defined"
 #endif
 
+#if MQTT_QOS != 0 && MQTT_QOS != 1
+#error "MQTT_QOS must be 0 or 1"
+#endif
+
 #if CARD_ABSENT_THRESHOLD < 1 || CARD_ABSENT_THRESHOLD > 20
 #error "CARD_ABSENT_THRESHOLD must be between 1 and 20"
 #endif
 
+#if MAX_FAILED_ATTEMPTS < 1
+#error "MAX_FAILED_ATTEMPTS must be at least 1"
+#endif
+
+#if EVENT_QUEUE_SIZE < 2 || (EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) != 0
+#error "EVENT_QUEUE_SIZE must be a power of two"
+#endif
+
+#if TRACE_QUEUE_SIZE < 2 || (TRACE_QUEUE_SIZE & (TRACE_QUEUE_SIZE - 1)) != 0
+#error "TRACE_QUEUE_SIZE must be a power of two"
+#endif
+
+#if LOG_RING_SIZE < 2 || (LOG_RING_SIZE & (LOG_RING_SIZE - 1)) != 0
+#error "LOG_RING_SIZE must be a power of two"
+#endif
+
+#if MQTT_RX_BUFFER_SIZE < ACL_FRAME_SIZE + 64
+#error "MQTT_RX_BUFFER_SIZE must hold an ACL_FRAME_SIZE payload and its topic"
+#endif
+
+#if PUBLISH_BATCH_MAX < 2 || PUBLISH_BATCH_MAX > 23
+#error "PUBLISH_BATCH_MAX must be between 2 and 23"
+#endif
+
+#if BATCH_FRAME_SIZE < 2 * EVENT_FRAME_SIZE
+#error "BATCH_FRAME_SIZE must hold at least two events"
+#endif
+
+#if UID_INDEX_CAPACITY <= MAX_USERS || (UID_INDEX_CAPACITY & (UID_INDEX_CAPACITY - 1)) != 0
+#error "UID_INDEX_CAPACITY must be a power of two larger than MAX_USERS"
+#endif
+
 // ============================================================================
 // HELPER MACROS
 // ============================================================================
@@ -245,7 +413,7 @@
 #define TOSTRING(x) STRINGIFY(x)
 
 /**
- * @brief Debug print macro
+ * @brief Synchronous debug print macro (firmware code logs through logger.h)
  */
 #if DEBUG_MODE
 #define DEBUG_PRINT(x) Serial.print(x)
@@ -262,7 +430,7 @@
  */
 #define REPORT_MEMORY() do { \
     if (DEBUG_MODE) { \
-        DEBUG_PRINTF("Free heap: %d bytes\n", ESP.getFreeHeap()); \
+        LOG_DEBUG(Sys, "Free heap: %u bytes", (unsigned)ESP.getFreeHeap()); \
     } \
 } while(0)
 
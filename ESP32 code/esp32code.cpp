@@ -30,12 +30,14 @@
  * GPIO23    | MOSI        | Master Out Slave In
  * GPIO19    | MISO        | Master In Slave Out
  * GPIO22    | RST         | Reset Pin
+ * GPIO27    | IRQ         | Card detect interrupt (optional)
  * 
  * @section hardware_parameters Configuration Parameters
  * All configuration parameters are defined in config.h:
  * - WiFi credentials (WIFI_SSID, WIFI_PASSWORD)
  * - Server endpoints (WEBSOCKET_HOST, WEBSOCKET_PORT)
- * - RFID pin assignments (RFID_RST_PIN, RFID_SS_PIN)
+ * - RFID pin assignments (RFID_RST_PIN, RFID_SS_PIN), or one RFID_READERS
+ *   row per door when a board serves several rooms
  * - Room identification (ROOM_NUMBER, BUILDING_ID, FLOOR_NUMBER)
  * - NTP server settings for time synchronization
  */
@@ -44,14 +46,32 @@
 #include <MFRC522.h>
 #include <WiFi.h>
 #include <WebSocketsClient.h>
-#include <ArduinoJson.h>
 #include "time.h"
+#include <sys/time.h>
+#include "esp_sntp.h"
+#include "esp_timer.h"
 #include "config.h"
-
-// ---- Pins and Config ----
-#define RST_PIN RFID_RST_PIN
-#define SS_PIN RFID_SS_PIN
-
+#include "uid_index.h"
+#include "event_encoder.h"
+#include "mqtt_client.h"
+#include "event_journal.h"
+#include "scheduler.h"
+#include "spsc_queue.h"
+#include "pinned_task.h"
+#include "card_reader.h"
+#include "presence.h"
+#include "event_publisher.h"
+#include "card_acl.h"
+#include "telemetry.h"
+#include "backoff.h"
+#include "logger.h"
+#include "wall_clock.h"
+#include "boot_state.h"
+#include "reader_trace.h"
+#include "card_auth.h"
+#include "hmac_sha256.h"
+
+// ---- Config ----
 const char* ssid = WIFI_SSID;
 const char* password = WIFI_PASSWORD;
 
@@ -64,346 +84,767 @@ const char* roomNumber  = ROOM_NUMBER;
 const char* building    = BUILDING_ID;
 const char* floorNumber = FLOOR_NUMBER;
 
+// One room per row of RFID_READERS; events carry the row they came from
+#define READER_ROOM(room, ss, rst, irq) DeviceContext{ BUILDING_ID, FLOOR_NUMBER, room },
+const DeviceContext rooms[] = { RFID_READERS(READER_ROOM) };
+constexpr size_t READER_COUNT = sizeof(rooms) / sizeof(rooms[0]);
+static_assert(READER_COUNT <= MAX_RFID_READERS, "Too many RFID_READERS for MAX_RFID_READERS");
+
 // ---- NTP Config (from config.h) ----
 const char* ntpServer1       = NTP_SERVER1;
 const char* ntpServer2       = NTP_SERVER2;
 const char* ntpServer3       = NTP_SERVER3;
 const long  gmtOffset_sec    = GMT_OFFSET_SEC;
 const int   daylightOffset_sec = DAYLIGHT_OFFSET_SEC;
-unsigned long lastSyncAttempt    = 0;
-const unsigned long SYNC_INTERVAL = NTP_SYNC_INTERVAL;
 
 // ---- RFID/WebSocket objects ----
-MFRC522 mfrc522(SS_PIN, RST_PIN);
+// The IRQ line only helps a single reader; several are polled in turn
+#define READER_DRIVER(room, ss, rst, irq) \
+  Mfrc522Reader(ss, rst, ENABLE_CARD_IRQ && READER_COUNT == 1 ? irq : -1),
+Mfrc522Reader cardReaders[] = { RFID_READERS(READER_DRIVER) };
 WebSocketsClient webSocket;
 
+bool sendMqttFrame(const uint8_t* data, size_t length);
+MqttClient mqtt(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, sendMqttFrame);
+
+// ---- Event journal (store-and-forward) ----
+FlashJournalStorage journalStorage(JOURNAL_PARTITION);
+EventJournal journal(journalStorage);
+bool journalReady = false;
+
+EventPublisher publisher(rooms, READER_COUNT, mqtt);
+
+// ---- Field trace (ENABLE_TRACE) ----
+FlashJournalStorage traceStorage(TRACE_PARTITION);
+TraceWriter trace(traceStorage);
+bool traceReady = false;
+
 // ---- UIDs and Roles ----
-struct UserAuth {
-  byte uid[4];
-  const char* role;
+// Used until the backend sends each room's card list
+constexpr UserAuth users[] = {
+  {cardUid({0xAF, 0x4D, 0x99, 0x1F}), Role::Maintenance},
+  {cardUid({0xBF, 0xD1, 0x07, 0x1F}), Role::Manager},
+  {cardUid({0xB2, 0xF9, 0x7C, 0x00}), Role::Guest}
 };
+static_assert(sizeof(users) / sizeof(users[0]) <= MAX_USERS, "Too many users for MAX_USERS");
 
-UserAuth users[] = {
-  {{0xAF, 0x4D, 0x99, 0x1F}, "Maintenance"},
-  {{0xBF, 0xD1, 0x07, 0x1F}, "Manager"},
-  {{0xB2, 0xF9, 0x7C, 0x00}, "Guest"}
-};
-const int numUsers = sizeof(users) / sizeof(users[0]);
+// One list per reader, read by the RFID task, updated by the network task
+CardAcl acl[READER_COUNT];
+bool    aclSubscribed = false;
+
+Role getUserRole(const uint8_t* uid, uint8_t length);
+void queueEvent(const JournalEntry& entry);
+
+// ---- Card and event authentication (CARD_AUTH, EVENT_SIGNING) ----
+CardAuth   cardAuth;      ///< RFID task
+HmacSha256 eventSigner;   ///< Network task
+
+// ---- Warm reset state ----
+// RTC memory keeps it through software, panic and watchdog resets; the
+// checksum tells a warm start from garbage after power-on
+RTC_NOINIT_ATTR BootState bootState;
+
+uint8_t nextBootId() {
+  return bootStateValid(bootState) ? bootState.bootId + 1 : (uint8_t)esp_random();
+}
+
+WallClock wallClock(nextBootId());
 
 // ---- Presence Detection State ----
-byte         presentCardUID[4] = {0};
-int          presentUserIndex  = -1;
-unsigned long checkedInTime    = 0;
-bool         checkedIn         = false;
-int          cardAbsentCount   = 0;
-const int    CARD_ABSENT_THRESHOLD = 5;
+#define READER_PRESENCE(room, ss, rst, irq) \
+  PresenceTracker(getUserRole, queueEvent, CARD_ABSENT_THRESHOLD),
+PresenceTracker presence[] = { RFID_READERS(READER_PRESENCE) };
+size_t       servingReader     = 0;   ///< Reader whose cycle is running (RFID task)
+size_t       firstReader       = 0;   ///< Where the next sweep starts
 bool         websocketConnected = false;
+bool         websocketStarted  = false;
+bool         sessionUp         = false;
+uint32_t     outageStartMs     = 0;   ///< When the link went down, 0 while up
+Backoff      reconnectBackoff(WS_RECONNECT_MIN, WS_RECONNECT_MAX, esp_random());
+
+// ---- Connection State Machines ----
+enum WiFiState : uint8_t { WIFI_IDLE, WIFI_JOINING, WIFI_UP };
+WiFiState     wifiState      = WIFI_IDLE;
+unsigned long wifiJoinStart  = 0;
+
+bool          ntpRequested   = false;
+unsigned long ntpRequestedAt = 0;
+
+// ---- Scheduler (network task) ----
+Scheduler scheduler;
+int       ntpTaskId = -1;
+
+// ---- RFID -> network pipeline ----
+// The RFID task on one core only detects cards and queues events; the
+// network task on the other core journals, encodes and sends them, so a
+// slow TLS write never delays the next card poll
+SpscQueue<JournalEntry, EVENT_QUEUE_SIZE> eventQueue;
+PinnedTask rfidThread;
+PinnedTask networkThread;
+// Formats and prints what the other tasks logged, at idle priority
+PinnedTask logThread;
+// Trace records take the same way; only the network task writes flash
+SpscQueue<TraceRecord, TRACE_QUEUE_SIZE> traceQueue;
+uint32_t rfidCheckpoint    = 0;   ///< Last trace checkpoint the RFID task recorded
+uint32_t networkCheckpoint = 0;   ///< Last one the network task recorded
+uint32_t traceDropped      = 0;   ///< traceQueue drops already recorded as a gap
+uint32_t traceFlushedMs    = 0;
+
+// ---- Performance telemetry ----
+Telemetry telemetry;
 
 // ---- Function prototypes ----
 void setupSystem();
-void connectWiFi();
-bool syncTime();
-String getTimestamp();
-int  getUserIndex(byte *uid, byte length);
-void cleanupRFID();
+void setupCardAuth();
+void setupEventSigning();
+void restoreBootState();
+void saveBootState(uint64_t nowUs);
+uint64_t monotonicUs();
+uint64_t systemTimeUs();
+void writeSerial(const char* data, size_t length);
+void logLoop(void* arg);
+void rfidLoop(void* arg);
+void networkLoop(void* arg);
+void rfidTask(uint32_t nowMs);
+void eventTask(uint32_t nowMs);
+void logEvent(const JournalEntry& entry);
+void wifiTask(uint32_t nowMs);
+void websocketTask(uint32_t nowMs);
+void ntpTask(uint32_t nowMs);
+void telemetryTask(uint32_t nowMs);
+void traceTask(uint32_t nowMs);
+void tracePoll(size_t reader, const CardUid* uids, size_t count, uint64_t nowUs);
+void traceLookup(const uint8_t* uid, uint8_t length, Role role);
+void traceEvent(const JournalEntry& entry);
+void tracePresence(size_t reader, uint64_t nowUs, uint32_t elapsedMs);
+void traceLink(bool up);
+void traceClock();
+void drainTrace();
 void connectWebSocket();
-void publishToMQTT(const char* type, const char* jsonData);
-bool isCardPresent();
+void recordEvent(const JournalEntry& entry);
+void onPublishAck(uint16_t packetId);
+void onPublished(const char* topic, const uint8_t* payload, size_t length, bool success);
+void onMqttMessage(const char* topic, size_t topicLength, const uint8_t* payload, size_t length);
+size_t aclTopic(size_t reader, char* buf, size_t size);
+bool subscribeAcl(uint32_t nowMs);
+bool requestAclSync(size_t reader, uint32_t nowMs);
 void webSocketEvent(WStype_t type, uint8_t * payload, size_t length);
-void handleUnauthorizedAccess(const char* cardUID);
+void scheduleReconnect();
 
 void setup() {
   Serial.begin(115200);
   delay(100);
   SPI.begin();
-  mfrc522.PCD_Init();
+  for (size_t i = 0; i < READER_COUNT; i++) {
+    if (!cardReaders[i].begin()) {
+      LOG_WARN(Rfid, "Card IRQ unavailable, falling back to polling");
+    }
+  }
   
   // Setup WebSocket event handler
   webSocket.onEvent(webSocketEvent);
+  mqtt.onAck(onPublishAck);
+  mqtt.onMessage(onMqttMessage);
+  for (CardAcl& list : acl) list.load(users, sizeof(users) / sizeof(users[0]));
+  publisher.onPublished(onPublished);
+  publisher.attachClock(&wallClock);
+  if (CARD_AUTH) setupCardAuth();
+  if (EVENT_SIGNING) setupEventSigning();
+
+  if (ENABLE_TRACE) {
+    traceReady = trace.begin(wallClock.bootId(), READER_COUNT);
+    if (traceReady) {
+      TraceRecord boot = {};
+      boot.kind = TraceKind::Boot;
+      boot.monoUs = monotonicUs();
+      boot.boot = {wallClock.bootId(), (uint8_t)READER_COUNT};
+      trace.write(boot);
+    } else {
+      LOG_WARN(Sys, "Trace partition unavailable, not tracing");
+    }
+  }
+  restoreBootState();
+
+  journalReady = journal.begin();
+  if (journalReady) {
+    publisher.attachJournal(&journal);
+    LOG_INFO(Sys, "Event journal: %u pending of %u",
+             (unsigned)journal.pending(), (unsigned)journal.capacity());
+  } else {
+    LOG_WARN(Sys, "Event journal unavailable, events are lost while offline");
+  }
   
   setupSystem();
+
+  if (!logThread.start("log", logLoop, nullptr, LOG_TASK_STACK,
+                       LOG_TASK_PRIORITY, LOG_TASK_CORE) ||
+      !rfidThread.start("rfid", rfidLoop, nullptr, RFID_TASK_STACK,
+                        RFID_TASK_PRIORITY, RFID_TASK_CORE) ||
+      !networkThread.start("network", networkLoop, nullptr, NETWORK_TASK_STACK,
+                           NETWORK_TASK_PRIORITY, NETWORK_TASK_CORE)) {
+    LOG_ERROR(Sys, "Failed to start pipeline tasks, restarting");
+    logger.drain(writeSerial);
+    Serial.flush();
+    ESP.restart();
+  }
 }
 
 void loop() {
-  // Maintain connections
-  if (WiFi.status() != WL_CONNECTED) {
-    connectWiFi();
+  // All work runs in the pinned RFID and network tasks
+  vTaskDelete(nullptr);
+}
+
+void writeSerial(const char* data, size_t length) {
+  Serial.write((const uint8_t*)data, length);
+}
+
+void logLoop(void* arg) {
+  for (;;) {
+    logger.drain(writeSerial);
+    sleepMs(LOG_DRAIN_INTERVAL);
   }
-  
-  if (!websocketConnected) {
-    connectWebSocket();
+}
+
+void rfidLoop(void* arg) {
+  uint32_t dueUs = 0;
+  bool     periodic = false;
+
+  for (;;) {
+    // Idle reader: sleep until the IRQ reports a card instead of polling
+    if (READER_COUNT == 1 && presence[0].idle() && cardReaders[0].interruptDriven() &&
+        !cardReaders[0].waitForCard(CARD_DETECT_INTERVAL)) {
+      periodic = false;
+      continue;
+    }
+
+    // Jitter only means something for cycles that follow a fixed delay
+    int32_t lateUs = (int32_t)(micros() - dueUs);
+    if (periodic) telemetry.record(Metric::RfidJitter, lateUs > 0 ? lateUs : 0);
+
+    rfidTask(millis());
+    dueUs = micros() + CARD_READ_DELAY * 1000;
+    periodic = true;
+    sleepMs(CARD_READ_DELAY);
   }
-  
-  webSocket.loop();
+}
+
+void networkLoop(void* arg) {
+  for (;;) {
+    uint32_t startUs = micros();
+    scheduler.tick(millis());
+    telemetry.record(Metric::NetworkTick, micros() - startUs);
+
+    // Nothing due: hand the core back to FreeRTOS until the next tick
+    uint32_t idle = scheduler.idleMs(millis());
+    sleepMs(idle < SCHEDULER_TICK_MS ? idle : SCHEDULER_TICK_MS);
+  }
+}
+
+// ---- Continuous Card Presence Detection ----
+// Every reader gets one inventory per cycle. An empty field costs about
+// RFID_RX_TIMEOUT_US, so a card waits at most CARD_READ_DELAY plus one
+// sweep; starting each sweep one reader later keeps any reader from
+// always being served last.
+void rfidTask(uint32_t nowMs) {
+  bool save = bootState.clockSynced != wallClock.synced();
+
+  // A new trace sector starts with the cards each reader has checked in
+  if (ENABLE_TRACE && traceReady && trace.checkpoints() != rfidCheckpoint) {
+    rfidCheckpoint = trace.checkpoints();
+    uint64_t nowUs = monotonicUs();
+    for (size_t i = 0; i < READER_COUNT; i++) tracePresence(i, nowUs, 0);
+  }
+
+  for (size_t n = 0; n < READER_COUNT; n++) {
+    size_t i = (firstReader + n) % READER_COUNT;
+    CardUid uids[MAX_PRESENT_CARDS];
+    uint32_t startUs = micros();
+    size_t count = cardReaders[i].readCards(uids, MAX_PRESENT_CARDS);
+    telemetry.record(Metric::RfidRead, micros() - startUs);
+
+    // One clock reading per reader: every event it emits carries the same time
+    uint64_t nowUs = monotonicUs();
+    servingReader = i;
+    tracePoll(i, uids, count, nowUs);
+    presence[i].update(uids, count, nowUs, wallClock.stamp(nowUs));
+    save = save || presence[i].present() > 0 || bootState.presence[i].count > 0 ||
+           presence[i].tracking() > 0 || bootState.presence[i].deniedCount > 0;
+  }
+  firstReader = (firstReader + 1) % READER_COUNT;
 
-  // Periodic time sync
-  if (millis() - lastSyncAttempt > SYNC_INTERVAL) {
-    if (WiFi.status() == WL_CONNECTED && syncTime()) {
-      lastSyncAttempt = millis();
+  if (save) saveBootState(monotonicUs());
+}
+
+uint64_t monotonicUs() {
+  return (uint64_t)esp_timer_get_time();
+}
+
+uint64_t systemTimeUs() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void restoreBootState() {
+  uint64_t nowUs = monotonicUs();
+
+  if (esp_reset_reason() == ESP_RST_POWERON || !bootStateValid(bootState) ||
+      bootState.readers != READER_COUNT) {
+    LOG_INFO(Sys, "Cold start, waiting for NTP to timestamp events");
+  } else {
+    // The system clock runs on through a warm reset, so if NTP had set it
+    // before, it is still good and events get real time from the start
+    uint32_t epoch = (uint32_t)time(nullptr);
+    uint32_t elapsedMs = 0;
+    if (bootState.clockSynced) {
+      wallClock.set(systemTimeUs(), nowUs);
+      if (bootState.savedAtEpoch != 0 && epoch >= bootState.savedAtEpoch) {
+        elapsedMs = (epoch - bootState.savedAtEpoch) * 1000;
+      }
     }
+    unsigned cards = 0;
+    if (bootState.clockSynced) traceClock();
+    for (size_t i = 0; i < READER_COUNT; i++) {
+      presence[i].restore(bootState.presence[i], nowUs, elapsedMs);
+      tracePresence(i, nowUs, elapsedMs);
+      cards += presence[i].present();
+    }
+    LOG_INFO(Sys, "Warm start: %u cards checked in, clock %s",
+             cards, wallClock.synced() ? "kept" : "not set");
   }
+  saveBootState(nowUs);
+}
 
-  // ---- Continuous Card Presence Detection ----
-  if (isCardPresent()) {
-    cardAbsentCount = 0;
+void saveBootState(uint64_t nowUs) {
+  bootState.bootId = wallClock.bootId();
+  bootState.clockSynced = wallClock.synced();
+  bootState.savedAtEpoch = (uint32_t)(wallClock.epochUs(nowUs) / 1000000);
+  bootState.readers = READER_COUNT;
+  for (size_t i = 0; i < READER_COUNT; i++) presence[i].save(bootState.presence[i], nowUs);
+  sealBootState(bootState);
+}
 
-    if (!checkedIn) {
-      int userIdx = getUserIndex(mfrc522.uid.uidByte, mfrc522.uid.size);
-      
-      char cardUID[9];
-      snprintf(cardUID, sizeof(cardUID),
-               "%02X%02X%02X%02X",
-               mfrc522.uid.uidByte[0],
-               mfrc522.uid.uidByte[1],
-               mfrc522.uid.uidByte[2],
-               mfrc522.uid.uidByte[3]);
-
-      if (userIdx != -1) {
-        // Authorized user - check in
-        String role = users[userIdx].role;
-        
-        DynamicJsonDocument doc(512);
-        doc["card_uid"] = cardUID;
-        doc["role"] = role;
-        doc["check_in"] = getTimestamp();
-        doc["room"] = roomNumber;
-        
-        String jsonString;
-        serializeJson(doc, jsonString);
-        
-        publishToMQTT("attendance", jsonString.c_str());
-        Serial.printf("%s Checked IN at %s\n", role.c_str(), getTimestamp().c_str());
-
-        memcpy(presentCardUID, mfrc522.uid.uidByte, 4);
-        presentUserIndex = userIdx;
-        checkedInTime = millis();
-        checkedIn = true;
+void queueEvent(const JournalEntry& event) {
+  JournalEntry entry = event;
+  entry.reader = (uint8_t)servingReader;
+
+  logEvent(entry);
+  traceEvent(entry);
+  telemetry.count(Stat::EventsQueued);
+  if (!eventQueue.push(entry)) {
+    telemetry.count(Stat::EventsDropped);
+    LOG_WARN(Rfid, "Event queue full, %s event dropped", eventTopicType(entry.type));
+  }
+}
+
+// Runs on the RFID task: queues log lines, the log task prints them
+void logEvent(const JournalEntry& entry) {
+  const char* room = rooms[entry.reader].room;
+  switch (entry.type) {
+    case EventType::CheckIn:
+      LOG_INFO(Rfid, "Room %s: %s Checked IN at %lu", room, roleName(entry.role),
+               (unsigned long)entry.timestamp);
+      break;
+    case EventType::CheckOut:
+      LOG_INFO(Rfid, "Room %s: %s Checked OUT at %lu (duration: %lu seconds)", room,
+               roleName(entry.role), (unsigned long)entry.timestamp,
+               (unsigned long)entry.duration);
+      break;
+    case EventType::Denied: {
+      char cardUID[2 * CARD_UID_MAX_SIZE + 1];
+      formatCardUid(entry.uid.bytes, entry.uid.size, cardUID, sizeof(cardUID));
+      if (entry.duration > 1) {
+        LOG_INFO(Rfid, "Room %s: DENIED ACCESS: Unknown card %s, %lu more attempts up to %lu",
+                 room, logText(cardUID), (unsigned long)entry.duration,
+                 (unsigned long)entry.timestamp);
       } else {
-        // Unauthorized access attempt
-        handleUnauthorizedAccess(cardUID);
+        LOG_INFO(Rfid, "Room %s: DENIED ACCESS: Unknown card %s at %lu",
+                 room, logText(cardUID), (unsigned long)entry.timestamp);
       }
+      break;
     }
-  } else {
-    cardAbsentCount++;
-
-    if (checkedIn && cardAbsentCount >= CARD_ABSENT_THRESHOLD) {
-      if (presentUserIndex != -1) {
-        String role = users[presentUserIndex].role;
-        unsigned long duration = (millis() - checkedInTime) / 1000;
-        
-        char cardUID[9];
-        snprintf(cardUID, sizeof(cardUID),
-                 "%02X%02X%02X%02X",
-                 presentCardUID[0],
-                 presentCardUID[1],
-                 presentCardUID[2],
-                 presentCardUID[3]);
-
-        DynamicJsonDocument doc(512);
-        doc["card_uid"] = cardUID;
-        doc["role"] = role;
-        doc["check_out"] = getTimestamp();
-        doc["duration"] = duration;
-        doc["room"] = roomNumber;
-        
-        String jsonString;
-        serializeJson(doc, jsonString);
-        
-        publishToMQTT("attendance", jsonString.c_str());
-        Serial.printf("%s Checked OUT at %s (duration: %lu seconds)\n",
-                      role.c_str(), getTimestamp().c_str(), duration);
-      }
-
-      // Reset state
-      checkedIn = false;
-      presentUserIndex = -1;
-      checkedInTime = 0;
-      memset(presentCardUID, 0, sizeof(presentCardUID));
-      cardAbsentCount = 0;
+    case EventType::Alert: {
+      char cardUID[2 * CARD_UID_MAX_SIZE + 1];
+      formatCardUid(entry.uid.bytes, entry.uid.size, cardUID, sizeof(cardUID));
+      LOG_WARN(Rfid, "Room %s: SECURITY ALERT: Card %s failed %lu times at %lu",
+               room, logText(cardUID), (unsigned long)entry.duration,
+               (unsigned long)entry.timestamp);
+      break;
     }
   }
+}
 
-  delay(100);
+void setupCardAuth() {
+  static const uint8_t guest[CARD_KEY_SIZE] = CARD_KEY_GUEST;
+  static const uint8_t manager[CARD_KEY_SIZE] = CARD_KEY_MANAGER;
+  static const uint8_t maintenance[CARD_KEY_SIZE] = CARD_KEY_MAINTENANCE;
+  static const uint8_t housekeeping[CARD_KEY_SIZE] = CARD_KEY_HOUSEKEEPING;
+  cardAuth.setSectorKey(Role::Guest, guest);
+  cardAuth.setSectorKey(Role::Manager, manager);
+  cardAuth.setSectorKey(Role::Maintenance, maintenance);
+  cardAuth.setSectorKey(Role::Housekeeping, housekeeping);
+  if (!cardAuth.setCredentialKey(CARD_CREDENTIAL_KEY)) {
+    LOG_ERROR(Rfid, "CARD_CREDENTIAL_KEY is not hex, every card will be refused");
+  }
 }
 
-void handleUnauthorizedAccess(const char* cardUID) {
-  DynamicJsonDocument doc(512);
-  doc["card_uid"] = cardUID;
-  doc["role"] = "Unknown";
-  doc["denial_reason"] = "Unauthorized card";
-  doc["attempted_at"] = getTimestamp();
-  doc["room"] = roomNumber;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  
-  publishToMQTT("denied_access", jsonString.c_str());
-  Serial.printf("DENIED ACCESS: Unknown card %s at %s\n", cardUID, getTimestamp().c_str());
-  
-  // Also send security alert
-  DynamicJsonDocument alertDoc(512);
-  alertDoc["card_uid"] = cardUID;
-  alertDoc["role"] = "Security";
-  alertDoc["alert_message"] = "Unauthorized access attempt detected";
-  alertDoc["triggered_at"] = getTimestamp();
-  alertDoc["room"] = roomNumber;
-  
-  String alertString;
-  serializeJson(alertDoc, alertString);
+void setupEventSigning() {
+  if (!eventSigner.setHexKey(EVENT_SIGNING_KEY)) {
+    LOG_ERROR(Mqtt, "EVENT_SIGNING_KEY is not hex, events go out unsigned");
+    return;
+  }
+  publisher.attachSigner(&eventSigner);
+}
+
+void setupSystem() {
+  // Card reading starts right away; the network comes up in the background
+  uint32_t nowMs = millis();
+  scheduler.add("events", eventTask, EVENT_DRAIN_INTERVAL, nowMs);
+  scheduler.add("wifi", wifiTask, WIFI_RETRY_DELAY, nowMs);
+  scheduler.add("websocket", websocketTask, WS_LOOP_INTERVAL, nowMs);
+  ntpTaskId = scheduler.add("ntp", ntpTask, NTP_RETRY_INTERVAL, nowMs);
+  scheduler.add("telemetry", telemetryTask, MEMORY_CHECK_INTERVAL, nowMs, MEMORY_CHECK_INTERVAL);
+  if (traceReady) scheduler.add("trace", traceTask, TRACE_DRAIN_INTERVAL, nowMs);
   
-  publishToMQTT("alerts", alertString.c_str());
+  LOG_INFO(Sys, "Room %s Access Control System", roomNumber);
+  LOG_INFO(Sys, "Hotel ID: %s", floorNumber);
+  LOG_INFO(Sys, "WebSocket: wss://%s%s", websocketHost, websocketPath);
+  LOG_INFO(Sys, "Ready to read cards...");
+}
+
+void wifiTask(uint32_t nowMs) {
+  bool linked = WiFi.status() == WL_CONNECTED;
+
+  switch (wifiState) {
+    case WIFI_IDLE:
+      if (linked) {
+        wifiState = WIFI_UP;
+        break;
+      }
+      LOG_INFO(Ws, "Connecting to WiFi: %s", ssid);
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(ssid, password);
+      wifiJoinStart = nowMs;
+      wifiState = WIFI_JOINING;
+      break;
+
+    case WIFI_JOINING:
+      if (linked) {
+        LOG_INFO(Ws, "WiFi Connected! IP: %s", logText(WiFi.localIP().toString().c_str()));
+        wifiState = WIFI_UP;
+      } else if (nowMs - wifiJoinStart >= WIFI_TIMEOUT) {
+        LOG_WARN(Ws, "WiFi Connection Failed");
+        WiFi.disconnect();
+        wifiState = WIFI_IDLE;
+      }
+      break;
+
+    case WIFI_UP:
+      if (!linked) {
+        LOG_WARN(Ws, "WiFi connection lost");
+        wifiState = WIFI_IDLE;
+      }
+      break;
+  }
 }
 
-bool isCardPresent() {
-  byte bufferATQA[2];
-  byte bufferSize = sizeof(bufferATQA);
+void websocketTask(uint32_t nowMs) {
+  if (wifiState != WIFI_UP) return;
+  if (!websocketStarted) connectWebSocket();
+
+  webSocket.loop();
 
-  MFRC522::StatusCode result = mfrc522.PICC_REQA_or_WUPA(
-    MFRC522::PICC_CMD_WUPA, bufferATQA, &bufferSize);
+  // MQTT keepalive replaces the WebSocket heartbeat
+  if (!mqtt.loop(nowMs)) {
+    LOG_WARN(Mqtt, "MQTT ping timeout, reconnecting");
+    webSocket.disconnect();
+  }
 
-  if (result == MFRC522::STATUS_OK) {
-    if (mfrc522.PICC_ReadCardSerial()) {
-      return true;
+  // Session up: the next drop starts from the shortest delay again
+  if (mqtt.connected() && !sessionUp) {
+    sessionUp = true;
+    reconnectBackoff.reset();
+    if (outageStartMs != 0) {
+      telemetry.record(Metric::Reconnect, nowMs - outageStartMs);
+      outageStartMs = 0;
     }
   }
 
-  mfrc522.PICC_HaltA();
-  return false;
+  // Fresh session: subscribe to each room's card list and report its version
+  if (mqtt.connected() && !aclSubscribed) {
+    aclSubscribed = subscribeAcl(nowMs);
+    for (size_t i = 0; i < READER_COUNT && aclSubscribed; i++) aclSubscribed = requestAclSync(i, nowMs);
+  }
+
+  publisher.drain(nowMs);
 }
 
-void setupSystem() {
-  Serial.println();
-  connectWiFi();
-  
-  while (!syncTime()) {
-    Serial.println("NTP sync failed, retrying in 5s...");
-    delay(5000);
-    if (WiFi.status() != WL_CONNECTED) connectWiFi();
+void ntpTask(uint32_t nowMs) {
+  if (wifiState != WIFI_UP) return;
+
+  if (!ntpRequested) {
+    LOG_INFO(Sys, "Syncing NTP time");
+    configTime(gmtOffset_sec, daylightOffset_sec,
+               ntpServer1, ntpServer2, ntpServer3);
+    ntpRequested = true;
+    ntpRequestedAt = nowMs;
+    scheduler.setPeriod(ntpTaskId, NTP_RETRY_INTERVAL);
+    return;
+  }
+
+  if (sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED) {
+    // SNTP has just set the system clock; the event clock follows it and
+    // corrects its rate by the drift seen since the last sync
+    wallClock.set(systemTimeUs(), monotonicUs());
+    traceClock();
+
+    uint64_t epochUs = wallClock.epochUs(monotonicUs());
+    char buf[TIMESTAMP_SIZE];
+    formatTimestamp((uint32_t)(epochUs / 1000000), (uint16_t)(epochUs / 1000 % 1000),
+                    buf, sizeof(buf));
+    LOG_INFO(Sys, "Current Time: %s (drift %ld ppb)", logText(buf), (long)wallClock.driftPpb());
+
+    // Poll again only when the next resync is due
+    ntpRequested = false;
+    scheduler.setPeriod(ntpTaskId, NTP_SYNC_INTERVAL);
+  } else if (nowMs - ntpRequestedAt >= NTP_SYNC_TIMEOUT) {
+    LOG_WARN(Sys, "NTP sync failed, retrying...");
+    ntpRequested = false;
   }
-  
-  lastSyncAttempt = millis();
-  connectWebSocket();
-  
-  Serial.println("\n====================");
-  Serial.printf("Room %s Access Control System\n", roomNumber);
-  Serial.printf("Hotel ID: %s\n", floorNumber);
-  Serial.printf("WebSocket: wss://%s%s\n", websocketHost, websocketPath);
-  Serial.println("====================\n");
-  Serial.println("Ready to read cards...");
 }
 
-void connectWiFi() {
-  if (WiFi.status() == WL_CONNECTED) return;
-  
-  Serial.printf("Connecting to WiFi: %s\n", ssid);
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  
-  unsigned long start = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - start < 15000) {
-    delay(500);
-    Serial.print(".");
+void eventTask(uint32_t nowMs) {
+  JournalEntry entry;
+  while (eventQueue.pop(entry)) {
+    recordEvent(entry);
   }
-  
-  Serial.println();
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("WiFi Connected! IP: " + WiFi.localIP().toString());
-  } else {
-    Serial.println("WiFi Connection Failed");
+}
+
+void telemetryTask(uint32_t nowMs) {
+  REPORT_MEMORY();
+
+#if ENABLE_TELEMETRY
+  static uint32_t unsendable = 0;
+  telemetry.count(Stat::Unsendable, publisher.unsendable() - unsendable);
+  unsendable = publisher.unsendable();
+
+  TelemetryReport report;
+  telemetry.report(report, nowMs);
+  report.heapFree = ESP.getFreeHeap();
+  report.heapMin = ESP.getMinFreeHeap();
+  report.heapLargest = ESP.getMaxAllocHeap();
+  if (!publisher.publishTelemetry(report, nowMs)) {
+    LOG_DEBUG(Sys, "Telemetry report not sent");
+  }
+#endif
+
+  LOG_DEBUG(Sys, "Event queue: %u queued, %u high water, %u dropped",
+            (unsigned)eventQueue.size(), (unsigned)eventQueue.highWater(),
+            (unsigned)eventQueue.dropped());
+  if (journalReady) {
+    LOG_DEBUG(Sys, "Journal: %u pending, %u dropped",
+              (unsigned)journal.pending(), (unsigned)journal.dropped());
+  }
+  if (logger.dropped() > 0) {
+    LOG_DEBUG(Sys, "Log: %lu lines dropped since boot", (unsigned long)logger.dropped());
   }
 }
 
-bool syncTime() {
-  if (WiFi.status() != WL_CONNECTED) return false;
-  
-  configTime(gmtOffset_sec, daylightOffset_sec,
-             ntpServer1, ntpServer2, ntpServer3);
-  
-  Serial.print("Syncing NTP time");
-  time_t now = time(nullptr);
-  int attempts = 0;
-  
-  while (now < 8 * 3600 * 2 && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    now = time(nullptr);
-    attempts++;
+Role getUserRole(const uint8_t* uid, uint8_t length) {
+  Role role = acl[servingReader].lookup(uid, length);
+
+  // Only cards on the list cost a read; unknown UIDs are denied as they are
+  if (CARD_AUTH && role != Role::Unknown && length <= CARD_UID_MAX_SIZE) {
+    CardUid card = {};
+    card.size = length;
+    memcpy(card.bytes, uid, length);
+    uint32_t startUs = micros();
+    AuthResult result = cardAuth.verify(cardReaders[servingReader], card, role, millis());
+    telemetry.record(Metric::CardAuth, micros() - startUs);
+    if (result == AuthResult::ReadFailed) {
+      // Swiped past or collided: decide on the next poll, not deny
+      LOG_DEBUG(Rfid, "%s card: %s, reading again", roleName(role), authResultName(result));
+      role = ROLE_UNDECIDED;
+    } else if (result != AuthResult::Ok) {
+      if (result != AuthResult::Refused) {
+        telemetry.count(Stat::AuthFailed);
+        LOG_WARN(Rfid, "%s card refused: %s", roleName(role), authResultName(result));
+      }
+      role = Role::Unknown;
+    }
   }
-  
-  Serial.println();
-  if (attempts >= 20) return false;
-  
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) return false;
-  
-  char buf[20];
-  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
-  Serial.printf("Current Time: %s\n", buf);
-  return true;
+
+  traceLookup(uid, length, role);
+  return role;
 }
 
-String getTimestamp() {
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) return "1970-01-01 00:00:00";
-  
-  char buf[20];
-  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
-  return String(buf);
+// ---- Field trace ----
+// The RFID task queues polls, lookups, events and checkpoints; the network
+// task writes them out together with its own link and clock records
+
+void tracePoll(size_t reader, const CardUid* uids, size_t count, uint64_t nowUs) {
+  if (!ENABLE_TRACE || !traceReady) return;
+  TraceRecord record;
+  record.kind = TraceKind::Poll;
+  record.reader = (uint8_t)reader;
+  record.monoUs = nowUs;
+  record.poll.count = (uint8_t)count;
+  memcpy(record.poll.uids, uids, sizeof(CardUid) * count);
+  traceQueue.push(record);
 }
 
-int getUserIndex(byte *uid, byte length) {
-  if (length != 4) return -1;
-  
-  for (int i = 0; i < numUsers; i++) {
-    if (memcmp(uid, users[i].uid, 4) == 0) return i;
+void traceLookup(const uint8_t* uid, uint8_t length, Role role) {
+  if (!ENABLE_TRACE || !traceReady || length > CARD_UID_MAX_SIZE) return;
+  TraceRecord record;
+  record.kind = TraceKind::Lookup;
+  record.reader = (uint8_t)servingReader;
+  record.monoUs = monotonicUs();
+  record.lookup.uid.size = length;
+  memcpy(record.lookup.uid.bytes, uid, length);
+  record.lookup.role = role;
+  traceQueue.push(record);
+}
+
+void traceEvent(const JournalEntry& entry) {
+  if (!ENABLE_TRACE || !traceReady) return;
+  TraceRecord record;
+  record.kind = TraceKind::Event;
+  record.reader = entry.reader;
+  record.monoUs = monotonicUs();
+  record.event = entry;
+  traceQueue.push(record);
+}
+
+void tracePresence(size_t reader, uint64_t nowUs, uint32_t elapsedMs) {
+  if (!ENABLE_TRACE || !traceReady) return;
+  TraceRecord record;
+  record.kind = TraceKind::Presence;
+  record.reader = (uint8_t)reader;
+  record.monoUs = nowUs;
+  presence[reader].save(record.presence.cards, nowUs);
+  record.presence.elapsedMs = elapsedMs;
+  traceQueue.push(record);
+}
+
+void traceLink(bool up) {
+  if (!ENABLE_TRACE || !traceReady) return;
+  drainTrace();
+  TraceRecord record = {};
+  record.kind = TraceKind::Link;
+  record.monoUs = monotonicUs();
+  record.up = up;
+  trace.write(record);
+}
+
+void traceClock() {
+  if (!ENABLE_TRACE || !traceReady) return;
+  drainTrace();
+  TraceRecord record = {};
+  record.kind = TraceKind::Clock;
+  record.monoUs = monotonicUs();
+  record.clock = wallClock.state();
+  trace.write(record);
+}
+
+// Network task: write out what the RFID task queued, in order
+void drainTrace() {
+  TraceRecord record;
+  while (traceQueue.pop(record)) trace.write(record);
+
+  uint32_t dropped = traceQueue.dropped();
+  if (dropped != traceDropped) {
+    record = {};
+    record.kind = TraceKind::Gap;
+    record.monoUs = monotonicUs();
+    record.lost = dropped - traceDropped;
+    trace.write(record);
+    traceDropped = dropped;
+    trace.requestCheckpoint();
+  }
+
+  if (trace.checkpoints() != networkCheckpoint) {
+    networkCheckpoint = trace.checkpoints();
+    record = {};
+    record.monoUs = monotonicUs();
+    record.kind = TraceKind::Link;
+    record.up = websocketConnected;
+    trace.write(record);
+    if (wallClock.synced()) {
+      record.kind = TraceKind::Clock;
+      record.clock = wallClock.state();
+      trace.write(record);
+    }
   }
-  return -1;
 }
 
-void cleanupRFID() {
-  mfrc522.PICC_HaltA();
-  mfrc522.PCD_StopCrypto1();
+void traceTask(uint32_t nowMs) {
+  drainTrace();
+  if (nowMs - traceFlushedMs >= TRACE_FLUSH_INTERVAL) {
+    if (!trace.flush()) LOG_WARN(Sys, "Trace write failed");
+    traceFlushedMs = nowMs;
+  }
 }
 
 void connectWebSocket() {
-  if (websocketConnected) return;
+  if (websocketStarted) return;
   
-  Serial.printf("Connecting to WebSocket: wss://%s:%d%s\n", 
-                websocketHost, websocketPort, websocketPath);
+  LOG_INFO(Ws, "Connecting to WebSocket: %s://%s:%d%s",
+           WEBSOCKET_TLS ? "wss" : "ws", websocketHost, websocketPort, websocketPath);
   
+#if WEBSOCKET_TLS
   // Use SSL for secure connection to your Render deployment
-  webSocket.beginSSL(websocketHost, websocketPort, websocketPath);
+  webSocket.beginSSL(websocketHost, websocketPort, websocketPath, "", "mqtt");
+#else
+  // An on-site gateway holds the one TLS session to the backend
+  webSocket.begin(websocketHost, websocketPort, websocketPath, "mqtt");
+#endif
   
-  // Set reconnect interval
-  webSocket.setReconnectInterval(5000);
-  
-  // Enable heartbeat
-  webSocket.enableHeartbeat(15000, 3000, 2);
+  // From here on the library reconnects by itself, after the delay
+  // scheduleReconnect() sets on every drop
+  webSocket.setReconnectInterval(WS_RECONNECT_MIN);
+  outageStartMs = millis();
+  websocketStarted = true;
 }
 
 void webSocketEvent(WStype_t type, uint8_t * payload, size_t length) {
   switch(type) {
     case WStype_DISCONNECTED:
-      Serial.println("WebSocket Disconnected");
+      LOG_INFO(Ws, "WebSocket Disconnected");
       websocketConnected = false;
+      traceLink(false);
+      aclSubscribed = false;
+      scheduleReconnect();
+      // Everything not acknowledged is replayed from the journal
+      publisher.connectionLost();
       break;
       
     case WStype_CONNECTED:
-      Serial.printf("WebSocket Connected to: %s\n", payload);
+      LOG_INFO(Ws, "WebSocket Connected to: %s", logText((const char*)payload));
       websocketConnected = true;
+      traceLink(true);
+      telemetry.count(Stat::Reconnects);
+      mqtt.connect(millis());
       break;
       
     case WStype_TEXT:
-      Serial.printf("Received: %s\n", payload);
+      LOG_DEBUG(Ws, "Received: %s", logText((const char*)payload));
+      break;
+
+    case WStype_BIN:
+      mqtt.onData(payload, length, millis());
       break;
       
     case WStype_ERROR:
-      Serial.printf("WebSocket Error: %s\n", payload);
+      LOG_WARN(Ws, "WebSocket Error: %s", logText((const char*)payload));
       websocketConnected = false;
+      traceLink(false);
+      aclSubscribed = false;
+      scheduleReconnect();
+      publisher.connectionLost();
       break;
       
     case WStype_PONG:
-      Serial.println("WebSocket Pong received");
+      LOG_DEBUG(Ws, "WebSocket Pong received");
       break;
       
     default:
@@ -411,41 +852,115 @@ void webSocketEvent(WStype_t type, uint8_t * payload, size_t length) {
   }
 }
 
-void publishToMQTT(const char* type, const char* jsonData) {
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("Cannot publish: WiFi disconnected");
-    return;
-  }
-  
-  if (!websocketConnected) {
-    Serial.println("Cannot publish: WebSocket disconnected");
-    connectWebSocket();
-    return;
+void scheduleReconnect() {
+  sessionUp = false;
+  if (outageStartMs == 0) outageStartMs = millis();
+
+  uint32_t delayMs = reconnectBackoff.next();
+  webSocket.setReconnectInterval(delayMs);
+  LOG_INFO(Ws, "Reconnecting in %lu ms (attempt %lu)",
+           (unsigned long)delayMs, (unsigned long)reconnectBackoff.attempts());
+}
+
+void recordEvent(const JournalEntry& entry) {
+  switch (publisher.record(entry, millis())) {
+    case RecordResult::Journaled:
+      if (!publisher.online()) {
+        LOG_INFO(Mqtt, "Offline: event queued (%u pending)", (unsigned)journal.pending());
+      }
+      break;
+    case RecordResult::Direct:
+      if (journalReady) LOG_WARN(Sys, "Journal write failed, event published directly");
+      break;
+    case RecordResult::Lost:
+      LOG_ERROR(Mqtt, "Event lost: journal unavailable and MQTT session not established");
+      break;
   }
+}
 
-  // Create MQTT topic that matches your backend expectation
-  char topic[128];
-  snprintf(topic, sizeof(topic),
-           "campus/room/%s/%s/%s/%s",
-           building, floorNumber, roomNumber, type);
+void onPublishAck(uint16_t packetId) {
+  telemetry.record(Metric::PublishAck, mqtt.lastAckLatencyMs());
+  publisher.onAck(packetId);
+}
 
-  // Create MQTT publish message
-  DynamicJsonDocument mqttDoc(1024);
-  mqttDoc["cmd"] = "publish";
-  mqttDoc["topic"] = topic;
-  mqttDoc["payload"] = jsonData;
-  mqttDoc["qos"] = 0;
-  mqttDoc["retain"] = false;
-  
-  String mqttMessage;
-  serializeJson(mqttDoc, mqttMessage);
-  
-  // Send via WebSocket
-  bool success = webSocket.sendTXT(mqttMessage);
-  
-  if (success) {
-    Serial.printf("Published to %s: %s\n", topic, jsonData);
+void onPublished(const char* topic, const uint8_t* payload, size_t length, bool success) {
+  telemetry.count(success ? Stat::Published : Stat::PublishFailed);
+  if (payload == nullptr) {
+    LOG_ERROR(Mqtt, "Event dropped: does not encode into EVENT_FRAME_SIZE");
+  } else if (success) {
+    LOG_DEBUG(Mqtt, "Published %u bytes to %s", (unsigned)length, logText(topic));
   } else {
-    Serial.printf("Publish failed to %s\n", topic);
+    LOG_WARN(Mqtt, "Publish failed to %s", logText(topic));
+  }
+}
+
+void onMqttMessage(const char* topic, size_t topicLength, const uint8_t* payload, size_t length) {
+  // Every subscription is a room's card list topic
+  size_t reader = 0;
+  char expected[64];
+  while (reader < READER_COUNT &&
+         (aclTopic(reader, expected, sizeof(expected)) != topicLength ||
+          memcmp(expected, topic, topicLength) != 0)) {
+    reader++;
+  }
+  if (reader == READER_COUNT) return;
+
+  CardAcl& list = acl[reader];
+  const char* room = rooms[reader].room;
+  switch (list.apply(payload, length)) {
+    case AclResult::Partial:
+      break;
+    case AclResult::Applied:
+      LOG_INFO(Mqtt, "Room %s: card list updated to version %lu (%u cards)", room,
+               (unsigned long)list.version(), (unsigned)list.size());
+      break;
+    case AclResult::Stale:
+    case AclResult::Invalid:
+      LOG_WARN(Mqtt, "Room %s: card list update out of sequence, resyncing", room);
+      requestAclSync(reader, millis());
+      break;
+    case AclResult::Full:
+      LOG_ERROR(Mqtt, "Room %s: card list over %u cards, kept version %lu", room,
+                (unsigned)CardAcl::capacity(), (unsigned long)list.version());
+      break;
+  }
+}
+
+size_t aclTopic(size_t reader, char* buf, size_t size) {
+  const DeviceContext& ctx = rooms[reader];
+  int length = snprintf(buf, size, "%s/%s/%s/%s", ACL_TOPIC_BASE, ctx.floor, ctx.building, ctx.room);
+  return length > 0 && length < (int)size ? (size_t)length : 0;
+}
+
+bool subscribeAcl(uint32_t nowMs) {
+  for (size_t i = 0; i < READER_COUNT; i++) {
+    char topic[64];
+    if (aclTopic(i, topic, sizeof(topic)) == 0) return false;
+    const char* topics[] = { topic };
+    if (!mqtt.subscribe(topics, 1, nowMs)) return false;
   }
+  return true;
+}
+
+bool requestAclSync(size_t reader, uint32_t nowMs) {
+  // The backend answers on the room topic with a snapshot or a delta
+  char topic[64];
+  size_t base = aclTopic(reader, topic, sizeof(topic));
+  int topicLength = snprintf(topic + base, sizeof(topic) - base, "/sync");
+  if (base == 0 || topicLength <= 0 || base + topicLength >= sizeof(topic)) return false;
+  topicLength += base;
+
+  uint8_t frame[128];
+  size_t reserve = MqttClient::publishHeaderSize(topicLength, 0);
+  int payloadLength = snprintf((char*)frame + reserve, sizeof(frame) - reserve,
+                               "{\"version\":%lu,\"capacity\":%u}", (unsigned long)acl[reader].version(),
+                               (unsigned)CardAcl::capacity());
+  return mqtt.publish(topic, topicLength, frame, sizeof(frame), payloadLength, 0, false, nowMs);
+}
+
+bool sendMqttFrame(const uint8_t* data, size_t length) {
+  uint32_t startUs = micros();
+  bool sent = webSocket.sendBIN((uint8_t*)data, length);
+  telemetry.record(Metric::WsSend, micros() - startUs);
+  return sent;
 }
\ No newline at end of file
@@ -0,0 +1,458 @@
+/**
+ * @file event_encoder.cpp
+ * @brief Allocation-free encoder for card events
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "event_encoder.h"
+#include "wall_clock.h"
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+namespace {
+
+// ---- Bounded JSON writer ----
+// Characters inside string values go through escaped(); everything else is
+// written verbatim. Writing past the end only counts, so overflow is
+// detected once in finish().
+class JsonWriter {
+public:
+  JsonWriter(char* buf, size_t size) : buf_(buf), size_(size), len_(0) {}
+
+  void raw(char c) {
+    if (len_ < size_) buf_[len_] = c;
+    len_++;
+  }
+
+  void raw(const char* s) { while (*s) raw(*s++); }
+
+  void string(const char* s) {
+    raw('"');
+    while (*s) escaped(*s++);
+    raw('"');
+  }
+
+  void hex(const uint8_t* bytes, uint8_t count) {
+    static const char digits[] = "0123456789ABCDEF";
+    raw('"');
+    for (uint8_t i = 0; i < count; i++) {
+      raw(digits[bytes[i] >> 4]);
+      raw(digits[bytes[i] & 0x0F]);
+    }
+    raw('"');
+  }
+
+  void number(uint32_t value) {
+    char digits[10];
+    int n = 0;
+    do {
+      digits[n++] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while (value != 0);
+    while (n > 0) raw(digits[--n]);
+  }
+
+  void key(const char* name, bool first = false) {
+    if (!first) raw(',');
+    string(name);
+    raw(':');
+  }
+
+  /**
+   * @return Bytes written (NUL terminated), or 0 on overflow
+   */
+  size_t finish() {
+    if (len_ >= size_) return 0;
+    buf_[len_] = '\0';
+    return len_;
+  }
+
+private:
+  void escaped(char c) {
+    if (c == '"' || c == '\\') {
+      raw('\\');
+      raw(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char digits[] = "0123456789abcdef";
+      raw("\\u00");
+      raw(digits[(c >> 4) & 0x0F]);
+      raw(digits[c & 0x0F]);
+    } else {
+      raw(c);
+    }
+  }
+
+  char*  buf_;
+  size_t size_;
+  size_t len_;
+};
+
+// ---- Bounded CBOR writer ----
+// Same overflow rule as JsonWriter: count past the end, check in finish().
+class CborWriter {
+public:
+  CborWriter(uint8_t* buf, size_t size) : buf_(buf), size_(size), len_(0) {}
+
+  void number(uint64_t value) { head(0, value); }
+
+  void bytes(const uint8_t* data, size_t count) {
+    head(2, count);
+    for (size_t i = 0; i < count; i++) byte(data[i]);
+  }
+
+  void array(size_t count) { head(4, count); }
+  void tag(uint64_t value) { head(6, value); }
+
+  /**
+   * @return Bytes written, or 0 on overflow
+   */
+  size_t finish() const { return len_ <= size_ ? len_ : 0; }
+
+private:
+  void byte(uint8_t b) {
+    if (len_ < size_) buf_[len_] = b;
+    len_++;
+  }
+
+  // Major type and argument in the shortest form (RFC 8949, 3.1)
+  void head(uint8_t major, uint64_t value) {
+    uint8_t type = (uint8_t)(major << 5);
+    if (value < 24) {
+      byte(type | (uint8_t)value);
+      return;
+    }
+    int width = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+    byte(type | (uint8_t)(width == 1 ? 24 : width == 2 ? 25 : width == 4 ? 26 : 27));
+    for (int i = width - 1; i >= 0; i--) byte((uint8_t)(value >> (i * 8)));
+  }
+
+  uint8_t* buf_;
+  size_t   size_;
+  size_t   len_;
+};
+
+const uint64_t CBOR_SELF_DESCRIBED = 55799;
+
+// Fields every event shares; trailing is the type-specific count, if any.
+// Batch items leave out the tag, the batch carries it once.
+size_t binaryPayload(EventType type, const CardUid& uid, Role role, uint64_t timeMs,
+                     uint32_t seq, const uint32_t* trailing, bool tagged,
+                     uint8_t* buf, size_t size) {
+  CborWriter w(buf, size);
+  if (tagged) w.tag(CBOR_SELF_DESCRIBED);
+  w.array(trailing != nullptr ? 7 : 6);
+  w.number(BINARY_PAYLOAD_VERSION);
+  w.number((uint8_t)type);
+  w.number(seq);
+  w.bytes(uid.bytes, uid.size);
+  w.number((uint8_t)role);
+  w.number(timeMs);
+  if (trailing != nullptr) w.number(*trailing);
+  return w.finish();
+}
+
+void writeTopic(JsonWriter& w, const DeviceContext& ctx, const char* type) {
+  w.raw(MQTT_TOPIC_BASE "/");
+  w.raw(ctx.building);
+  w.raw('/');
+  w.raw(ctx.floor);
+  w.raw('/');
+  w.raw(ctx.room);
+  w.raw('/');
+  w.raw(type);
+}
+
+// ---- Payload bodies ----
+void writeBody(JsonWriter& w, const DeviceContext& ctx, const CheckInEvent& e) {
+  w.raw('{');
+  w.key("card_uid", true);
+  w.hex(e.uid.bytes, e.uid.size);
+  w.key("role");
+  w.string(roleName(e.role));
+  w.key("check_in");
+  w.string(e.timestamp);
+  w.key("room");
+  w.string(ctx.room);
+  w.key("seq");
+  w.number(e.seq);
+  w.raw('}');
+}
+
+void writeBody(JsonWriter& w, const DeviceContext& ctx, const CheckOutEvent& e) {
+  w.raw('{');
+  w.key("card_uid", true);
+  w.hex(e.uid.bytes, e.uid.size);
+  w.key("role");
+  w.string(roleName(e.role));
+  w.key("check_out");
+  w.string(e.timestamp);
+  w.key("duration");
+  w.number(e.durationSec);
+  w.key("room");
+  w.string(ctx.room);
+  w.key("seq");
+  w.number(e.seq);
+  w.raw('}');
+}
+
+void writeBody(JsonWriter& w, const DeviceContext& ctx, const DeniedEvent& e) {
+  w.raw('{');
+  w.key("card_uid", true);
+  w.hex(e.uid.bytes, e.uid.size);
+  w.key("role");
+  w.string(roleName(Role::Unknown));
+  w.key("denial_reason");
+  w.string(e.reason);
+  w.key("attempted_at");
+  w.string(e.timestamp);
+  w.key("attempts");
+  w.number(e.attempts);
+  w.key("room");
+  w.string(ctx.room);
+  w.key("seq");
+  w.number(e.seq);
+  w.raw('}');
+}
+
+void writeBody(JsonWriter& w, const DeviceContext& ctx, const AlertEvent& e) {
+  w.raw('{');
+  w.key("card_uid", true);
+  w.hex(e.uid.bytes, e.uid.size);
+  w.key("role");
+  w.string(roleName(Role::Security));
+  w.key("alert_message");
+  w.string(e.message);
+  w.key("triggered_at");
+  w.string(e.timestamp);
+  w.key("attempts");
+  w.number(e.attempts);
+  w.key("room");
+  w.string(ctx.room);
+  w.key("seq");
+  w.number(e.seq);
+  w.raw('}');
+}
+
+template <typename Event>
+size_t payload(const DeviceContext& ctx, const Event& event, char* buf, size_t size) {
+  JsonWriter w(buf, size);
+  writeBody(w, ctx, event);
+  return w.finish();
+}
+
+// ---- Timestamp formatting ----
+struct DateCache {
+  uint32_t dayStart;             ///< Unix time of local midnight, 0 before first use
+  char     date[11];             ///< "YYYY-MM-DD"
+};
+
+thread_local DateCache dateCache = {0, ""};
+
+void putTwoDigits(char* p, uint32_t value) {
+  p[0] = (char)('0' + value / 10);
+  p[1] = (char)('0' + value % 10);
+}
+
+} // namespace
+
+const char* eventTopicType(EventType type) {
+  switch (type) {
+    case EventType::CheckIn:
+    case EventType::CheckOut: return "attendance";
+    case EventType::Denied:   return "denied_access";
+    case EventType::Alert:    return "alerts";
+  }
+  return "attendance";
+}
+
+void formatTimestamp(uint32_t epoch, uint16_t millis, char* buf, size_t size) {
+  if (size < TIMESTAMP_SIZE) {
+    if (size > 0) buf[0] = '\0';
+    return;
+  }
+
+  // Anything this early, or an unresolved WallClock stamp, means NTP has
+  // not set the clock yet
+  if (epoch < 8 * 3600 * 2 || (epoch & UNSYNCED_STAMP) != 0) {
+    memcpy(buf, "1970-01-01 00:00:00.000", TIMESTAMP_SIZE);
+    return;
+  }
+
+  // GMT_OFFSET_SEC and DAYLIGHT_OFFSET_SEC are fixed, so every local day
+  // is 86400 s long
+  DateCache& cache = dateCache;
+  if (epoch < cache.dayStart || epoch - cache.dayStart >= 86400) {
+    time_t t = (time_t)epoch;
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+    strftime(cache.date, sizeof(cache.date), "%Y-%m-%d", &timeinfo);
+    cache.dayStart = epoch - (timeinfo.tm_hour * 3600 + timeinfo.tm_min * 60 + timeinfo.tm_sec);
+  }
+
+  uint32_t second = epoch - cache.dayStart;
+  millis %= 1000;
+  memcpy(buf, cache.date, 10);
+  buf[10] = ' ';
+  putTwoDigits(buf + 11, second / 3600);
+  buf[13] = ':';
+  putTwoDigits(buf + 14, second / 60 % 60);
+  buf[16] = ':';
+  putTwoDigits(buf + 17, second % 60);
+  buf[19] = '.';
+  buf[20] = (char)('0' + millis / 100);
+  putTwoDigits(buf + 21, millis % 100);
+  buf[23] = '\0';
+}
+
+size_t encodeTopic(const DeviceContext& ctx, EventType type, char* buf, size_t size) {
+  JsonWriter w(buf, size);
+  writeTopic(w, ctx, eventTopicType(type));
+  return w.finish();
+}
+
+size_t encodePayload(const DeviceContext& ctx, const CheckInEvent& event, char* buf, size_t size) {
+  return payload(ctx, event, buf, size);
+}
+
+size_t encodePayload(const DeviceContext& ctx, const CheckOutEvent& event, char* buf, size_t size) {
+  return payload(ctx, event, buf, size);
+}
+
+size_t encodePayload(const DeviceContext& ctx, const DeniedEvent& event, char* buf, size_t size) {
+  return payload(ctx, event, buf, size);
+}
+
+size_t encodePayload(const DeviceContext& ctx, const AlertEvent& event, char* buf, size_t size) {
+  return payload(ctx, event, buf, size);
+}
+
+size_t encodeBinaryPayload(const CheckInEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::CheckIn, event.uid, event.role, event.timeMs, event.seq,
+                       nullptr, true, buf, size);
+}
+
+size_t encodeBinaryPayload(const CheckOutEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::CheckOut, event.uid, event.role, event.timeMs, event.seq,
+                       &event.durationSec, true, buf, size);
+}
+
+size_t encodeBinaryPayload(const DeniedEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::Denied, event.uid, Role::Unknown, event.timeMs, event.seq,
+                       &event.attempts, true, buf, size);
+}
+
+size_t encodeBinaryPayload(const AlertEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::Alert, event.uid, Role::Security, event.timeMs, event.seq,
+                       &event.attempts, true, buf, size);
+}
+
+size_t encodeSignature(const uint8_t mac[EVENT_SIGNATURE_SIZE], bool binary,
+                       uint8_t* buf, size_t length, size_t size) {
+  if (binary) {
+    if (length + EVENT_SIGNATURE_SPACE_BINARY > size) return 0;
+    buf[length] = 0x40 | EVENT_SIGNATURE_SIZE;   // Byte string, length in the initial byte
+    memcpy(buf + length + 1, mac, EVENT_SIGNATURE_SIZE);
+    return length + EVENT_SIGNATURE_SPACE_BINARY;
+  }
+
+  static const char hex[] = "0123456789abcdef";
+  if (length + EVENT_SIGNATURE_SPACE_JSON > size) return 0;
+  uint8_t* out = buf + length;
+  *out++ = '\n';
+  for (size_t i = 0; i < EVENT_SIGNATURE_SIZE; i++) {
+    *out++ = hex[mac[i] >> 4];
+    *out++ = hex[mac[i] & 0x0F];
+  }
+  return length + EVENT_SIGNATURE_SPACE_JSON;
+}
+
+size_t encodeBinaryBatch(size_t count, uint8_t* buf, size_t size) {
+  CborWriter w(buf, size);
+  w.tag(CBOR_SELF_DESCRIBED);
+  w.array(count);
+  return w.finish();
+}
+
+size_t encodeBinaryBatchItem(const CheckInEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::CheckIn, event.uid, event.role, event.timeMs, event.seq,
+                       nullptr, false, buf, size);
+}
+
+size_t encodeBinaryBatchItem(const CheckOutEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::CheckOut, event.uid, event.role, event.timeMs, event.seq,
+                       &event.durationSec, false, buf, size);
+}
+
+size_t encodeBinaryBatchItem(const DeniedEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::Denied, event.uid, Role::Unknown, event.timeMs, event.seq,
+                       &event.attempts, false, buf, size);
+}
+
+size_t encodeBinaryBatchItem(const AlertEvent& event, uint8_t* buf, size_t size) {
+  return binaryPayload(EventType::Alert, event.uid, Role::Security, event.timeMs, event.seq,
+                       &event.attempts, false, buf, size);
+}
+
+size_t encodeBatchTopic(const DeviceContext& ctx, char* buf, size_t size) {
+  JsonWriter w(buf, size);
+  writeTopic(w, ctx, "batch");
+  return w.finish();
+}
+
+size_t encodeTelemetryTopic(const DeviceContext& ctx, char* buf, size_t size) {
+  JsonWriter w(buf, size);
+  writeTopic(w, ctx, "telemetry");
+  return w.finish();
+}
+
+size_t encodeTelemetry(const DeviceContext& ctx, const TelemetryReport& report, char* buf, size_t size) {
+  JsonWriter w(buf, size);
+  w.raw('{');
+  w.key("room", true);
+  w.string(ctx.room);
+  w.key("uptime");
+  w.number(report.uptimeSec);
+  w.key("heap");
+  w.raw('[');
+  w.number(report.heapFree);
+  w.raw(',');
+  w.number(report.heapMin);
+  w.raw(',');
+  w.number(report.heapLargest);
+  w.raw(']');
+
+  for (size_t m = 0; m < METRIC_COUNT; m++) {
+    const HistogramSnapshot& h = report.metrics[m];
+    uint32_t count = 0;
+    size_t used = 0;
+    for (size_t b = 0; b < TELEMETRY_BUCKETS; b++) {
+      count += h.buckets[b];
+      if (h.buckets[b] != 0) used = b + 1;
+    }
+
+    w.key(metricName((Metric)m));
+    w.raw('{');
+    w.key("n", true);
+    w.number(count);
+    w.key("sum");
+    w.number(h.sum);
+    w.key("b");
+    w.raw('[');
+    for (size_t b = 0; b < used; b++) {
+      if (b > 0) w.raw(',');
+      w.number(h.buckets[b]);
+    }
+    w.raw("]}");
+  }
+
+  for (size_t s = 0; s < STAT_COUNT; s++) {
+    w.key(statName((Stat)s));
+    w.number(report.stats[s]);
+  }
+  w.raw('}');
+  return w.finish();
+}
@@ -0,0 +1,207 @@
+/**
+ * @file event_encoder.h
+ * @brief Allocation-free encoder for card events
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section event_encoder_overview Overview
+ *
+ * Turns a typed card event into its MQTT topic and JSON payload in a
+ * single pass over a caller-provided buffer. No heap allocation and no
+ * intermediate JSON document.
+ *
+ * Topic layout: campus/room/{building}/{floor}/{room}/{type}
+ *
+ * Telemetry reports go out the same way on the "telemetry" topic type.
+ *
+ * @section event_encoder_binary Binary payload
+ *
+ * encodeBinaryPayload() writes the same events as CBOR (RFC 8949), about
+ * a fifth of the JSON size. Nothing the topic already says is repeated,
+ * the time is an integer and the UID is raw bytes:
+ *
+ * @code
+ * D9 D9 F7          tag 55799, self-described CBOR: tells it apart from JSON
+ * array(6 or 7)
+ *   uint            BINARY_PAYLOAD_VERSION
+ *   uint            EventType
+ *   uint            seq
+ *   bytes           card UID (4, 7 or 10 bytes)
+ *   uint            Role
+ *   uint            Unix time in ms, 0 if NTP had not set the clock
+ *   uint            check-out: duration (s); denied, alert: attempts
+ * @endcode
+ *
+ * A JSON payload always starts with '{', so the first byte is enough to
+ * pick the decoder.
+ *
+ * @section event_encoder_batch Batches
+ *
+ * Several events of one room can share a publish on the "batch" topic
+ * type. The JSON form is an array of the usual event objects. The binary
+ * form is the D9 D9 F7 tag followed by an array of event arrays, so its
+ * first element is an array where a single event has the version. Fields
+ * are only ever appended; a decoder ignores what it does not know and
+ * rejects versions it was not written for.
+ *
+ * @section event_encoder_signature Signatures
+ *
+ * With EVENT_SIGNING, encodeSignature() appends the first
+ * EVENT_SIGNATURE_SIZE bytes of HMAC-SHA256(key, topic, 0x00, payload)
+ * to the payload. JSON gets a newline and the MAC in lower-case hex,
+ * which compact JSON never contains. Binary gets a CBOR byte string after
+ * the top-level item, which a decoder reading one item skips.
+ */
+
+#ifndef EVENT_ENCODER_H
+#define EVENT_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "uid_index.h"
+#include "telemetry.h"
+
+// ---- Event types ----
+enum class EventType : uint8_t {
+  CheckIn  = 0,
+  CheckOut = 1,
+  Denied   = 2,
+  Alert    = 3
+};
+
+/**
+ * @brief Topic suffix for an event type ("attendance", "denied_access", "alerts")
+ */
+const char* eventTopicType(EventType type);
+
+/**
+ * @brief Identity of the reader, shared by every event it sends
+ */
+struct DeviceContext {
+  const char* building;
+  const char* floor;     ///< Maps to backend hotelId
+  const char* room;
+};
+
+/**
+ * @brief Typed events; seq is the journal sequence number the backend
+ *        uses to drop replayed duplicates
+ */
+struct CheckInEvent {
+  CardUid     uid;
+  Role        role;
+  const char* timestamp;
+  uint64_t    timeMs;            ///< Same instant as timestamp, for the binary payload
+  uint32_t    seq;
+};
+
+struct CheckOutEvent {
+  CardUid     uid;
+  Role        role;
+  const char* timestamp;
+  uint64_t    timeMs;
+  uint32_t    durationSec;
+  uint32_t    seq;
+};
+
+struct DeniedEvent {
+  CardUid     uid;
+  const char* reason;
+  const char* timestamp;
+  uint64_t    timeMs;
+  uint32_t    attempts;          ///< Presentations folded into this report
+  uint32_t    seq;
+};
+
+struct AlertEvent {
+  CardUid     uid;
+  const char* message;
+  const char* timestamp;
+  uint64_t    timeMs;
+  uint32_t    attempts;          ///< Attempts in the window when the alert was raised
+  uint32_t    seq;
+};
+
+/**
+ * @brief Write the topic for an event type into buf
+ * @return Topic length, or 0 if buf is too small
+ */
+size_t encodeTopic(const DeviceContext& ctx, EventType type, char* buf, size_t size);
+
+/**
+ * @brief Write the JSON payload for an event into buf
+ * @return Payload length, or 0 if buf is too small
+ */
+size_t encodePayload(const DeviceContext& ctx, const CheckInEvent& event, char* buf, size_t size);
+size_t encodePayload(const DeviceContext& ctx, const CheckOutEvent& event, char* buf, size_t size);
+size_t encodePayload(const DeviceContext& ctx, const DeniedEvent& event, char* buf, size_t size);
+size_t encodePayload(const DeviceContext& ctx, const AlertEvent& event, char* buf, size_t size);
+
+#define BINARY_PAYLOAD_VERSION 1
+#define BINARY_PAYLOAD_MAX_SIZE 40  ///< Largest binary event (10-byte UID, 32-bit counters)
+
+/**
+ * @brief Write the binary (CBOR) payload for an event into buf
+ * @return Payload length, or 0 if buf is too small
+ */
+size_t encodeBinaryPayload(const CheckInEvent& event, uint8_t* buf, size_t size);
+size_t encodeBinaryPayload(const CheckOutEvent& event, uint8_t* buf, size_t size);
+size_t encodeBinaryPayload(const DeniedEvent& event, uint8_t* buf, size_t size);
+size_t encodeBinaryPayload(const AlertEvent& event, uint8_t* buf, size_t size);
+
+/**
+ * @brief Binary batch: encodeBinaryBatch() writes the tag and item count,
+ *        each event follows as encodeBinaryBatchItem()
+ * @return Length written, or 0 if buf is too small
+ */
+size_t encodeBinaryBatch(size_t count, uint8_t* buf, size_t size);
+size_t encodeBinaryBatchItem(const CheckInEvent& event, uint8_t* buf, size_t size);
+size_t encodeBinaryBatchItem(const CheckOutEvent& event, uint8_t* buf, size_t size);
+size_t encodeBinaryBatchItem(const DeniedEvent& event, uint8_t* buf, size_t size);
+size_t encodeBinaryBatchItem(const AlertEvent& event, uint8_t* buf, size_t size);
+
+/**
+ * @brief Topic for a batch of events of one room
+ */
+size_t encodeBatchTopic(const DeviceContext& ctx, char* buf, size_t size);
+
+/**
+ * @brief Telemetry topic and payload; histograms are sent as
+ *        {"n":count,"sum":total,"b":[bucket counts]} with trailing empty buckets dropped
+ * @return Length written, or 0 if buf is too small
+ */
+size_t encodeTelemetryTopic(const DeviceContext& ctx, char* buf, size_t size);
+size_t encodeTelemetry(const DeviceContext& ctx, const TelemetryReport& report, char* buf, size_t size);
+
+#define EVENT_SIGNATURE_SIZE 16       ///< Truncated HMAC-SHA256 (bytes)
+#define EVENT_SIGNATURE_SPACE_JSON 33 ///< Newline and 32 hex digits
+#define EVENT_SIGNATURE_SPACE_BINARY 17
+
+/**
+ * @brief Append a signature to the payload of length bytes in buf
+ * @return New payload length, or 0 if buf is too small
+ */
+size_t encodeSignature(const uint8_t mac[EVENT_SIGNATURE_SIZE], bool binary,
+                       uint8_t* buf, size_t length, size_t size);
+
+#define TIMESTAMP_SIZE 24   ///< "YYYY-MM-DD HH:MM:SS.mmm" and its terminator
+
+/**
+ * @brief Local time as "YYYY-MM-DD HH:MM:SS.mmm" (buf >= TIMESTAMP_SIZE bytes)
+ *
+ * Times before NTP has set the clock come out as 1970-01-01 00:00:00.000.
+ * The date is converted once per day and cached per thread, so most calls
+ * are a handful of divisions.
+ */
+void formatTimestamp(uint32_t epoch, uint16_t millis, char* buf, size_t size);
+
+/**
+ * @brief Event type of a typed event, for encodeTopic()
+ */
+inline EventType eventType(const CheckInEvent&)  { return EventType::CheckIn; }
+inline EventType eventType(const CheckOutEvent&) { return EventType::CheckOut; }
+inline EventType eventType(const DeniedEvent&)   { return EventType::Denied; }
+inline EventType eventType(const AlertEvent&)    { return EventType::Alert; }
+
+#endif // EVENT_ENCODER_H
@@ -0,0 +1,298 @@
+/**
+ * @file event_journal.cpp
+ * @brief Crash-safe store-and-forward journal for card events
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "event_journal.h"
+#include "config.h"
+#include <string.h>
+
+#if defined(ARDUINO)
+#include <esp_partition.h>
+#else
+#include <stdio.h>
+#endif
+
+// ---- On-storage record (32 bytes) ----
+struct EventJournal::Record {
+  uint8_t  magic;
+  uint8_t  state;                ///< STATE_PENDING, cleared to STATE_DELIVERED
+  uint8_t  type;
+  uint8_t  role;
+  uint32_t seq;
+  uint32_t timestamp;
+  uint32_t duration;
+  uint8_t  uidSize;
+  uint8_t  uid[CARD_UID_MAX_SIZE];
+  uint8_t  reader;               ///< 0xFF in records from older firmware
+  uint16_t crc;                  ///< Over every byte except state and crc
+  uint16_t millis;               ///< Outside the CRC; 0xFFFF in records from older firmware
+};
+
+namespace {
+
+const uint8_t RECORD_MAGIC    = 0xA5;
+const uint8_t STATE_PENDING   = 0xFF;
+const uint8_t STATE_DELIVERED = 0x00;
+const size_t  RECORD_SIZE     = 32;
+
+uint16_t crc16(uint16_t crc, const uint8_t* data, size_t length) {
+  while (length--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+template <typename Record>
+uint16_t recordCrc(const Record& r) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&r);
+  uint16_t crc = crc16(0xFFFF, bytes, 1);
+  return crc16(crc, bytes + 2, offsetof(Record, crc) - 2);
+}
+
+} // namespace
+
+// ---- Storage backends ----
+#if defined(ARDUINO)
+
+FlashJournalStorage::FlashJournalStorage(const char* label)
+  : label_(label), partition_(nullptr) {}
+
+bool FlashJournalStorage::begin() {
+  partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY, label_);
+  return partition_ != nullptr;
+}
+
+size_t FlashJournalStorage::size() const {
+  return partition_ ? static_cast<const esp_partition_t*>(partition_)->size : 0;
+}
+
+size_t FlashJournalStorage::sectorSize() const {
+  return SPI_FLASH_SEC_SIZE;
+}
+
+bool FlashJournalStorage::read(size_t offset, void* data, size_t length) {
+  return esp_partition_read(static_cast<const esp_partition_t*>(partition_),
+                            offset, data, length) == ESP_OK;
+}
+
+bool FlashJournalStorage::write(size_t offset, const void* data, size_t length) {
+  return esp_partition_write(static_cast<const esp_partition_t*>(partition_),
+                             offset, data, length) == ESP_OK;
+}
+
+bool FlashJournalStorage::eraseSector(size_t offset) {
+  return esp_partition_erase_range(static_cast<const esp_partition_t*>(partition_),
+                                   offset, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
+
+#else
+
+FileJournalStorage::FileJournalStorage(const char* path, size_t size, size_t sectorSize)
+  : path_(path), size_(size - size % sectorSize), sectorSize_(sectorSize), file_(nullptr) {}
+
+FileJournalStorage::~FileJournalStorage() {
+  if (file_) fclose(static_cast<FILE*>(file_));
+}
+
+bool FileJournalStorage::begin() {
+  FILE* f = fopen(path_, "r+b");
+  if (f == nullptr) {
+    // New journal: start from an erased image, as flash would
+    f = fopen(path_, "w+b");
+    if (f == nullptr) return false;
+    file_ = f;
+    for (size_t offset = 0; offset < size_; offset += sectorSize_) {
+      if (!eraseSector(offset)) return false;
+    }
+    return true;
+  }
+  file_ = f;
+  return true;
+}
+
+bool FileJournalStorage::read(size_t offset, void* data, size_t length) {
+  FILE* f = static_cast<FILE*>(file_);
+  if (f == nullptr || offset + length > size_) return false;
+  if (fseek(f, (long)offset, SEEK_SET) != 0) return false;
+  if (fread(data, 1, length, f) != length) {
+    // Past the end of a short file reads as erased
+    memset(data, 0xFF, length);
+  }
+  return true;
+}
+
+bool FileJournalStorage::write(size_t offset, const void* data, size_t length) {
+  FILE* f = static_cast<FILE*>(file_);
+  if (f == nullptr || offset + length > size_) return false;
+  if (fseek(f, (long)offset, SEEK_SET) != 0) return false;
+  if (fwrite(data, 1, length, f) != length) return false;
+  return fflush(f) == 0;
+}
+
+bool FileJournalStorage::eraseSector(size_t offset) {
+  uint8_t blank[256];
+  memset(blank, 0xFF, sizeof(blank));
+  for (size_t done = 0; done < sectorSize_; done += sizeof(blank)) {
+    size_t chunk = sectorSize_ - done < sizeof(blank) ? sectorSize_ - done : sizeof(blank);
+    if (!write(offset + done, blank, chunk)) return false;
+  }
+  return true;
+}
+
+#endif
+
+// ---- Journal ----
+EventJournal::EventJournal(JournalStorage& storage)
+  : storage_(storage),
+    slots_(0),
+    slotsPerSector_(0),
+    head_(1),
+    tail_(1),
+    cursor_(1),
+    dropped_(0) {}
+
+bool EventJournal::begin() {
+  static_assert(sizeof(Record) == RECORD_SIZE, "Journal record must be 32 bytes");
+  if (!storage_.begin()) return false;
+
+  slots_ = storage_.size() / RECORD_SIZE;
+  slotsPerSector_ = storage_.sectorSize() / RECORD_SIZE;
+  // Need at least one sector to write into while another holds history
+  if (slotsPerSector_ == 0 || slots_ < 2 * slotsPerSector_) return false;
+
+  // The newest valid record marks the write position
+  uint32_t newest = 0;
+  for (size_t slot = 0; slot < slots_; slot++) {
+    Record record;
+    if (!storage_.read(slot * RECORD_SIZE, &record, sizeof(record))) return false;
+    if (record.magic != RECORD_MAGIC || record.crc != recordCrc(record)) continue;
+    if (record.seq % slots_ != slot) continue;
+    if (record.seq > newest) newest = record.seq;
+  }
+  head_ = newest + 1;
+
+  // The oldest undelivered record still in the ring marks the replay position
+  uint32_t oldest = head_ > slots_ ? head_ - (uint32_t)slots_ : 1;
+  tail_ = head_;
+  for (uint32_t seq = oldest; seq < head_; seq++) {
+    if (!isDelivered(seq)) {
+      tail_ = seq;
+      break;
+    }
+  }
+  cursor_ = tail_;
+  return true;
+}
+
+bool EventJournal::append(JournalEntry& entry) {
+  if (slots_ == 0) return false;
+
+  for (;;) {
+    size_t offset = offsetOf(head_);
+
+    if (offset % storage_.sectorSize() == 0) {
+      // Entering a sector: whatever it holds is a full ring older
+      uint32_t sectorEnd = head_ + (uint32_t)slotsPerSector_;
+      if (sectorEnd > slots_ + tail_) {
+        uint32_t newTail = sectorEnd - (uint32_t)slots_;
+        dropped_ += newTail - tail_;
+        tail_ = newTail;
+        if (cursor_ < tail_) cursor_ = tail_;
+      }
+      if (!storage_.eraseSector(offset)) return false;
+      break;
+    }
+
+    // Mid-sector slots are erased already unless a write was torn by a reset
+    Record existing;
+    if (!storage_.read(offset, &existing, sizeof(existing))) return false;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&existing);
+    bool blank = true;
+    for (size_t i = 0; i < sizeof(existing); i++) {
+      if (bytes[i] != 0xFF) blank = false;
+    }
+    if (blank) break;
+
+    if (tail_ == head_) tail_++;
+    if (cursor_ == head_) cursor_++;
+    head_++;
+  }
+
+  Record record;
+  memset(&record, 0xFF, sizeof(record));
+  record.magic = RECORD_MAGIC;
+  record.state = STATE_PENDING;
+  record.type = static_cast<uint8_t>(entry.type);
+  record.role = static_cast<uint8_t>(entry.role);
+  record.seq = head_;
+  record.timestamp = entry.timestamp;
+  record.duration = entry.duration;
+  record.millis = entry.millis;
+  record.reader = entry.reader;
+  record.uidSize = entry.uid.size;
+  memcpy(record.uid, entry.uid.bytes, entry.uid.size);
+  record.crc = recordCrc(record);
+
+  if (!storage_.write(offsetOf(head_), &record, sizeof(record))) return false;
+
+  entry.seq = head_++;
+  return true;
+}
+
+bool EventJournal::next(JournalEntry& entry) {
+  while (cursor_ < head_) {
+    uint32_t seq = cursor_++;
+    Record record;
+    if (!readRecord(seq, record) || record.state != STATE_PENDING) continue;
+
+    entry.seq = record.seq;
+    entry.type = static_cast<EventType>(record.type);
+    entry.role = static_cast<Role>(record.role);
+    entry.uid.size = record.uidSize;
+    memcpy(entry.uid.bytes, record.uid, sizeof(record.uid));
+    entry.timestamp = record.timestamp;
+    entry.duration = record.duration;
+    entry.millis = record.millis < 1000 ? record.millis : 0;
+    entry.reader = record.reader < MAX_RFID_READERS ? record.reader : 0;
+    return true;
+  }
+  return false;
+}
+
+void EventJournal::markDelivered(uint32_t seq) {
+  if (seq < tail_ || seq >= head_) return;
+
+  const uint8_t delivered = STATE_DELIVERED;
+  storage_.write(offsetOf(seq) + offsetof(Record, state), &delivered, 1);
+
+  // Acknowledgements normally arrive in order; release the tail past them
+  while (tail_ < cursor_ && isDelivered(tail_)) tail_++;
+}
+
+void EventJournal::rewind() {
+  cursor_ = tail_;
+}
+
+size_t EventJournal::offsetOf(uint32_t seq) const {
+  return (seq % slots_) * RECORD_SIZE;
+}
+
+bool EventJournal::readRecord(uint32_t seq, Record& record) {
+  if (!storage_.read(offsetOf(seq), &record, sizeof(record))) return false;
+  return record.magic == RECORD_MAGIC && record.seq == seq &&
+         record.crc == recordCrc(record) && record.uidSize <= CARD_UID_MAX_SIZE;
+}
+
+bool EventJournal::isDelivered(uint32_t seq) {
+  // Missing or torn records have nothing left to deliver
+  Record record;
+  return !readRecord(seq, record) || record.state != STATE_PENDING;
+}
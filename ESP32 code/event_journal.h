@@ -0,0 +1,175 @@
+/**
+ * @file event_journal.h
+ * @brief Crash-safe store-and-forward journal for card events
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section event_journal_overview Overview
+ *
+ * Every card event is appended to a bounded ring of fixed-size 32-byte
+ * records before it is published, and is only released once the broker
+ * has acknowledged it. Events raised while WiFi or the WebSocket is down
+ * therefore wait in the journal and are replayed in order on reconnect.
+ *
+ * Each record carries a sequence number that also fixes its slot
+ * (slot = seq % capacity), so recovery after a reset is a single scan:
+ * the highest valid sequence is the write position and the lowest
+ * undelivered one is the replay position. A CRC guards against records
+ * torn by a power loss. The backend uses the sequence number to drop
+ * duplicates of events replayed after a lost PUBACK.
+ *
+ * Storage is abstracted by JournalStorage: a flash partition on the ESP32,
+ * a plain file on the Linux host.
+ */
+
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "uid_index.h"
+#include "event_encoder.h"
+
+// ---- Storage abstraction ----
+class JournalStorage {
+public:
+  virtual ~JournalStorage() {}
+
+  virtual bool   begin() = 0;
+  virtual size_t size() const = 0;
+  virtual size_t sectorSize() const = 0;
+
+  virtual bool read(size_t offset, void* data, size_t length) = 0;
+
+  /**
+   * @brief Program bytes; like NOR flash, only 1 -> 0 bit changes are
+   *        guaranteed without a preceding erase
+   */
+  virtual bool write(size_t offset, const void* data, size_t length) = 0;
+
+  /**
+   * @brief Reset one whole sector to 0xFF
+   */
+  virtual bool eraseSector(size_t offset) = 0;
+};
+
+#if defined(ARDUINO)
+
+/**
+ * @brief Journal kept in a data partition (see partitions.csv)
+ */
+class FlashJournalStorage : public JournalStorage {
+public:
+  explicit FlashJournalStorage(const char* label);
+
+  bool   begin() override;
+  size_t size() const override;
+  size_t sectorSize() const override;
+  bool   read(size_t offset, void* data, size_t length) override;
+  bool   write(size_t offset, const void* data, size_t length) override;
+  bool   eraseSector(size_t offset) override;
+
+private:
+  const char* label_;
+  const void* partition_;        ///< esp_partition_t, kept opaque here
+};
+
+#else
+
+/**
+ * @brief Journal kept in a regular file, for running on the Linux host
+ */
+class FileJournalStorage : public JournalStorage {
+public:
+  FileJournalStorage(const char* path, size_t size, size_t sectorSize = 4096);
+  ~FileJournalStorage() override;
+
+  bool   begin() override;
+  size_t size() const override { return size_; }
+  size_t sectorSize() const override { return sectorSize_; }
+  bool   read(size_t offset, void* data, size_t length) override;
+  bool   write(size_t offset, const void* data, size_t length) override;
+  bool   eraseSector(size_t offset) override;
+
+private:
+  const char* path_;
+  size_t      size_;
+  size_t      sectorSize_;
+  void*       file_;             ///< FILE*
+};
+
+#endif
+
+// ---- Journal ----
+
+/**
+ * @brief Card event in the compact form kept by the journal
+ */
+struct JournalEntry {
+  uint32_t  seq;                 ///< Assigned by append()
+  EventType type;
+  Role      role;
+  CardUid   uid;
+  uint32_t  timestamp;           ///< Unix time (s), or a WallClock stamp before NTP
+  uint32_t  duration;            ///< Check-out: time present (s); denied/alert: attempts
+  uint16_t  millis;              ///< Sub-second part of timestamp
+  uint8_t   reader;              ///< Row of RFID_READERS (room) that saw the card
+};
+
+class EventJournal {
+public:
+  explicit EventJournal(JournalStorage& storage);
+
+  /**
+   * @brief Mount the storage and recover positions from its contents
+   */
+  bool begin();
+
+  /**
+   * @brief Append an event and assign its sequence number
+   *
+   * When the ring is full the oldest sector of undelivered events is
+   * discarded to make room (counted in dropped()).
+   *
+   * @return false if the storage could not be written
+   */
+  bool append(JournalEntry& entry);
+
+  /**
+   * @brief Fetch the next event that has not been handed out for sending
+   * @return false when every stored event has been handed out
+   */
+  bool next(JournalEntry& entry);
+
+  /**
+   * @brief Broker acknowledged an event; it will not be replayed again
+   */
+  void markDelivered(uint32_t seq);
+
+  /**
+   * @brief Connection lost: hand out every undelivered event again
+   */
+  void rewind();
+
+  size_t   pending() const { return head_ - tail_; }
+  size_t   capacity() const { return slots_; }
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  struct Record;
+
+  size_t offsetOf(uint32_t seq) const;
+  bool   readRecord(uint32_t seq, Record& record);
+  bool   isDelivered(uint32_t seq);
+
+  JournalStorage& storage_;
+  size_t   slots_;
+  size_t   slotsPerSector_;
+  uint32_t head_;                ///< Next sequence number to write
+  uint32_t tail_;                ///< Oldest undelivered sequence number
+  uint32_t cursor_;              ///< Next sequence number to hand out
+  uint32_t dropped_;
+};
+
+#endif // EVENT_JOURNAL_H
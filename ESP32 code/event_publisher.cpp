@@ -0,0 +1,286 @@
+/**
+ * @file event_publisher.cpp
+ * @brief Journal-backed publish path from card event to MQTT frame
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "event_publisher.h"
+#include <string.h>
+
+EventPublisher::EventPublisher(const DeviceContext& ctx, MqttClient& mqtt)
+  : EventPublisher(&ctx, 1, mqtt) {}
+
+EventPublisher::EventPublisher(const DeviceContext* rooms, size_t roomCount, MqttClient& mqtt)
+  : rooms_(rooms), roomCount_(roomCount), mqtt_(mqtt), journal_(nullptr), clock_(nullptr), signer_(nullptr), holdStartMs_(0),
+    windowStartMs_(0), published_(nullptr),
+    format_(EVENT_PAYLOAD_CBOR ? PayloadFormat::Binary : PayloadFormat::Json),
+    carry_(), hasCarry_(false), unsendable_(0), pendingAcks_() {}
+
+RecordResult EventPublisher::record(const JournalEntry& entry, uint32_t nowMs) {
+  JournalEntry stored = entry;
+  if (journal_ == nullptr || !journal_->append(stored)) {
+    return publish(entry, nowMs) == Sent::Ok ? RecordResult::Direct : RecordResult::Lost;
+  }
+
+  // Cards often come in groups (shift change, several doors on one board);
+  // a short wait lets them share one publish
+  if (PUBLISH_BATCH_WINDOW > 0 && windowStartMs_ == 0) windowStartMs_ = nowMs | 1;
+  drain(nowMs);
+  return RecordResult::Journaled;
+}
+
+void EventPublisher::drain(uint32_t nowMs) {
+  if (journal_ == nullptr || !online()) return;
+
+  // NTP usually answers right after the session comes up; waiting for it
+  // sends events recorded before it with their real time
+  if (clock_ != nullptr && !clock_->synced()) {
+    if (holdStartMs_ == 0) holdStartMs_ = nowMs | 1;
+    if ((int32_t)(nowMs - holdStartMs_) < NTP_HOLD_TIMEOUT) return;
+  }
+
+  if (windowStartMs_ != 0) {
+    if ((int32_t)(nowMs - windowStartMs_) < PUBLISH_BATCH_WINDOW &&
+        journal_->pending() < PUBLISH_BATCH_MAX) {
+      return;
+    }
+    windowStartMs_ = 0;
+  }
+
+  // Keep up to MQTT_MAX_INFLIGHT publishes in flight instead of waiting
+  // for each PUBACK; bounded per call so other tasks are not starved
+  JournalEntry entry;
+  for (int sent = 0; sent < JOURNAL_DRAIN_BATCH; sent++) {
+    if (MQTT_QOS > 0 && mqtt_.inflight() >= MQTT_MAX_INFLIGHT) break;
+    if (!nextEntry(entry)) break;
+    // An unsendable event is already released; the ones behind it go on
+    if (publishBatch(entry, nowMs) == Sent::Retry) {
+      hasCarry_ = false;
+      journal_->rewind();
+      break;
+    }
+  }
+}
+
+void EventPublisher::onAck(uint16_t packetId) {
+  for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (pendingAcks_[i].packetId == packetId) {
+      if (journal_) markDelivered(pendingAcks_[i].firstSeq, pendingAcks_[i].lastSeq);
+      pendingAcks_[i].packetId = 0;
+      return;
+    }
+  }
+}
+
+void EventPublisher::connectionLost() {
+  mqtt_.disconnected();
+  memset(pendingAcks_, 0, sizeof(pendingAcks_));
+  hasCarry_ = false;
+  if (journal_) journal_->rewind();
+}
+
+bool EventPublisher::nextEntry(JournalEntry& entry) {
+  if (hasCarry_) {
+    entry = carry_;
+    hasCarry_ = false;
+    return true;
+  }
+  return journal_->next(entry);
+}
+
+void EventPublisher::putBack(const JournalEntry& entry) {
+  carry_ = entry;
+  hasCarry_ = true;
+}
+
+void EventPublisher::markDelivered(uint32_t firstSeq, uint32_t lastSeq) {
+  for (uint32_t seq = firstSeq; seq != lastSeq + 1; seq++) journal_->markDelivered(seq);
+}
+
+const DeviceContext& EventPublisher::roomOf(const JournalEntry& entry) const {
+  return rooms_[entry.reader < roomCount_ ? entry.reader : 0];
+}
+
+EventPublisher::Sent EventPublisher::publish(const JournalEntry& entry, uint32_t nowMs) {
+  if (!online()) return Sent::Retry;
+
+  const DeviceContext& ctx = roomOf(entry);
+  char topic[64];
+  size_t topicLength = encodeTopic(ctx, entry.type, topic, sizeof(topic));
+
+  // Payload is encoded in place behind the space reserved for the MQTT headers
+  uint8_t frame[EVENT_FRAME_SIZE];
+  size_t reserve = MqttClient::publishHeaderSize(topicLength, MQTT_QOS);
+  size_t space = signatureSpace(format_ == PayloadFormat::Binary);
+  size_t payloadLength = encode(ctx, entry, false, frame + reserve, sizeof(frame) - reserve - space);
+  return send(topic, topicLength, frame, sizeof(frame), reserve, payloadLength,
+              entry.seq, entry.seq, nowMs);
+}
+
+EventPublisher::Sent EventPublisher::publishBatch(const JournalEntry& first, uint32_t nowMs) {
+  // A batch needs a second event from the same room; anything else goes
+  // out on its usual topic
+  JournalEntry item;
+  if (!nextEntry(item)) return publish(first, nowMs);
+  putBack(item);
+  if (item.reader != first.reader) return publish(first, nowMs);
+
+  const DeviceContext& ctx = roomOf(first);
+  char topic[64];
+  size_t topicLength = encodeBatchTopic(ctx, topic, sizeof(topic));
+
+  uint8_t frame[BATCH_FRAME_SIZE];
+  size_t reserve = MqttClient::publishHeaderSize(topicLength, MQTT_QOS);
+  uint8_t* payload = frame + reserve;
+  bool binary = format_ == PayloadFormat::Binary;
+  // Room for the closing ']' and the signature
+  size_t capacity = sizeof(frame) - reserve - 1 - signatureSpace(binary);
+
+  // The binary header is one byte per count below 24, so it is patched
+  // once the count is known
+  size_t length = binary ? encodeBinaryBatch(PUBLISH_BATCH_MAX, payload, capacity) : 1;
+  if (!binary) payload[0] = '[';
+
+  size_t count = 0;
+  uint32_t lastSeq = first.seq;
+  item = first;
+  for (;;) {
+    size_t separator = !binary && count > 0 ? 1 : 0;
+    size_t n = length + separator < capacity
+        ? encode(ctx, item, true, payload + length + separator, capacity - length - separator)
+        : 0;
+    if (n == 0) {
+      // Does not fit: it leads the next publish. One that does not fit an
+      // empty batch never will, and send() drops it.
+      if (count > 0) putBack(item);
+      break;
+    }
+    if (separator) payload[length] = ',';
+    length += separator + n;
+    lastSeq = item.seq;
+
+    if (++count == PUBLISH_BATCH_MAX || !nextEntry(item)) break;
+    if (item.reader != first.reader) {
+      putBack(item);
+      break;
+    }
+  }
+
+  if (binary) {
+    encodeBinaryBatch(count, payload, capacity);
+  } else {
+    payload[length++] = ']';
+  }
+  return send(topic, topicLength, frame, sizeof(frame), reserve, count > 0 ? length : 0,
+              first.seq, lastSeq, nowMs);
+}
+
+EventPublisher::Sent EventPublisher::send(const char* topic, size_t topicLength, uint8_t* frame,
+                                          size_t frameSize, size_t reserve, size_t payloadLength,
+                                          uint32_t firstSeq, uint32_t lastSeq, uint32_t nowMs) {
+  if (signer_ != nullptr && payloadLength > 0) {
+    payloadLength = sign(topic, topicLength, frame + reserve, payloadLength, frameSize - reserve,
+                         format_ == PayloadFormat::Binary);
+  }
+  if (topicLength == 0 || payloadLength == 0) {
+    if (published_) published_(topic, nullptr, 0, false);
+    // Sending it again cannot help, and a rewind would put it in front of
+    // every later event
+    unsendable_ += lastSeq - firstSeq + 1;
+    if (firstSeq != 0 && journal_ != nullptr) markDelivered(firstSeq, lastSeq);
+    return Sent::Unsendable;
+  }
+
+  uint16_t packetId = 0;
+  bool success = mqtt_.publish(topic, topicLength, frame, frameSize, payloadLength,
+                               MQTT_QOS, MQTT_RETAIN, nowMs, &packetId);
+  if (published_) published_(topic, frame + reserve, payloadLength, success);
+  if (!success) return Sent::Retry;
+  if (firstSeq == 0 || journal_ == nullptr) return Sent::Ok;
+
+  if (packetId == 0) {
+    // QoS 0: handing the frame to the socket is all the delivery we get
+    markDelivered(firstSeq, lastSeq);
+    return Sent::Ok;
+  }
+  for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (pendingAcks_[i].packetId == 0) {
+      pendingAcks_[i] = {packetId, firstSeq, lastSeq};
+      break;
+    }
+  }
+  return Sent::Ok;
+}
+
+size_t EventPublisher::sign(const char* topic, size_t topicLength, uint8_t* payload, size_t length,
+                            size_t size, bool binary) {
+  static const uint8_t separator = 0;
+  uint8_t mac[HMAC_SHA256_SIZE];
+  signer_->begin();
+  signer_->update(topic, topicLength);
+  signer_->update(&separator, 1);
+  signer_->update(payload, length);
+  signer_->finish(mac);
+  return encodeSignature(mac, binary, payload, length, size);
+}
+
+template <typename Event>
+size_t EventPublisher::encodeEvent(const DeviceContext& ctx, const Event& event, bool batched,
+                                   uint8_t* buf, size_t size) const {
+  if (format_ == PayloadFormat::Json) return encodePayload(ctx, event, (char*)buf, size);
+  return batched ? encodeBinaryBatchItem(event, buf, size) : encodeBinaryPayload(event, buf, size);
+}
+
+size_t EventPublisher::encode(const DeviceContext& ctx, const JournalEntry& entry, bool batched,
+                              uint8_t* buf, size_t size) const {
+  uint32_t epoch = entry.timestamp;
+  uint16_t millis = entry.millis;
+  if (clock_ != nullptr) {
+    uint64_t epochUs = clock_->resolve({entry.timestamp, entry.millis});
+    epoch = (uint32_t)(epochUs / 1000000);
+    millis = (uint16_t)(epochUs / 1000 % 1000);
+  }
+  // Unresolved stamps go out as 0, like the 1970 placeholder in JSON
+  uint64_t timeMs = (epoch & UNSYNCED_STAMP) != 0 ? 0 : (uint64_t)epoch * 1000 + millis % 1000;
+  char timestamp[TIMESTAMP_SIZE] = "";
+  if (format_ == PayloadFormat::Json) formatTimestamp(epoch, millis, timestamp, sizeof(timestamp));
+
+  // Entries journaled before attempts were counted carry 0
+  uint32_t attempts = entry.duration > 0 ? entry.duration : 1;
+
+  switch (entry.type) {
+    case EventType::CheckIn:
+      return encodeEvent(ctx, CheckInEvent{entry.uid, entry.role, timestamp, timeMs, entry.seq},
+                         batched, buf, size);
+    case EventType::CheckOut:
+      return encodeEvent(ctx, CheckOutEvent{entry.uid, entry.role, timestamp, timeMs, entry.duration, entry.seq},
+                         batched, buf, size);
+    case EventType::Denied:
+      return encodeEvent(ctx, DeniedEvent{entry.uid, "Unauthorized card", timestamp, timeMs, attempts, entry.seq},
+                         batched, buf, size);
+    case EventType::Alert:
+      return encodeEvent(ctx, AlertEvent{entry.uid, "Repeated unauthorized access attempts", timestamp, timeMs, attempts, entry.seq},
+                         batched, buf, size);
+  }
+  return 0;
+}
+
+bool EventPublisher::publishTelemetry(const TelemetryReport& report, uint32_t nowMs) {
+  if (!online()) return false;
+
+  char topic[64];
+  size_t topicLength = encodeTelemetryTopic(rooms_[0], topic, sizeof(topic));
+
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+  size_t reserve = MqttClient::publishHeaderSize(topicLength, 0);
+  size_t payloadLength = encodeTelemetry(rooms_[0], report, (char*)frame + reserve,
+                                         sizeof(frame) - reserve - signatureSpace(false));
+  if (signer_ != nullptr && payloadLength > 0) {
+    payloadLength = sign(topic, topicLength, frame + reserve, payloadLength, sizeof(frame) - reserve, false);
+  }
+  if (topicLength == 0 || payloadLength == 0) return false;
+
+  return mqtt_.publish(topic, topicLength, frame, sizeof(frame), payloadLength, 0, false, nowMs);
+}
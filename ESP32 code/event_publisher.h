@@ -0,0 +1,186 @@
+/**
+ * @file event_publisher.h
+ * @brief Journal-backed publish path from card event to MQTT frame
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section event_publisher_overview Overview
+ *
+ * Owns the path every card event takes on the network side: append to the
+ * journal, encode topic and payload in place, publish through MqttClient,
+ * and release the journal record once the broker acknowledges it. Keeps
+ * up to MQTT_MAX_INFLIGHT QoS 1 publishes outstanding. A board with
+ * several readers passes one DeviceContext per reader, and each event goes
+ * out under the room of the reader that saw it.
+ *
+ * Events recorded before NTP carry a WallClock stamp. With a clock
+ * attached, they are published with the Unix time it resolves to, and the
+ * journal replay waits up to NTP_HOLD_TIMEOUT for the clock to be set.
+ *
+ * Payloads are JSON, or the binary format from event_encoder.h when
+ * EVENT_PAYLOAD_CBOR is set; the backend accepts either on any topic.
+ * With a signer attached, every payload ends in its signature.
+ *
+ * A new event waits up to PUBLISH_BATCH_WINDOW for company. Consecutive
+ * journal events of one room, up to PUBLISH_BATCH_MAX, then go out as one
+ * "batch" publish with a single PUBACK; an event on its own keeps its
+ * usual topic. Journal replays after an outage batch the same way.
+ *
+ * A publish that fails for lack of a session or of an inflight slot is
+ * retried from the journal. An event that cannot be encoded into a frame
+ * at all, such as a damaged journal record, never will be: it is released
+ * from the journal and counted in unsendable() so it does not hold up the
+ * events behind it.
+ *
+ * Like MqttClient it never touches the network; the transport and the
+ * clock come from the caller, so the same code runs on the host.
+ */
+
+#ifndef EVENT_PUBLISHER_H
+#define EVENT_PUBLISHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+#include "event_encoder.h"
+#include "event_journal.h"
+#include "hmac_sha256.h"
+#include "mqtt_client.h"
+#include "wall_clock.h"
+
+enum class PayloadFormat : uint8_t {
+  Json,
+  Binary       ///< CBOR, see encodeBinaryPayload()
+};
+
+enum class RecordResult : uint8_t {
+  Journaled,   ///< Stored; sent now if online, otherwise replayed on reconnect
+  Direct,      ///< No journal to store it in; published without redelivery
+  Lost         ///< No journal and the publish failed
+};
+
+class EventPublisher {
+public:
+  /**
+   * @brief Observer for every publish attempt
+   * @param payload Encoded payload (JSON text or binary), or nullptr if the event did not fit
+   */
+  typedef void (*PublishedFn)(const char* topic, const uint8_t* payload, size_t length,
+                              bool success);
+
+  EventPublisher(const DeviceContext& ctx, MqttClient& mqtt);
+
+  /**
+   * @param rooms One context per reader, indexed by JournalEntry::reader;
+   *              telemetry goes out under the first
+   */
+  EventPublisher(const DeviceContext* rooms, size_t roomCount, MqttClient& mqtt);
+
+  /**
+   * @brief Journal to store events in; nullptr publishes them directly
+   */
+  void attachJournal(EventJournal* journal) { journal_ = journal; }
+
+  /**
+   * @brief Clock that resolves pre-NTP stamps; nullptr publishes them as-is
+   */
+  void attachClock(const WallClock* clock) { clock_ = clock; }
+
+  /**
+   * @brief Key every publish is signed with (EVENT_SIGNING); nullptr sends them unsigned
+   */
+  void attachSigner(HmacSha256* signer) { signer_ = signer; }
+  void onPublished(PublishedFn fn) { published_ = fn; }
+
+  /**
+   * @brief Encoding for events published from now on; defaults to EVENT_PAYLOAD_CBOR
+   */
+  void setPayloadFormat(PayloadFormat format) { format_ = format; }
+
+  /**
+   * @brief Store an event and send it if the session is up
+   */
+  RecordResult record(const JournalEntry& entry, uint32_t nowMs);
+
+  /**
+   * @brief Send journaled events, up to JOURNAL_DRAIN_BATCH publishes per call
+   */
+  void drain(uint32_t nowMs);
+
+  /**
+   * @brief Send a telemetry report at QoS 0; never journaled
+   * @return false if offline or the report exceeds TELEMETRY_FRAME_SIZE
+   */
+  bool publishTelemetry(const TelemetryReport& report, uint32_t nowMs);
+
+  /**
+   * @brief PUBACK received; hook up with MqttClient::onAck()
+   */
+  void onAck(uint16_t packetId);
+
+  /**
+   * @brief Transport dropped; everything unacknowledged will be replayed
+   */
+  void connectionLost();
+
+  bool online() const { return mqtt_.connected(); }
+
+  /**
+   * @brief Events dropped since boot because they do not encode into a frame
+   */
+  uint32_t unsendable() const { return unsendable_; }
+
+private:
+  /// How a publish attempt ended
+  enum class Sent : uint8_t {
+    Ok,
+    Retry,         ///< Offline or no inflight slot; the same events can go later
+    Unsendable     ///< Does not encode; the events were released and counted
+  };
+
+  struct PendingAck {
+    uint16_t packetId;
+    uint32_t firstSeq;    ///< Journal events the publish carried
+    uint32_t lastSeq;
+  };
+
+  bool nextEntry(JournalEntry& entry);
+  void putBack(const JournalEntry& entry);
+  void markDelivered(uint32_t firstSeq, uint32_t lastSeq);
+  const DeviceContext& roomOf(const JournalEntry& entry) const;
+
+  Sent publish(const JournalEntry& entry, uint32_t nowMs);
+  Sent publishBatch(const JournalEntry& first, uint32_t nowMs);
+  Sent send(const char* topic, size_t topicLength, uint8_t* frame, size_t frameSize,
+            size_t reserve, size_t payloadLength, uint32_t firstSeq, uint32_t lastSeq,
+            uint32_t nowMs);
+  size_t sign(const char* topic, size_t topicLength, uint8_t* payload, size_t length,
+              size_t size, bool binary);
+  size_t signatureSpace(bool binary) const {
+    if (signer_ == nullptr) return 0;
+    return binary ? EVENT_SIGNATURE_SPACE_BINARY : EVENT_SIGNATURE_SPACE_JSON;
+  }
+  size_t encode(const DeviceContext& ctx, const JournalEntry& entry, bool batched,
+                uint8_t* buf, size_t size) const;
+  template <typename Event>
+  size_t encodeEvent(const DeviceContext& ctx, const Event& event, bool batched,
+                     uint8_t* buf, size_t size) const;
+
+  const DeviceContext* rooms_;
+  size_t               roomCount_;
+  MqttClient&          mqtt_;
+  EventJournal*        journal_;
+  const WallClock*     clock_;
+  HmacSha256*          signer_;
+  uint32_t             holdStartMs_;    ///< First online drain without a clock, 0 before
+  uint32_t             windowStartMs_;  ///< First event of the open batch window, 0 if none
+  PublishedFn          published_;
+  PayloadFormat        format_;
+  JournalEntry         carry_;          ///< Taken from the journal, leads the next publish
+  bool                 hasCarry_;
+  uint32_t             unsendable_;
+  PendingAck           pendingAcks_[MQTT_MAX_INFLIGHT];
+};
+
+#endif // EVENT_PUBLISHER_H
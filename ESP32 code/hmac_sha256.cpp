@@ -0,0 +1,219 @@
+/**
+ * @file hmac_sha256.cpp
+ * @brief HMAC-SHA256 with the key set once, for card checks and event signatures
+ */
+
+#include "hmac_sha256.h"
+#include <string.h>
+
+namespace {
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+} // namespace
+
+bool HmacSha256::setHexKey(const char* text) {
+  size_t digits = strlen(text);
+  if (digits == 0 || digits % 2 != 0 || digits > 2 * HMAC_KEY_MAX) return false;
+
+  uint8_t key[HMAC_KEY_MAX];
+  for (size_t i = 0; i < digits / 2; i++) {
+    int high = hexDigit(text[2 * i]);
+    int low = hexDigit(text[2 * i + 1]);
+    if (high < 0 || low < 0) return false;
+    key[i] = (uint8_t)(high << 4 | low);
+  }
+  bool ok = setKey(key, digits / 2);
+  memset(key, 0, sizeof(key));
+  return ok;
+}
+
+bool HmacSha256::equal(const uint8_t* a, const uint8_t* b, size_t length) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < length; i++) diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+#if defined(ARDUINO)
+
+HmacSha256::HmacSha256() : ready_(false) {
+  mbedtls_md_init(&md_);
+}
+
+HmacSha256::~HmacSha256() {
+  mbedtls_md_free(&md_);
+}
+
+bool HmacSha256::setKey(const uint8_t* key, size_t length) {
+  ready_ = false;
+  if (length == 0 || length > HMAC_KEY_MAX) return false;
+  mbedtls_md_free(&md_);
+  mbedtls_md_init(&md_);
+  if (mbedtls_md_setup(&md_, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) return false;
+  ready_ = mbedtls_md_hmac_starts(&md_, key, length) == 0;
+  return ready_;
+}
+
+void HmacSha256::begin() {
+  // Starts over from the stored key ^ ipad block; the accelerator does the rest
+  mbedtls_md_hmac_reset(&md_);
+}
+
+void HmacSha256::update(const void* data, size_t length) {
+  mbedtls_md_hmac_update(&md_, (const unsigned char*)data, length);
+}
+
+void HmacSha256::finish(uint8_t out[HMAC_SHA256_SIZE]) {
+  mbedtls_md_hmac_finish(&md_, out);
+}
+
+#else
+
+namespace {
+
+const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+} // namespace
+
+HmacSha256::HmacSha256() : ready_(false), inner_(), outer_(), work_() {}
+
+HmacSha256::~HmacSha256() {
+  memset(&inner_, 0, sizeof(inner_));
+  memset(&outer_, 0, sizeof(outer_));
+}
+
+bool HmacSha256::setKey(const uint8_t* key, size_t length) {
+  ready_ = false;
+  if (length == 0 || length > HMAC_KEY_MAX) return false;
+
+  uint8_t pad[64];
+  memset(pad, 0x36, sizeof(pad));
+  for (size_t i = 0; i < length; i++) pad[i] ^= key[i];
+  sha256Init(inner_);
+  sha256Update(inner_, pad, sizeof(pad));
+
+  memset(pad, 0x5c, sizeof(pad));
+  for (size_t i = 0; i < length; i++) pad[i] ^= key[i];
+  sha256Init(outer_);
+  sha256Update(outer_, pad, sizeof(pad));
+
+  memset(pad, 0, sizeof(pad));
+  ready_ = true;
+  return true;
+}
+
+void HmacSha256::begin() {
+  work_ = inner_;
+}
+
+void HmacSha256::update(const void* data, size_t length) {
+  sha256Update(work_, (const uint8_t*)data, length);
+}
+
+void HmacSha256::finish(uint8_t out[HMAC_SHA256_SIZE]) {
+  uint8_t innerHash[HMAC_SHA256_SIZE];
+  sha256Finish(work_, innerHash);
+  work_ = outer_;
+  sha256Update(work_, innerHash, sizeof(innerHash));
+  sha256Finish(work_, out);
+}
+
+void HmacSha256::sha256Init(Sha256& sha) {
+  static const uint32_t initial[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(sha.state, initial, sizeof(initial));
+  sha.length = 0;
+  sha.used = 0;
+}
+
+void HmacSha256::sha256Update(Sha256& sha, const uint8_t* data, size_t length) {
+  sha.length += length;
+  if (sha.used > 0) {
+    size_t n = 64 - sha.used < length ? 64 - sha.used : length;
+    memcpy(sha.block + sha.used, data, n);
+    sha.used += n;
+    data += n;
+    length -= n;
+    if (sha.used < 64) return;
+    compress(sha.state, sha.block);
+    sha.used = 0;
+  }
+  for (; length >= 64; data += 64, length -= 64) compress(sha.state, data);
+  memcpy(sha.block, data, length);
+  sha.used = length;
+}
+
+void HmacSha256::sha256Finish(Sha256& sha, uint8_t out[HMAC_SHA256_SIZE]) {
+  uint64_t bits = sha.length * 8;
+  sha.block[sha.used++] = 0x80;
+  if (sha.used > 56) {
+    memset(sha.block + sha.used, 0, 64 - sha.used);
+    compress(sha.state, sha.block);
+    sha.used = 0;
+  }
+  memset(sha.block + sha.used, 0, 56 - sha.used);
+  for (int i = 0; i < 8; i++) sha.block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+  compress(sha.state, sha.block);
+
+  for (int i = 0; i < 8; i++) {
+    out[4 * i]     = (uint8_t)(sha.state[i] >> 24);
+    out[4 * i + 1] = (uint8_t)(sha.state[i] >> 16);
+    out[4 * i + 2] = (uint8_t)(sha.state[i] >> 8);
+    out[4 * i + 3] = (uint8_t)sha.state[i];
+  }
+}
+
+void HmacSha256::compress(uint32_t state[8], const uint8_t block[64]) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+           (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+#endif
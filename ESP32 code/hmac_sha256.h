@@ -0,0 +1,93 @@
+/**
+ * @file hmac_sha256.h
+ * @brief HMAC-SHA256 with the key set once, for card checks and event signatures
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section hmac_sha256_overview Overview
+ *
+ * The key is fixed for the lifetime of the object, so setKey() does the
+ * key schedule once and every MAC after that only hashes the message. A
+ * short event costs two SHA-256 block compressions plus the message.
+ *
+ * On the ESP32 the work goes to mbedtls, which the Arduino core builds on
+ * the SHA accelerator. On Linux a portable SHA-256 stands in, so the host
+ * build and the tools compute the same MACs as a reader.
+ *
+ * An object is not thread safe: each task that signs or verifies keeps its
+ * own.
+ */
+
+#ifndef HMAC_SHA256_H
+#define HMAC_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ARDUINO)
+#include <mbedtls/md.h>
+#endif
+
+#define HMAC_SHA256_SIZE 32
+#define HMAC_KEY_MAX 64      ///< One SHA-256 block; longer keys are not needed here
+
+class HmacSha256 {
+public:
+  HmacSha256();
+  ~HmacSha256();
+
+  HmacSha256(const HmacSha256&) = delete;
+  HmacSha256& operator=(const HmacSha256&) = delete;
+
+  /**
+   * @return false if the key is empty or longer than HMAC_KEY_MAX
+   */
+  bool setKey(const uint8_t* key, size_t length);
+
+  /**
+   * @brief setKey() from hex text, e.g. a key in config.h
+   * @return false unless text is 2 to 2 * HMAC_KEY_MAX hex digits
+   */
+  bool setHexKey(const char* text);
+
+  bool ready() const { return ready_; }
+
+  void begin();
+  void update(const void* data, size_t length);
+
+  /**
+   * @brief The MAC of everything passed to update() since begin()
+   */
+  void finish(uint8_t out[HMAC_SHA256_SIZE]);
+
+  /**
+   * @brief Compare MACs in constant time
+   */
+  static bool equal(const uint8_t* a, const uint8_t* b, size_t length);
+
+private:
+  bool ready_;
+
+#if defined(ARDUINO)
+  mbedtls_md_context_t md_;
+#else
+  struct Sha256 {
+    uint32_t state[8];
+    uint64_t length;           ///< Bytes hashed so far
+    uint8_t  block[64];
+    size_t   used;             ///< Bytes waiting in block
+  };
+
+  static void sha256Init(Sha256& sha);
+  static void sha256Update(Sha256& sha, const uint8_t* data, size_t length);
+  static void sha256Finish(Sha256& sha, uint8_t out[HMAC_SHA256_SIZE]);
+  static void compress(uint32_t state[8], const uint8_t block[64]);
+
+  Sha256 inner_;               ///< State after the key ^ ipad block
+  Sha256 outer_;               ///< State after the key ^ opad block
+  Sha256 work_;
+#endif
+};
+
+#endif // HMAC_SHA256_H
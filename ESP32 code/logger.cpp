@@ -0,0 +1,85 @@
+/**
+ * @file logger.cpp
+ * @brief Deferred logger: record on the hot path, format and print later
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "logger.h"
+#include <stdio.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+Logger logger;
+
+namespace {
+
+const char LEVEL_CHARS[] = "?EWID";
+
+const char* categoryName(uint8_t category) {
+  switch ((LogCategory)category) {
+    case LogCategory::Sys:  return "sys";
+    case LogCategory::Rfid: return "rfid";
+    case LogCategory::Ws:   return "ws";
+    case LogCategory::Mqtt: return "mqtt";
+  }
+  return "?";
+}
+
+} // namespace
+
+Logger::Logger() : head_(0), tail_(0), dropped_(0), reportedDrops_(0) {
+  for (size_t i = 0; i < LOG_RING_SIZE; i++) slots_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+uint32_t Logger::clockMs() {
+#if defined(ARDUINO)
+  return millis();
+#else
+  static const auto start = std::chrono::steady_clock::now();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+#endif
+}
+
+size_t Logger::drain(WriteFn write, size_t maxLines) {
+  char line[LOG_LINE_SIZE];
+  size_t lines = 0;
+
+  while (lines < maxLines) {
+    Slot& slot = slots_[tail_ & (LOG_RING_SIZE - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != tail_ + 1) break;
+
+    Record r = slot.record;
+    slot.seq.store(tail_ + LOG_RING_SIZE, std::memory_order_release);
+    tail_++;
+
+    uintptr_t a[LOG_MAX_ARGS];
+    for (size_t i = 0; i < LOG_MAX_ARGS; i++) a[i] = r.args[i];
+    if (r.textArg != LOG_NO_TEXT) a[r.textArg] = (uintptr_t)r.text;
+
+    int n = snprintf(line, sizeof(line), "[%lu] %c %s: ", (unsigned long)r.timeMs,
+                     LEVEL_CHARS[r.level < sizeof(LEVEL_CHARS) - 1 ? r.level : 0],
+                     categoryName(r.category));
+    // Every argument was widened to one word, which is what varargs pass anyway
+    n += snprintf(line + n, sizeof(line) - n, r.format, a[0], a[1], a[2], a[3]);
+    if (n > (int)sizeof(line) - 2) n = sizeof(line) - 2;
+    line[n++] = '\n';
+    write(line, n);
+    lines++;
+  }
+
+  uint32_t drops = dropped();
+  if (drops != reportedDrops_) {
+    int n = snprintf(line, sizeof(line), "[log] %lu lines dropped\n",
+                     (unsigned long)(drops - reportedDrops_));
+    write(line, n);
+    reportedDrops_ = drops;
+  }
+  return lines;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file logger.h
+ * @brief Deferred logger: record on the hot path, format and print later
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section logger_overview Overview
+ *
+ * At 115200 baud a 200 byte line keeps Serial busy for about 17 ms. So
+ * the LOG_* macros do not format anything. They store the format string
+ * pointer, a timestamp and up to LOG_MAX_ARGS raw argument words in a
+ * lock-free ring, and a low-priority log task formats and prints them
+ * later. Any task may log; when the ring is full the line is dropped and
+ * counted, never waited for.
+ *
+ * Arguments must be integers of at most 32 bits, enums or strings that
+ * live forever (string literals, roleName(), ...). A string in a temporary
+ * buffer must be wrapped in logText(), which copies up to LOG_TEXT_SIZE - 1
+ * characters into the record; one logText() per line. The compiler checks
+ * every line against its format as it would a printf, and refuses 64-bit
+ * and floating-point arguments.
+ *
+ * Levels and categories are filtered at compile time. Lines above
+ * LOG_LEVEL, and debug lines of a category whose DEBUG_* flag in config.h
+ * is off, compile to nothing, format string included.
+ *
+ * @code
+ * LOG_INFO(Rfid, "%s checked in", roleName(role));
+ * LOG_DEBUG(Mqtt, "Published to %s", logText(topic));
+ * @endcode
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+#include "config.h"
+
+// ---- Levels ----
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// ---- Categories and their debug switches ----
+enum class LogCategory : uint8_t { Sys, Rfid, Ws, Mqtt };
+
+#define LOG_DEBUG_Sys  DEBUG_MODE
+#define LOG_DEBUG_Rfid DEBUG_RFID
+#define LOG_DEBUG_Ws   DEBUG_WEBSOCKET
+#define LOG_DEBUG_Mqtt DEBUG_MQTT
+
+#define LOG_ENABLED(level, cat) \
+  ((level) <= LOG_LEVEL && ((level) < LOG_LEVEL_DEBUG || (DEBUG_MODE && LOG_DEBUG_##cat)))
+
+// The printf check runs on every line, compiled in or not; it costs nothing
+#define LOG_AT(level, cat, format, ...) do { \
+    (void)sizeof(logFormatCheck(LOG_CHECK_ARGS(format, ##__VA_ARGS__))); \
+    if (LOG_ENABLED(level, cat)) logger.write(level, LogCategory::cat, format, ##__VA_ARGS__); \
+  } while (0)
+
+#define LOG_ERROR(cat, format, ...) LOG_AT(LOG_LEVEL_ERROR, cat, format, ##__VA_ARGS__)
+#define LOG_WARN(cat, format, ...)  LOG_AT(LOG_LEVEL_WARN, cat, format, ##__VA_ARGS__)
+#define LOG_INFO(cat, format, ...)  LOG_AT(LOG_LEVEL_INFO, cat, format, ##__VA_ARGS__)
+#define LOG_DEBUG(cat, format, ...) LOG_AT(LOG_LEVEL_DEBUG, cat, format, ##__VA_ARGS__)
+
+#define LOG_MAX_ARGS 4
+#define LOG_TEXT_SIZE 48
+#define LOG_LINE_SIZE 192
+#define LOG_NO_TEXT 0xFF
+
+/**
+ * @brief Copy a short-lived string into the log record
+ */
+struct LogText {
+  const char* s;
+};
+
+inline LogText logText(const char* s) { return LogText{s}; }
+
+// ---- Compile-time argument check ----
+// Each argument is mapped to what printf would see and checked against the
+// format, inside sizeof so nothing is called. Arguments are stored as one
+// 32-bit word on the ESP32, so wider integers and floating point are
+// refused outright rather than truncated.
+
+template <typename T, bool = std::is_enum<T>::value>
+struct LogArg {
+  static_assert(!std::is_floating_point<T>::value,
+                "Floating-point log arguments are not supported; scale to an integer");
+  static_assert(std::is_integral<T>::value || std::is_floating_point<T>::value,
+                "Log arguments must be integers, static strings or logText()");
+  static_assert(sizeof(T) <= 4,
+                "64-bit log arguments would be truncated on the ESP32; cast to a 32-bit type");
+  typedef T type;
+};
+
+template <typename T>
+struct LogArg<T, true> {
+  typedef typename std::underlying_type<T>::type type;
+};
+
+template <typename T>
+struct LogArg<T*, false> {
+  typedef T* type;
+};
+
+template <>
+struct LogArg<LogText, false> {
+  typedef const char* type;
+};
+
+template <typename T>
+typename LogArg<T>::type logCheckArg(T value);
+
+int logFormatCheck(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// The format is counted with the arguments, so there is always one
+#define LOG_CHECK_CAT_(a, b) a##b
+#define LOG_CHECK_CAT(a, b) LOG_CHECK_CAT_(a, b)
+#define LOG_CHECK_COUNT(...) LOG_CHECK_COUNT_(__VA_ARGS__, 4, 3, 2, 1, 0, 0)
+#define LOG_CHECK_COUNT_(f, a, b, c, d, n, ...) n
+#define LOG_CHECK_0(f) f
+#define LOG_CHECK_1(f, a) f, logCheckArg(a)
+#define LOG_CHECK_2(f, a, b) f, logCheckArg(a), logCheckArg(b)
+#define LOG_CHECK_3(f, a, b, c) f, logCheckArg(a), logCheckArg(b), logCheckArg(c)
+#define LOG_CHECK_4(f, a, b, c, d) f, logCheckArg(a), logCheckArg(b), logCheckArg(c), logCheckArg(d)
+#define LOG_CHECK_ARGS(...) LOG_CHECK_CAT(LOG_CHECK_, LOG_CHECK_COUNT(__VA_ARGS__))(__VA_ARGS__)
+
+class Logger {
+public:
+  typedef void (*WriteFn)(const char* data, size_t length);
+
+  Logger();
+
+  /**
+   * @brief Queue one line; use the LOG_* macros rather than calling this
+   */
+  template <typename... Args>
+  void write(uint8_t level, LogCategory category, const char* format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos & (LOG_RING_SIZE - 1)];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+
+    Record& r = slot->record;
+    r.format = format;
+    r.timeMs = clockMs();
+    r.level = level;
+    r.category = (uint8_t)category;
+    r.textArg = LOG_NO_TEXT;
+    pack(r, 0, args...);
+    slot->seq.store(pos + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Format and write queued lines (one consumer task only)
+   * @return Number of lines written
+   */
+  size_t drain(WriteFn write, size_t maxLines = LOG_RING_SIZE);
+
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Record {
+    const char* format;
+    uint32_t    timeMs;
+    uint8_t     level;
+    uint8_t     category;
+    uint8_t     textArg;           ///< Argument replaced by text, or LOG_NO_TEXT
+    uintptr_t   args[LOG_MAX_ARGS];
+    char        text[LOG_TEXT_SIZE];
+  };
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    Record              record;
+  };
+
+  static uint32_t clockMs();
+
+  // ---- Argument packing ----
+  static void pack(Record&, uint8_t) {}
+
+  template <typename T, typename... Rest>
+  static void pack(Record& r, uint8_t i, T first, Rest... rest) {
+    r.args[i] = word(r, i, first);
+    pack(r, i + 1, rest...);
+  }
+
+  static uintptr_t word(Record&, uint8_t, const char* s) { return (uintptr_t)s; }
+
+  static uintptr_t word(Record& r, uint8_t i, LogText text) {
+    if (r.textArg != LOG_NO_TEXT) return (uintptr_t)"...";
+    strncpy(r.text, text.s != nullptr ? text.s : "", sizeof(r.text) - 1);
+    r.text[sizeof(r.text) - 1] = '\0';
+    r.textArg = i;
+    return 0;
+  }
+
+  template <typename T>
+  static uintptr_t word(Record&, uint8_t, T value) {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                  "Log arguments must be integers, static strings or logText()");
+    return (uintptr_t)value;
+  }
+
+  Slot                  slots_[LOG_RING_SIZE];
+  std::atomic<size_t>   head_;
+  size_t                tail_;
+  std::atomic<uint32_t> dropped_;
+  uint32_t              reportedDrops_;
+};
+
+extern Logger logger;
+
+#endif // LOGGER_H
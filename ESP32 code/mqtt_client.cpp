@@ -0,0 +1,318 @@
+/**
+ * @file mqtt_client.cpp
+ * @brief Minimal MQTT 3.1.1 client for the /mqtt WebSocket
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "mqtt_client.h"
+#include <string.h>
+
+namespace {
+
+size_t remainingLengthSize(size_t length) {
+  if (length < 128) return 1;
+  if (length < 16384) return 2;
+  if (length < 2097152) return 3;
+  return 4;
+}
+
+uint8_t* writeRemainingLength(uint8_t* p, size_t length) {
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) digit |= 0x80;
+    *p++ = digit;
+  } while (length > 0);
+  return p;
+}
+
+uint8_t* writeString(uint8_t* p, const char* s, size_t length) {
+  *p++ = (uint8_t)(length >> 8);
+  *p++ = (uint8_t)(length & 0xFF);
+  memcpy(p, s, length);
+  return p + length;
+}
+
+} // namespace
+
+MqttClient::MqttClient(const char* clientId, uint32_t keepAliveMs, uint32_t pingTimeoutMs, SendFn send)
+  : clientId_(clientId),
+    keepAliveMs_(keepAliveMs),
+    pingTimeoutMs_(pingTimeoutMs),
+    send_(send),
+    ack_(nullptr),
+    message_(nullptr),
+    connected_(false),
+    lastPacketId_(0),
+    lastSendMs_(0),
+    pingSentMs_(0),
+    pingOutstanding_(false),
+    lastAckLatencyMs_(0),
+    oversized_(0),
+    inflight_(),
+    rxState_(RX_TYPE),
+    rxType_(0),
+    rxRemaining_(0),
+    rxMultiplier_(1),
+    rxBody_(),
+    rxBodyLength_(0),
+    rxTruncated_(false) {}
+
+bool MqttClient::connect(uint32_t nowMs) {
+  connected_ = false;
+  pingOutstanding_ = false;
+  rxState_ = RX_TYPE;
+
+  size_t idLength = strlen(clientId_);
+  if (idLength > 64) return false;
+
+  // Variable header (10) + client id
+  size_t remaining = 10 + 2 + idLength;
+  uint8_t packet[2 + 12 + 64];
+
+  uint16_t keepAliveSec = (uint16_t)(keepAliveMs_ / 1000);
+  uint8_t* p = packet;
+  *p++ = MQTT_CONNECT;
+  p = writeRemainingLength(p, remaining);
+  p = writeString(p, "MQTT", 4);
+  *p++ = 4;                          // Protocol level 3.1.1
+  *p++ = 0x02;                       // Clean session
+  *p++ = (uint8_t)(keepAliveSec >> 8);
+  *p++ = (uint8_t)(keepAliveSec & 0xFF);
+  p = writeString(p, clientId_, idLength);
+
+  return send(packet, p - packet, nowMs);
+}
+
+void MqttClient::disconnected() {
+  connected_ = false;
+  pingOutstanding_ = false;
+  rxState_ = RX_TYPE;
+  for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) inflight_[i].packetId = 0;
+}
+
+size_t MqttClient::publishHeaderSize(size_t topicLength, uint8_t qos) {
+  // Fixed header with the longest remaining length, topic, packet id
+  return 1 + 4 + 2 + topicLength + (qos > 0 ? 2 : 0);
+}
+
+bool MqttClient::publish(const char* topic, size_t topicLength,
+                         uint8_t* frame, size_t frameSize, size_t payloadLength,
+                         uint8_t qos, bool retain, uint32_t nowMs, uint16_t* packetId) {
+  if (!connected_) return false;
+
+  size_t reserve = publishHeaderSize(topicLength, qos);
+  if (reserve + payloadLength > frameSize) return false;
+  if (qos > 0 && reserve + payloadLength > sizeof(inflight_[0].frame)) return false;
+
+  Inflight* slot = nullptr;
+  if (qos > 0) {
+    for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+      if (inflight_[i].packetId == 0) {
+        slot = &inflight_[i];
+        break;
+      }
+    }
+    if (slot == nullptr) return false;
+  }
+
+  size_t variable = 2 + topicLength + (qos > 0 ? 2 : 0);
+  size_t remaining = variable + payloadLength;
+  size_t header = 1 + remainingLengthSize(remaining) + variable;
+
+  // Headers end exactly where the payload begins
+  uint8_t* start = frame + reserve - header;
+  uint8_t* p = start;
+  *p++ = MQTT_PUBLISH | (uint8_t)((qos & 0x03) << 1) | (retain ? 0x01 : 0x00);
+  p = writeRemainingLength(p, remaining);
+  p = writeString(p, topic, topicLength);
+
+  uint16_t id = 0;
+  if (qos > 0) {
+    id = nextPacketId();
+    *p++ = (uint8_t)(id >> 8);
+    *p++ = (uint8_t)(id & 0xFF);
+  }
+
+  size_t length = header + payloadLength;
+  if (slot != nullptr) {
+    // Keep a copy for retransmission until the broker acknowledges it
+    slot->packetId = id;
+    slot->length = (uint16_t)length;
+    slot->sentAtMs = nowMs;
+    slot->firstSentAtMs = nowMs;
+    memcpy(slot->frame, start, length);
+    slot->frame[0] |= MQTT_FLAG_DUP;
+  }
+  if (packetId != nullptr) *packetId = id;
+
+  return send(start, length, nowMs);
+}
+
+bool MqttClient::subscribe(const char* const* topics, size_t count, uint32_t nowMs) {
+  if (!connected_) return false;
+
+  // Packet id + (length, filter, QoS) per topic
+  size_t remaining = 2;
+  for (size_t i = 0; i < count; i++) remaining += 2 + strlen(topics[i]) + 1;
+
+  uint8_t packet[256];
+  if (1 + remainingLengthSize(remaining) + remaining > sizeof(packet)) return false;
+
+  uint16_t id = nextPacketId();
+  uint8_t* p = packet;
+  *p++ = MQTT_SUBSCRIBE;
+  p = writeRemainingLength(p, remaining);
+  *p++ = (uint8_t)(id >> 8);
+  *p++ = (uint8_t)(id & 0xFF);
+  for (size_t i = 0; i < count; i++) {
+    p = writeString(p, topics[i], strlen(topics[i]));
+    *p++ = 0;                        // QoS 0
+  }
+
+  return send(packet, p - packet, nowMs);
+}
+
+void MqttClient::onData(const uint8_t* data, size_t length, uint32_t nowMs) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t b = data[i];
+    switch (rxState_) {
+      case RX_TYPE:
+        rxType_ = b;
+        rxRemaining_ = 0;
+        rxMultiplier_ = 1;
+        rxBodyLength_ = 0;
+        rxTruncated_ = false;
+        rxState_ = RX_LENGTH;
+        break;
+
+      case RX_LENGTH:
+        rxRemaining_ += (b & 0x7F) * rxMultiplier_;
+        rxMultiplier_ *= 128;
+        if ((b & 0x80) == 0) {
+          if (rxRemaining_ == 0) {
+            handlePacket(nowMs);
+            rxState_ = RX_TYPE;
+          } else {
+            rxState_ = RX_BODY;
+          }
+        }
+        break;
+
+      case RX_BODY:
+        if (rxBodyLength_ < sizeof(rxBody_)) {
+          rxBody_[rxBodyLength_++] = b;
+        } else {
+          rxTruncated_ = true;
+        }
+        if (--rxRemaining_ == 0) {
+          handlePacket(nowMs);
+          rxState_ = RX_TYPE;
+        }
+        break;
+    }
+  }
+}
+
+void MqttClient::handlePacket(uint32_t nowMs) {
+  switch (rxType_ & 0xF0) {
+    case MQTT_CONNACK:
+      // Byte 1 is the return code; 0 = accepted
+      connected_ = rxBodyLength_ >= 2 && rxBody_[1] == 0;
+      break;
+
+    case MQTT_PUBACK:
+      if (rxBodyLength_ >= 2) {
+        uint16_t id = (uint16_t)((rxBody_[0] << 8) | rxBody_[1]);
+        for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+          if (inflight_[i].packetId == id) {
+            lastAckLatencyMs_ = nowMs - inflight_[i].firstSentAtMs;
+            inflight_[i].packetId = 0;
+            if (ack_ != nullptr) ack_(id);
+            break;
+          }
+        }
+      }
+      break;
+
+    case MQTT_PINGRESP:
+      pingOutstanding_ = false;
+      break;
+
+    case MQTT_PUBLISH: {
+      if (rxBodyLength_ < 2) break;
+      size_t  topicLength = (size_t)((rxBody_[0] << 8) | rxBody_[1]);
+      uint8_t qos = (rxType_ >> 1) & 0x03;
+      size_t  offset = 2 + topicLength + (qos > 0 ? 2 : 0);
+      if (offset > rxBodyLength_) {
+        oversized_++;
+        break;
+      }
+
+      if (qos == 1) {
+        const uint8_t ack[4] = { MQTT_PUBACK, 2, rxBody_[offset - 2], rxBody_[offset - 1] };
+        send(ack, sizeof(ack), nowMs);
+      }
+      if (rxTruncated_) {
+        oversized_++;
+      } else if (message_ != nullptr) {
+        message_((const char*)rxBody_ + 2, topicLength, rxBody_ + offset, rxBodyLength_ - offset);
+      }
+      break;
+    }
+
+    default:
+      // SUBACK and anything else are not used by the reader
+      break;
+  }
+}
+
+bool MqttClient::loop(uint32_t nowMs) {
+  if (!connected_) return true;
+
+  if (pingOutstanding_) {
+    if (nowMs - pingSentMs_ > pingTimeoutMs_) return false;
+  } else if (nowMs - lastSendMs_ >= keepAliveMs_) {
+    const uint8_t ping[2] = { MQTT_PINGREQ, 0 };
+    if (send(ping, sizeof(ping), nowMs)) {
+      pingOutstanding_ = true;
+      pingSentMs_ = nowMs;
+    }
+  }
+
+  for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    Inflight& slot = inflight_[i];
+    if (slot.packetId == 0 || nowMs - slot.sentAtMs < MQTT_RETRY_TIMEOUT) continue;
+    slot.sentAtMs = nowMs;
+    send(slot.frame, slot.length, nowMs);
+  }
+  return true;
+}
+
+size_t MqttClient::inflight() const {
+  size_t count = 0;
+  for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    if (inflight_[i].packetId != 0) count++;
+  }
+  return count;
+}
+
+bool MqttClient::send(const uint8_t* data, size_t length, uint32_t nowMs) {
+  if (!send_(data, length)) return false;
+  lastSendMs_ = nowMs;
+  return true;
+}
+
+uint16_t MqttClient::nextPacketId() {
+  // Skip 0 (reserved) and any id still awaiting PUBACK
+  for (;;) {
+    if (++lastPacketId_ == 0) lastPacketId_ = 1;
+    bool used = false;
+    for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+      if (inflight_[i].packetId == lastPacketId_) used = true;
+    }
+    if (!used) return lastPacketId_;
+  }
+}
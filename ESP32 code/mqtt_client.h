@@ -0,0 +1,179 @@
+/**
+ * @file mqtt_client.h
+ * @brief Minimal MQTT 3.1.1 client for the /mqtt WebSocket
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section mqtt_client_overview Overview
+ *
+ * Speaks binary MQTT control packets to the backend broker (aedes) over an
+ * already established WebSocket. Only what the reader needs is supported:
+ * CONNECT/CONNACK, PUBLISH at QoS 0 or 1 with PUBACK tracking, QoS 0
+ * SUBSCRIBE for the card list updates, and PINGREQ/PINGRESP keepalive.
+ * Incoming PUBLISH packets up to MQTT_RX_BUFFER_SIZE are handed to the
+ * MessageFn; larger ones are counted and skipped.
+ *
+ * Publishing is zero-copy: the caller encodes the payload directly into
+ * its frame buffer at publishHeaderSize() and publish() writes the fixed
+ * and variable headers in front of it, so the frame is sent as-is.
+ *
+ * The client never touches the network itself; frames go out through the
+ * SendFn supplied at construction and received bytes are fed to onData().
+ */
+
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+// ---- Packet types ----
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+#define MQTT_FLAG_DUP    0x08
+
+class MqttClient {
+public:
+  typedef bool (*SendFn)(const uint8_t* data, size_t length);
+  typedef void (*AckFn)(uint16_t packetId);
+  typedef void (*MessageFn)(const char* topic, size_t topicLength,
+                            const uint8_t* payload, size_t length);
+
+  /**
+   * @param clientId Client identifier sent in CONNECT (e.g. DEVICE_ID)
+   * @param keepAliveMs Idle time before a PINGREQ is sent; also the CONNECT keepalive
+   * @param pingTimeoutMs Time to wait for PINGRESP before reporting the link dead
+   * @param send Transport used for every outgoing frame
+   */
+  MqttClient(const char* clientId, uint32_t keepAliveMs, uint32_t pingTimeoutMs, SendFn send);
+
+  /**
+   * @brief Send CONNECT on a freshly opened transport
+   */
+  bool connect(uint32_t nowMs);
+
+  /**
+   * @brief Transport dropped; unacknowledged QoS 1 frames are forgotten
+   *
+   * Redelivery after a reconnect is left to the caller (the event journal),
+   * which still holds every message that was never acknowledged.
+   */
+  void disconnected();
+
+  /**
+   * @brief Called with the packet identifier of every PUBACK received
+   */
+  void onAck(AckFn ack) { ack_ = ack; }
+
+  /**
+   * @brief Called with every PUBLISH received on a subscribed topic
+   */
+  void onMessage(MessageFn message) { message_ = message; }
+
+  /**
+   * @brief True once the broker has accepted the CONNECT
+   */
+  bool connected() const { return connected_; }
+
+  /**
+   * @brief Space to leave in front of the payload for the PUBLISH headers
+   */
+  static size_t publishHeaderSize(size_t topicLength, uint8_t qos);
+
+  /**
+   * @brief Publish a payload already encoded at frame + publishHeaderSize()
+   *
+   * @param frame Buffer holding the payload after the reserved header space
+   * @param frameSize Total size of frame
+   * @param payloadLength Payload bytes written after the header space
+   * @param packetId Receives the QoS 1 packet identifier (optional)
+   * @return false if not connected, the frame does not fit, or too many
+   *         QoS 1 messages are awaiting PUBACK
+   */
+  bool publish(const char* topic, size_t topicLength,
+               uint8_t* frame, size_t frameSize, size_t payloadLength,
+               uint8_t qos, bool retain, uint32_t nowMs, uint16_t* packetId = nullptr);
+
+  /**
+   * @brief Subscribe to topic filters at QoS 0 (SUBACK is not tracked)
+   */
+  bool subscribe(const char* const* topics, size_t count, uint32_t nowMs);
+
+  /**
+   * @brief Feed bytes received from the transport
+   */
+  void onData(const uint8_t* data, size_t length, uint32_t nowMs);
+
+  /**
+   * @brief Keepalive and QoS 1 retransmission
+   * @return false if the broker stopped answering pings
+   */
+  bool loop(uint32_t nowMs);
+
+  /**
+   * @brief Number of QoS 1 publishes waiting for PUBACK
+   */
+  size_t inflight() const;
+
+  /**
+   * @brief Publish-to-PUBACK time of the most recently acknowledged message
+   */
+  uint32_t lastAckLatencyMs() const { return lastAckLatencyMs_; }
+
+  /**
+   * @brief Incoming PUBLISH packets skipped for exceeding MQTT_RX_BUFFER_SIZE
+   */
+  uint32_t oversized() const { return oversized_; }
+
+private:
+  struct Inflight {
+    uint16_t packetId;            ///< 0 = free slot
+    uint16_t length;
+    uint32_t sentAtMs;
+    uint32_t firstSentAtMs;
+    uint8_t  frame[BATCH_FRAME_SIZE];  ///< Largest QoS 1 publish is a batch
+  };
+
+  bool send(const uint8_t* data, size_t length, uint32_t nowMs);
+  uint16_t nextPacketId();
+  void handlePacket(uint32_t nowMs);
+
+  const char* clientId_;
+  uint32_t    keepAliveMs_;
+  uint32_t    pingTimeoutMs_;
+  SendFn      send_;
+  AckFn       ack_;
+  MessageFn   message_;
+
+  bool        connected_;
+  uint16_t    lastPacketId_;
+  uint32_t    lastSendMs_;
+  uint32_t    pingSentMs_;
+  bool        pingOutstanding_;
+  uint32_t    lastAckLatencyMs_;
+  uint32_t    oversized_;
+
+  Inflight    inflight_[MQTT_MAX_INFLIGHT];
+
+  // ---- Receive state ----
+  enum RxState : uint8_t { RX_TYPE, RX_LENGTH, RX_BODY };
+  RxState     rxState_;
+  uint8_t     rxType_;
+  uint32_t    rxRemaining_;
+  uint32_t    rxMultiplier_;
+  uint8_t     rxBody_[MQTT_RX_BUFFER_SIZE];
+  size_t      rxBodyLength_;
+  bool        rxTruncated_;
+};
+
+#endif // MQTT_CLIENT_H
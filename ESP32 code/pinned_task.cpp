@@ -0,0 +1,92 @@
+/**
+ * @file pinned_task.cpp
+ * @brief Thread pinned to one CPU core
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "pinned_task.h"
+
+#if defined(ARDUINO)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <chrono>
+#include <thread>
+#endif
+
+PinnedTask::PinnedTask() : handle_(nullptr) {}
+
+#if defined(ARDUINO)
+
+PinnedTask::~PinnedTask() {}
+
+bool PinnedTask::start(const char* name, EntryFn fn, void* arg,
+                       uint32_t stackBytes, uint8_t priority, int core) {
+  if (handle_ != nullptr) return false;
+
+  TaskHandle_t task = nullptr;
+  BaseType_t coreId = core < 0 ? tskNO_AFFINITY : (BaseType_t)core;
+  // ESP-IDF takes the stack depth in bytes
+  if (xTaskCreatePinnedToCore(fn, name, stackBytes, arg, priority, &task, coreId) != pdPASS) {
+    return false;
+  }
+  handle_ = task;
+  return true;
+}
+
+void PinnedTask::join() {}
+
+void sleepMs(uint32_t ms) {
+  vTaskDelay(ms == 0 ? 1 : pdMS_TO_TICKS(ms));
+}
+
+#else
+
+PinnedTask::~PinnedTask() {
+  join();
+}
+
+bool PinnedTask::start(const char* name, EntryFn fn, void* arg,
+                       uint32_t stackBytes, uint8_t priority, int core) {
+  (void)stackBytes;
+  (void)priority;
+  if (handle_ != nullptr) return false;
+
+  std::thread* thread = new std::thread(fn, arg);
+#if defined(__linux__)
+  pthread_setname_np(thread->native_handle(), name);
+  if (core >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(thread->native_handle(), sizeof(cpus), &cpus);
+  }
+#else
+  (void)name;
+  (void)core;
+#endif
+  handle_ = thread;
+  return true;
+}
+
+void PinnedTask::join() {
+  std::thread* thread = static_cast<std::thread*>(handle_);
+  if (thread == nullptr) return;
+  if (thread->joinable()) thread->join();
+  delete thread;
+  handle_ = nullptr;
+}
+
+void sleepMs(uint32_t ms) {
+  if (ms == 0) {
+    std::this_thread::yield();
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file pinned_task.h
+ * @brief Thread pinned to one CPU core
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section pinned_task_overview Overview
+ *
+ * Runs a function on its own thread bound to a given core: a FreeRTOS
+ * task created with xTaskCreatePinnedToCore() on the ESP32, a std::thread
+ * with its CPU affinity set on Linux. The firmware puts the RFID side on
+ * one core and the network side on the other.
+ */
+
+#ifndef PINNED_TASK_H
+#define PINNED_TASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class PinnedTask {
+public:
+  typedef void (*EntryFn)(void* arg);
+
+  PinnedTask();
+  ~PinnedTask();
+
+  /**
+   * @brief Start fn(arg) on a new thread
+   * @param stackBytes Stack size (ignored on Linux)
+   * @param priority   FreeRTOS priority (ignored on Linux)
+   * @param core       Core to run on; -1 lets the OS choose
+   * @return false if the thread could not be created
+   */
+  bool start(const char* name, EntryFn fn, void* arg,
+             uint32_t stackBytes, uint8_t priority, int core);
+
+  /**
+   * @brief Wait for the thread to return (Linux only; firmware tasks never return)
+   */
+  void join();
+
+  bool running() const { return handle_ != nullptr; }
+
+private:
+  PinnedTask(const PinnedTask&) = delete;
+  PinnedTask& operator=(const PinnedTask&) = delete;
+
+  void* handle_;                 ///< TaskHandle_t or std::thread*
+};
+
+/**
+ * @brief Put the calling thread to sleep, yielding the core
+ */
+void sleepMs(uint32_t ms);
+
+#endif // PINNED_TASK_H
@@ -0,0 +1,182 @@
+/**
+ * @file presence.cpp
+ * @brief Check-in/check-out state machine for the cards at one reader
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "presence.h"
+
+PresenceTracker::PresenceTracker(LookupFn lookup, EventFn emit, int absentThreshold)
+  : lookup_(lookup),
+    emit_(emit),
+    absentThreshold_(absentThreshold),
+    slots_(),
+    count_(0),
+    overflows_(0),
+    denied_(),
+    suppressed_(0) {}
+
+void PresenceTracker::update(const CardUid* uids, size_t count, uint64_t nowUs, const EventTime& time) {
+  // Denied windows only need differences, which survive the 32-bit wrap
+  uint32_t nowMs = (uint32_t)(nowUs / 1000);
+
+  for (size_t i = 0; i < count_; i++) slots_[i].seen = false;
+  for (size_t i = 0; i < DENIED_TRACK_SLOTS; i++) denied_[i].seen = false;
+
+  for (size_t n = 0; n < count; n++) {
+    const CardUid& uid = uids[n];
+
+    Slot* slot = nullptr;
+    for (size_t i = 0; i < count_; i++) {
+      if (sameCard(slots_[i].uid, uid)) slot = &slots_[i];
+    }
+    if (slot != nullptr) {
+      slot->seen = true;
+      slot->absentCount = 0;
+      continue;
+    }
+
+    Role role = lookup_(uid.bytes, uid.size);
+    if (role == ROLE_UNDECIDED) continue;
+    if (role == Role::Unknown) {
+      deny(uid, nowMs, time);
+      continue;
+    }
+
+    if (count_ == MAX_PRESENT_CARDS) {
+      overflows_++;
+      continue;
+    }
+    emit(EventType::CheckIn, role, uid, time, 0);
+    slots_[count_++] = {uid, role, nowUs, 0, true};
+  }
+
+  // Cards missing from enough consecutive cycles check out
+  for (size_t i = 0; i < count_;) {
+    Slot& slot = slots_[i];
+    if (slot.seen || ++slot.absentCount < absentThreshold_) {
+      i++;
+      continue;
+    }
+    emit(EventType::CheckOut, slot.role, slot.uid, time,
+         (uint32_t)((nowUs - slot.checkedInUs) / 1000000));
+    slot = slots_[--count_];
+  }
+
+  expireDenied(nowMs, time);
+}
+
+void PresenceTracker::save(PresenceSnapshot& out, uint64_t nowUs) const {
+  out.count = (uint8_t)count_;
+  for (size_t i = 0; i < count_; i++) {
+    const Slot& slot = slots_[i];
+    out.cards[i] = {slot.uid, slot.role, (uint8_t)(slot.absentCount < 0xFF ? slot.absentCount : 0xFF),
+                    (uint32_t)((nowUs - slot.checkedInUs) / 1000)};
+  }
+
+  uint32_t nowMs = (uint32_t)(nowUs / 1000);
+  out.deniedCount = 0;
+  for (size_t i = 0; i < DENIED_TRACK_SLOTS; i++) {
+    const DeniedSlot& slot = denied_[i];
+    if (!slot.used) continue;
+    out.denied[out.deniedCount++] = {slot.uid, (uint8_t)(slot.absentCount < 0xFF ? slot.absentCount : 0xFF),
+                                     slot.inField, slot.alerted, nowMs - slot.windowStartMs,
+                                     slot.attempts, slot.unreported};
+  }
+}
+
+void PresenceTracker::restore(const PresenceSnapshot& snapshot, uint64_t nowUs, uint32_t elapsedMs) {
+  count_ = 0;
+  for (size_t i = 0; i < snapshot.count && i < MAX_PRESENT_CARDS; i++) {
+    const PresenceSnapshot::Card& card = snapshot.cards[i];
+    uint64_t presentUs = ((uint64_t)card.presentMs + elapsedMs) * 1000;
+    slots_[count_++] = {card.uid, card.role, nowUs - presentUs, card.absentCount, false};
+  }
+
+  uint32_t nowMs = (uint32_t)(nowUs / 1000);
+  for (size_t i = 0; i < DENIED_TRACK_SLOTS; i++) {
+    denied_[i] = DeniedSlot();
+    if (i >= snapshot.deniedCount) continue;
+    const PresenceSnapshot::Denied& card = snapshot.denied[i];
+    denied_[i] = {card.uid, nowMs - card.windowAgeMs - elapsedMs, card.attempts, card.unreported,
+                  card.absentCount, true, false, card.inField, card.alerted};
+  }
+}
+
+size_t PresenceTracker::tracking() const {
+  size_t n = 0;
+  for (size_t i = 0; i < DENIED_TRACK_SLOTS; i++) n += denied_[i].used ? 1 : 0;
+  return n;
+}
+
+void PresenceTracker::deny(const CardUid& uid, uint32_t nowMs, const EventTime& time) {
+  DeniedSlot* slot = nullptr;
+  for (size_t i = 0; i < DENIED_TRACK_SLOTS && slot == nullptr; i++) {
+    if (denied_[i].used && sameCard(denied_[i].uid, uid)) slot = &denied_[i];
+  }
+
+  if (slot != nullptr) {
+    slot->seen = true;
+    slot->absentCount = 0;
+    if (slot->inField) return;
+
+    // Presented again inside the window: fold it into the summary
+    slot->inField = true;
+    slot->attempts++;
+    slot->unreported++;
+    suppressed_++;
+    if (slot->attempts >= MAX_FAILED_ATTEMPTS && !slot->alerted) {
+      emit(EventType::Alert, Role::Security, uid, time, slot->attempts);
+      slot->alerted = true;
+    }
+    return;
+  }
+
+  // Take a free slot, or the one whose window started longest ago
+  slot = &denied_[0];
+  for (size_t i = 1; i < DENIED_TRACK_SLOTS && slot->used; i++) {
+    DeniedSlot& d = denied_[i];
+    if (!d.used || nowMs - d.windowStartMs > nowMs - slot->windowStartMs) slot = &d;
+  }
+  if (slot->used && slot->unreported > 0) {
+    emit(EventType::Denied, Role::Unknown, slot->uid, time, slot->unreported);
+  }
+  *slot = {uid, nowMs, 1, 0, 0, true, true, true, MAX_FAILED_ATTEMPTS <= 1};
+
+  // First attempt is reported straight away
+  emit(EventType::Denied, Role::Unknown, uid, time, 1);
+  if (slot->alerted) emit(EventType::Alert, Role::Security, uid, time, 1);
+}
+
+void PresenceTracker::expireDenied(uint32_t nowMs, const EventTime& time) {
+  for (size_t i = 0; i < DENIED_TRACK_SLOTS; i++) {
+    DeniedSlot& slot = denied_[i];
+    if (!slot.used) continue;
+
+    if (!slot.seen && slot.inField && ++slot.absentCount >= absentThreshold_) {
+      slot.inField = false;
+    }
+    if (nowMs - slot.windowStartMs < DENIED_WINDOW_MS) continue;
+
+    if (slot.unreported > 0) {
+      emit(EventType::Denied, Role::Unknown, slot.uid, time, slot.unreported);
+    }
+    if (slot.inField) {
+      // Still held on the reader: keep tracking it in a fresh window
+      slot.windowStartMs = nowMs;
+      slot.attempts = 0;
+      slot.unreported = 0;
+      slot.alerted = false;
+    } else {
+      slot.used = false;
+    }
+  }
+}
+
+void PresenceTracker::emit(EventType type, Role role, const CardUid& uid,
+                           const EventTime& time, uint32_t duration) {
+  JournalEntry entry = {0, type, role, uid, time.timestamp, duration, time.millis, 0};
+  emit_(entry);
+}
@@ -0,0 +1,182 @@
+/**
+ * @file presence.h
+ * @brief Check-in/check-out state machine for the cards at one reader
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section presence_overview Overview
+ *
+ * Fed the inventory of every read cycle, it decides when a card has
+ * checked in, when it has been gone long enough to check out, and when an
+ * unknown card should raise a denied event and a security alert. Several
+ * cards can be present at once (say a guest and housekeeping); each
+ * authorized card has its own slot in a table of MAX_PRESENT_CARDS, with
+ * its own absence counter and check-in time.
+ *
+ * Unknown cards are rate limited per UID in a second table of
+ * DENIED_TRACK_SLOTS. An attempt is one presentation: holding a card on
+ * the reader is a single attempt, taking it away for CARD_ABSENT_THRESHOLD
+ * cycles and presenting it again is another. The first attempt is reported
+ * at once. Repeats inside DENIED_WINDOW_MS fold into one summary denied
+ * event at the end of the window, carrying the attempt count. A security
+ * alert is raised once per window, when MAX_FAILED_ATTEMPTS is reached.
+ *
+ * The checked-in cards and the rate limited unknown cards can be saved
+ * to a PresenceSnapshot and restored after a reset, so a guest who never
+ * left is not checked in twice, the stay duration keeps counting, and a
+ * card that was already being rate limited is not reported afresh. The
+ * absence counts go with them: a tracker restored from a snapshot emits
+ * exactly what the saved one would have.
+ *
+ * It has no hardware dependencies: the UID lookup and the event sink are
+ * supplied by the caller, and time is passed in with each reading. A
+ * lookup that cannot decide yet (a credential read that got no answer)
+ * returns ROLE_UNDECIDED: the card is neither checked in nor denied, and
+ * is looked up again the next cycle it answers.
+ */
+
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+#include "uid_index.h"
+#include "event_journal.h"
+#include "wall_clock.h"
+
+/**
+ * @brief Checked-in and rate limited cards, in a form that outlives a reset
+ */
+struct PresenceSnapshot {
+  struct Card {
+    CardUid  uid;
+    Role     role;
+    uint8_t  absentCount;        ///< Consecutive cycles missed so far
+    uint32_t presentMs;          ///< Time present when the snapshot was taken
+  };
+
+  struct Denied {
+    CardUid  uid;
+    uint8_t  absentCount;
+    bool     inField;
+    bool     alerted;
+    uint32_t windowAgeMs;        ///< Time since its window opened
+    uint32_t attempts;
+    uint32_t unreported;
+  };
+
+  uint8_t count;
+  uint8_t deniedCount;
+  Card    cards[MAX_PRESENT_CARDS];
+  Denied  denied[DENIED_TRACK_SLOTS];
+};
+
+/**
+ * @brief Lookup result for a card to ask about again next cycle; never sent
+ */
+const Role ROLE_UNDECIDED = (Role)0xFF;
+
+class PresenceTracker {
+public:
+  typedef Role (*LookupFn)(const uint8_t* uid, uint8_t size);
+  typedef void (*EventFn)(const JournalEntry& entry);
+
+  /**
+   * @param absentThreshold Consecutive empty reads before a check-out
+   */
+  PresenceTracker(LookupFn lookup, EventFn emit, int absentThreshold);
+
+  /**
+   * @brief Process one read cycle
+   * @param uids  Cards that answered the inventory (count may be 0)
+   * @param nowUs Monotonic time (us), used for check-in durations
+   * @param time  Event time stamped on everything this cycle emits
+   */
+  void update(const CardUid* uids, size_t count, uint64_t nowUs, const EventTime& time);
+
+  /**
+   * @brief Copy the checked-in and the rate limited cards
+   */
+  void save(PresenceSnapshot& out, uint64_t nowUs) const;
+
+  /**
+   * @brief Take over the cards of a snapshot without emitting check-ins
+   *
+   * Each card checks out as usual once it has been absent for
+   * absentThreshold cycles in all, with the saved time included in its
+   * duration. Denied windows go on from where they were; elapsedMs counts
+   * towards them too.
+   *
+   * @param elapsedMs Time between the snapshot and nowUs, if known
+   */
+  void restore(const PresenceSnapshot& snapshot, uint64_t nowUs, uint32_t elapsedMs);
+
+  /**
+   * @brief Number of cards currently checked in
+   */
+  size_t present() const { return count_; }
+
+  /**
+   * @brief Unknown cards currently rate limited
+   */
+  size_t tracking() const;
+
+  /**
+   * @brief Nothing to follow: the reader may wait for a new card
+   *
+   * A rate limited card still needs update() every cycle, whether or not
+   * it is in the field: that is what notices it leave, counts its next
+   * presentation and closes its window.
+   */
+  bool idle() const { return count_ == 0 && tracking() == 0; }
+
+  /**
+   * @brief Authorized cards that could not be checked in because the table was full
+   */
+  uint32_t overflows() const { return overflows_; }
+
+  /**
+   * @brief Denied attempts folded into a summary instead of reported on their own
+   */
+  uint32_t suppressed() const { return suppressed_; }
+
+private:
+  struct Slot {
+    CardUid  uid;
+    Role     role;
+    uint64_t checkedInUs;
+    int      absentCount;
+    bool     seen;               ///< Answered in the current cycle
+  };
+
+  struct DeniedSlot {
+    CardUid  uid;
+    uint32_t windowStartMs;
+    uint32_t attempts;           ///< In the current window
+    uint32_t unreported;         ///< Attempts not yet sent in a denied event
+    int      absentCount;
+    bool     used;
+    bool     seen;               ///< Answered in the current cycle
+    bool     inField;            ///< Still on the reader since its last attempt
+    bool     alerted;            ///< Alert already raised in this window
+  };
+
+  void deny(const CardUid& uid, uint32_t nowMs, const EventTime& time);
+  void expireDenied(uint32_t nowMs, const EventTime& time);
+  void emit(EventType type, Role role, const CardUid& uid, const EventTime& time, uint32_t duration);
+
+  LookupFn lookup_;
+  EventFn  emit_;
+  int      absentThreshold_;
+
+  Slot     slots_[MAX_PRESENT_CARDS];
+  size_t   count_;
+  uint32_t overflows_;
+
+  DeniedSlot denied_[DENIED_TRACK_SLOTS];
+  uint32_t   suppressed_;
+};
+
+#endif // PRESENCE_H
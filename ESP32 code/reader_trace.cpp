@@ -0,0 +1,481 @@
+/**
+ * @file reader_trace.cpp
+ * @brief Compact binary trace of what a reader saw, for replay on the host
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "reader_trace.h"
+#include <string.h>
+
+#if !defined(ARDUINO)
+#include <algorithm>
+#include <utility>
+#endif
+
+namespace {
+
+const uint8_t TRACE_MAGIC[4] = {'R', 'T', 'R', 'C'};
+const uint8_t TAG_ERASED = 0xFF;
+
+// Kinds on storage: the TraceKind values, plus two short forms of Poll
+const uint8_t WIRE_POLL_EMPTY = 9;
+const uint8_t WIRE_POLL_SAME  = 10;
+const uint8_t READER_UNKNOWN  = 0xFF;   ///< No poll of this reader in the sector yet
+
+// Tag and time delta, then the largest record: a presence snapshot with
+// every card and every denied slot at its longest UID and counts
+static_assert(1 + 10 + 1 + MAX_PRESENT_CARDS * (1 + CARD_UID_MAX_SIZE + 2 + 5) +
+              1 + DENIED_TRACK_SLOTS * (1 + CARD_UID_MAX_SIZE + 2 + 3 * 5) + 5 <= TRACE_RECORD_MAX,
+              "TRACE_RECORD_MAX too small for a full presence record");
+
+uint8_t* putVarint(uint8_t* p, uint64_t value) {
+  while (value >= 0x80) {
+    *p++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (uint8_t)value;
+  return p;
+}
+
+// Records come from two tasks, so a time can be a little behind the previous one
+uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+uint8_t* putLe(uint8_t* p, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) *p++ = (uint8_t)(value >> (8 * i));
+  return p;
+}
+
+uint8_t* putUid(uint8_t* p, const CardUid& uid) {
+  *p++ = uid.size;
+  memcpy(p, uid.bytes, uid.size);
+  return p + uid.size;
+}
+
+bool sameCards(uint8_t count, const CardUid* a, const CardUid* b) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (!sameCard(a[i], b[i])) return false;
+  }
+  return true;
+}
+
+} // namespace
+
+// ---- Writer ----
+
+TraceWriter::TraceWriter(JournalStorage& storage)
+  : storage_(storage),
+    sectorSize_(0),
+    sectorCount_(0),
+    bootId_(0),
+    readers_(0),
+    open_(false),
+    sector_(0),
+    seq_(0),
+    offset_(0),
+    lastUs_(0),
+    last_(),
+    page_(),
+    pageLength_(0),
+    checkpoints_(0),
+    sectorsWritten_(0),
+    bytes_(0),
+    errors_(0) {}
+
+bool TraceWriter::begin(uint8_t bootId, uint8_t readers) {
+  if (!storage_.begin()) return false;
+  sectorSize_ = storage_.sectorSize();
+  sectorCount_ = storage_.size() / sectorSize_;
+  if (sectorCount_ < 2 || readers == 0 || readers > MAX_RFID_READERS) return false;
+  bootId_ = bootId;
+  readers_ = readers;
+
+  // Carry on after the newest sector; the one after it is the oldest
+  seq_ = 0;
+  sector_ = sectorCount_ - 1;
+  for (size_t i = 0; i < sectorCount_; i++) {
+    uint8_t header[8];
+    if (!storage_.read(i * sectorSize_, header, sizeof(header))) return false;
+    if (memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) continue;
+    uint32_t seq = header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24;
+    if (seq >= seq_) {
+      seq_ = seq;
+      sector_ = i;
+    }
+  }
+  open_ = false;
+  return true;
+}
+
+void TraceWriter::write(const TraceRecord& record) {
+  if (sectorCount_ == 0) return;
+  if (!open_ && !openSector(record.monoUs)) return;
+
+  uint8_t buf[TRACE_RECORD_MAX];
+  size_t length = encode(record, buf);
+  if (offset_ + pageLength_ + length > sectorSize_) {
+    flush();
+    if (!openSector(record.monoUs)) return;
+    length = encode(record, buf);
+  }
+
+  for (size_t done = 0; done < length;) {
+    size_t n = length - done;
+    if (n > TRACE_PAGE_SIZE - pageLength_) n = TRACE_PAGE_SIZE - pageLength_;
+    memcpy(page_ + pageLength_, buf + done, n);
+    pageLength_ += n;
+    done += n;
+    if (pageLength_ == TRACE_PAGE_SIZE) flush();
+  }
+  bytes_ += length;
+  remember(record);
+}
+
+bool TraceWriter::flush() {
+  if (pageLength_ == 0) return true;
+  bool ok = storage_.write(sector_ * sectorSize_ + offset_, page_, pageLength_);
+  if (!ok) errors_++;
+  // A failed write may have programmed some of it; never write there again
+  offset_ += pageLength_;
+  pageLength_ = 0;
+  return ok;
+}
+
+bool TraceWriter::openSector(uint64_t baseUs) {
+  open_ = false;
+  sector_ = (sector_ + 1) % sectorCount_;
+  size_t start = sector_ * sectorSize_;
+  if (!storage_.eraseSector(start)) {
+    errors_++;
+    return false;
+  }
+
+  uint8_t header[TRACE_HEADER_SIZE - 4];
+  uint8_t* p = header;
+  memcpy(p, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  p = putLe(p + sizeof(TRACE_MAGIC), seq_ + 1, 4);
+  p = putLe(p, baseUs, 8);
+  *p++ = TRACE_FORMAT_VERSION;
+  *p++ = bootId_;
+  *p++ = readers_;
+  *p++ = 0xFF;
+  if (!storage_.write(start, header, sizeof(header))) {
+    errors_++;
+    return false;
+  }
+
+  seq_++;
+  offset_ = TRACE_HEADER_SIZE;
+  lastUs_ = baseUs;
+  for (size_t i = 0; i < MAX_RFID_READERS; i++) last_[i].count = READER_UNKNOWN;
+  open_ = true;
+  sectorsWritten_++;
+  requestCheckpoint();
+  return true;
+}
+
+size_t TraceWriter::encode(const TraceRecord& record, uint8_t* out) const {
+  uint8_t* p = out + 1;
+  p = putVarint(p, zigzag((int64_t)(record.monoUs - lastUs_)));
+  uint8_t kind = (uint8_t)record.kind;
+
+  switch (record.kind) {
+    case TraceKind::Boot:
+      *p++ = record.boot.bootId;
+      *p++ = record.boot.readers;
+      break;
+
+    case TraceKind::Poll: {
+      const TraceRecord::Poll& poll = record.poll;
+      const ReaderState& last = last_[record.reader];
+      if (poll.count == 0) {
+        kind = WIRE_POLL_EMPTY;
+      } else if (last.count == poll.count && sameCards(poll.count, last.uids, poll.uids)) {
+        kind = WIRE_POLL_SAME;
+      } else {
+        *p++ = poll.count;
+        for (uint8_t i = 0; i < poll.count; i++) p = putUid(p, poll.uids[i]);
+      }
+      break;
+    }
+
+    case TraceKind::Lookup:
+      p = putUid(p, record.lookup.uid);
+      *p++ = (uint8_t)record.lookup.role;
+      break;
+
+    case TraceKind::Event: {
+      const JournalEntry& e = record.event;
+      *p++ = (uint8_t)e.type;
+      *p++ = (uint8_t)e.role;
+      p = putUid(p, e.uid);
+      p = putLe(p, e.timestamp, 4);
+      p = putLe(p, e.millis, 2);
+      p = putVarint(p, e.duration);
+      break;
+    }
+
+    case TraceKind::Link:
+      *p++ = record.up ? 1 : 0;
+      break;
+
+    case TraceKind::Clock:
+      p = putLe(p, record.clock.baseMonoUs, 8);
+      p = putLe(p, record.clock.baseEpochUs, 8);
+      p = putLe(p, (uint32_t)record.clock.ratePpb, 4);
+      break;
+
+    case TraceKind::Presence: {
+      const PresenceSnapshot& cards = record.presence.cards;
+      *p++ = cards.count;
+      for (uint8_t i = 0; i < cards.count; i++) {
+        p = putUid(p, cards.cards[i].uid);
+        *p++ = (uint8_t)cards.cards[i].role;
+        *p++ = cards.cards[i].absentCount;
+        p = putVarint(p, cards.cards[i].presentMs);
+      }
+      *p++ = cards.deniedCount;
+      for (uint8_t i = 0; i < cards.deniedCount; i++) {
+        const PresenceSnapshot::Denied& d = cards.denied[i];
+        p = putUid(p, d.uid);
+        *p++ = d.absentCount;
+        *p++ = (uint8_t)((d.inField ? 1 : 0) | (d.alerted ? 2 : 0));
+        p = putVarint(p, d.windowAgeMs);
+        p = putVarint(p, d.attempts);
+        p = putVarint(p, d.unreported);
+      }
+      p = putVarint(p, record.presence.elapsedMs);
+      break;
+    }
+
+    case TraceKind::Gap:
+      p = putVarint(p, record.lost);
+      break;
+  }
+
+  out[0] = (uint8_t)(kind << 4 | (record.reader & 0x0F));
+  return p - out;
+}
+
+void TraceWriter::remember(const TraceRecord& record) {
+  lastUs_ = record.monoUs;
+  if (record.kind != TraceKind::Poll) return;
+  ReaderState& last = last_[record.reader];
+  last.count = record.poll.count;
+  memcpy(last.uids, record.poll.uids, sizeof(CardUid) * record.poll.count);
+}
+
+#if !defined(ARDUINO)
+
+// ---- Reader ----
+
+namespace {
+
+// Bounds-checked cursor over one sector; any overrun marks it failed
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok;
+
+  uint8_t byte() {
+    if (p >= end) {
+      ok = false;
+      return 0;
+    }
+    return *p++;
+  }
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t b = byte();
+      value |= (uint64_t)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) return value;
+    }
+    ok = false;
+    return 0;
+  }
+
+  uint64_t le(size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) value |= (uint64_t)byte() << (8 * i);
+    return value;
+  }
+
+  void uid(CardUid& out) {
+    out.size = byte();
+    if (out.size > CARD_UID_MAX_SIZE || (size_t)(end - p) < out.size) {
+      ok = false;
+      out.size = 0;
+      return;
+    }
+    memcpy(out.bytes, p, out.size);
+    p += out.size;
+  }
+};
+
+} // namespace
+
+TraceReader::TraceReader(const uint8_t* image, size_t size, size_t sectorSize)
+  : image_(image), size_(size), sectorSize_(sectorSize), next_(0), bootId_(0), readers_(0),
+    pos_(nullptr), end_(nullptr), lastUs_(0), last_(), corrupt_(0) {
+  std::vector<std::pair<uint32_t, size_t>> found;
+  for (size_t i = 0; (i + 1) * sectorSize_ <= size_; i++) {
+    const uint8_t* h = image_ + i * sectorSize_;
+    if (memcmp(h, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || h[16] != TRACE_FORMAT_VERSION) continue;
+    uint32_t seq = h[4] | h[5] << 8 | h[6] << 16 | (uint32_t)h[7] << 24;
+    found.push_back({seq, i});
+  }
+  std::sort(found.begin(), found.end());
+  for (size_t i = 0; i < found.size(); i++) order_.push_back(found[i].second);
+
+  if (!order_.empty()) {
+    const uint8_t* h = image_ + order_[0] * sectorSize_;
+    bootId_ = h[17];
+    readers_ = h[18];
+  }
+}
+
+bool TraceReader::openSector(size_t index) {
+  const uint8_t* h = image_ + index * sectorSize_;
+  Cursor c = {h + 8, h + 16, true};
+  lastUs_ = c.le(8);
+  readers_ = h[18];
+  pos_ = h + TRACE_HEADER_SIZE;
+  end_ = h + sectorSize_;
+  for (size_t i = 0; i < MAX_RFID_READERS; i++) last_[i].count = READER_UNKNOWN;
+  return readers_ >= 1 && readers_ <= MAX_RFID_READERS;
+}
+
+bool TraceReader::next(TraceRecord& record) {
+  for (;;) {
+    if (pos_ != nullptr && pos_ < end_ && *pos_ != TAG_ERASED) {
+      if (decode(record)) return true;
+      corrupt_++;
+    }
+    if (next_ == order_.size()) return false;
+    if (!openSector(order_[next_++])) {
+      corrupt_++;
+      pos_ = nullptr;
+    }
+  }
+}
+
+bool TraceReader::decode(TraceRecord& record) {
+  Cursor c = {pos_, end_, true};
+  uint8_t tag = c.byte();
+  uint8_t kind = tag >> 4;
+  record.reader = tag & 0x0F;
+  record.monoUs = lastUs_ + (uint64_t)unzigzag(c.varint());
+  if (record.reader >= readers_) return false;
+
+  TraceRecord::Poll& last = last_[record.reader];
+  switch (kind) {
+    case (uint8_t)TraceKind::Boot:
+      record.kind = TraceKind::Boot;
+      record.boot.bootId = c.byte();
+      record.boot.readers = c.byte();
+      break;
+
+    case (uint8_t)TraceKind::Poll:
+      record.kind = TraceKind::Poll;
+      record.poll.count = c.byte();
+      if (record.poll.count > MAX_PRESENT_CARDS) return false;
+      for (uint8_t i = 0; i < record.poll.count && c.ok; i++) c.uid(record.poll.uids[i]);
+      break;
+
+    case WIRE_POLL_EMPTY:
+      record.kind = TraceKind::Poll;
+      record.poll.count = 0;
+      break;
+
+    case WIRE_POLL_SAME:
+      if (last.count == READER_UNKNOWN) return false;
+      record.kind = TraceKind::Poll;
+      record.poll = last;
+      break;
+
+    case (uint8_t)TraceKind::Lookup:
+      record.kind = TraceKind::Lookup;
+      c.uid(record.lookup.uid);
+      record.lookup.role = (Role)c.byte();
+      break;
+
+    case (uint8_t)TraceKind::Event: {
+      record.kind = TraceKind::Event;
+      JournalEntry& e = record.event;
+      e.seq = 0;
+      e.reader = record.reader;
+      e.type = (EventType)c.byte();
+      e.role = (Role)c.byte();
+      c.uid(e.uid);
+      e.timestamp = (uint32_t)c.le(4);
+      e.millis = (uint16_t)c.le(2);
+      e.duration = (uint32_t)c.varint();
+      break;
+    }
+
+    case (uint8_t)TraceKind::Link:
+      record.kind = TraceKind::Link;
+      record.up = c.byte() != 0;
+      break;
+
+    case (uint8_t)TraceKind::Clock:
+      record.kind = TraceKind::Clock;
+      record.clock.baseMonoUs = c.le(8);
+      record.clock.baseEpochUs = c.le(8);
+      record.clock.ratePpb = (int32_t)(uint32_t)c.le(4);
+      break;
+
+    case (uint8_t)TraceKind::Presence: {
+      record.kind = TraceKind::Presence;
+      PresenceSnapshot& cards = record.presence.cards;
+      cards.count = c.byte();
+      if (cards.count > MAX_PRESENT_CARDS) return false;
+      for (uint8_t i = 0; i < cards.count && c.ok; i++) {
+        c.uid(cards.cards[i].uid);
+        cards.cards[i].role = (Role)c.byte();
+        cards.cards[i].absentCount = c.byte();
+        cards.cards[i].presentMs = (uint32_t)c.varint();
+      }
+      cards.deniedCount = c.byte();
+      if (cards.deniedCount > DENIED_TRACK_SLOTS) return false;
+      for (uint8_t i = 0; i < cards.deniedCount && c.ok; i++) {
+        PresenceSnapshot::Denied& d = cards.denied[i];
+        c.uid(d.uid);
+        d.absentCount = c.byte();
+        uint8_t flags = c.byte();
+        d.inField = (flags & 1) != 0;
+        d.alerted = (flags & 2) != 0;
+        d.windowAgeMs = (uint32_t)c.varint();
+        d.attempts = (uint32_t)c.varint();
+        d.unreported = (uint32_t)c.varint();
+      }
+      record.presence.elapsedMs = (uint32_t)c.varint();
+      break;
+    }
+
+    case (uint8_t)TraceKind::Gap:
+      record.kind = TraceKind::Gap;
+      record.lost = (uint32_t)c.varint();
+      break;
+
+    default:
+      return false;
+  }
+  if (!c.ok) return false;
+
+  if (record.kind == TraceKind::Poll) last = record.poll;
+  lastUs_ = record.monoUs;
+  pos_ = c.p;
+  return true;
+}
+
+#endif
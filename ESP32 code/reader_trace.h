@@ -0,0 +1,235 @@
+/**
+ * @file reader_trace.h
+ * @brief Compact binary trace of what a reader saw, for replay on the host
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section reader_trace_overview Overview
+ *
+ * With ENABLE_TRACE set, the firmware records everything the presence and
+ * publish logic act on, below the events they produce:
+ * - every inventory of every reader, with the UIDs that answered,
+ * - every card list lookup the presence logic made, and its result,
+ * - every event it emitted,
+ * - session up and down, and every change of the event clock,
+ * - resets, with the checked-in cards carried over.
+ *
+ * tools/trace_replay feeds such a trace through the same PresenceTracker
+ * and EventPublisher on Linux, checks that they emit the recorded events
+ * again, and times each stage.
+ *
+ * @section reader_trace_format Format
+ *
+ * The trace fills a ring of flash sectors (the "trace" partition). The
+ * partition image read back with esptool is the trace file; the replayer
+ * maps it into memory as it is. Each sector starts with a header:
+ *
+ * @code
+ * uint32  magic "RTRC"
+ * uint32  sector sequence number, oldest sector has the lowest
+ * uint64  monotonic time (us) that record times in this sector count from
+ * uint8   format version, boot id, reader count, 0xFF
+ * uint32  0xFFFFFFFF
+ * @endcode
+ *
+ * followed by records up to the first 0xFF tag. A record is a tag byte
+ * (kind << 4 | reader), the time since the previous record as a varint
+ * in microseconds, and a body that depends on the kind. An empty
+ * inventory, or one with the same cards as the reader's previous one,
+ * takes four bytes or less. Sectors never refer to each other, so the
+ * trace stays readable once the oldest sectors have been overwritten.
+ *
+ * Every time a sector is opened, the writer asks for a checkpoint: the
+ * RFID task adds each reader's checked-in cards, the network task the
+ * clock and the link state. A replay that starts in the middle of the
+ * ring begins at those.
+ *
+ * Records travel from the RFID task to the network task in a SpscQueue,
+ * like card events; only the network task writes to flash, one page at a
+ * time.
+ */
+
+#ifndef READER_TRACE_H
+#define READER_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "config.h"
+#include "event_journal.h"
+#include "presence.h"
+#include "uid_index.h"
+#include "wall_clock.h"
+
+#if !defined(ARDUINO)
+#include <vector>
+#endif
+
+#define TRACE_FORMAT_VERSION 2
+#define TRACE_HEADER_SIZE 24
+#define TRACE_RECORD_MAX 400         ///< Longest encoded record: a full presence snapshot of 10-byte UIDs (bytes)
+#define TRACE_PAGE_SIZE 256          ///< Flash write unit
+
+enum class TraceKind : uint8_t {
+  Boot = 1,        ///< Reset; the records after it are the state carried over
+  Poll = 2,        ///< One inventory of one reader
+  Lookup = 3,      ///< Card list lookup by the presence logic
+  Event = 4,       ///< Event emitted by the presence logic
+  Link = 5,        ///< MQTT session up or down
+  Clock = 6,       ///< Event clock set (NTP, warm reset) or checkpointed
+  Presence = 7,    ///< Checked-in cards of one reader (warm reset, checkpoint)
+  Gap = 8          ///< Records were lost to a full queue
+};
+
+/**
+ * @brief One trace record, as written and as read back
+ */
+struct TraceRecord {
+  struct Poll {
+    uint8_t count;
+    CardUid uids[MAX_PRESENT_CARDS];
+  };
+  struct Lookup {
+    CardUid uid;
+    Role    role;
+  };
+  struct Presence {
+    PresenceSnapshot cards;
+    uint32_t         elapsedMs;  ///< As passed to PresenceTracker::restore()
+  };
+  struct Boot {
+    uint8_t bootId;
+    uint8_t readers;
+  };
+
+  TraceKind kind;
+  uint8_t   reader;              ///< Row of RFID_READERS; 0 for kinds without one
+  uint64_t  monoUs;              ///< Monotonic time of the record
+  union {
+    Poll         poll;
+    Lookup       lookup;
+    JournalEntry event;          ///< seq is not recorded
+    Presence     presence;
+    Boot         boot;
+    ClockState   clock;
+    bool         up;             ///< Link
+    uint32_t     lost;           ///< Gap: records dropped
+  };
+};
+
+class TraceWriter {
+public:
+  explicit TraceWriter(JournalStorage& storage);
+
+  /**
+   * @brief Mount the storage and continue after the newest sector in it
+   * @return false if the storage is missing or smaller than two sectors
+   */
+  bool begin(uint8_t bootId, uint8_t readers);
+
+  /**
+   * @brief Encode one record; a full page goes to storage
+   *
+   * Records must come in time order. Network task only.
+   */
+  void write(const TraceRecord& record);
+
+  /**
+   * @brief Write out the partial page, if any
+   */
+  bool flush();
+
+  /**
+   * @brief Incremented whenever the tasks should record their state
+   *
+   * Each task keeps the last value it acted on. Any task may read it.
+   */
+  uint32_t checkpoints() const { return checkpoints_.load(std::memory_order_acquire); }
+
+  /**
+   * @brief Ask for a checkpoint, e.g. after records were lost
+   */
+  void requestCheckpoint() { checkpoints_.fetch_add(1, std::memory_order_release); }
+
+  uint32_t sectors() const { return sectorsWritten_; }   ///< Sectors opened since begin()
+  uint64_t bytes() const { return bytes_; }              ///< Encoded bytes since begin()
+  uint32_t errors() const { return errors_; }            ///< Failed erases and writes
+
+private:
+  struct ReaderState {
+    uint8_t count;
+    CardUid uids[MAX_PRESENT_CARDS];
+  };
+
+  size_t encode(const TraceRecord& record, uint8_t* out) const;
+  void   remember(const TraceRecord& record);
+  bool   openSector(uint64_t baseUs);
+
+  JournalStorage& storage_;
+  size_t   sectorSize_;
+  size_t   sectorCount_;
+  uint8_t  bootId_;
+  uint8_t  readers_;
+
+  bool     open_;                ///< A sector is being filled
+  size_t   sector_;
+  uint32_t seq_;                 ///< Of the sector being filled
+  size_t   offset_;              ///< In it, of the first unwritten byte
+  uint64_t lastUs_;
+  ReaderState last_[MAX_RFID_READERS];   ///< Previous poll per reader, this sector
+
+  uint8_t  page_[TRACE_PAGE_SIZE];
+  size_t   pageLength_;
+
+  std::atomic<uint32_t> checkpoints_;
+  uint32_t sectorsWritten_;
+  uint64_t bytes_;
+  uint32_t errors_;
+};
+
+#if !defined(ARDUINO)
+
+/**
+ * @brief Reads a trace image (a copy of the partition) in time order
+ */
+class TraceReader {
+public:
+  /**
+   * @param image Whole partition image, e.g. mapped with mmap()
+   */
+  TraceReader(const uint8_t* image, size_t size, size_t sectorSize = 4096);
+
+  /**
+   * @brief Next record, across sectors
+   * @return false at the end of the trace
+   */
+  bool next(TraceRecord& record);
+
+  size_t  sectors() const { return order_.size(); }    ///< Sectors holding a header
+  uint8_t bootId() const { return bootId_; }           ///< Of the oldest sector
+  uint8_t readers() const { return readers_; }
+  uint32_t corrupt() const { return corrupt_; }        ///< Sectors cut short by a bad record
+
+private:
+  bool openSector(size_t index);
+  bool decode(TraceRecord& record);
+
+  const uint8_t*      image_;
+  size_t              size_;
+  size_t              sectorSize_;
+  std::vector<size_t> order_;    ///< Sector indices, oldest first
+  size_t              next_;     ///< Into order_
+  uint8_t             bootId_;
+  uint8_t             readers_;
+
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  uint64_t       lastUs_;
+  TraceRecord::Poll last_[MAX_RFID_READERS];
+  uint32_t       corrupt_;
+};
+
+#endif
+
+#endif // READER_TRACE_H
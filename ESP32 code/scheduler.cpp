@@ -0,0 +1,129 @@
+/**
+ * @file scheduler.cpp
+ * @brief Cooperative task scheduler driven by a hashed timer wheel
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "scheduler.h"
+
+namespace {
+
+uint32_t toTicks(uint32_t ms) {
+  uint32_t ticks = (ms + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS;
+  return ticks == 0 ? 1 : ticks;
+}
+
+// Wrap-safe "a is at or after b" for tick counters
+bool reached(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) >= 0;
+}
+
+} // namespace
+
+Scheduler::Scheduler() : tasks_(), currentTick_(0), started_(false) {
+  for (size_t i = 0; i < SCHEDULER_WHEEL_SLOTS; i++) wheel_[i] = -1;
+}
+
+int Scheduler::add(const char* name, TaskFn fn, uint32_t periodMs, uint32_t nowMs, uint32_t firstDelayMs) {
+  if (!started_) {
+    currentTick_ = nowMs / SCHEDULER_TICK_MS;
+    started_ = true;
+  }
+
+  for (int id = 0; id < SCHEDULER_MAX_TASKS; id++) {
+    Task& task = tasks_[id];
+    if (task.used) continue;
+
+    task.name = name;
+    task.fn = fn;
+    task.periodTicks = toTicks(periodMs);
+    task.next = -1;
+    task.used = true;
+    schedule(id, currentTick_ + (firstDelayMs == 0 ? 1 : toTicks(firstDelayMs)));
+    return id;
+  }
+  return -1;
+}
+
+void Scheduler::setPeriod(int id, uint32_t periodMs) {
+  if (id < 0 || id >= SCHEDULER_MAX_TASKS || !tasks_[id].used) return;
+  tasks_[id].periodTicks = toTicks(periodMs);
+}
+
+void Scheduler::wake(int id) {
+  if (id < 0 || id >= SCHEDULER_MAX_TASKS || !tasks_[id].used) return;
+  unlink(id);
+  schedule(id, currentTick_ + 1);
+}
+
+void Scheduler::tick(uint32_t nowMs) {
+  if (!started_) return;
+
+  uint32_t target = nowMs / SCHEDULER_TICK_MS;
+  if (!reached(target, currentTick_ + 1)) return;
+
+  // After a stall longer than one revolution every slot is visited once;
+  // the due check below still catches everything that has expired
+  uint32_t steps = target - currentTick_;
+  if (steps > SCHEDULER_WHEEL_SLOTS) steps = SCHEDULER_WHEEL_SLOTS;
+
+  uint32_t first = target - steps + 1;
+  currentTick_ = target;
+
+  for (uint32_t t = first; reached(target, t); t++) {
+    int8_t id = wheel_[t % SCHEDULER_WHEEL_SLOTS];
+    while (id >= 0) {
+      Task& task = tasks_[id];
+      int8_t next = task.next;
+
+      if (reached(target, task.dueTick)) {
+        unlink(id);
+        // Reschedule before running so a task may wake() or retune itself
+        schedule(id, target + task.periodTicks);
+        task.fn(nowMs);
+      }
+      id = next;
+    }
+  }
+}
+
+uint32_t Scheduler::idleMs(uint32_t nowMs) const {
+  uint32_t nowTick = nowMs / SCHEDULER_TICK_MS;
+  uint32_t best = UINT32_MAX;
+
+  for (int id = 0; id < SCHEDULER_MAX_TASKS; id++) {
+    const Task& task = tasks_[id];
+    if (!task.used) continue;
+    if (reached(nowTick, task.dueTick)) return 0;
+    uint32_t wait = (task.dueTick - nowTick) * SCHEDULER_TICK_MS - nowMs % SCHEDULER_TICK_MS;
+    if (wait < best) best = wait;
+  }
+  return best;
+}
+
+const char* Scheduler::name(int id) const {
+  if (id < 0 || id >= SCHEDULER_MAX_TASKS || !tasks_[id].used) return "";
+  return tasks_[id].name;
+}
+
+void Scheduler::schedule(int id, uint32_t dueTick) {
+  Task& task = tasks_[id];
+  size_t slot = dueTick % SCHEDULER_WHEEL_SLOTS;
+  task.dueTick = dueTick;
+  task.next = wheel_[slot];
+  wheel_[slot] = (int8_t)id;
+}
+
+void Scheduler::unlink(int id) {
+  int8_t* link = &wheel_[tasks_[id].dueTick % SCHEDULER_WHEEL_SLOTS];
+  while (*link >= 0) {
+    if (*link == id) {
+      *link = tasks_[id].next;
+      tasks_[id].next = -1;
+      return;
+    }
+    link = &tasks_[*link].next;
+  }
+}
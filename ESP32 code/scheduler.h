@@ -0,0 +1,82 @@
+/**
+ * @file scheduler.h
+ * @brief Cooperative task scheduler driven by a hashed timer wheel
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section scheduler_overview Overview
+ *
+ * Runs the network task's periodic jobs (event journaling, WiFi and WebSocket
+ * maintenance, NTP resync, telemetry) without any of them
+ * blocking the others. Every task is a short, non-blocking step function
+ * that returns quickly and keeps its progress in its own state; long
+ * operations such as a WiFi join are spread over many calls.
+ *
+ * Pending tasks sit in a timer wheel of SCHEDULER_WHEEL_SLOTS buckets of
+ * SCHEDULER_TICK_MS each, so a tick only inspects the bucket(s) that have
+ * come due rather than every task.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+class Scheduler {
+public:
+  typedef void (*TaskFn)(uint32_t nowMs);
+
+  Scheduler();
+
+  /**
+   * @brief Register a periodic task
+   * @param firstDelayMs Delay before the first run (0 = next tick)
+   * @return Task id, or -1 if SCHEDULER_MAX_TASKS are already registered
+   */
+  int add(const char* name, TaskFn fn, uint32_t periodMs, uint32_t nowMs, uint32_t firstDelayMs = 0);
+
+  /**
+   * @brief Change a task's period; takes effect from its next run
+   */
+  void setPeriod(int id, uint32_t periodMs);
+
+  /**
+   * @brief Run a task on the next tick instead of waiting for its period
+   */
+  void wake(int id);
+
+  /**
+   * @brief Run every task that has come due
+   */
+  void tick(uint32_t nowMs);
+
+  /**
+   * @brief Time until the next task is due (0 if one is due now)
+   */
+  uint32_t idleMs(uint32_t nowMs) const;
+
+  const char* name(int id) const;
+
+private:
+  struct Task {
+    const char* name;
+    TaskFn      fn;
+    uint32_t    periodTicks;
+    uint32_t    dueTick;
+    int8_t      next;            ///< Next task in the same wheel slot, -1 = end
+    bool        used;
+  };
+
+  void schedule(int id, uint32_t dueTick);
+  void unlink(int id);
+
+  Task     tasks_[SCHEDULER_MAX_TASKS];
+  int8_t   wheel_[SCHEDULER_WHEEL_SLOTS];
+  uint32_t currentTick_;         ///< Last tick whose slot has been processed
+  bool     started_;
+};
+
+#endif // SCHEDULER_H
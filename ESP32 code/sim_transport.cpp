@@ -0,0 +1,141 @@
+/**
+ * @file sim_transport.cpp
+ * @brief Deterministic WiFi link and WebSocket stand-ins for the Linux host
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "sim_transport.h"
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+
+// ---- Link ----
+SimLink::SimLink()
+  : state_(1),
+    meanUpMs_(0),
+    meanDownMs_(0),
+    changeAtMs_(0),
+    scheduled_(false),
+    started_(false),
+    up_(true),
+    flaps_(0) {}
+
+SimLink::SimLink(uint32_t seed, uint32_t meanUpMs, uint32_t meanDownMs)
+  : state_(seed == 0 ? 1 : seed),
+    meanUpMs_(meanUpMs),
+    meanDownMs_(meanDownMs),
+    changeAtMs_(0),
+    scheduled_(true),
+    started_(false),
+    up_(true),
+    flaps_(0) {}
+
+bool SimLink::update(uint32_t nowMs) {
+  if (!scheduled_) return false;
+
+  if (!started_) {
+    changeAtMs_ = nowMs + period(meanUpMs_);
+    started_ = true;
+    return false;
+  }
+  if ((int32_t)(nowMs - changeAtMs_) < 0) return false;
+
+  up_ = !up_;
+  if (!up_) flaps_++;
+  changeAtMs_ = nowMs + period(up_ ? meanUpMs_ : meanDownMs_);
+  return true;
+}
+
+uint32_t SimLink::nextRandom() {
+  // xorshift32
+  state_ ^= state_ << 13;
+  state_ ^= state_ >> 17;
+  state_ ^= state_ << 5;
+  return state_;
+}
+
+uint32_t SimLink::period(uint32_t mean) {
+  if (mean == 0) return 1;
+  return mean / 2 + nextRandom() % (mean + 1);
+}
+
+// ---- Socket ----
+SimSocket* SimSocket::active_ = nullptr;
+
+SimSocket::SimSocket(SimLink& link)
+  : link_(link),
+    client_(nullptr),
+    autoAck_(true),
+    replyLength_(0),
+    frames_(0),
+    publishes_(0),
+    bytes_(0) {
+  active_ = this;
+}
+
+SimSocket::~SimSocket() {
+  if (active_ == this) active_ = nullptr;
+}
+
+bool SimSocket::send(const uint8_t* data, size_t length) {
+  return active_ != nullptr && active_->receive(data, length);
+}
+
+void SimSocket::deliver(uint32_t nowMs) {
+  if (client_ == nullptr || replyLength_ == 0) return;
+
+  // Copy first: the client may send (and queue new replies) while handling these
+  uint8_t pending[sizeof(replies_)];
+  size_t length = replyLength_;
+  memcpy(pending, replies_, length);
+  replyLength_ = 0;
+  client_->onData(pending, length, nowMs);
+}
+
+bool SimSocket::receive(const uint8_t* data, size_t length) {
+  if (!link_.up() || length < 2) return false;
+  frames_++;
+  bytes_ += length;
+
+  // MqttClient hands over exactly one control packet per send
+  size_t offset = 1;
+  while (offset < length && offset < 5 && (data[offset] & 0x80)) offset++;
+  offset++;
+
+  switch (data[0] & 0xF0) {
+    case MQTT_CONNECT: {
+      const uint8_t connack[] = {MQTT_CONNACK, 0x02, 0x00, 0x00};
+      reply(connack, sizeof(connack));
+      break;
+    }
+    case MQTT_PUBLISH: {
+      publishes_++;
+      uint8_t qos = (data[0] >> 1) & 0x03;
+      if (qos == 0 || !autoAck_ || offset + 2 > length) break;
+      size_t idAt = offset + 2 + ((size_t)data[offset] << 8 | data[offset + 1]);
+      if (idAt + 2 > length) break;
+      const uint8_t puback[] = {MQTT_PUBACK, 0x02, data[idAt], data[idAt + 1]};
+      reply(puback, sizeof(puback));
+      break;
+    }
+    case MQTT_PINGREQ: {
+      const uint8_t pingresp[] = {MQTT_PINGRESP, 0x00};
+      reply(pingresp, sizeof(pingresp));
+      break;
+    }
+    default:
+      break;
+  }
+  return true;
+}
+
+void SimSocket::reply(const uint8_t* packet, size_t length) {
+  if (replyLength_ + length > sizeof(replies_)) return;
+  memcpy(replies_ + replyLength_, packet, length);
+  replyLength_ += length;
+}
+
+#endif
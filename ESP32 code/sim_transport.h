@@ -0,0 +1,124 @@
+/**
+ * @file sim_transport.h
+ * @brief Deterministic WiFi link and WebSocket stand-ins for the Linux host
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section sim_transport_overview Overview
+ *
+ * Together with SimCardReader (card_reader.h) these replace the hardware
+ * the firmware talks to, so the presence, journal and publish path can be
+ * run and profiled off-device:
+ * - SimLink is the WiFi link. It is either held up or down by the caller,
+ *   or flaps on a pseudo-random schedule fixed by its seed.
+ * - SimSocket is the WebSocket plus the broker behind it. It accepts the
+ *   frames MqttClient sends, answers CONNECT, QoS 1 PUBLISH and PINGREQ
+ *   the way aedes does, and hands the replies back on deliver().
+ *
+ * Nothing here reads a real clock; time only moves when the caller passes
+ * a new nowMs, so every run with the same inputs is identical.
+ */
+
+#ifndef SIM_TRANSPORT_H
+#define SIM_TRANSPORT_H
+
+#if !defined(ARDUINO)
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mqtt_client.h"
+
+class SimLink {
+public:
+  /**
+   * @brief Link that only changes when setUp() is called
+   */
+  SimLink();
+
+  /**
+   * @brief Link that flaps; each up or down period lasts between half and
+   *        one and a half times its mean
+   */
+  SimLink(uint32_t seed, uint32_t meanUpMs, uint32_t meanDownMs);
+
+  /**
+   * @brief Advance the flap schedule
+   * @return true if the link changed state
+   */
+  bool update(uint32_t nowMs);
+
+  void     setUp(bool up) { up_ = up; }
+  bool     up() const { return up_; }
+  uint32_t flaps() const { return flaps_; }
+
+private:
+  uint32_t nextRandom();
+  uint32_t period(uint32_t mean);
+
+  uint32_t state_;
+  uint32_t meanUpMs_;
+  uint32_t meanDownMs_;
+  uint32_t changeAtMs_;
+  bool     scheduled_;
+  bool     started_;
+  bool     up_;
+  uint32_t flaps_;
+};
+
+class SimSocket {
+public:
+  /**
+   * @brief Frames from send() go to the most recently constructed socket
+   */
+  explicit SimSocket(SimLink& link);
+  ~SimSocket();
+
+  /**
+   * @brief MqttClient::SendFn for the active socket; fails while the link is down
+   */
+  static bool send(const uint8_t* data, size_t length);
+
+  /**
+   * @brief Client that broker replies are delivered to
+   */
+  void attach(MqttClient& client) { client_ = &client; }
+
+  /**
+   * @brief Withhold PUBACKs, e.g. to fill the inflight window
+   */
+  void setAutoAck(bool on) { autoAck_ = on; }
+
+  /**
+   * @brief Feed the replies queued since the last call to the client
+   */
+  void deliver(uint32_t nowMs);
+
+  /**
+   * @brief Drop queued replies, as a broken connection would
+   */
+  void reset() { replyLength_ = 0; }
+
+  uint32_t frames() const { return frames_; }
+  uint32_t publishes() const { return publishes_; }
+  size_t   bytes() const { return bytes_; }
+
+private:
+  bool receive(const uint8_t* data, size_t length);
+  void reply(const uint8_t* packet, size_t length);
+
+  static SimSocket* active_;
+
+  SimLink&    link_;
+  MqttClient* client_;
+  bool        autoAck_;
+  uint8_t     replies_[256];
+  size_t      replyLength_;
+  uint32_t    frames_;
+  uint32_t    publishes_;
+  size_t      bytes_;
+};
+
+#endif
+
+#endif // SIM_TRANSPORT_H
@@ -0,0 +1,94 @@
+/**
+ * @file spsc_queue.h
+ * @brief Lock-free single-producer/single-consumer queue
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section spsc_queue_overview Overview
+ *
+ * Hands card events from the RFID task to the network task, which run on
+ * different cores. Exactly one thread may push and exactly one may pop;
+ * neither side ever blocks or takes a lock. The queue is a fixed ring of
+ * Capacity slots and never allocates.
+ *
+ * When the ring is full push() fails and the event is counted in
+ * dropped(); highWater() records the deepest the queue has been, so the
+ * telemetry report shows how close the consumer came to falling behind.
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Producer and consumer indices live on separate cache lines
+#define SPSC_CACHE_LINE 64
+
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+public:
+  SpscQueue() : head_(0), tail_(0), pushed_(0), dropped_(0), highWater_(0) {}
+
+  /**
+   * @brief Producer side: append an item
+   * @return false if the queue is full (the item is counted as dropped)
+   */
+  bool push(const T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t depth = head - tail_.load(std::memory_order_acquire);
+    if (depth >= Capacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    slots_[head & (Capacity - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    if (depth + 1 > highWater_.load(std::memory_order_relaxed)) {
+      highWater_.store((uint32_t)(depth + 1), std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Consumer side: take the oldest item
+   * @return false if the queue is empty
+   */
+  bool pop(T& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+
+    item = slots_[tail & (Capacity - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Items currently queued; exact only from the producer or consumer
+   */
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  size_t   capacity() const { return Capacity; }
+  uint32_t pushed() const { return pushed_.load(std::memory_order_relaxed); }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  uint32_t highWater() const { return highWater_.load(std::memory_order_relaxed); }
+
+private:
+  alignas(SPSC_CACHE_LINE) std::atomic<size_t> head_;   ///< Written by producer
+  alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail_;   ///< Written by consumer
+  alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> pushed_;
+  std::atomic<uint32_t> dropped_;
+  std::atomic<uint32_t> highWater_;
+  T slots_[Capacity];
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,64 @@
+/**
+ * @file telemetry.cpp
+ * @brief Allocation-free latency histograms and counters for the firmware
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "telemetry.h"
+
+const char* metricName(Metric metric) {
+  switch (metric) {
+    case Metric::RfidRead:    return "rfid_read_us";
+    case Metric::RfidJitter:  return "rfid_jitter_us";
+    case Metric::NetworkTick: return "network_tick_us";
+    case Metric::WsSend:      return "ws_send_us";
+    case Metric::PublishAck:  return "publish_ack_ms";
+    case Metric::Reconnect:   return "reconnect_ms";
+    case Metric::CardAuth:    return "card_auth_us";
+    default:                  return "unknown";
+  }
+}
+
+const char* statName(Stat stat) {
+  switch (stat) {
+    case Stat::EventsQueued:  return "events";
+    case Stat::EventsDropped: return "events_dropped";
+    case Stat::Published:     return "published";
+    case Stat::PublishFailed: return "publish_failed";
+    case Stat::Unsendable:    return "events_unsendable";
+    case Stat::Reconnects:    return "reconnects";
+    case Stat::AuthFailed:    return "auth_failed";
+    default:                  return "unknown";
+  }
+}
+
+Telemetry::Telemetry()
+  : metrics_(),
+    stats_(),
+    lastMetrics_(),
+    lastStats_() {}
+
+void Telemetry::report(TelemetryReport& out, uint32_t nowMs) {
+  out.uptimeSec = nowMs / 1000;
+
+  for (size_t m = 0; m < METRIC_COUNT; m++) {
+    Cells& cells = metrics_[m];
+    HistogramSnapshot& last = lastMetrics_[m];
+    for (size_t b = 0; b < TELEMETRY_BUCKETS; b++) {
+      uint32_t now = cells.buckets[b].load(std::memory_order_relaxed);
+      out.metrics[m].buckets[b] = now - last.buckets[b];
+      last.buckets[b] = now;
+    }
+    uint32_t sum = cells.sum.load(std::memory_order_relaxed);
+    out.metrics[m].sum = sum - last.sum;
+    last.sum = sum;
+  }
+
+  for (size_t s = 0; s < STAT_COUNT; s++) {
+    uint32_t now = stats_[s].load(std::memory_order_relaxed);
+    out.stats[s] = now - lastStats_[s];
+    lastStats_[s] = now;
+  }
+}
@@ -0,0 +1,129 @@
+/**
+ * @file telemetry.h
+ * @brief Allocation-free latency histograms and counters for the firmware
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section telemetry_overview Overview
+ *
+ * The hot paths (card reads, scheduler ticks, WebSocket sends, PUBACKs)
+ * record into fixed log2-bucket histograms: one bucket lookup and two
+ * stores, no locks, no heap. Bucket 0 counts zeros, bucket i counts values
+ * in [2^(i-1), 2^i), and the last bucket also takes everything larger.
+ *
+ * Every metric and counter has exactly one writer task. Values only ever
+ * grow, and report() sends the difference from the previous report, so the
+ * network task can read what the RFID task writes without ever resetting
+ * it under its feet.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define TELEMETRY_BUCKETS 16
+
+// ---- Metrics ----
+enum class Metric : uint8_t {
+  RfidRead,        ///< readCards() time, i.e. SPI traffic per cycle (us); RFID task
+  RfidJitter,      ///< Read cycle start past its due time (us); RFID task
+  NetworkTick,     ///< One scheduler tick on the network task (us)
+  WsSend,          ///< One WebSocket frame send (us); network task
+  PublishAck,      ///< Publish to PUBACK (ms); network task
+  Reconnect,       ///< Connection lost (or first attempt) to MQTT session up (ms); network task
+  CardAuth,        ///< Credential check of an arriving card, i.e. added tap-to-decision time (us); RFID task
+  Count
+};
+
+enum class Stat : uint8_t {
+  EventsQueued,    ///< Card events handed to the network task; RFID task
+  EventsDropped,   ///< Card events lost to a full queue; RFID task
+  Published,       ///< Successful event publishes; network task
+  PublishFailed,   ///< Failed event publishes; network task
+  Unsendable,      ///< Journal events dropped because they do not encode; network task
+  Reconnects,      ///< WebSocket connections opened; network task
+  AuthFailed,      ///< Cards on the card list refused by CARD_AUTH; RFID task
+  Count
+};
+
+const size_t METRIC_COUNT = (size_t)Metric::Count;
+const size_t STAT_COUNT   = (size_t)Stat::Count;
+
+/**
+ * @brief JSON key of a metric ("rfid_read_us", ...) or counter ("events", ...)
+ */
+const char* metricName(Metric metric);
+const char* statName(Stat stat);
+
+struct HistogramSnapshot {
+  uint32_t buckets[TELEMETRY_BUCKETS];
+  uint32_t sum;                    ///< Wraps; only the per-report difference is meaningful
+};
+
+/**
+ * @brief Counts and heap figures for one reporting interval
+ */
+struct TelemetryReport {
+  uint32_t          uptimeSec;
+  uint32_t          heapFree;      ///< Filled in by the caller (platform specific)
+  uint32_t          heapMin;
+  uint32_t          heapLargest;
+  HistogramSnapshot metrics[METRIC_COUNT];
+  uint32_t          stats[STAT_COUNT];
+};
+
+class Telemetry {
+public:
+  Telemetry();
+
+  /**
+   * @brief Record one sample; only the metric's writer task may call this
+   */
+  void record(Metric metric, uint32_t value) {
+    Cells& cells = metrics_[(size_t)metric];
+    bump(cells.buckets[bucketOf(value)], 1);
+    bump(cells.sum, value);
+  }
+
+  /**
+   * @brief Add to a counter; only the counter's writer task may call this
+   */
+  void count(Stat stat, uint32_t n = 1) {
+    bump(stats_[(size_t)stat], n);
+  }
+
+  /**
+   * @brief Fill in everything recorded since the previous call (heap fields excepted)
+   */
+  void report(TelemetryReport& out, uint32_t nowMs);
+
+  static size_t bucketOf(uint32_t value) {
+    if (value == 0) return 0;
+    size_t bucket = 32 - __builtin_clz(value);   // NSAU on the ESP32
+    return bucket < TELEMETRY_BUCKETS ? bucket : TELEMETRY_BUCKETS - 1;
+  }
+
+private:
+  struct Cells {
+    std::atomic<uint32_t> buckets[TELEMETRY_BUCKETS];
+    std::atomic<uint32_t> sum;
+  };
+
+  // Single writer: a plain load and store, no read-modify-write needed
+  static void bump(std::atomic<uint32_t>& cell, uint32_t n) {
+    cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  Cells                 metrics_[METRIC_COUNT];
+  std::atomic<uint32_t> stats_[STAT_COUNT];
+
+  // ---- Previous report (network task) ----
+  HistogramSnapshot lastMetrics_[METRIC_COUNT];
+  uint32_t          lastStats_[STAT_COUNT];
+};
+
+#endif // TELEMETRY_H
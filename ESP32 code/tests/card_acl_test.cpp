@@ -0,0 +1,225 @@
+/**
+ * @file card_acl_test.cpp
+ * @brief Applying 10k-card snapshots and 100-card deltas: time, memory, correctness
+ *
+ * Updates are encoded the way the backend encodes them, 64 cards per
+ * chunk, and applied to a BasicCardAcl sized for a 10k-card list while
+ * another thread keeps looking cards up. Ten snapshots of 10,000 cards,
+ * then 200 deltas of 100 cards each (half adds, half revokes). After every
+ * update the list is compared with a reference map.
+ *
+ * Memory is the object itself (both tables, the delta log) and the heap:
+ * apply() must not allocate. The first delta after a snapshot copies the
+ * live table into the spare one; every later delta replays the last one
+ * instead, which is what the per-delta time shows.
+ *
+ * The firmware's CardAcl holds UID_INDEX_CAPACITY - 1 cards. A 10k
+ * snapshot must come back Full and leave its live list as it was.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "card_acl.h"
+#include "host_test.h"
+
+namespace {
+
+const size_t HOTEL_CARDS = 10000;
+const size_t DELTA_CARDS = 100;
+const size_t CHUNK_CARDS = 64;
+
+typedef BasicCardAcl<16384> HotelAcl;
+
+HotelAcl hotel;                        ///< 393 KB: not on the stack
+CardAcl  room;
+
+CardUid card(uint32_t n) {
+  return cardUid({0x5A, (uint8_t)(n >> 16), (uint8_t)(n >> 8), (uint8_t)n});
+}
+
+// Never changed; lookups from the card thread must always find it
+const CardUid STAFF = cardUid({0x5B, 0x00, 0x00, 0x01});
+
+typedef std::vector<std::pair<CardUid, Role>> Records;
+typedef std::vector<std::vector<uint8_t>> Chunks;
+
+// As encodeAclChunks() in the backend
+Chunks encode(uint8_t kind, uint32_t base, uint32_t version, const Records& records) {
+  size_t count = records.empty() ? 1 : (records.size() + CHUNK_CARDS - 1) / CHUNK_CARDS;
+  Chunks chunks(count);
+  for (size_t i = 0; i < count; i++) {
+    std::vector<uint8_t>& chunk = chunks[i];
+    uint8_t header[ACL_HEADER_SIZE] = {kind,
+      (uint8_t)base, (uint8_t)(base >> 8), (uint8_t)(base >> 16), (uint8_t)(base >> 24),
+      (uint8_t)version, (uint8_t)(version >> 8), (uint8_t)(version >> 16), (uint8_t)(version >> 24),
+      (uint8_t)i, (uint8_t)(i >> 8), (uint8_t)count, (uint8_t)(count >> 8)};
+    chunk.assign(header, header + ACL_HEADER_SIZE);
+    for (size_t r = i * CHUNK_CARDS; r < records.size() && r < (i + 1) * CHUNK_CARDS; r++) {
+      chunk.push_back((uint8_t)records[r].second);
+      chunk.push_back(records[r].first.size);
+      chunk.insert(chunk.end(), records[r].first.bytes, records[r].first.bytes + records[r].first.size);
+    }
+  }
+  return chunks;
+}
+
+struct Applied {
+  AclResult result;
+  double    us;
+  uint64_t  allocations;
+};
+
+template <typename Acl>
+Applied applyChunks(Acl& acl, const Chunks& chunks) {
+  Applied applied = {AclResult::Invalid, 0, 0};
+  uint64_t allocations = benchAllocations();
+  auto start = std::chrono::steady_clock::now();
+  for (const std::vector<uint8_t>& chunk : chunks) {
+    applied.result = acl.apply(chunk.data(), chunk.size());
+    if (applied.result != AclResult::Partial && applied.result != AclResult::Applied) break;
+  }
+  applied.us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  applied.allocations = benchAllocations() - allocations;
+  return applied;
+}
+
+// Every card ever issued, against the reference; STAFF is on top of it
+bool matches(const HotelAcl& acl, const std::map<uint32_t, Role>& expected, uint32_t serials) {
+  if (acl.size() != expected.size() + 1) return false;
+  for (uint32_t n = 0; n < serials; n++) {
+    CardUid uid = card(n);
+    auto it = expected.find(n);
+    Role role = it == expected.end() ? Role::Unknown : it->second;
+    if (acl.lookup(uid.bytes, uid.size) != role) return false;
+  }
+  return acl.lookup(STAFF.bytes, STAFF.size) == Role::Security;
+}
+
+struct Times {
+  double   totalUs = 0;
+  double   worstUs = 0;
+  uint32_t count = 0;
+  uint64_t allocations = 0;
+
+  void add(const Applied& a) {
+    totalUs += a.us;
+    worstUs = a.us > worstUs ? a.us : worstUs;
+    count++;
+    allocations += a.allocations;
+  }
+};
+
+struct Run {
+  Times snapshots;
+  Times copied;                        ///< First delta after the snapshots
+  Times replayed;
+};
+
+uint32_t version = 0;
+uint32_t serials = 0;
+
+/**
+ * Ten 10k snapshots, then 200 deltas, each checked against the reference
+ */
+Run updates() {
+  Run run;
+  std::map<uint32_t, Role> expected;
+  for (int s = 0; s < 10; s++) {
+    expected.clear();
+    Records records = {{STAFF, Role::Security}};
+    for (size_t i = 0; i < HOTEL_CARDS - 1; i++) {
+      uint32_t n = serials++;
+      Role role = i % 10 == 0 ? Role::Housekeeping : Role::Guest;
+      records.push_back({card(n), role});
+      expected[n] = role;
+    }
+    Applied a = applyChunks(hotel, encode(ACL_KIND_SNAPSHOT, 0, ++version, records));
+    CHECK(a.result == AclResult::Applied);
+    run.snapshots.add(a);
+  }
+  CHECK(hotel.version() == version && hotel.size() == HOTEL_CARDS);
+  CHECK(matches(hotel, expected, serials));
+
+  for (int d = 0; d < 200; d++) {
+    Records records;
+    // Revoke the oldest live cards, add as many new ones
+    auto it = expected.begin();
+    for (size_t i = 0; i < DELTA_CARDS / 2; i++) {
+      records.push_back({card(it->first), Role::Unknown});
+      it = expected.erase(it);
+    }
+    for (size_t i = 0; i < DELTA_CARDS / 2; i++) {
+      uint32_t n = serials++;
+      records.push_back({card(n), Role::Guest});
+      expected[n] = Role::Guest;
+    }
+    Applied a = applyChunks(hotel, encode(ACL_KIND_DELTA, version, version + 1, records));
+    version++;
+    CHECK(a.result == AclResult::Applied);
+    (d == 0 ? run.copied : run.replayed).add(a);
+
+    // Every few deltas, the whole list against the reference
+    if (d % 20 == 0 || d == 199) CHECK(matches(hotel, expected, serials));
+  }
+  CHECK(hotel.version() == version);
+  return run;
+}
+
+} // namespace
+
+int main() {
+  // Timed alone, then again while another thread keeps reading cards
+  Run run = updates();
+
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> lookups(0);
+  std::atomic<uint64_t> misses(0);
+  std::thread cards([&] {
+    while (!done.load()) {
+      if (hotel.lookup(STAFF.bytes, STAFF.size) != Role::Security) misses++;
+      lookups++;
+    }
+  });
+  updates();
+  done = true;
+  cards.join();
+  CHECK(misses == 0);
+
+  // A delta that does not start at our version changes nothing
+  Records late = {{card(serials), Role::Guest}};
+  CHECK(applyChunks(hotel, encode(ACL_KIND_DELTA, version - 1, version + 1, late)).result == AclResult::Stale);
+  CHECK(hotel.version() == version);
+  CardUid lateUid = card(serials);
+  CHECK(hotel.lookup(lateUid.bytes, lateUid.size) == Role::Unknown);
+
+  // The firmware table refuses a list it cannot hold, whole
+  static const UserAuth users[] = {{STAFF, Role::Security}};
+  room.load(users, 1);
+  Records tooMany;
+  for (uint32_t n = 0; n < HOTEL_CARDS; n++) tooMany.push_back({card(n), Role::Guest});
+  Applied full = applyChunks(room, encode(ACL_KIND_SNAPSHOT, 0, 1, tooMany));
+  CHECK(full.result == AclResult::Full);
+  CHECK(room.version() == 0 && room.size() == 1);
+  CHECK(room.lookup(STAFF.bytes, STAFF.size) == Role::Security);
+
+  printf("Card list updates, %zu-card list (table of %zu slots)\n", HOTEL_CARDS, HotelAcl::capacity() + 1);
+  printf("  snapshot of %zu cards:   %8.1f us mean %8.1f us max  (%u applied)\n", HOTEL_CARDS,
+         run.snapshots.totalUs / run.snapshots.count, run.snapshots.worstUs, run.snapshots.count);
+  printf("  delta of %zu, copy:       %8.1f us       (first after a snapshot)\n", DELTA_CARDS, run.copied.totalUs);
+  printf("  delta of %zu, replay:     %8.1f us mean %8.1f us max  (%u applied)\n", DELTA_CARDS,
+         run.replayed.totalUs / run.replayed.count, run.replayed.worstUs, run.replayed.count);
+  printf("  memory: %zu bytes in the object, %llu heap allocations in apply()\n", sizeof(HotelAcl),
+         (unsigned long long)(run.snapshots.allocations + run.copied.allocations + run.replayed.allocations));
+  printf("  firmware CardAcl: %zu bytes, holds %zu cards; 10k snapshot refused as Full\n", sizeof(CardAcl),
+         CardAcl::capacity());
+  printf("  %llu lookups during a second run of the updates, none missed\n", (unsigned long long)lookups.load());
+
+  CHECK(run.snapshots.allocations + run.copied.allocations + run.replayed.allocations == 0);
+  CHECK(run.replayed.totalUs / run.replayed.count < run.copied.totalUs);
+  return testResult();
+}
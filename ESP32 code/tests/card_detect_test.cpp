@@ -0,0 +1,281 @@
+/**
+ * @file card_detect_test.cpp
+ * @brief SPI traffic and detection latency: IRQ card detection vs polling
+ *
+ * One reader over a simulated hour, driven the way rfidLoop() drives it.
+ * Polling runs a full inventory every CARD_READ_DELAY, as isCardPresent()
+ * did. Interrupt mode kicks one REQA every CARD_DETECT_INTERVAL while the
+ * field is empty and polls only while PresenceTracker has a card present.
+ * The MFRC522 sends a kicked REQA once, so a card that arrives after the
+ * kick answers the next one: detection waits for the kick, not for an
+ * edge.
+ *
+ * SimCardReader counts inventories, selected cards, kicks and interrupts;
+ * they are turned into SPI register accesses with the MFRC522 library's
+ * costs below, and into bus time at SPI_ACCESS_US per access. Latency is
+ * card placed to check-in decided. A quiet hour (a guest every two
+ * minutes) and a busy one (every 20 s) are run in both modes.
+ *
+ * A halted card does not answer a kick, so interrupt mode must keep
+ * polling while an unknown card is rate limited too. An unknown card
+ * presented MAX_FAILED_ATTEMPTS times, taken away in between, must raise
+ * the security alert and get its summary denied event when the window
+ * closes, after which the reader goes back to waiting for the IRQ.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "card_acl.h"
+#include "card_reader.h"
+#include "config.h"
+#include "host_test.h"
+#include "presence.h"
+
+namespace {
+
+const uint32_t HOUR_MS = 3600 * 1000;
+
+// ---- MFRC522 SPI costs ----
+// One transaction is one register read or write (two bytes at 4 MHz)
+
+const double   SPI_ACCESS_US = 5;
+// PCD_CommunicateWithPICC: idle, clear IRQs, flush FIFO, write FIFO,
+// bit framing, transceive, StartSend
+const uint32_t FRAME_SETUP = 8;
+// Answered: error, FIFO level, FIFO data and control registers
+const uint32_t FRAME_RESULT = 4;
+const uint32_t CARD_ANSWER_US = 100;
+// ComIrqReg is read in a loop until the answer or the timer IRQ
+const uint32_t ANSWERED_FRAME = FRAME_SETUP + (uint32_t)(CARD_ANSWER_US / SPI_ACCESS_US) + FRAME_RESULT;
+const uint32_t SILENT_FRAME = FRAME_SETUP + (uint32_t)(RFID_RX_TIMEOUT_US / SPI_ACCESS_US);
+// armReceiveIrq() and the idle and IRQ clear after the wait
+const uint32_t KICK = 6;
+
+struct Traffic {
+  uint32_t inventories;
+  uint32_t emptyInventories;
+  uint32_t selects;
+  uint32_t kicks;
+  uint32_t interrupts;
+
+  /**
+   * WUPA answered, then per card anticollision and select answered and
+   * HLTA left silent, then a closing REQA nobody answers. An empty field
+   * is one silent WUPA.
+   */
+  uint64_t spi() const {
+    uint32_t busy = inventories - emptyInventories;
+    return (uint64_t)emptyInventories * SILENT_FRAME +
+           (uint64_t)busy * (ANSWERED_FRAME + SILENT_FRAME) +
+           (uint64_t)selects * (2 * ANSWERED_FRAME + SILENT_FRAME) +
+           (uint64_t)kicks * KICK;
+  }
+};
+
+// ---- Reader ----
+
+CardAcl  acl;
+uint32_t nowMs = 0;
+std::vector<uint32_t> placedAt;        ///< Per guest, 0 when not waiting
+std::vector<uint32_t> latencyMs;
+
+CardUid guestCard(size_t i) {
+  return cardUid({0x47, 0x55, (uint8_t)(i >> 8), (uint8_t)i});
+}
+
+Role lookup(const uint8_t* uid, uint8_t size) { return acl.lookup(uid, size); }
+
+void emit(const JournalEntry& entry) {
+  if (entry.type != EventType::CheckIn) return;
+  size_t guest = ((size_t)entry.uid.bytes[2] << 8) | entry.uid.bytes[3];
+  if (guest >= placedAt.size() || placedAt[guest] == 0) return;
+  latencyMs.push_back(nowMs - placedAt[guest]);
+  placedAt[guest] = 0;
+}
+
+struct Result {
+  Traffic  traffic;
+  size_t   taps;
+  size_t   missed;
+  uint32_t p50Ms;
+  uint32_t worstMs;
+};
+
+/**
+ * @param interruptDriven Kick and wait for the IRQ while idle, as rfidLoop() does
+ * @param meanGapMs       Mean time between guests
+ */
+Result run(bool interruptDriven, uint32_t meanGapMs, uint32_t seed) {
+  const size_t guests = 256;
+  static UserAuth users[guests];
+  for (size_t i = 0; i < guests; i++) users[i] = {guestCard(i), Role::Guest};
+  acl.load(users, guests);
+  placedAt.assign(guests, 0);
+  latencyMs.clear();
+
+  SimCardReader reader(interruptDriven);
+  PresenceTracker presence(lookup, emit, CARD_ABSENT_THRESHOLD);
+  Traffic traffic = {};
+
+  uint32_t rng = seed;
+  auto random = [&rng]() { rng = rng * 1103515245 + 12345; return rng >> 8; };
+  uint32_t nextTapMs = 1 + random() % (2 * meanGapMs);
+  uint32_t removeAtMs = 0;
+  uint32_t nextWakeMs = 0;
+  size_t   taps = 0;
+  CardUid  held = {};
+
+  for (nowMs = 0; nowMs < HOUR_MS; nowMs++) {
+    // Guests hold the card to the reader for 1 to 3 s
+    if (removeAtMs != 0 && nowMs >= removeAtMs) {
+      reader.removeCard(held);
+      removeAtMs = 0;
+    }
+    if (removeAtMs == 0 && nowMs >= nextTapMs) {
+      size_t guest = taps++ % guests;
+      held = guestCard(guest);
+      reader.placeCard(held);
+      placedAt[guest] = nowMs;
+      removeAtMs = nowMs + 1000 + random() % 2000;
+      nextTapMs = removeAtMs + random() % (2 * meanGapMs);
+    }
+    if (nowMs < nextWakeMs) continue;
+
+    // Idle reader: one REQA per CARD_DETECT_INTERVAL, answered only by a card already there
+    if (interruptDriven && presence.idle()) {
+      traffic.kicks++;
+      if (!reader.waitForCard(0)) {
+        nextWakeMs = nowMs + CARD_DETECT_INTERVAL;
+        continue;
+      }
+      traffic.interrupts++;
+    }
+
+    CardUid uids[MAX_PRESENT_CARDS];
+    size_t count = reader.readCards(uids, MAX_PRESENT_CARDS);
+    traffic.inventories++;
+    if (count == 0) traffic.emptyInventories++;
+    traffic.selects += (uint32_t)count;
+    presence.update(uids, count, (uint64_t)nowMs * 1000, EventTime{1735381800 + nowMs / 1000, (uint16_t)(nowMs % 1000)});
+    nextWakeMs = nowMs + CARD_READ_DELAY;
+  }
+
+  // The simulated reader keeps its own counts; they must agree
+  CHECK(reader.fullReads() == traffic.inventories);
+  CHECK(reader.selects() == traffic.selects);
+  CHECK(reader.kicks() == traffic.kicks);
+  CHECK(reader.interrupts() == traffic.interrupts);
+
+  size_t missed = 0;
+  for (uint32_t at : placedAt) missed += at != 0 && at + 3000 < HOUR_MS;
+  std::sort(latencyMs.begin(), latencyMs.end());
+  uint32_t p50 = latencyMs.empty() ? 0 : latencyMs[latencyMs.size() / 2];
+  uint32_t worst = latencyMs.empty() ? 0 : latencyMs.back();
+  return {traffic, taps, missed, p50, worst};
+}
+
+// ---- Unknown card, presented again and again ----
+
+std::vector<JournalEntry> denials;
+
+void emitDenied(const JournalEntry& entry) { denials.push_back(entry); }
+
+void deniedRepeats() {
+  acl.load(nullptr, 0);
+  denials.clear();
+  SimCardReader reader(true);
+  PresenceTracker presence(lookup, emitDenied, CARD_ABSENT_THRESHOLD);
+  const CardUid rogue = cardUid({0xDE, 0xAD, 0xBE, 0xEF});
+
+  // Held for 1 s, then away for 2 s (longer than CARD_ABSENT_THRESHOLD cycles)
+  const uint32_t periodMs = 3000;
+  const uint32_t endMs = DENIED_WINDOW_MS + 10000;
+  uint32_t nextWakeMs = 0;
+  uint32_t alertMs = 0;
+  uint32_t idleKicks = 0;
+  for (nowMs = 0; nowMs < endMs; nowMs++) {
+    if (nowMs < MAX_FAILED_ATTEMPTS * periodMs) {
+      if (nowMs % periodMs == 0) reader.placeCard(rogue);
+      if (nowMs % periodMs == 1000) reader.removeCard(rogue);
+    }
+    if (nowMs < nextWakeMs) continue;
+
+    // The gate of rfidLoop()
+    if (presence.idle()) {
+      if (!reader.waitForCard(0)) {
+        idleKicks++;
+        nextWakeMs = nowMs + CARD_DETECT_INTERVAL;
+        continue;
+      }
+    }
+
+    CardUid uids[MAX_PRESENT_CARDS];
+    size_t count = reader.readCards(uids, MAX_PRESENT_CARDS);
+    size_t before = denials.size();
+    presence.update(uids, count, (uint64_t)nowMs * 1000, EventTime{1735381800 + nowMs / 1000, (uint16_t)(nowMs % 1000)});
+    for (size_t i = before; i < denials.size(); i++) {
+      if (denials[i].type == EventType::Alert) alertMs = nowMs;
+    }
+    nextWakeMs = nowMs + CARD_READ_DELAY;
+  }
+
+  // First attempt at once, the alert on the last, the rest in one summary
+  size_t alerts = 0, reports = 0;
+  uint32_t reported = 0;
+  for (const JournalEntry& e : denials) {
+    CHECK(sameCard(e.uid, rogue));
+    if (e.type == EventType::Alert) {
+      alerts++;
+      CHECK(e.duration == MAX_FAILED_ATTEMPTS);
+    } else if (e.type == EventType::Denied) {
+      reports++;
+      reported += e.duration;
+    }
+  }
+  CHECK(alerts == 1);
+  CHECK(alertMs >= (MAX_FAILED_ATTEMPTS - 1) * periodMs && alertMs < (MAX_FAILED_ATTEMPTS - 1) * periodMs + 1000);
+  CHECK(reports == (MAX_FAILED_ATTEMPTS > 1 ? 2u : 1u));
+  CHECK(reported == MAX_FAILED_ATTEMPTS);
+  CHECK(denials.empty() || denials.back().type == EventType::Denied);
+
+  // The window is over and the card gone: waiting for the IRQ again
+  CHECK(presence.idle());
+  CHECK(idleKicks > 0);
+  printf("Unknown card presented %d times with IRQ detection: alert at %.1f s, %zu denied events for %u attempts\n",
+         MAX_FAILED_ATTEMPTS, alertMs / 1000.0, reports, reported);
+}
+
+void report(const char* name, const Result& r) {
+  uint64_t spi = r.traffic.spi();
+  printf("  %-9s %5zu %8u %7u %6u %11llu %9.1f s (%4.2f%%) %6u / %u ms\n", name, r.taps,
+         r.traffic.inventories, r.traffic.kicks, r.traffic.interrupts, (unsigned long long)spi,
+         spi * SPI_ACCESS_US / 1e6, spi * SPI_ACCESS_US / (HOUR_MS * 10.0), r.p50Ms, r.worstMs);
+}
+
+} // namespace
+
+int main() {
+  printf("One reader, one simulated hour; SPI bus time at %.0f us per register access\n", SPI_ACCESS_US);
+  const uint32_t gaps[] = {120000, 20000};
+  for (uint32_t gap : gaps) {
+    printf("A guest every %u s:\n", gap / 1000);
+    printf("            taps  inventories  kicks   IRQs  SPI accesses  SPI bus time      latency p50 / max\n");
+    Result polled = run(false, gap, 7);
+    Result irq = run(true, gap, 7);
+    report("polling", polled);
+    report("IRQ", irq);
+
+    CHECK(polled.taps == irq.taps);
+    CHECK(polled.missed == 0 && irq.missed == 0);
+    // A card waits for the next inventory, or for the next kick; one that
+    // comes while the last guest's check-out is pending waits for a poll
+    CHECK(polled.worstMs <= CARD_READ_DELAY);
+    CHECK(irq.worstMs <= CARD_READ_DELAY && irq.p50Ms < polled.p50Ms);
+    CHECK(irq.traffic.inventories < polled.traffic.inventories);
+    CHECK(irq.traffic.spi() < polled.traffic.spi());
+    if (gap >= 120000) CHECK(irq.worstMs <= CARD_DETECT_INTERVAL && irq.traffic.spi() * 5 < polled.traffic.spi());
+  }
+  deniedRepeats();
+  return testResult();
+}
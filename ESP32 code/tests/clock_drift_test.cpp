@@ -0,0 +1,103 @@
+/**
+ * @file clock_drift_test.cpp
+ * @brief How far event stamps stray from true time between NTP syncs
+ *
+ * The reader's crystal runs a few ppm fast or slow, so its monotonic
+ * clock drifts from true time. NTP answers every NTP_SYNC_INTERVAL, off
+ * by up to NTP_JITTER_US each time. For a day, the stamp WallClock would
+ * give an event is compared with true time once a second, after the
+ * second sync, when the rate correction has had something to go on.
+ *
+ * The offset-only row is the same clock with the rate correction left
+ * at zero: each sync resets the error, which then grows for an hour. The
+ * corrected error must stay within three jitters (the sync's own error,
+ * plus the rate misjudged by both ends of the last interval), and a clock
+ * step must not be mistaken for drift.
+ */
+
+#include <stdlib.h>
+
+#include "config.h"
+#include "host_test.h"
+#include "wall_clock.h"
+
+namespace {
+
+const uint64_t EPOCH_US = 1735381800ull * 1000000;
+const uint64_t DAY_US = 24ull * 3600 * 1000000;
+const uint64_t SYNC_US = (uint64_t)NTP_SYNC_INTERVAL * 1000;
+const int64_t  NTP_JITTER_US = 5000;
+
+uint32_t seed = 1;
+int64_t jitter(int64_t bound) {
+  if (bound == 0) return 0;
+  seed = seed * 1664525u + 1013904223u;
+  return (int64_t)(seed >> 8) % (2 * bound + 1) - bound;
+}
+
+/**
+ * @param ppm       Crystal error: the monotonic clock runs this fast
+ * @param corrected Rate correction on; otherwise each sync only sets the offset
+ * @return Largest |stamp - true time| in us
+ */
+int64_t worstError(int32_t ppm, int64_t ntpJitterUs, bool corrected) {
+  WallClock clock(1);
+  seed = 1;
+  int64_t worst = 0;
+  for (uint64_t trueUs = 0; trueUs <= DAY_US; trueUs += 1000000) {
+    uint64_t monoUs = trueUs + (int64_t)trueUs * ppm / 1000000;
+    if (trueUs % SYNC_US == 0) {
+      uint64_t epochUs = EPOCH_US + trueUs + jitter(ntpJitterUs);
+      if (corrected) {
+        clock.set(epochUs, monoUs);
+      } else {
+        clock.restore({monoUs, epochUs, 0});
+      }
+    }
+    if (trueUs <= SYNC_US) continue;
+
+    int64_t error = (int64_t)(clock.epochUs(monoUs) - (EPOCH_US + trueUs));
+    if (llabs(error) > worst) worst = llabs(error);
+  }
+  return worst;
+}
+
+// The first sync after a bad one moves the clock by seconds: not drift
+void step() {
+  WallClock clock(1);
+  clock.set(EPOCH_US, 0);
+  clock.set(EPOCH_US + SYNC_US + 5000000, SYNC_US);
+  CHECK(clock.driftPpb() == 0);
+  CHECK(clock.epochUs(SYNC_US) == EPOCH_US + SYNC_US + 5000000);
+}
+
+} // namespace
+
+int main() {
+  printf("Worst stamp error over a day, NTP every %u s\n", NTP_SYNC_INTERVAL / 1000);
+  printf("  %8s  %14s  %14s  %14s\n", "crystal", "offset only", "corrected", "corrected,");
+  printf("  %8s  %14s  %14s  %14s\n", "", "", "exact NTP", "NTP +-5 ms");
+
+  const int32_t crystals[] = {-100, -20, 0, 20, 100};
+  for (int32_t ppm : crystals) {
+    int64_t offsetOnly = worstError(ppm, NTP_JITTER_US, false);
+    int64_t exact = worstError(ppm, 0, true);
+    int64_t noisy = worstError(ppm, NTP_JITTER_US, true);
+    printf("  %+5d ppm  %11.3f ms  %11.3f ms  %11.3f ms\n", ppm, offsetOnly / 1000.0, exact / 1000.0,
+           noisy / 1000.0);
+
+    // Exact syncs: only rounding is left
+    CHECK(exact <= 1000);
+    CHECK(noisy <= 3 * NTP_JITTER_US);
+    if (ppm != 0) CHECK(noisy < offsetOnly);
+  }
+
+  // Past the clamp the correction stops at CLOCK_MAX_DRIFT_PPB; the rest drifts
+  int64_t clamped = worstError(600, 0, true);
+  printf("  %+5d ppm  %14s  %11.3f ms  (clamped to %d ppm)\n", 600, "", clamped / 1000.0,
+         CLOCK_MAX_DRIFT_PPB / 1000);
+  CHECK(clamped <= (int64_t)(100 * SYNC_US / 1000000) + 1000);
+
+  step();
+  return testResult();
+}
@@ -0,0 +1,102 @@
+/**
+ * @file denied_storm_test.cpp
+ * @brief Messages per minute while someone keeps presenting unknown cards
+ *
+ * PresenceTracker is fed an inventory every CARD_READ_DELAY for 30
+ * simulated minutes while an attacker works the reader. Every event it
+ * emits is one message to the broker. Before the per-UID rate limit, each
+ * presentation of an unknown card published a denied_access and an
+ * alerts message.
+ *
+ * Three attacks: one rogue card tapped every second, four rogue cards
+ * taken in turn, and an emulator presenting a new random UID every 300 ms.
+ * Denied events carry their attempt count, so the test also checks that
+ * the summaries add up to every attempt made.
+ */
+
+#include "config.h"
+#include "host_test.h"
+#include "presence.h"
+
+namespace {
+
+const uint32_t ATTACK_MS = 30 * 60 * 1000;
+
+uint32_t messages = 0;
+uint32_t alerts = 0;
+uint64_t reportedAttempts = 0;
+
+Role lookup(const uint8_t*, uint8_t) { return Role::Unknown; }
+
+void emit(const JournalEntry& entry) {
+  messages++;
+  if (entry.type == EventType::Alert) alerts++;
+  if (entry.type == EventType::Denied) reportedAttempts += entry.duration;
+}
+
+struct Attack {
+  const char* name;
+  uint32_t    periodMs;          ///< One presentation per period
+  uint32_t    holdMs;            ///< Card on the reader per presentation
+  uint32_t    cards;             ///< Distinct UIDs, used in turn; 0 for a new one each time
+};
+
+struct Result {
+  uint32_t attempts;
+  uint32_t messages;
+  uint32_t alerts;
+  uint64_t reportedAttempts;
+};
+
+Result run(const Attack& attack) {
+  messages = 0;
+  alerts = 0;
+  reportedAttempts = 0;
+  PresenceTracker presence(lookup, emit, CARD_ABSENT_THRESHOLD);
+
+  uint32_t attempts = 0;
+  // One more window of quiet at the end lets the last summaries out
+  for (uint32_t nowMs = 0; nowMs < ATTACK_MS + DENIED_WINDOW_MS + CARD_READ_DELAY; nowMs += CARD_READ_DELAY) {
+    uint32_t into = nowMs % attack.periodMs;
+    bool onReader = nowMs < ATTACK_MS && into < attack.holdMs;
+    if (onReader && into < CARD_READ_DELAY) attempts++;
+
+    uint32_t n = nowMs / attack.periodMs;
+    uint32_t serial = attack.cards > 0 ? n % attack.cards : n * 2654435761u;
+    CardUid card = cardUid({0xEE, (uint8_t)(serial >> 16), (uint8_t)(serial >> 8), (uint8_t)serial});
+    presence.update(&card, onReader ? 1 : 0, (uint64_t)nowMs * 1000,
+                    EventTime{1735381800 + nowMs / 1000, (uint16_t)(nowMs % 1000)});
+  }
+  return {attempts, messages, alerts, reportedAttempts};
+}
+
+} // namespace
+
+int main() {
+  const Attack attacks[] = {
+    {"one card, every 1 s", 1000, 300, 1},
+    {"four cards in turn, 1 s", 1000, 300, 4},
+    {"new UID every 300 ms", 300, 200, 0},
+  };
+  const double minutes = ATTACK_MS / 60000.0;
+
+  printf("30-minute attacks, MAX_FAILED_ATTEMPTS %d, DENIED_WINDOW_MS %d\n", MAX_FAILED_ATTEMPTS, DENIED_WINDOW_MS);
+  printf("  %-26s attempts/min  before/min  now/min  alerts\n", "");
+  for (const Attack& a : attacks) {
+    Result r = run(a);
+    printf("  %-26s %12.1f %11.1f %8.1f %7u\n", a.name, r.attempts / minutes,
+           2 * r.attempts / minutes, r.messages / minutes, r.alerts);
+
+    // Nothing is lost by folding: the summaries count every attempt
+    CHECK(r.reportedAttempts == r.attempts);
+    if (a.cards > 0) {
+      // Per card and window: the first attempt, one alert, one summary
+      CHECK(r.messages <= a.cards * 3 * (uint32_t)(minutes + 2));
+      CHECK(r.alerts >= a.cards * (uint32_t)minutes);
+    } else {
+      // Every UID is new: each is reported once, without an alert
+      CHECK(r.messages == r.attempts && r.alerts == 0);
+    }
+  }
+  return testResult();
+}
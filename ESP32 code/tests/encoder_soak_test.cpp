@@ -0,0 +1,139 @@
+/**
+ * @file encoder_soak_test.cpp
+ * @brief A million events through the encoder without touching the heap
+ *
+ * Weeks of uptime at a busy door, compressed: every event type, every UID
+ * size and growing sequence numbers and times, encoded as JSON and CBOR.
+ * The heap is never used, so it cannot fragment; each payload is checked
+ * for shape and size, and one of each against its exact bytes.
+ */
+
+#include <string.h>
+
+#include "alloc_counter.h"
+#include "config.h"
+#include "event_encoder.h"
+#include "host_test.h"
+
+namespace {
+
+const DeviceContext ctx = {"BLDG001", "1", "202"};
+
+CardUid soakCard(uint32_t n) {
+  static const uint8_t sizes[] = {4, 7, 10};
+  CardUid uid = {};
+  uid.size = sizes[n % 3];
+  for (uint8_t i = 0; i < uid.size; i++) uid.bytes[i] = (uint8_t)(n >> (i % 4 * 8));
+  return uid;
+}
+
+// Balanced braces and quotes, one object, nothing after it
+bool wellFormed(const char* json, size_t length) {
+  if (length < 2 || json[0] != '{' || json[length - 1] != '}' || strlen(json) != length) {
+    return false;
+  }
+  int depth = 0;
+  bool quoted = false;
+  for (size_t i = 0; i < length; i++) {
+    char c = json[i];
+    if (quoted) {
+      if (c == '\\') i++;
+      else if (c == '"') quoted = false;
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      if (--depth == 0 && i + 1 != length) return false;
+    }
+  }
+  return depth == 0 && !quoted;
+}
+
+template <typename Event>
+void encodeBoth(const Event& event, size_t& longestJson, size_t& longestBinary) {
+  char topic[EVENT_FRAME_SIZE];
+  char json[EVENT_FRAME_SIZE];
+  uint8_t binary[EVENT_FRAME_SIZE];
+
+  size_t topicLength = encodeTopic(ctx, eventType(event), topic, sizeof(topic));
+  size_t jsonLength = encodePayload(ctx, event, json, sizeof(json));
+  size_t binaryLength = encodeBinaryPayload(event, binary, sizeof(binary));
+  CHECK(topicLength > 0);
+  CHECK(wellFormed(json, jsonLength));
+  CHECK(binaryLength > 3 && binaryLength <= BINARY_PAYLOAD_MAX_SIZE);
+  CHECK(binary[0] == 0xD9 && binary[1] == 0xD9 && binary[2] == 0xF7);
+  if (jsonLength > longestJson) longestJson = jsonLength;
+  if (binaryLength > longestBinary) longestBinary = binaryLength;
+}
+
+void soak() {
+  const uint32_t events = 1000000;
+  char timestamp[TIMESTAMP_SIZE];
+  size_t longestJson = 0;
+  size_t longestBinary = 0;
+
+  uint64_t before = benchAllocations();
+  for (uint32_t n = 0; n < events; n++) {
+    // A month of events; the top of the sequence range is reached too
+    uint32_t seq = n < events - 10 ? n : 0xFFFFFFFF - (events - n);
+    uint32_t epoch = 1735381800 + n * 3;
+    uint64_t timeMs = (uint64_t)epoch * 1000 + n % 1000;
+    formatTimestamp(epoch, (uint16_t)(n % 1000), timestamp, sizeof(timestamp));
+    CardUid uid = soakCard(n);
+
+    switch (n % 4) {
+      case 0: encodeBoth(CheckInEvent{uid, (Role)(1 + n % 4), timestamp, timeMs, seq},
+                         longestJson, longestBinary); break;
+      case 1: encodeBoth(CheckOutEvent{uid, (Role)(1 + n % 4), timestamp, timeMs, n, seq},
+                         longestJson, longestBinary); break;
+      case 2: encodeBoth(DeniedEvent{uid, "Unauthorized card", timestamp, timeMs, n % 50, seq},
+                         longestJson, longestBinary); break;
+      default: encodeBoth(AlertEvent{uid, "Multiple \"failed\" attempts", timestamp, timeMs, n, seq},
+                          longestJson, longestBinary); break;
+    }
+  }
+  uint64_t allocations = benchAllocations() - before;
+
+  printf("%u events: %llu heap allocations, longest JSON %zu bytes, longest CBOR %zu bytes\n",
+         events, (unsigned long long)allocations, longestJson, longestBinary);
+  CHECK(allocations == 0);
+  CHECK(longestJson < EVENT_FRAME_SIZE);
+}
+
+void exactBytes() {
+  char timestamp[TIMESTAMP_SIZE];
+  formatTimestamp(0, 0, timestamp, sizeof(timestamp));
+  CHECK(strcmp(timestamp, "1970-01-01 00:00:00.000") == 0);
+
+  CheckOutEvent event = {cardUid({0xB2, 0xF9, 0x7C, 0x00}), Role::Guest, "2024-12-28 10:30:00.250",
+                         1735381800250ull, 5400, 42};
+  char topic[EVENT_FRAME_SIZE];
+  char json[EVENT_FRAME_SIZE];
+  uint8_t binary[EVENT_FRAME_SIZE];
+  CHECK(encodeTopic(ctx, eventType(event), topic, sizeof(topic)) > 0);
+  CHECK(strcmp(topic, MQTT_TOPIC_BASE "/BLDG001/1/202/attendance") == 0);
+  CHECK(encodePayload(ctx, event, json, sizeof(json)) > 0);
+  CHECK(strcmp(json, "{\"card_uid\":\"B2F97C00\",\"role\":\"Guest\","
+                     "\"check_out\":\"2024-12-28 10:30:00.250\",\"duration\":5400,"
+                     "\"room\":\"202\",\"seq\":42}") == 0);
+
+  const uint8_t expected[] = {
+    0xD9, 0xD9, 0xF7, 0x87, 0x01, 0x01, 0x18, 0x2A, 0x44, 0xB2, 0xF9, 0x7C, 0x00, 0x01,
+    0x1B, 0x00, 0x00, 0x01, 0x94, 0x0C, 0xD0, 0xD5, 0x3A, 0x19, 0x15, 0x18,
+  };
+  size_t length = encodeBinaryPayload(event, binary, sizeof(binary));
+  CHECK(length == sizeof(expected) && memcmp(binary, expected, length) == 0);
+
+  // Too small a buffer is an error, not a truncated payload
+  CHECK(encodePayload(ctx, event, json, 40) == 0);
+  CHECK(encodeBinaryPayload(event, binary, 10) == 0);
+}
+
+} // namespace
+
+int main() {
+  soak();
+  exactBytes();
+  return testResult();
+}
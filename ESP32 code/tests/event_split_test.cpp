@@ -0,0 +1,192 @@
+/**
+ * @file event_split_test.cpp
+ * @brief What the edge gateway splits and what it keeps whole
+ *
+ * Publishes come from EventPublisher exactly as a reader sends them: a
+ * single event, then PUBLISH_BATCH_MAX events in as many publishes as
+ * BATCH_FRAME_SIZE needs (one batch in CBOR), JSON and CBOR, with and
+ * without EVENT_SIGNING. Unsigned publishes must split into their events
+ * with the right sequence numbers and types. Signed ones, the CBOR batch
+ * included, must be kept whole, and the whole publish must still carry a
+ * signature the backend accepts.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "event_publisher.h"
+#include "event_split.h"
+#include "host_test.h"
+#include "sim_transport.h"
+
+namespace {
+
+// ---- Reader side ----
+struct Publish {
+  std::string          topic;
+  std::vector<uint8_t> payload;
+};
+
+std::vector<Publish> publishes;
+
+void onPublished(const char* topic, const uint8_t* payload, size_t length, bool success) {
+  if (payload == nullptr || !success) return;
+  publishes.push_back({topic, std::vector<uint8_t>(payload, payload + length)});
+}
+
+EventPublisher* activePublisher = nullptr;
+void onAck(uint16_t packetId) { activePublisher->onAck(packetId); }
+
+/**
+ * @brief One single-event publish, then PUBLISH_BATCH_MAX events in batches
+ */
+void publishEvents(PayloadFormat format, HmacSha256* signer) {
+  publishes.clear();
+  char path[] = "/tmp/event_split_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd >= 0) close(fd);
+  unlink(path);
+
+  DeviceContext ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+  SimLink link;
+  SimSocket socket(link);
+  MqttClient mqtt(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, SimSocket::send);
+  EventPublisher publisher(ctx, mqtt);
+  FileJournalStorage storage(path, 0x10000);
+  EventJournal journal(storage);
+  CHECK(journal.begin());
+  socket.attach(mqtt);
+  mqtt.onAck(onAck);
+  activePublisher = &publisher;
+  publisher.attachJournal(&journal);
+  publisher.setPayloadFormat(format);
+  publisher.attachSigner(signer);
+  publisher.onPublished(onPublished);
+
+  uint32_t nowMs = 1;
+  link.setUp(true);
+  mqtt.connect(nowMs);
+  socket.deliver(nowMs);
+
+  // Alone in its batch window: goes out on its own topic
+  JournalEntry entry = {0, EventType::CheckIn, Role::Guest, cardUid({0xB2, 0xF9, 0x7C, 0x00}),
+                        1735381800, 0, 120, 0};
+  publisher.record(entry, nowMs);
+  nowMs += PUBLISH_BATCH_WINDOW;
+  publisher.drain(nowMs);
+  socket.deliver(++nowMs);
+
+  // A full window goes out as soon as the last one is recorded
+  for (int i = 0; i < PUBLISH_BATCH_MAX; i++) {
+    entry.type = i % 3 == 2 ? EventType::Denied : EventType::CheckOut;
+    entry.uid = cardUid({0xB2, 0xF9, 0x7C, (uint8_t)(i + 1)});
+    entry.duration = 1800;
+    publisher.record(entry, ++nowMs);
+  }
+  for (int i = 0; i < 4; i++) {
+    socket.deliver(++nowMs);
+    publisher.drain(nowMs);
+  }
+  unlink(path);
+}
+
+const char* topicType(const Publish& p) {
+  return p.topic.c_str() + p.topic.rfind('/') + 1;
+}
+
+// ---- Backend side ----
+// As the broker's signature check: HMAC over topic, a zero byte and the unsigned payload
+bool verifies(HmacSha256& signer, const Publish& p, bool binary) {
+  size_t space = binary ? EVENT_SIGNATURE_SPACE_BINARY : EVENT_SIGNATURE_SPACE_JSON;
+  if (p.payload.size() <= space) return false;
+  size_t length = p.payload.size() - space;
+  static const uint8_t separator = 0;
+  uint8_t mac[HMAC_SHA256_SIZE];
+  signer.begin();
+  signer.update(p.topic.data(), p.topic.size());
+  signer.update(&separator, 1);
+  signer.update(p.payload.data(), length);
+  signer.finish(mac);
+
+  uint8_t sent[EVENT_SIGNATURE_SPACE_BINARY - 1];
+  if (binary) {
+    if (p.payload[length] != 0x50) return false;
+    memcpy(sent, &p.payload[length + 1], sizeof(sent));
+  } else {
+    for (size_t i = 0; i < sizeof(sent); i++) {
+      sent[i] = (uint8_t)strtoul(std::string((const char*)&p.payload[length + 1 + 2 * i], 2).c_str(), nullptr, 16);
+    }
+  }
+  return HmacSha256::equal(mac, sent, sizeof(sent));
+}
+
+void checkFormat(PayloadFormat format, HmacSha256& signer) {
+  bool binary = format == PayloadFormat::Binary;
+  std::vector<SplitEvent> events;
+
+  // ---- Unsigned: split into single events ----
+  publishEvents(format, nullptr);
+  CHECK(publishes.size() >= 2);
+  if (publishes.size() < 2) return;
+  const Publish& single = publishes[0];
+  CHECK(strcmp(topicType(single), "attendance") == 0);
+  CHECK(splitEvents(topicType(single), single.payload.data(), single.payload.size(), events));
+  CHECK(events.size() == 1 && events[0].seq == 1 && events[0].tag == binary);
+  CHECK(events.size() == 1 && events[0].length + (binary ? sizeof(CBOR_SELF_DESCRIBED) : 0) ==
+                                  single.payload.size());
+  size_t singleBytes = single.payload.size();
+
+  // What is left over when BATCH_FRAME_SIZE is full may go out alone
+  std::vector<SplitEvent> all;
+  size_t batches = publishes.size() - 1;
+  CHECK(strcmp(topicType(publishes[1]), "batch") == 0);
+  for (size_t b = 1; b < publishes.size(); b++) {
+    const Publish& batch = publishes[b];
+    CHECK(splitEvents(topicType(batch), batch.payload.data(), batch.payload.size(), events));
+    for (const SplitEvent& e : events) {
+      CHECK(e.data >= batch.payload.data() && e.data + e.length <= batch.payload.data() + batch.payload.size());
+    }
+    all.insert(all.end(), events.begin(), events.end());
+  }
+  CHECK(all.size() == PUBLISH_BATCH_MAX);
+  for (size_t i = 0; i < all.size(); i++) {
+    CHECK(all[i].seq == i + 2);
+    CHECK(strcmp(all[i].type, i % 3 == 2 ? "denied_access" : "attendance") == 0);
+  }
+
+  // ---- Signed: kept whole, single event and batch alike ----
+  publishEvents(format, &signer);
+  CHECK(publishes.size() == batches + 1);
+  for (const Publish& p : publishes) {
+    CHECK(!splitEvents(topicType(p), p.payload.data(), p.payload.size(), events));
+    CHECK(events.empty());
+    CHECK(verifies(signer, p, binary));
+  }
+  printf("  %-4s  single event %3zu bytes, %d more in %zu publish(es); signed: all %zu publishes kept whole\n",
+         binary ? "CBOR" : "JSON", singleBytes, PUBLISH_BATCH_MAX, batches, publishes.size());
+}
+
+} // namespace
+
+int main() {
+  HmacSha256 signer;
+  CHECK(signer.setHexKey(EVENT_SIGNING_KEY));
+
+  printf("Reader publishes through the gateway's splitter\n");
+  checkFormat(PayloadFormat::Binary, signer);
+  checkFormat(PayloadFormat::Json, signer);
+
+  // Trailing bytes that are not a whole CBOR item: not understood, kept whole
+  publishEvents(PayloadFormat::Binary, nullptr);
+  std::vector<uint8_t> padded = publishes[1].payload;
+  padded.push_back(0x50);
+  std::vector<SplitEvent> events;
+  CHECK(!splitEvents("batch", padded.data(), padded.size(), events));
+
+  return testResult();
+}
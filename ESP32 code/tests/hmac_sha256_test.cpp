@@ -0,0 +1,110 @@
+/**
+ * @file hmac_sha256_test.cpp
+ * @brief HmacSha256 against published and independently computed MACs
+ *
+ * RFC 4231 test cases 1, 2 and 4 cover a key shorter than the hash, a
+ * text key and a 25-byte key over repeated data. A HMAC_KEY_MAX (64-byte)
+ * key, one whole SHA-256 block and the longest setKey() accepts, is
+ * checked against a MAC from Python's hmac module over a signed event's
+ * topic and body and over 200 bytes fed in uneven pieces. The same signer
+ * is reused across cases through begin(), as EventPublisher reuses it.
+ */
+
+#include <string.h>
+
+#include "hmac_sha256.h"
+#include "host_test.h"
+
+namespace {
+
+// ---- Helpers ----
+bool macIs(const uint8_t mac[HMAC_SHA256_SIZE], const char* hex) {
+  char text[HMAC_SHA256_SIZE * 2 + 1];
+  for (size_t i = 0; i < HMAC_SHA256_SIZE; i++) snprintf(text + i * 2, 3, "%02x", mac[i]);
+  if (strcmp(text, hex) == 0) return true;
+  fprintf(stderr, "  got  %s\n  want %s\n", text, hex);
+  return false;
+}
+
+bool check(HmacSha256& hmac, const uint8_t* data, size_t length, const char* hex) {
+  uint8_t mac[HMAC_SHA256_SIZE];
+  hmac.begin();
+  hmac.update(data, length);
+  hmac.finish(mac);
+  return macIs(mac, hex);
+}
+
+// ---- RFC 4231 ----
+void rfc4231(HmacSha256& hmac) {
+  uint8_t key[25];
+  uint8_t data[50];
+
+  // Test case 1
+  memset(key, 0x0b, 20);
+  CHECK(hmac.setKey(key, 20));
+  CHECK(check(hmac, (const uint8_t*)"Hi There", 8,
+              "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"));
+
+  // Test case 2
+  const char* text = "what do ya want for nothing?";
+  CHECK(hmac.setKey((const uint8_t*)"Jefe", 4));
+  CHECK(check(hmac, (const uint8_t*)text, strlen(text),
+              "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
+
+  // The same key as hex text, as config.h gives it
+  CHECK(hmac.setHexKey("4a656665"));
+  CHECK(check(hmac, (const uint8_t*)text, strlen(text),
+              "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
+
+  // Test case 4
+  for (size_t i = 0; i < sizeof(key); i++) key[i] = (uint8_t)(i + 1);
+  memset(data, 0xcd, sizeof(data));
+  CHECK(hmac.setKey(key, sizeof(key)));
+  CHECK(check(hmac, data, sizeof(data),
+              "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b"));
+
+  printf("  RFC 4231 cases 1, 2 and 4\n");
+}
+
+// ---- HMAC_KEY_MAX ----
+void fullBlockKey(HmacSha256& hmac) {
+  uint8_t key[HMAC_KEY_MAX + 1];
+  for (size_t i = 0; i < sizeof(key); i++) key[i] = (uint8_t)(0x40 + i);
+  CHECK(hmac.setKey(key, HMAC_KEY_MAX));
+
+  // Topic, NUL, body: what EventPublisher signs
+  const uint8_t signedEvent[] = "campus/room/main/3/202/attendance\0{\"seq\":1}";
+  CHECK(check(hmac, signedEvent, sizeof(signedEvent) - 1,
+              "30d1bacdb3b9457054c46202f4dd294024d96b98603de583855d625ee6d97783"));
+
+  // 200 bytes in pieces that straddle the 64-byte block boundaries
+  uint8_t data[200];
+  memset(data, 'a', sizeof(data));
+  const size_t pieces[] = {1, 62, 2, 63, 0, 72};
+  uint8_t mac[HMAC_SHA256_SIZE];
+  hmac.begin();
+  size_t offset = 0;
+  for (size_t piece : pieces) {
+    hmac.update(data + offset, piece);
+    offset += piece;
+  }
+  CHECK(offset == sizeof(data));
+  hmac.finish(mac);
+  CHECK(macIs(mac, "5656cdea5bb317c234c05873d5ed36efabc87e0f33ea10b405fdd54b00bf3c54"));
+
+  // One byte longer than a block is refused, and leaves the signer unusable
+  CHECK(!hmac.setKey(key, HMAC_KEY_MAX + 1));
+  CHECK(!hmac.ready());
+
+  printf("  %d-byte key, whole and in pieces\n", HMAC_KEY_MAX);
+}
+
+} // namespace
+
+int main() {
+  printf("HMAC-SHA256 known answers\n");
+  HmacSha256 hmac;
+  rfc4231(hmac);
+  fullBlockKey(hmac);
+  return testResult();
+}
@@ -0,0 +1,44 @@
+/**
+ * @file host_test.h
+ * @brief Minimal checks for the host tests run by ctest
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section host_test_overview Overview
+ *
+ * Each file in tests/ is one program that ctest runs. CHECK() prints the
+ * failed condition with its line and carries on; main() returns
+ * testResult(), which is non-zero if any check failed. Tests run in
+ * simulated time, so anything they assert is reproducible; wall-clock
+ * figures are printed for reference only.
+ */
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+
+inline int& testFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond)                                                      \
+  do {                                                                   \
+    if (!(cond)) {                                                       \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      testFailures()++;                                                  \
+    }                                                                    \
+  } while (0)
+
+/**
+ * @brief Exit status for main(): 0 if every check passed
+ */
+inline int testResult() {
+  if (testFailures() == 0) return 0;
+  fprintf(stderr, "%d check(s) failed\n", testFailures());
+  return 1;
+}
+
+#endif // HOST_TEST_H
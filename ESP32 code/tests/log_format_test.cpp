@@ -0,0 +1,53 @@
+/**
+ * @file log_format_test.cpp
+ * @brief The LOG_* macros refuse arguments their format or the ESP32 cannot take
+ *
+ * Built as it stands, every line here is well-formed and the program
+ * logs and drains them. ctest also compiles it once per LOG_REJECT_*
+ * case with format warnings as errors and expects each of those builds to
+ * fail: a mismatched format, a 64-bit argument, a double, a float. A
+ * disabled debug line is checked the same as one that is compiled in.
+ */
+
+#include <stdint.h>
+#include <string>
+
+#include "host_test.h"
+#include "logger.h"
+#include "uid_index.h"
+
+namespace {
+
+std::string out;
+void sink(const char* data, size_t length) { out.append(data, length); }
+
+} // namespace
+
+int main() {
+  char uid[] = "B2F97C00";
+  uint32_t seen = 3;
+
+  LOG_WARN(Rfid, "No arguments");
+  LOG_INFO(Rfid, "Card %s seen %u times, role %d", logText(uid), (unsigned)seen, Role::Guest);
+  LOG_INFO(Sys, "Reader %s up", "202");
+  LOG_DEBUG(Rfid, "Compiled out, still checked: %u", (unsigned)seen);
+
+#if defined(LOG_REJECT_MISMATCH)
+  LOG_INFO(Rfid, "Card %u", "B2F97C00");
+#elif defined(LOG_REJECT_INT64)
+  LOG_INFO(Rfid, "Uptime %llu", (unsigned long long)seen);
+#elif defined(LOG_REJECT_DOUBLE)
+  LOG_INFO(Rfid, "Drift %f", 1.5);
+#elif defined(LOG_REJECT_FLOAT)
+  LOG_INFO(Rfid, "Drift %f", 1.5f);
+#elif defined(LOG_REJECT_DISABLED)
+  LOG_DEBUG(Rfid, "Compiled out, still checked: %s", (unsigned)seen);
+#endif
+
+  logger.drain(sink);
+  CHECK(out.find("W rfid: No arguments\n") != std::string::npos);
+  CHECK(out.find("I rfid: Card B2F97C00 seen 3 times, role 1\n") != std::string::npos);
+  CHECK(out.find("I sys: Reader 202 up\n") != std::string::npos);
+  CHECK(out.find("Compiled out") == std::string::npos);
+  return testResult();
+}
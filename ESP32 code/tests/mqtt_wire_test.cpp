@@ -0,0 +1,189 @@
+/**
+ * @file mqtt_wire_test.cpp
+ * @brief MQTT 3.1.1 frames as the broker sees them, and what an event costs on the wire
+ *
+ * Every frame MqttClient sends is captured and decoded by hand: CONNECT
+ * with the keepalive from WS_HEARTBEAT_INTERVAL, QoS 1 PUBLISH with its
+ * packet id, retransmission with DUP, PUBACK bookkeeping. Then each event
+ * type is published through EventPublisher and the bytes of its MQTT
+ * frame and WebSocket frame are compared with the JSON "cmd" envelope
+ * the firmware sent before. Publish-to-PUBACK latency against the real
+ * aedes broker is reported by fleet_loadgen.
+ */
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "event_publisher.h"
+#include "host_test.h"
+#include "sim_transport.h"
+
+namespace {
+
+std::vector<std::vector<uint8_t>> frames;
+
+bool capture(const uint8_t* data, size_t length) {
+  frames.push_back(std::vector<uint8_t>(data, data + length));
+  return true;
+}
+
+void deliver(MqttClient& mqtt, std::initializer_list<uint8_t> packet, uint32_t nowMs) {
+  std::vector<uint8_t> bytes(packet);
+  mqtt.onData(bytes.data(), bytes.size(), nowMs);
+}
+
+uint16_t acked = 0;
+void onAck(uint16_t packetId) { acked = packetId; }
+
+// Remaining length as written by the client, and where the body starts
+size_t remainingLength(const std::vector<uint8_t>& frame, size_t& body) {
+  size_t value = 0;
+  size_t multiplier = 1;
+  body = 1;
+  while (body < frame.size()) {
+    uint8_t b = frame[body++];
+    value += (b & 0x7F) * multiplier;
+    multiplier *= 128;
+    if ((b & 0x80) == 0) break;
+  }
+  return value;
+}
+
+void session() {
+  frames.clear();
+  MqttClient mqtt("ESP32_ROOM_202_HOTEL_1", MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, capture);
+  mqtt.onAck(onAck);
+
+  CHECK(mqtt.connect(0));
+  CHECK(frames.size() == 1);
+  const std::vector<uint8_t>& connect = frames[0];
+  size_t body = 0;
+  CHECK(connect[0] == 0x10);
+  CHECK(remainingLength(connect, body) == connect.size() - body);
+  CHECK(memcmp(&connect[body], "\x00\x04MQTT\x04\x02", 8) == 0);
+  CHECK(((connect[body + 8] << 8) | connect[body + 9]) == WS_HEARTBEAT_INTERVAL / 1000);
+
+  // Nothing is published before CONNACK
+  uint8_t frame[EVENT_FRAME_SIZE];
+  const char topic[] = "campus/room/BLDG001/1/202/attendance";
+  size_t reserve = MqttClient::publishHeaderSize(strlen(topic), 1);
+  memcpy(frame + reserve, "{}", 2);
+  CHECK(!mqtt.publish(topic, strlen(topic), frame, sizeof(frame), 2, 1, false, 0));
+  deliver(mqtt, {0x20, 0x02, 0x00, 0x00}, 5);
+  CHECK(mqtt.connected());
+
+  uint16_t id = 0;
+  CHECK(mqtt.publish(topic, strlen(topic), frame, sizeof(frame), 2, 1, false, 10, &id));
+  const std::vector<uint8_t>& publish = frames.back();
+  CHECK(publish[0] == 0x32);                              // PUBLISH, QoS 1
+  CHECK(remainingLength(publish, body) == publish.size() - body);
+  CHECK(((publish[body] << 8) | publish[body + 1]) == (int)strlen(topic));
+  CHECK(memcmp(&publish[body + 2], topic, strlen(topic)) == 0);
+  size_t idAt = body + 2 + strlen(topic);
+  CHECK(((publish[idAt] << 8) | publish[idAt + 1]) == id && id != 0);
+  CHECK(memcmp(&publish[idAt + 2], "{}", 2) == 0 && publish.size() == idAt + 4);
+  CHECK(mqtt.inflight() == 1);
+
+  // Unacknowledged: sent again with DUP after MQTT_RETRY_TIMEOUT
+  size_t sent = frames.size();
+  mqtt.loop(10 + MQTT_RETRY_TIMEOUT - 1);
+  CHECK(frames.size() == sent);
+  mqtt.loop(10 + MQTT_RETRY_TIMEOUT);
+  CHECK(frames.size() == sent + 1);
+  CHECK(frames.back()[0] == 0x3A);
+  CHECK(memcmp(frames.back().data() + 1, publish.data() + 1, publish.size() - 1) == 0);
+
+  // A PUBACK for another id changes nothing; the right one frees the slot
+  deliver(mqtt, {0x40, 0x02, (uint8_t)((id + 1) >> 8), (uint8_t)(id + 1)}, 20);
+  CHECK(mqtt.inflight() == 1 && acked == 0);
+  deliver(mqtt, {0x40, 0x02, (uint8_t)(id >> 8), (uint8_t)id}, 25 + MQTT_RETRY_TIMEOUT);
+  CHECK(mqtt.inflight() == 0 && acked == id);
+  CHECK(mqtt.lastAckLatencyMs() == 15 + MQTT_RETRY_TIMEOUT);
+
+  // The inflight window is a hard limit
+  for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+    CHECK(mqtt.publish(topic, strlen(topic), frame, sizeof(frame), 2, 1, false, 30));
+  }
+  CHECK(!mqtt.publish(topic, strlen(topic), frame, sizeof(frame), 2, 1, false, 30));
+  CHECK(mqtt.publish(topic, strlen(topic), frame, sizeof(frame), 2, 0, false, 30));
+  CHECK(frames.back()[0] == 0x30);
+}
+
+// ---- Bytes per event ----
+
+size_t publishedLength = 0;
+std::string publishedTopic;
+std::string publishedPayload;
+
+void onPublished(const char* topic, const uint8_t* payload, size_t length, bool success) {
+  if (payload == nullptr || !success) return;
+  publishedTopic = topic;
+  publishedPayload.assign((const char*)payload, length);
+  publishedLength = length;
+}
+
+// Client-to-server WebSocket frames are masked: 2 bytes, 2 more past 125, then the mask
+size_t webSocketFrame(size_t length) {
+  return length + 2 + (length > 125 ? 2 : 0) + 4;
+}
+
+// What publishToMQTT() sent before: the event as an escaped string inside a text frame
+size_t legacyEnvelope(const std::string& topic, const std::string& payload) {
+  std::string text = "{\"cmd\":\"publish\",\"topic\":\"" + topic + "\",\"payload\":\"";
+  for (char c : payload) {
+    if (c == '"' || c == '\\') text += '\\';
+    text += c;
+  }
+  text += "\"}";
+  return text.size();
+}
+
+void wireBytes() {
+  const JournalEntry events[] = {
+    {0, EventType::CheckIn, Role::Guest, cardUid({0xB2, 0xF9, 0x7C, 0x00}), 1735381800, 0, 250, 0},
+    {0, EventType::CheckOut, Role::Guest, cardUid({0xB2, 0xF9, 0x7C, 0x00}), 1735387200, 5400, 0, 0},
+    {0, EventType::Denied, Role::Unknown, cardUid({0xDE, 0xAD, 0xBE, 0xEF}), 1735387300, 1, 0, 0},
+    {0, EventType::Alert, Role::Security, cardUid({0xDE, 0xAD, 0xBE, 0xEF}), 1735387400, 5, 0, 0},
+  };
+  const char* names[] = {"check-in", "check-out", "denied", "alert"};
+
+  printf("Bytes per event      payload  MQTT frame  WebSocket frame  old envelope\n");
+  for (int binary = 0; binary < 2; binary++) {
+    DeviceContext ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+    SimLink link;
+    SimSocket socket(link);
+    MqttClient mqtt(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, SimSocket::send);
+    EventPublisher publisher(ctx, mqtt);
+    socket.attach(mqtt);
+    publisher.onPublished(onPublished);
+    publisher.setPayloadFormat(binary ? PayloadFormat::Binary : PayloadFormat::Json);
+    mqtt.connect(0);
+    socket.deliver(0);
+
+    for (size_t i = 0; i < 4; i++) {
+      size_t before = socket.bytes();
+      CHECK(publisher.record(events[i], 10) == RecordResult::Direct);
+      size_t frame = socket.bytes() - before;
+      size_t header = MqttClient::publishHeaderSize(publishedTopic.size(), MQTT_QOS) - 3;
+      CHECK(frame == publishedLength + header || frame == publishedLength + header + 1);
+      socket.deliver(10);
+      CHECK(mqtt.inflight() == 0);
+
+      size_t envelope = legacyEnvelope(publishedTopic, publishedPayload);
+      printf("  %-9s %-5s %9zu %11zu %16zu %13s\n", names[i], binary ? "CBOR" : "JSON",
+             publishedLength, frame, webSocketFrame(frame),
+             binary ? "-" : std::to_string(webSocketFrame(envelope)).c_str());
+      if (!binary) CHECK(webSocketFrame(frame) < webSocketFrame(envelope));
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  session();
+  wireBytes();
+  return testResult();
+}
@@ -0,0 +1,164 @@
+/**
+ * @file multi_reader_test.cpp
+ * @brief Per-reader detection latency as one board drives 1 to 8 readers
+ *
+ * N readers on the shared SPI bus, driven the way rfidTask() drives them:
+ * one inventory per reader per sweep, each sweep starting one reader
+ * later than the last, then CARD_READ_DELAY of sleep. Inventories take
+ * bus time: an empty field costs one silent frame, about
+ * RFID_RX_TIMEOUT_US, and each card in the field an anticollision, a
+ * select and a halt on top. The frame costs are card_detect_test's.
+ *
+ * Each room sees a guest tap every 20 s on average, for an hour. In the
+ * occupied run every room also has a card resting in its holder, so each
+ * inventory selects a card. Latency is card placed to check-in decided.
+ * A card waits at most for the rest of the sweep it just missed, the
+ * sleep, and one more sweep: CARD_READ_DELAY plus two sweeps.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "card_reader.h"
+#include "config.h"
+#include "host_test.h"
+#include "presence.h"
+
+namespace {
+
+const uint64_t HOUR_US = 3600ull * 1000000;
+const uint32_t MEAN_GAP_MS = 20000;
+
+// ---- MFRC522 SPI costs ----
+
+const double   SPI_ACCESS_US = 5;
+const uint32_t FRAME_SETUP = 8;
+const uint32_t FRAME_RESULT = 4;
+const uint32_t CARD_ANSWER_US = 100;
+const uint32_t ANSWERED_FRAME = FRAME_SETUP + (uint32_t)(CARD_ANSWER_US / SPI_ACCESS_US) + FRAME_RESULT;
+const uint32_t SILENT_FRAME = FRAME_SETUP + (uint32_t)(RFID_RX_TIMEOUT_US / SPI_ACCESS_US);
+
+uint64_t inventoryUs(size_t cards) {
+  uint64_t accesses = cards == 0 ? SILENT_FRAME
+                                 : ANSWERED_FRAME + SILENT_FRAME + cards * (2 * ANSWERED_FRAME + SILENT_FRAME);
+  return (uint64_t)(accesses * SPI_ACCESS_US);
+}
+
+// ---- Readers ----
+
+struct Room {
+  uint64_t nextTapUs;
+  uint64_t removeAtUs;
+  uint64_t placedAtUs;                 ///< 0 when no tap is waiting
+  uint64_t worstUs;
+  CardUid  tap;
+  uint32_t taps;
+};
+
+std::vector<Room> rooms;
+size_t   serving = 0;
+uint64_t nowUs = 0;
+uint32_t rng = 7;
+
+uint32_t random() {
+  rng = rng * 1103515245 + 12345;
+  return rng >> 8;
+}
+
+CardUid card(size_t room, uint32_t n) {
+  return cardUid({0x47, (uint8_t)room, (uint8_t)(n >> 8), (uint8_t)n});
+}
+
+Role lookup(const uint8_t*, uint8_t) { return Role::Guest; }
+
+void emit(const JournalEntry& entry) {
+  Room& room = rooms[serving];
+  if (entry.type != EventType::CheckIn || room.placedAtUs == 0 || !sameCard(entry.uid, room.tap)) return;
+  room.worstUs = std::max(room.worstUs, nowUs - room.placedAtUs);
+  room.placedAtUs = 0;
+}
+
+// Guests hold the card to the reader for 1 to 3 s
+void advance(size_t i, SimCardReader& reader, uint64_t untilUs) {
+  Room& room = rooms[i];
+  if (room.removeAtUs != 0 && untilUs >= room.removeAtUs) {
+    reader.removeCard(room.tap);
+    room.removeAtUs = 0;
+  }
+  if (room.removeAtUs == 0 && untilUs >= room.nextTapUs) {
+    room.tap = card(i, ++room.taps);
+    reader.placeCard(room.tap);
+    room.placedAtUs = room.nextTapUs;
+    room.removeAtUs = room.nextTapUs + (1000 + random() % 2000) * 1000ull;
+    room.nextTapUs = room.removeAtUs + (random() % (2 * MEAN_GAP_MS)) * 1000ull;
+  }
+}
+
+struct Result {
+  uint64_t worstUs;                    ///< Slowest reader
+  uint64_t bestUs;                     ///< Fastest reader's worst case
+  uint64_t sweepUs;                    ///< Longest sweep
+  uint32_t taps;
+};
+
+Result run(size_t readers, bool occupied) {
+  rooms.assign(readers, Room{});
+  std::vector<std::unique_ptr<SimCardReader>> fields;
+  std::vector<std::unique_ptr<PresenceTracker>> presence;
+  for (size_t i = 0; i < readers; i++) {
+    fields.emplace_back(new SimCardReader(false));
+    presence.emplace_back(new PresenceTracker(lookup, emit, CARD_ABSENT_THRESHOLD));
+    if (occupied) fields[i]->placeCard(card(i, 0));
+    rooms[i].nextTapUs = 1 + (random() % (2 * MEAN_GAP_MS)) * 1000ull;
+  }
+
+  Result result = {0, ~0ull, 0, 0};
+  size_t first = 0;
+  for (nowUs = 0; nowUs < HOUR_US;) {
+    uint64_t sweepStartUs = nowUs;
+    for (size_t n = 0; n < readers; n++) {
+      size_t i = (first + n) % readers;
+      advance(i, *fields[i], nowUs);
+      CardUid uids[MAX_PRESENT_CARDS];
+      size_t count = fields[i]->readCards(uids, MAX_PRESENT_CARDS);
+      nowUs += inventoryUs(count);
+      serving = i;
+      presence[i]->update(uids, count, nowUs, EventTime{1735381800 + (uint32_t)(nowUs / 1000000), 0});
+    }
+    first = (first + 1) % readers;
+    result.sweepUs = std::max(result.sweepUs, nowUs - sweepStartUs);
+    nowUs += CARD_READ_DELAY * 1000;
+  }
+
+  for (const Room& room : rooms) {
+    result.worstUs = std::max(result.worstUs, room.worstUs);
+    result.bestUs = std::min(result.bestUs, room.worstUs);
+    result.taps += room.taps;
+    CHECK(room.placedAtUs == 0 || room.placedAtUs + 3000000 > HOUR_US);
+  }
+  return result;
+}
+
+} // namespace
+
+int main() {
+  printf("Readers on one SPI bus, a tap per room every %u s for an hour\n", MEAN_GAP_MS / 1000);
+  printf("  %-9s %7s  %10s  %23s  %10s\n", "", "readers", "sweep max", "worst latency per reader", "bound");
+  printf("  %-9s %7s  %10s  %11s %11s  %10s\n", "", "", "", "slowest", "fastest", "");
+
+  for (int occupied = 0; occupied < 2; occupied++) {
+    for (size_t readers = 1; readers <= MAX_RFID_READERS; readers++) {
+      Result r = run(readers, occupied != 0);
+      // Two cards at most in a field: the resting one and a tap
+      uint64_t sweepBoundUs = readers * inventoryUs(occupied ? 2 : 1);
+      uint64_t boundUs = CARD_READ_DELAY * 1000ull + 2 * sweepBoundUs;
+      printf("  %-9s %7zu  %7.1f ms  %8.1f ms %8.1f ms  %7.1f ms\n", occupied ? "occupied" : "idle", readers,
+             r.sweepUs / 1000.0, r.worstUs / 1000.0, r.bestUs / 1000.0, boundUs / 1000.0);
+
+      CHECK(r.taps > readers * 100);
+      CHECK(r.sweepUs <= sweepBoundUs);
+      CHECK(r.worstUs <= boundUs);
+    }
+  }
+  return testResult();
+}
@@ -0,0 +1,277 @@
+/**
+ * @file outage_latency_test.cpp
+ * @brief Card-to-publish latency while the network comes and goes
+ *
+ * The firmware's two loops in simulated time: the RFID loop polls a
+ * SimCardReader every CARD_READ_DELAY and queues events; the network
+ * loop is the Scheduler running the event, WebSocket and drain tasks over
+ * a SimLink that drops for tens of seconds at a time, reconnecting with
+ * the jittered backoff. Guests tap cards throughout a simulated hour.
+ *
+ * For each check-in it measures card-to-decision (the event exists) and
+ * card-to-publish (the broker has it). A card tapped while the link is
+ * up must be published within a few task periods, and one tapped during
+ * an outage must still be decided at once; its publish waits for the
+ * session. For comparison it runs the old loop() model, where
+ * connectWiFi() held the only thread for up to WIFI_TIMEOUT at a time
+ * while the link was down.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "backoff.h"
+#include "card_acl.h"
+#include "card_reader.h"
+#include "config.h"
+#include "event_publisher.h"
+#include "host_test.h"
+#include "presence.h"
+#include "scheduler.h"
+#include "sim_transport.h"
+#include "spsc_queue.h"
+
+namespace {
+
+const uint32_t HOUR_MS = 3600 * 1000;
+const uint32_t SETTLE_MS = 10 * 60 * 1000;     ///< After the hour, for taps still waiting on the session
+
+// ---- Firmware stand-in ----
+// Globals and plain-function tasks, as in esp32code.cpp
+
+struct Tap {
+  uint32_t placedMs;
+  uint32_t decidedMs;
+  bool     online;              ///< Session up from placement to publish
+};
+
+SimLink*        netLink = nullptr;
+SimSocket*      netSocket = nullptr;
+MqttClient*     mqtt = nullptr;
+EventPublisher* publisher = nullptr;
+CardAcl*        acl = nullptr;
+Backoff*        backoff = nullptr;
+
+SpscQueue<JournalEntry, EVENT_QUEUE_SIZE> eventQueue;
+uint32_t nowMs = 0;
+uint32_t reconnectAtMs = 0;
+bool     sessionUp = false;
+
+std::map<std::string, Tap> taps;           ///< By UID, until published
+std::vector<uint32_t>      decideMs;
+std::vector<uint32_t>      onlinePublishMs;
+std::vector<uint32_t>      offlinePublishMs;
+
+std::string uidText(const CardUid& uid) {
+  char buf[2 * CARD_UID_MAX_SIZE + 1];
+  formatCardUid(uid.bytes, uid.size, buf, sizeof(buf));
+  return buf;
+}
+
+Role lookup(const uint8_t* uid, uint8_t size) {
+  return acl->lookup(uid, size);
+}
+
+void emit(const JournalEntry& entry) {
+  if (entry.type == EventType::CheckIn) {
+    auto it = taps.find(uidText(entry.uid));
+    if (it != taps.end()) {
+      it->second.decidedMs = nowMs;
+      decideMs.push_back(nowMs - it->second.placedMs);
+    }
+  }
+  CHECK(eventQueue.push(entry));
+}
+
+// The broker has the event: every check-in object carries its card_uid first
+void onPublished(const char*, const uint8_t* payload, size_t length, bool success) {
+  if (payload == nullptr || !success) return;
+  std::string text((const char*)payload, length);
+  for (size_t at = text.find("\"card_uid\":\""); at != std::string::npos;
+       at = text.find("\"card_uid\":\"", at + 1)) {
+    size_t end = text.find('"', at + 12);
+    size_t object = text.find('}', at);
+    if (text.find("\"check_in\"", at) > object) continue;
+    auto it = taps.find(text.substr(at + 12, end - at - 12));
+    if (it == taps.end()) continue;
+    (it->second.online ? onlinePublishMs : offlinePublishMs).push_back(nowMs - it->second.placedMs);
+    taps.erase(it);
+  }
+}
+
+void onAck(uint16_t packetId) { publisher->onAck(packetId); }
+
+void eventTask(uint32_t now) {
+  JournalEntry entry;
+  while (eventQueue.pop(entry)) publisher->record(entry, now);
+}
+
+// WebSocketsClient and webSocketEvent(), reduced to what the session needs
+void websocketTask(uint32_t now) {
+  if (netLink->update(now) && !netLink->up() && sessionUp) {
+    sessionUp = false;
+    for (auto& tap : taps) tap.second.online = false;
+    netSocket->reset();
+    publisher->connectionLost();
+    reconnectAtMs = now + backoff->next();
+  }
+  if (!mqtt->connected() && (int32_t)(now - reconnectAtMs) >= 0) {
+    if (!netLink->up() || !mqtt->connect(now)) reconnectAtMs = now + backoff->next();
+    else reconnectAtMs = now + WS_HEARTBEAT_TIMEOUT;
+  }
+
+  netSocket->deliver(now);
+  mqtt->loop(now);
+  if (mqtt->connected() && !sessionUp) {
+    sessionUp = true;
+    backoff->reset();
+  }
+  publisher->drain(now);
+}
+
+struct Result {
+  size_t   taps;
+  size_t   missed;              ///< Never checked in, or never published
+  uint32_t outages;
+  uint32_t worstDecideMs;
+  uint32_t worstOnlineMs;
+  uint32_t worstOfflineMs;
+  uint32_t p99OnlineMs;
+};
+
+uint32_t percentile(std::vector<uint32_t> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p / 100.0 * (double)(v.size() - 1) + 0.5))];
+}
+
+/**
+ * @param blockingLoop Model the old loop(): no card polls while connectWiFi() runs
+ */
+Result run(uint32_t seed, bool blockingLoop) {
+  char path[] = "/tmp/outage_latency_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd >= 0) close(fd);
+  unlink(path);
+
+  DeviceContext ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+  SimLink flapping(seed, 120000, 30000);
+  SimSocket sim(flapping);
+  MqttClient client(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, SimSocket::send);
+  EventPublisher pub(ctx, client);
+  FileJournalStorage storage(path, 0x60000);
+  EventJournal journal(storage);
+  CardAcl list;
+  Backoff retry(WS_RECONNECT_MIN, WS_RECONNECT_MAX, seed);
+  SimCardReader reader(false);
+  PresenceTracker presence(lookup, emit, CARD_ABSENT_THRESHOLD);
+  Scheduler scheduler;
+
+  netLink = &flapping;
+  netSocket = &sim;
+  mqtt = &client;
+  publisher = &pub;
+  acl = &list;
+  backoff = &retry;
+  sim.attach(client);
+  client.onAck(onAck);
+  pub.onPublished(onPublished);
+  pub.setPayloadFormat(PayloadFormat::Json);
+  CHECK(journal.begin());
+  pub.attachJournal(&journal);
+  taps.clear();
+  decideMs.clear();
+  onlinePublishMs.clear();
+  offlinePublishMs.clear();
+  sessionUp = false;
+  reconnectAtMs = 0;
+
+  static UserAuth guests[400];
+  for (size_t i = 0; i < 400; i++) guests[i] = {cardUid({0x47, 0x55, (uint8_t)(i >> 8), (uint8_t)i}), Role::Guest};
+  list.load(guests, 400);
+
+  scheduler.add("events", eventTask, EVENT_DRAIN_INTERVAL, 0);
+  scheduler.add("websocket", websocketTask, WS_LOOP_INTERVAL, 0);
+
+  // A guest every 20 s on average, holding the card for 1 to 2 s
+  uint32_t rng = seed;
+  auto random = [&rng]() { rng = rng * 1103515245 + 12345; return rng >> 8; };
+  uint32_t nextTapMs = 1000 + random() % 40000;
+  uint32_t removeAtMs = 0;
+  uint32_t nextPollMs = 0;
+  uint32_t blockedUntilMs = 0;
+  size_t   guest = 0;
+  size_t   placed = 0;
+  CardUid  held = {};
+
+  for (nowMs = 0; nowMs < HOUR_MS + SETTLE_MS && (nowMs < HOUR_MS || !taps.empty()); nowMs++) {
+    if (removeAtMs != 0 && nowMs >= removeAtMs) {
+      reader.removeCard(held);
+      removeAtMs = 0;
+    }
+    if (removeAtMs == 0 && nowMs >= nextTapMs && nowMs < HOUR_MS) {
+      held = guests[guest++ % 400].uid;
+      reader.placeCard(held);
+      taps[uidText(held)] = {nowMs, 0, sessionUp};
+      placed++;
+      removeAtMs = nowMs + 1000 + random() % 1000;
+      nextTapMs = removeAtMs + random() % 40000;
+    }
+
+    if (blockingLoop) {
+      // connectWiFi() spins until the link returns or WIFI_TIMEOUT passes
+      if (!flapping.up() && nowMs >= blockedUntilMs) blockedUntilMs = nowMs + WIFI_TIMEOUT;
+      if (flapping.up()) blockedUntilMs = 0;
+      if (blockedUntilMs > nowMs) {
+        scheduler.tick(nowMs);
+        nextPollMs = nowMs;
+        continue;
+      }
+    }
+
+    if (nowMs >= nextPollMs) {
+      CardUid uids[MAX_PRESENT_CARDS];
+      size_t count = reader.readCards(uids, MAX_PRESENT_CARDS);
+      presence.update(uids, count, (uint64_t)nowMs * 1000, EventTime{1735381800 + nowMs / 1000, (uint16_t)(nowMs % 1000)});
+      nextPollMs = nowMs + CARD_READ_DELAY;
+    }
+    scheduler.tick(nowMs);
+  }
+  unlink(path);
+
+  uint32_t worstDecide = decideMs.empty() ? 0 : *std::max_element(decideMs.begin(), decideMs.end());
+  return {placed, taps.size(), flapping.flaps(), worstDecide,
+          percentile(onlinePublishMs, 100), percentile(offlinePublishMs, 100),
+          percentile(onlinePublishMs, 99)};
+}
+
+} // namespace
+
+int main() {
+  printf("One simulated hour, link up ~2 min and down ~30 s at a time\n");
+  printf("              taps  missed  outages  card->decision  card->publish online p99 / max  offline max\n");
+  const uint32_t seeds[] = {1, 2, 3};
+  for (uint32_t seed : seeds) {
+    Result r = run(seed, false);
+    printf("  scheduler  %5zu %7zu %8u %12u ms %22u / %u ms %9u ms\n", r.taps, r.missed, r.outages,
+           r.worstDecideMs, r.p99OnlineMs, r.worstOnlineMs, r.worstOfflineMs);
+    CHECK(r.outages > 0);
+    // A poll period, whatever the network is doing
+    CHECK(r.worstDecideMs <= CARD_READ_DELAY);
+    // Poll, queue drain, batch window and a WebSocket service round
+    CHECK(r.worstOnlineMs <= CARD_READ_DELAY + EVENT_DRAIN_INTERVAL + PUBLISH_BATCH_WINDOW +
+                             2 * WS_LOOP_INTERVAL + SCHEDULER_TICK_MS);
+    CHECK(r.missed == 0);
+
+    Result old = run(seed, true);
+    printf("  old loop() %5zu %7zu %8u %12u ms %22u / %u ms %9u ms\n", old.taps, old.missed, old.outages,
+           old.worstDecideMs, old.p99OnlineMs, old.worstOnlineMs, old.worstOfflineMs);
+  }
+  return testResult();
+}
@@ -0,0 +1,150 @@
+/**
+ * @file spsc_queue_test.cpp
+ * @brief The RFID-to-network event queue under two real threads
+ *
+ * A producer and a consumer thread, started with PinnedTask on separate
+ * cores where the host has them, hammer the same SpscQueue<JournalEntry,
+ * EVENT_QUEUE_SIZE> the firmware uses. Every entry is filled from its
+ * sequence number, so the consumer can tell a lost, repeated, reordered or
+ * half-written entry from a good one.
+ *
+ * The first run retries on a full queue and must deliver all entries in
+ * order. The second runs as queueEvent() does, dropping on a full queue
+ * against a consumer that naps like the network task: whatever was pushed
+ * must arrive in order, and pushed() plus dropped() must account for
+ * every attempt. Throughput and hand-off latency are in
+ * bench/spsc_queue_bench.cpp.
+ */
+
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "config.h"
+#include "event_journal.h"
+#include "host_test.h"
+#include "pinned_task.h"
+#include "spsc_queue.h"
+
+namespace {
+
+typedef SpscQueue<JournalEntry, EVENT_QUEUE_SIZE> EventQueue;
+
+EventQueue*           queue = nullptr;
+uint32_t              attempts = 0;
+bool                  retryWhenFull = false;
+std::atomic<bool>     producerDone(false);
+
+uint32_t              received = 0;
+uint32_t              lastSeq = 0;
+uint32_t              corrupt = 0;
+uint32_t              outOfOrder = 0;
+
+// Every field a function of seq, so a torn copy shows
+JournalEntry entryFor(uint32_t seq) {
+  JournalEntry entry = {seq, seq % 3 == 0 ? EventType::CheckOut : EventType::CheckIn, Role::Guest,
+                        cardUid({(uint8_t)(seq >> 24), (uint8_t)(seq >> 16), (uint8_t)(seq >> 8), (uint8_t)seq}),
+                        1735381800 + seq, seq * 7, (uint16_t)(seq % 1000), (uint8_t)(seq & 3)};
+  return entry;
+}
+
+bool intact(const JournalEntry& entry) {
+  JournalEntry expected = entryFor(entry.seq);
+  return entry.type == expected.type && entry.uid.size == 4 &&
+         memcmp(entry.uid.bytes, expected.uid.bytes, 4) == 0 &&
+         entry.timestamp == expected.timestamp && entry.duration == expected.duration &&
+         entry.millis == expected.millis && entry.reader == expected.reader;
+}
+
+void producer(void*) {
+  for (uint32_t seq = 1; seq <= attempts; seq++) {
+    JournalEntry entry = entryFor(seq);
+    if (retryWhenFull) {
+      while (!queue->push(entry)) sleepMs(0);
+    } else {
+      queue->push(entry);
+      if (seq % 64 == 0) sleepMs(0);
+    }
+  }
+  producerDone.store(true, std::memory_order_release);
+}
+
+void take(const JournalEntry& entry) {
+  received++;
+  if (!intact(entry)) corrupt++;
+  if (entry.seq <= lastSeq || (retryWhenFull && entry.seq != lastSeq + 1)) outOfOrder++;
+  lastSeq = entry.seq;
+}
+
+void consumer(void*) {
+  JournalEntry entry;
+  uint32_t idle = 0;
+  for (;;) {
+    if (queue->pop(entry)) {
+      take(entry);
+      continue;
+    }
+    if (producerDone.load(std::memory_order_acquire)) {
+      // Every push happened before the flag; what is left is final
+      while (queue->pop(entry)) take(entry);
+      break;
+    }
+    // The network task only looks at the queue once per scheduler tick
+    if (!retryWhenFull && ++idle % 16 == 0) sleepMs(1);
+    else sleepMs(0);
+  }
+}
+
+void run(uint32_t count, bool retry) {
+  static std::unique_ptr<EventQueue> events;
+  events.reset(new EventQueue());
+  queue = events.get();
+  attempts = count;
+  retryWhenFull = retry;
+  producerDone.store(false);
+  received = 0;
+  lastSeq = 0;
+  corrupt = 0;
+  outOfOrder = 0;
+
+  // RFID task on core 1, network task on core 0, as on the ESP32
+  bool cores = std::thread::hardware_concurrency() >= 2;
+  PinnedTask rfid;
+  PinnedTask network;
+  CHECK(network.start("network", consumer, nullptr, 0, 0, cores ? 0 : -1));
+  CHECK(rfid.start("rfid", producer, nullptr, 0, 0, cores ? 1 : -1));
+  rfid.join();
+  network.join();
+}
+
+} // namespace
+
+int main() {
+  printf("SpscQueue<JournalEntry, %d>, producer and consumer threads\n", EVENT_QUEUE_SIZE);
+
+  // Lossless: the producer waits for room
+  const uint32_t lossless = 2000000;
+  run(lossless, true);
+  CHECK(received == lossless);
+  CHECK(lastSeq == lossless);
+  CHECK(corrupt == 0 && outOfOrder == 0);
+  CHECK(queue->pushed() == lossless);
+  CHECK(queue->highWater() <= EVENT_QUEUE_SIZE);
+  CHECK(queue->size() == 0);
+  printf("  retry when full: %u of %u received in order, %u full-queue retries, high water %u\n",
+         received, lossless, queue->dropped(), queue->highWater());
+
+  // As queueEvent(): a full queue drops the event and counts it
+  const uint32_t lossy = 1000000;
+  run(lossy, false);
+  CHECK(queue->pushed() + queue->dropped() == lossy);
+  CHECK(received == queue->pushed());
+  CHECK(corrupt == 0 && outOfOrder == 0);
+  CHECK(queue->highWater() <= EVENT_QUEUE_SIZE);
+  printf("  drop when full:  %u pushed, %u dropped, %u received in order, high water %u\n",
+         queue->pushed(), queue->dropped(), received, queue->highWater());
+
+  return testResult();
+}
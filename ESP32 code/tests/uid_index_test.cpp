@@ -0,0 +1,87 @@
+/**
+ * @file uid_index_test.cpp
+ * @brief UidIndex against a reference map, through inserts and removals
+ */
+
+#include <map>
+#include <vector>
+
+#include "host_test.h"
+#include "uid_index.h"
+
+namespace {
+
+// Compile-time construction of the baked-in list
+constexpr UserAuth baked[] = {
+  {cardUid({0xAF, 0x4D, 0x99, 0x1F}), Role::Maintenance},
+  {cardUid({0x04, 0x52, 0x9A, 0x12, 0x6B, 0x5C, 0x80}), Role::Housekeeping},
+  {cardUid({0x08, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99}), Role::Manager},
+};
+constexpr auto bakedIndex = makeUidIndex<8>(baked);
+static_assert(bakedIndex.size() == 3, "all baked cards inserted");
+static_assert(bakedIndex.lookup(baked[1].uid.bytes, 7) == Role::Housekeeping, "7-byte lookup");
+static_assert(bakedIndex.lookup(baked[0].uid.bytes, 7) == Role::Unknown, "size is part of the key");
+
+CardUid randomCard(uint32_t& seed) {
+  static const uint8_t sizes[] = {4, 7, 10};
+  seed = seed * 1103515245 + 12345;
+  CardUid uid = {};
+  uid.size = sizes[(seed >> 16) % 3];
+  // Few distinct bytes, so UIDs repeat and probe runs collide
+  for (uint8_t i = 0; i < uid.size; i++) {
+    seed = seed * 1103515245 + 12345;
+    uid.bytes[i] = (uint8_t)((seed >> 16) % 4);
+  }
+  return uid;
+}
+
+std::vector<uint8_t> key(const CardUid& uid) {
+  return std::vector<uint8_t>(uid.bytes, uid.bytes + uid.size);
+}
+
+void churn() {
+  static UidIndex<256> index;
+  std::map<std::vector<uint8_t>, Role> reference;
+  std::vector<CardUid> seen;
+  uint32_t seed = 1;
+
+  for (int step = 0; step < 200000; step++) {
+    CardUid uid = randomCard(seed);
+    seen.push_back(uid);
+    if (seed % 3 == 0) {
+      bool removed = index.remove(uid.bytes, uid.size);
+      CHECK(removed == (reference.erase(key(uid)) == 1));
+    } else if (reference.size() < 200) {
+      Role role = (Role)(1 + seed % 5);
+      CHECK(index.insert(uid, role));
+      reference[key(uid)] = role;
+    }
+    CHECK(index.size() == reference.size());
+  }
+
+  for (const CardUid& uid : seen) {
+    auto it = reference.find(key(uid));
+    CHECK(index.lookup(uid.bytes, uid.size) == (it == reference.end() ? Role::Unknown : it->second));
+  }
+}
+
+void full() {
+  UidIndex<8> index;
+  for (uint8_t i = 0; i < 7; i++) CHECK(index.insert(cardUid({i, 0, 0, 0}), Role::Guest));
+  // One slot always stays empty
+  CHECK(!index.insert(cardUid({7, 0, 0, 0}), Role::Guest));
+  CHECK(index.insert(cardUid({3, 0, 0, 0}), Role::Manager));
+  CHECK(index.lookup(cardUid({3, 0, 0, 0}).bytes, 4) == Role::Manager);
+  CHECK(index.lookup(cardUid({9, 0, 0, 0}).bytes, 4) == Role::Unknown);
+
+  const uint8_t fiveBytes[5] = {1, 2, 3, 4, 5};
+  CHECK(!index.insert(fiveBytes, 5, Role::Guest));
+}
+
+} // namespace
+
+int main() {
+  churn();
+  full();
+  return testResult();
+}
@@ -0,0 +1,213 @@
+/**
+ * @file warm_boot_test.cpp
+ * @brief Reset to first card read, and no second check-in for a guest who stayed
+ *
+ * A guest's card sits in the room's card holder for an hour. Halfway
+ * through, the reader resets and comes back 300 ms later; the card never
+ * leaves. The boot path is the firmware's setup() and restoreBootState():
+ * card list, BootState from "RTC memory" (a global that outlives the
+ * reader), first inventory. Nothing waits for WiFi or NTP.
+ *
+ * After a watchdog or brown-out reset the guest must not be checked in
+ * again, and the check-out must carry the whole stay. A power-on reset, a
+ * damaged block, or the old firmware that kept nothing, check the guest in
+ * twice. A card read before NTP ever answered is stamped against the boot
+ * and resolves to the right Unix time once the clock is set.
+ *
+ * Reset-to-first-read is host time from the start of boot to the end of
+ * the first inventory, printed for reference.
+ */
+
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "boot_state.h"
+#include "card_acl.h"
+#include "card_reader.h"
+#include "config.h"
+#include "host_test.h"
+#include "presence.h"
+#include "wall_clock.h"
+
+namespace {
+
+const uint64_t EPOCH_US = 1735381800ull * 1000000;   ///< Unix time at the start of the run
+const uint64_t MINUTE_US = 60ull * 1000000;
+const uint64_t REBOOT_US = 300000;
+
+enum class Reset { Watchdog, PowerOn, Damaged, NothingKept };
+
+// ---- Reader ----
+
+BootState     rtc;                     ///< RTC_NOINIT: survives every reset but power-on
+SimCardReader reader(false);           ///< The card stays in the field through a reset
+CardAcl       acl;
+std::vector<JournalEntry> events;
+
+CardUid guest() { return cardUid({0xB2, 0xF9, 0x7C, 0x00}); }
+
+Role lookup(const uint8_t* uid, uint8_t size) { return acl.lookup(uid, size); }
+void emit(const JournalEntry& entry) { events.push_back(entry); }
+
+struct Device {
+  WallClock       clock;
+  PresenceTracker presence;
+  uint64_t        bootUs;              ///< True time of the reset; esp_timer starts over
+
+  Device(uint8_t bootId, uint64_t nowUs)
+    : clock(bootId), presence(lookup, emit, CARD_ABSENT_THRESHOLD), bootUs(nowUs) {}
+
+  uint64_t monoUs(uint64_t nowUs) const { return nowUs - bootUs; }
+
+  void save(uint64_t nowUs) {
+    rtc.bootId = clock.bootId();
+    rtc.clockSynced = clock.synced();
+    rtc.savedAtEpoch = (uint32_t)(clock.epochUs(monoUs(nowUs)) / 1000000);
+    rtc.readers = 1;
+    presence.save(rtc.presence[0], monoUs(nowUs));
+    sealBootState(rtc);
+  }
+
+  void poll(uint64_t nowUs) {
+    CardUid uids[MAX_PRESENT_CARDS];
+    size_t count = reader.readCards(uids, MAX_PRESENT_CARDS);
+    uint64_t mono = monoUs(nowUs);
+    presence.update(uids, count, mono, clock.stamp(mono));
+    if (count > 0 || presence.present() > 0) save(nowUs);
+  }
+};
+
+std::unique_ptr<Device> device;
+uint8_t  bootId = 0;
+double   firstReadUs = 0;
+
+/**
+ * @param systemClockKept The system clock was set before the reset and ran on through it
+ */
+void boot(Reset reset, uint64_t nowUs, bool systemClockKept) {
+  auto start = std::chrono::steady_clock::now();
+  device.reset(new Device(++bootId, nowUs));
+  Device& d = *device;
+
+  if (reset == Reset::PowerOn) memset(&rtc, 0xA5, sizeof(rtc));
+  if (reset == Reset::Damaged) rtc.presence[0].cards[0].presentMs ^= 1;
+  bool warm = reset == Reset::Watchdog || reset == Reset::Damaged;
+  if (warm && bootStateValid(rtc) && rtc.readers == 1) {
+    uint32_t elapsedMs = 0;
+    if (rtc.clockSynced && systemClockKept) {
+      d.clock.set(EPOCH_US + nowUs, 0);
+      uint32_t epoch = (uint32_t)((EPOCH_US + nowUs) / 1000000);
+      if (rtc.savedAtEpoch != 0 && epoch >= rtc.savedAtEpoch) elapsedMs = (epoch - rtc.savedAtEpoch) * 1000;
+    }
+    d.presence.restore(rtc.presence[0], 0, elapsedMs);
+  }
+  d.save(nowUs);
+  d.poll(nowUs);
+  firstReadUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Stay {
+  size_t   checkIns;
+  uint32_t durationSec;                ///< Of the last check-out
+  double   firstReadUs;                ///< After the reset
+};
+
+/**
+ * @param ntp NTP answers 2 s after the first boot; otherwise never
+ */
+Stay hour(Reset reset, bool ntp) {
+  memset(&rtc, 0, sizeof(rtc));
+  reader.clear();
+  events.clear();
+
+  const uint64_t placeUs = 5 * 1000000;
+  const uint64_t resetUs = 30 * MINUTE_US;
+  const uint64_t removeUs = 60 * MINUTE_US;
+  boot(Reset::PowerOn, 0, false);
+  double resetToRead = 0;
+
+  for (uint64_t nowUs = CARD_READ_DELAY * 1000; nowUs < removeUs + 2 * 1000000; nowUs += CARD_READ_DELAY * 1000) {
+    if (ntp && nowUs == 2 * 1000000) device->clock.set(EPOCH_US + nowUs, device->monoUs(nowUs));
+    if (nowUs == placeUs) reader.placeCard(guest());
+    if (nowUs == removeUs) reader.removeCard(guest());
+    if (nowUs == resetUs) {
+      nowUs += REBOOT_US;
+      boot(reset, nowUs, ntp);
+      resetToRead = firstReadUs;
+      continue;
+    }
+    device->poll(nowUs);
+  }
+
+  Stay stay = {0, 0, resetToRead};
+  for (const JournalEntry& e : events) {
+    if (!sameCard(e.uid, guest())) continue;
+    if (e.type == EventType::CheckIn) stay.checkIns++;
+    if (e.type == EventType::CheckOut) stay.durationSec = e.duration;
+  }
+  return stay;
+}
+
+// A card read before NTP: the stamp resolves once the clock is set
+void unsyncedStamp() {
+  memset(&rtc, 0, sizeof(rtc));
+  reader.clear();
+  events.clear();
+  boot(Reset::PowerOn, 0, false);
+  CHECK(!device->clock.synced());
+
+  const uint64_t tapUs = 1234567;
+  reader.placeCard(guest());
+  device->poll(tapUs);
+  CHECK(events.size() == 1 && events[0].type == EventType::CheckIn);
+  CHECK((events[0].timestamp & UNSYNCED_STAMP) != 0);
+
+  device->clock.set(EPOCH_US + 8 * 1000000, 8 * 1000000);
+  uint64_t resolved = device->clock.resolve({events[0].timestamp, events[0].millis});
+  CHECK(resolved / 1000 == (EPOCH_US + tapUs) / 1000);
+  reader.clear();
+}
+
+} // namespace
+
+int main() {
+  static UserAuth users[] = {{guest(), Role::Guest}};
+  acl.load(users, 1);
+
+  const uint32_t expected = (uint32_t)((60 * MINUTE_US - 5 * 1000000) / 1000000);
+  printf("Guest's card in the holder for an hour, reader reset after 30 minutes\n");
+  printf("  %-36s check-ins  stay reported  reset->first read (host)\n", "");
+
+  struct Case {
+    const char* name;
+    Reset       reset;
+    bool        ntp;
+    size_t      checkIns;
+  };
+  const Case cases[] = {
+    {"watchdog reset, NTP synced", Reset::Watchdog, true, 1},
+    {"watchdog reset, NTP never answered", Reset::Watchdog, false, 1},
+    {"power-on reset", Reset::PowerOn, true, 2},
+    {"damaged RTC block", Reset::Damaged, true, 2},
+    {"old firmware, nothing kept", Reset::NothingKept, true, 2},
+  };
+  for (const Case& c : cases) {
+    Stay stay = hour(c.reset, c.ntp);
+    printf("  %-36s %9zu %12u s %19.1f us\n", c.name, stay.checkIns, stay.durationSec, stay.firstReadUs);
+    CHECK(stay.checkIns == c.checkIns);
+    if (c.checkIns == 1) {
+      // The whole stay, give or take the reset when no clock could measure it
+      uint32_t slack = c.ntp ? 1 : 1 + (uint32_t)(REBOOT_US / 1000000) + 1;
+      CHECK(stay.durationSec + slack >= expected && stay.durationSec <= expected + 1);
+    } else {
+      // Only what the reader saw after the reset
+      CHECK(stay.durationSec <= 30 * 60);
+    }
+  }
+
+  unsyncedStamp();
+  return testResult();
+}
@@ -0,0 +1,407 @@
+/**
+ * @file auth_bench.cpp
+ * @brief What card authentication and event signing cost at the door
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section auth_bench_overview Overview
+ *
+ * Answers two questions before CARD_AUTH and EVENT_SIGNING are turned on:
+ *
+ * - How much later does the door decide? Issued cards and clones are
+ *   tapped on a SimCardReader behind the firmware's PresenceTracker, card
+ *   list and CardAuth. The tool checks every decision, counts credential
+ *   reads and times the CPU side of each check. The radio side can only be
+ *   modelled off the board: the extra ISO 14443A exchanges of
+ *   Mfrc522Reader::readBlock() at 106 kbit/s, plus --spi-us of MFRC522
+ *   register traffic per exchange. On a reader, the card_auth_us
+ *   telemetry histogram is the measured figure.
+ *
+ * - How many events a second can be signed? The real EventPublisher sends
+ *   JSON and binary events into a SimSocket, single and batched through
+ *   the journal, once unsigned and once signed. The difference is what
+ *   signing adds. On Linux this runs the portable SHA-256, so the figure
+ *   is the host's, not an ESP32's.
+ *
+ * key prints the per-hotel EVENT_SIGNING_KEY the backend derives from
+ * READER_SIGNING_SECRET, for flashing a reader.
+ *
+ *   auth_bench --taps 20000 --spi-us 300
+ *   auth_bench key "$READER_SIGNING_SECRET" BLDG001/1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "card_acl.h"
+#include "card_auth.h"
+#include "config.h"
+#include "event_journal.h"
+#include "event_publisher.h"
+#include "presence.h"
+#include "sim_transport.h"
+
+namespace {
+
+// ---- Options ----
+struct Options {
+  int    taps = 20000;
+  int    events = 20000;
+  double spiUs = 300;             ///< MFRC522 register traffic per exchange
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: auth_bench [--taps N] [--events N] [--spi-us US]\n"
+          "       auth_bench key SECRET BUILDING/HOTEL\n");
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) return false;
+    const char* value = argv[++i];
+    if (arg == "--taps") o.taps = atoi(value);
+    else if (arg == "--events") o.events = atoi(value);
+    else if (arg == "--spi-us") o.spiUs = atof(value);
+    else return false;
+  }
+  return o.taps > 0 && o.events > 0 && o.spiUs >= 0;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t nanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+double percentileUs(std::vector<uint64_t>& ns, double p) {
+  if (ns.empty()) return 0;
+  std::sort(ns.begin(), ns.end());
+  size_t index = (size_t)(p / 100.0 * (double)(ns.size() - 1) + 0.5);
+  return ns[std::min(index, ns.size() - 1)] / 1000.0;
+}
+
+// ---- Radio model ----
+// ISO 14443A at 106 kbit/s is 9.44 us a bit, 9 bits a byte with parity;
+// a card answers after the 86 us frame delay time
+
+double frameUs(int bits) { return bits * 9.44; }
+
+double exchangeUs(int sendBytes, int answerBytes, double spiUs) {
+  return frameUs(sendBytes * 9 + 2) + 86 + frameUs(answerBytes * 9 + 2) + spiUs;
+}
+
+double readBlockUs(uint8_t uidSize, double spiUs) {
+  int cascades = uidSize == 4 ? 1 : uidSize == 7 ? 2 : 3;
+  double us = frameUs(7 + 2) + 86 + frameUs(2 * 9 + 2) + spiUs;    // WUPA, ATQA
+  us += cascades * exchangeUs(9, 3, spiUs);                         // SELECT, SAK
+  us += exchangeUs(6, 4, spiUs) + exchangeUs(8, 4, spiUs);          // Three-pass auth
+  us += exchangeUs(4, 18, spiUs);                                   // READ: block and CRC
+  us += frameUs(4 * 9 + 2) + RFID_RX_TIMEOUT_US + spiUs;            // HLTA, no answer
+  return us;
+}
+
+// ---- Door ----
+// getUserRole() of esp32code.cpp on one reader; callbacks are plain
+// functions, as on the device
+
+SimCardReader*        doorReader = nullptr;
+CardAcl*              doorAcl = nullptr;
+CardAuth*             doorAuth = nullptr;
+uint32_t              doorNowMs = 0;
+std::vector<uint64_t> doorCheckNs;
+int                   doorCheckIns = 0;
+int                   doorDenials = 0;  ///< Of the card being tapped
+CardUid               doorTapped = {};
+
+Role doorLookup(const uint8_t* uid, uint8_t size) {
+  Role role = doorAcl->lookup(uid, size);
+  if (role == Role::Unknown) return role;
+
+  CardUid card = {};
+  card.size = size;
+  memcpy(card.bytes, uid, size);
+  Clock::time_point start = Clock::now();
+  AuthResult result = doorAuth->verify(*doorReader, card, role, doorNowMs);
+  doorCheckNs.push_back(nanosSince(start));
+  if (result == AuthResult::ReadFailed) return ROLE_UNDECIDED;
+  return result == AuthResult::Ok ? role : Role::Unknown;
+}
+
+void doorEmit(const JournalEntry& entry) {
+  if (entry.type == EventType::CheckIn) doorCheckIns++;
+  if (entry.type == EventType::Denied && sameCard(entry.uid, doorTapped)) doorDenials++;
+}
+
+// Indexed by Role, as setupCardAuth() loads them
+const uint8_t sectorKeys[CARD_ROLE_COUNT][CARD_KEY_SIZE] = {
+  {}, CARD_KEY_GUEST, CARD_KEY_MANAGER, CARD_KEY_MAINTENANCE, CARD_KEY_HOUSEKEEPING, {},
+};
+
+struct Tapper {
+  const char*    name;
+  CardUid        uid;
+  const uint8_t* key;             ///< Key A of the credential sector on this card
+  const uint8_t* block;           ///< What the card holds in CARD_AUTH_BLOCK
+  bool           genuine;
+  bool           swiped;          ///< The first credential read gets no answer
+  int            taps;
+  int            wrong;           ///< Decisions other than the expected one
+};
+
+int benchDoor(const Options& o) {
+  SimCardReader reader(false);
+  CardAuth auth;
+  CardAcl acl;
+  auth.setCredentialKey(CARD_CREDENTIAL_KEY);
+  for (size_t r = 1; r <= (size_t)Role::Housekeeping; r++) auth.setSectorKey((Role)r, sectorKeys[r]);
+
+  const UserAuth issued[] = {
+    {cardUid({0xB2, 0xF9, 0x7C, 0x00}), Role::Guest},
+    {cardUid({0xBF, 0xD1, 0x07, 0x1F}), Role::Manager},
+    {cardUid({0xAF, 0x4D, 0x99, 0x1F}), Role::Maintenance},
+    {cardUid({0x04, 0x52, 0x9A, 0x12, 0x6B, 0x5C, 0x80}), Role::Housekeeping},
+  };
+  acl.load(issued, sizeof(issued) / sizeof(issued[0]));
+  uint8_t credentials[4][CARD_BLOCK_SIZE];
+  for (size_t i = 0; i < 4; i++) auth.makeCredential(issued[i].uid, issued[i].role, 0, credentials[i]);
+  const uint8_t factoryKey[CARD_KEY_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  const uint8_t blank[CARD_BLOCK_SIZE] = {};
+
+  const uint8_t* guestKey = sectorKeys[(size_t)Role::Guest];
+  const uint8_t* housekeepingKey = sectorKeys[(size_t)Role::Housekeeping];
+  std::vector<Tapper> tappers = {
+    {"guest", issued[0].uid, guestKey, credentials[0], true, false, 0, 0},
+    {"manager", issued[1].uid, sectorKeys[(size_t)Role::Manager], credentials[1], true, false, 0, 0},
+    {"maintenance", issued[2].uid, sectorKeys[(size_t)Role::Maintenance], credentials[2], true, false, 0, 0},
+    {"housekeeping, 7-byte UID", issued[3].uid, housekeepingKey, credentials[3], true, false, 0, 0},
+    // Swiped past: the inventory sees it, the credential read does not
+    {"guest, first read missed", issued[0].uid, guestKey, credentials[0], true, true, 0, 0},
+    // A blank card given the manager's UID: still the factory key
+    {"manager UID clone", issued[1].uid, factoryKey, blank, false, false, 0, 0},
+    // The housekeeping UID with the guest card's block copied under the right key
+    {"clone with a copied block", issued[3].uid, housekeepingKey, credentials[0], false, false, 0, 0},
+  };
+
+  doorReader = &reader;
+  doorAcl = &acl;
+  doorAuth = &auth;
+  PresenceTracker presence(doorLookup, doorEmit, CARD_ABSENT_THRESHOLD);
+
+  // Cards are held for a second and taken away; a clone is looked up on
+  // every poll while it is held, the rejected memo keeps that off the air
+  const int heldPolls = 1000 / CARD_READ_DELAY;
+  std::vector<uint64_t> genuineNs;
+  uint64_t nowUs = 1000000;
+  uint32_t seed = 7;
+  for (int tap = 0; tap < o.taps; tap++) {
+    seed = seed * 1103515245 + 12345;
+    Tapper& t = tappers[(seed >> 16) % tappers.size()];
+    t.taps++;
+
+    // A clone has the same UID, so it takes the real card's place
+    reader.clear();
+    reader.writeBlock(t.uid, CARD_AUTH_BLOCK, t.swiped ? factoryKey : t.key, t.block);
+    reader.placeCard(t.uid);
+
+    size_t firstCheck = doorCheckNs.size();
+    doorCheckIns = 0;
+    doorDenials = 0;
+    doorTapped = t.uid;
+    for (int poll = 0; poll < heldPolls + CARD_ABSENT_THRESHOLD; poll++) {
+      if (poll == 1 && t.swiped) reader.writeBlock(t.uid, CARD_AUTH_BLOCK, t.key, t.block);
+      if (poll == heldPolls) reader.clear();
+      CardUid uids[MAX_PRESENT_CARDS];
+      size_t count = reader.readCards(uids, MAX_PRESENT_CARDS);
+      doorNowMs = (uint32_t)(nowUs / 1000);
+      presence.update(uids, count, nowUs, EventTime{0, 0});
+      nowUs += CARD_READ_DELAY * 1000;
+    }
+    nowUs += 2000000;
+
+    // A missed read must not be reported as a denial (clones of other UIDs
+    // can leave denied summaries for the genuine ones, so only checked here)
+    if ((doorCheckIns > 0) != t.genuine || (t.swiped && doorDenials > 0)) t.wrong++;
+    if (t.genuine && !t.swiped && doorCheckNs.size() > firstCheck) genuineNs.push_back(doorCheckNs[firstCheck]);
+  }
+
+  printf("Door: %d taps of %d polls, %u credential reads; %u passed, %u refused after a read, "
+         "%u refused from memory, %u unanswered\n",
+         o.taps, heldPolls, reader.blockReads(), auth.verified(), auth.failed(), auth.refused(), auth.unread());
+  int wrong = 0;
+  for (const Tapper& t : tappers) {
+    printf("  %-28s %6d taps  %s\n", t.name, t.taps,
+           t.wrong > 0 ? "WRONG DECISIONS" : t.genuine ? "all admitted" : "all refused");
+    wrong += t.wrong;
+  }
+
+  printf("\nTime a genuine card adds before the door decides:\n");
+  printf("  CPU, lookup and credential MAC (host)  p50 %7.2f us  p99 %7.2f us\n",
+         percentileUs(genuineNs, 50), percentileUs(genuineNs, 99));
+  printf("  radio model, 4-byte UID                %10.0f us\n", readBlockUs(4, o.spiUs));
+  printf("  radio model, 7-byte UID                %10.0f us\n", readBlockUs(7, o.spiUs));
+  printf("  for scale: an empty poll               %10.0f us, one every %d ms\n",
+         frameUs(7 + 2) + RFID_RX_TIMEOUT_US + o.spiUs, CARD_READ_DELAY);
+  return wrong == 0 ? 0 : 1;
+}
+
+// ---- Signing ----
+
+EventPublisher* benchPublisher = nullptr;
+uint64_t        benchPublishes = 0;
+uint64_t        benchBytes = 0;
+
+void benchAck(uint16_t packetId) {
+  benchPublisher->onAck(packetId);
+}
+
+void benchPublished(const char*, const uint8_t*, size_t length, bool success) {
+  if (!success) return;
+  benchPublishes++;
+  benchBytes += length;
+}
+
+struct PublishCost {
+  double usPerEvent;
+  double bytesPerPublish;
+};
+
+/**
+ * Time record() for every event; with a journal, every PUBLISH_BATCH_MAX-th
+ * record() publishes the batch
+ */
+PublishCost benchPublish(int events, PayloadFormat format, bool journaled, HmacSha256* signer) {
+  DeviceContext ctx = {BUILDING_ID, FLOOR_NUMBER, ROOM_NUMBER};
+  SimLink link;
+  SimSocket socket(link);
+  MqttClient mqtt(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, SimSocket::send);
+  EventPublisher publisher(ctx, mqtt);
+  socket.attach(mqtt);
+  mqtt.onAck(benchAck);
+  benchPublisher = &publisher;
+  publisher.setPayloadFormat(format);
+  publisher.attachSigner(signer);
+  publisher.onPublished(benchPublished);
+
+  char path[] = "/tmp/auth_bench_journal_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd >= 0) close(fd);
+  unlink(path);
+  FileJournalStorage storage(path, 0x10000);
+  EventJournal journal(storage);
+  if (journaled && journal.begin()) publisher.attachJournal(&journal);
+
+  uint32_t nowMs = 1;
+  link.setUp(true);
+  mqtt.connect(nowMs);
+  socket.deliver(nowMs);
+  mqtt.loop(nowMs);
+  benchPublishes = 0;
+  benchBytes = 0;
+
+  JournalEntry entry = {0, EventType::CheckOut, Role::Guest, cardUid({0xB2, 0xF9, 0x7C, 0x00}),
+                        1735381800, 5400, 120, 0};
+  uint64_t ns = 0;
+  for (int i = 0; i < events; i++) {
+    Clock::time_point start = Clock::now();
+    publisher.record(entry, nowMs);
+    ns += nanosSince(start);
+    entry.timestamp++;
+    nowMs++;
+    socket.deliver(nowMs);
+    mqtt.loop(nowMs);
+  }
+  unlink(path);
+
+  return {(double)ns / events / 1000, benchPublishes ? (double)benchBytes / benchPublishes : 0};
+}
+
+void benchSigning(const Options& o) {
+  HmacSha256 signer;
+  signer.setHexKey(EVENT_SIGNING_KEY);
+
+  struct Case {
+    const char*   name;
+    PayloadFormat format;
+    bool          journaled;
+  } cases[] = {
+    {"JSON, direct", PayloadFormat::Json, false},
+    {"binary, direct", PayloadFormat::Binary, false},
+    {"JSON, journal batches", PayloadFormat::Json, true},
+    {"binary, journal batches", PayloadFormat::Binary, true},
+  };
+
+  printf("\nPublish path per event     unsigned      signed     added   bytes per publish\n");
+  for (const Case& c : cases) {
+    PublishCost plain = benchPublish(o.events, c.format, c.journaled, nullptr);
+    PublishCost sign = benchPublish(o.events, c.format, c.journaled, &signer);
+    printf("  %-24s %7.2f us  %7.2f us  %6.2f us   %4.0f -> %.0f\n", c.name, plain.usPerEvent,
+           sign.usPerEvent, sign.usPerEvent - plain.usPerEvent, plain.bytesPerPublish,
+           sign.bytesPerPublish);
+  }
+
+  // Raw MAC rate over a message the size of a JSON event and its topic
+  uint8_t message[220];
+  memset(message, 'x', sizeof(message));
+  uint8_t mac[HMAC_SHA256_SIZE];
+  const int rounds = 200000;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < rounds; i++) {
+    message[0] = (uint8_t)i;
+    signer.begin();
+    signer.update(message, sizeof(message));
+    signer.finish(mac);
+  }
+  double us = (double)nanosSince(start) / rounds / 1000;
+  printf("  HMAC-SHA256 of %zu bytes: %.2f us, %.0f per second (portable SHA-256)\n",
+         sizeof(message), us, 1e6 / us);
+}
+
+// ---- Key ----
+// HMAC-SHA256(READER_SIGNING_SECRET, "building/hotel"), as the backend does
+
+int printKey(const char* secret, const char* scope) {
+  HmacSha256 mac;
+  if (!mac.setKey((const uint8_t*)secret, strlen(secret))) {
+    fprintf(stderr, "The secret must be 1 to %d bytes\n", HMAC_KEY_MAX);
+    return 2;
+  }
+  uint8_t key[HMAC_SHA256_SIZE];
+  mac.begin();
+  mac.update(scope, strlen(scope));
+  mac.finish(key);
+  printf("#define EVENT_SIGNING_KEY \"");
+  for (uint8_t b : key) printf("%02x", b);
+  printf("\"\n");
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "key") == 0) {
+    if (argc != 4) {
+      usage();
+      return 2;
+    }
+    return printKey(argv[2], argv[3]);
+  }
+
+  Options o;
+  if (!parseOptions(argc, argv, o)) {
+    usage();
+    return 2;
+  }
+  int status = benchDoor(o);
+  benchSigning(o);
+  return status;
+}
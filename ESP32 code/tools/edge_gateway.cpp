@@ -0,0 +1,1245 @@
+/**
+ * @file edge_gateway.cpp
+ * @brief On-premises gateway: one hotel's readers, one connection to the cloud
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section edge_gateway_overview Overview
+ *
+ * Readers built with WEBSOCKET_TLS false and WEBSOCKET_HOST pointing at
+ * this machine open their /mqtt WebSocket on the LAN instead of holding
+ * a TLS session each to the backend. One epoll loop serves all of them.
+ * It speaks the part of MQTT 3.1.1 that the readers use, the same part
+ * that MqttClient implements.
+ *
+ * Events on campus/room/... are split into single events, including
+ * readers' batches; signed publishes stay whole so the backend can
+ * still verify them. Each event is checked against the recent sequence
+ * numbers of its room and appended to the GatewayLog. A reader gets its
+ * PUBACK only after the loop iteration's commit, so an acknowledged
+ * event is on disk. Every other publish, such as the card list sync
+ * request, is passed upstream as it is.
+ *
+ * An upstream thread reads the log and forwards it over a single MQTT
+ * session to the backend (wss:// or ws://). Events from all rooms travel
+ * together in envelopes on campus/gateway/{id}:
+ *
+ * @code
+ * D9 D9 F7          tag 55799, as in event payloads
+ * array(n)
+ *   array(2)
+ *     bytes         topic the reader used, with the event's own type
+ *     bytes         payload of one event, JSON or binary
+ * @endcode
+ *
+ * At most --window envelopes are unacknowledged at a time. The log
+ * cursor moves once the backend's PUBACK arrives; an envelope lost with
+ * the connection is sent again after the reconnect, and the backend
+ * drops the copies by sequence number.
+ *
+ * A wss:// upstream keeps the TLS session the backend hands out and offers
+ * it on every reconnect (see upstream_link.h), so a reconnect after an
+ * outage costs an abbreviated handshake rather than a full one.
+ *
+ * Card list updates from the backend reach the readers through the same
+ * session: every filter a reader subscribes to is subscribed upstream as
+ * well, and incoming messages are routed to matching readers.
+ *
+ * Backpressure: while more than --max-backlog-mb is waiting in the log,
+ * events are neither logged nor acknowledged. The readers keep them in
+ * their own journals and send them again after MQTT_RETRY_TIMEOUT.
+ *
+ * @section edge_gateway_bench Benchmark
+ *
+ * A second instance with --sink acknowledges and counts envelopes
+ * without logging or forwarding them. That measures the gateway itself,
+ * without the backend. fleet_loadgen --no-subscriber simulates the
+ * readers:
+ *
+ *   edge_gateway --listen 9090 --sink &
+ *   edge_gateway --listen 8080 --upstream ws://127.0.0.1:9090/mqtt --log /tmp/gw &
+ *   fleet_loadgen --port 8080 --rooms 5000 --rate 2000 --duration 60 --no-subscriber
+ *
+ * Every --stats seconds the gateway prints readers, events in and
+ * forwarded per second, the backlog, and its resident memory per reader
+ * above what it used idle.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "backoff.h"
+#include "event_encoder.h"
+#include "event_split.h"
+#include "gateway_log.h"
+#include "mqtt_client.h"
+#include "upstream_link.h"
+
+namespace {
+
+// ---- Options ----
+struct Options {
+  int         listenPort = 8080;
+  std::string path = "/mqtt";
+  std::string upstream = "ws://127.0.0.1:3000/mqtt";
+  std::string id;                       ///< Gateway id in the envelope topic; hostname if unset
+  std::string logDir = "gateway-log";
+  uint64_t    segmentBytes = 64ull << 20;
+  uint64_t    maxBacklog = 1024ull << 20;
+  size_t      envelopeBytes = 16384;
+  size_t      window = 8;               ///< Envelopes awaiting PUBACK
+  int         statsSec = 10;
+  bool        sink = false;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: edge_gateway [--listen PORT] [--path P] [--upstream ws[s]://HOST:PORT/PATH]\n"
+          "                    [--id NAME] [--log DIR] [--segment-mb N] [--max-backlog-mb N]\n"
+          "                    [--envelope-bytes N] [--window N] [--stats SEC] [--sink]\n");
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--sink") {
+      o.sink = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--listen") o.listenPort = atoi(value);
+    else if (arg == "--path") o.path = value;
+    else if (arg == "--upstream") o.upstream = value;
+    else if (arg == "--id") o.id = value;
+    else if (arg == "--log") o.logDir = value;
+    else if (arg == "--segment-mb") o.segmentBytes = strtoull(value, nullptr, 10) << 20;
+    else if (arg == "--max-backlog-mb") o.maxBacklog = strtoull(value, nullptr, 10) << 20;
+    else if (arg == "--envelope-bytes") o.envelopeBytes = (size_t)atoi(value);
+    else if (arg == "--window") o.window = (size_t)atoi(value);
+    else if (arg == "--stats") o.statsSec = atoi(value);
+    else {
+      usage();
+      return false;
+    }
+  }
+  // A sink takes the envelopes as reader publishes, which are capped at 64 KB
+  if (o.listenPort <= 0 || o.segmentBytes == 0 || o.envelopeBytes < 256 || o.envelopeBytes > 60000 ||
+      o.window == 0 || o.statsSec <= 0) {
+    usage();
+    return false;
+  }
+  if (o.id.empty()) {
+    char host[64] = "gateway";
+    gethostname(host, sizeof(host) - 1);
+    o.id = host;
+  }
+  return true;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+uint32_t nowMs() {
+  static const Clock::time_point start = Clock::now();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+std::atomic<bool> running(true);
+
+void onSignal(int) {
+  running = false;
+}
+
+// ---- MQTT and WebSocket framing ----
+const uint8_t MQTT_UNSUBSCRIBE = 0xA2;
+const uint8_t MQTT_UNSUBACK    = 0xB0;
+
+const size_t MAX_PACKET_SIZE = 64 * 1024;     ///< Readers never send more than a batch frame
+
+void putLength(std::string& out, size_t length) {
+  do {
+    uint8_t byte = length % 128;
+    length /= 128;
+    out += (char)(length > 0 ? byte | 0x80 : byte);
+  } while (length > 0);
+}
+
+void putString(std::string& out, const char* s, size_t length) {
+  out += (char)(length >> 8);
+  out += (char)length;
+  out.append(s, length);
+}
+
+/**
+ * @brief Split the next MQTT packet off a byte stream
+ * @return 1 packet found, 0 need more bytes, -1 malformed
+ */
+int nextPacket(const std::string& in, size_t pos, size_t& headerSize, size_t& bodyLength) {
+  size_t length = 0;
+  size_t multiplier = 1;
+  for (size_t i = 1; i <= 4; i++) {
+    if (pos + i >= in.size()) return 0;
+    uint8_t byte = (uint8_t)in[pos + i];
+    length += (byte & 0x7F) * multiplier;
+    if ((byte & 0x80) == 0) {
+      headerSize = i + 1;
+      bodyLength = length;
+      if (length > MAX_PACKET_SIZE) return -1;
+      return pos + headerSize + length <= in.size() ? 1 : 0;
+    }
+    multiplier *= 128;
+  }
+  return -1;
+}
+
+std::string publishPacket(const std::string& topic, const uint8_t* payload, size_t length,
+                          uint8_t qos, uint16_t packetId) {
+  std::string packet;
+  packet.reserve(8 + topic.size() + length);
+  packet += (char)(MQTT_PUBLISH | (qos << 1));
+  putLength(packet, 2 + topic.size() + (qos > 0 ? 2 : 0) + length);
+  putString(packet, topic.data(), topic.size());
+  if (qos > 0) {
+    packet += (char)(packetId >> 8);
+    packet += (char)packetId;
+  }
+  packet.append((const char*)payload, length);
+  return packet;
+}
+
+/**
+ * @brief Server-side frame header (servers never mask)
+ */
+void putFrameHeader(std::string& out, uint8_t opcode, size_t length) {
+  out += (char)(0x80 | opcode);
+  if (length < 126) {
+    out += (char)length;
+  } else if (length < 65536) {
+    out += (char)126;
+    out += (char)(length >> 8);
+    out += (char)length;
+  } else {
+    out += (char)127;
+    for (int i = 7; i >= 0; i--) out += (char)((uint64_t)length >> (8 * i));
+  }
+}
+
+bool topicMatches(const std::string& filter, const std::string& topic) {
+  size_t f = 0;
+  size_t t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') return true;
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') t++;
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t]) {
+      // "a/#" also matches "a"
+      return t == topic.size() && filter.compare(f, std::string::npos, "/#") == 0;
+    }
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+// ---- CBOR envelopes ----
+void putCborHead(std::string& out, uint8_t major, uint64_t arg) {
+  major <<= 5;
+  if (arg < 24) {
+    out += (char)(major | arg);
+  } else if (arg < 0x100) {
+    out += (char)(major | 24);
+    out += (char)arg;
+  } else if (arg < 0x10000) {
+    out += (char)(major | 25);
+    out += (char)(arg >> 8);
+    out += (char)arg;
+  } else {
+    out += (char)(major | 26);
+    for (int i = 3; i >= 0; i--) out += (char)(arg >> (8 * i));
+  }
+}
+
+// Sequence numbers recently logged per room; mirrors isDuplicateEvent() in the backend
+const size_t RECENT_SEQS = 64;
+
+struct RecentSeqs {
+  uint32_t seqs[RECENT_SEQS] = {};
+  uint8_t  next = 0;
+
+  bool seen(uint32_t seq) const {
+    for (uint32_t s : seqs) {
+      if (s == seq) return true;
+    }
+    return false;
+  }
+
+  void add(uint32_t seq) {
+    seqs[next] = seq;
+    next = (uint8_t)((next + 1) % RECENT_SEQS);
+  }
+};
+
+// ---- Statistics ----
+struct Stats {
+  std::atomic<uint64_t> eventsIn{0};
+  std::atomic<uint64_t> duplicates{0};
+  std::atomic<uint64_t> held{0};          ///< Publishes left unacknowledged under backpressure
+  std::atomic<uint64_t> forwarded{0};
+  std::atomic<uint64_t> envelopes{0};
+  std::atomic<bool>     upstreamUp{false};
+};
+
+Stats stats;
+
+size_t residentBytes() {
+  long pages = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f == nullptr) return 0;
+  long size = 0;
+  if (fscanf(f, "%ld %ld", &size, &pages) != 2) pages = 0;
+  fclose(f);
+  return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// ---- Upstream session ----
+const uint32_t UPSTREAM_KEEPALIVE_MS = 30000;
+const uint32_t UPSTREAM_ACK_TIMEOUT_MS = 30000;
+const size_t   ENVELOPE_MAX_EVENTS = 1024;
+
+struct Message {
+  std::string          topic;
+  std::vector<uint8_t> payload;
+};
+
+class Upstream {
+public:
+  Upstream(const Options& o, GatewayLog& log)
+    : o_(o), log_(log), topic_("campus/gateway/" + o.id),
+      wakeFd_(eventfd(0, EFD_NONBLOCK)), downFd_(eventfd(0, EFD_NONBLOCK)),
+      nextPacketId_(0) {}
+
+  ~Upstream() {
+    ::close(wakeFd_);
+    ::close(downFd_);
+  }
+
+  bool start() {
+    if (!link_.parse(o_.upstream)) {
+      fprintf(stderr, "Bad upstream URL %s\n", o_.upstream.c_str());
+      return false;
+    }
+    thread_ = std::thread(&Upstream::run, this);
+    return true;
+  }
+
+  void join() {
+    wake();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  // ---- Called from the event loop ----
+  void wake() {
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) return;
+  }
+
+  void subscribe(const std::string& filter) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (filters_.insert(filter).second) newFilters_.push_back(filter);
+  }
+
+  void forward(const std::string& topic, const uint8_t* payload, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Message m{topic, std::vector<uint8_t>(payload, payload + length)};
+    // The backend answers a card list sync on connect only, so a reconnect repeats the last one
+    if (topic.size() > 5 && topic.compare(topic.size() - 5, 5, "/sync") == 0) syncs_[topic] = m.payload;
+    if (stats.upstreamUp) live_.push_back(std::move(m));
+  }
+
+  int downstreamFd() const { return downFd_; }
+
+  void takeDownstream(std::vector<Message>& out) {
+    uint64_t count;
+    if (read(downFd_, &count, sizeof(count)) < 0) {
+      // Nothing signalled; the queue is checked anyway
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.swap(down_);
+    down_.clear();
+  }
+
+private:
+  struct Inflight {
+    uint16_t    packetId;
+    LogPosition end;
+    size_t      events;
+    uint32_t    sentMs;
+    bool        acked;
+  };
+
+  void run() {
+    Backoff backoff(1000, 30000, (uint32_t)getpid());
+    while (running) {
+      if (link_.open()) {
+        if (link_.resumed()) fprintf(stderr, "Upstream connected, TLS session resumed\n");
+        stats.upstreamUp = true;
+        session(backoff);
+        stats.upstreamUp = false;
+        link_.close();
+      }
+      uint32_t delay = backoff.next();
+      fprintf(stderr, "Upstream unavailable, retrying in %u ms\n", delay);
+      // Commits keep signalling wakeFd_; only shutdown ends the wait early
+      uint32_t start = nowMs();
+      while (running && nowMs() - start < delay) {
+        pollfd p = {wakeFd_, POLLIN, 0};
+        uint64_t count;
+        if (poll(&p, 1, 200) > 0 && read(wakeFd_, &count, sizeof(count)) < 0) continue;
+      }
+    }
+  }
+
+  bool sendPacket(const std::string& packet) {
+    lastSendMs_ = nowMs();
+    return link_.send(packet);
+  }
+
+  bool connectSession() {
+    std::string packet;
+    size_t idLength = std::min<size_t>(o_.id.size(), 64);
+    packet += (char)MQTT_CONNECT;
+    putLength(packet, 10 + 2 + idLength);
+    putString(packet, "MQTT", 4);
+    packet += (char)4;                                    // Protocol level 3.1.1
+    packet += (char)0x02;                                 // Clean session
+    packet += (char)((UPSTREAM_KEEPALIVE_MS / 1000) >> 8);
+    packet += (char)(UPSTREAM_KEEPALIVE_MS / 1000);
+    putString(packet, o_.id.data(), idLength);
+    if (!sendPacket(packet)) return false;
+
+    // Wait for CONNACK
+    uint32_t start = nowMs();
+    while (running && nowMs() - start < 10000) {
+      pollfd p = {link_.fd(), POLLIN, 0};
+      if (poll(&p, 1, 200) <= 0) continue;
+      if (!link_.receive(rx_)) return false;
+      size_t header, body;
+      if (nextPacket(rx_, 0, header, body) == 1) {
+        bool accepted = (uint8_t)rx_[0] == MQTT_CONNACK && body >= 2 && rx_[header + 1] == 0;
+        rx_.erase(0, header + body);
+        return accepted;
+      }
+    }
+    return false;
+  }
+
+  bool sendSubscriptions(const std::vector<std::string>& filters) {
+    if (filters.empty()) return true;
+    std::string packet;
+    std::string body;
+    uint16_t id = packetId();
+    body += (char)(id >> 8);
+    body += (char)id;
+    for (const std::string& f : filters) {
+      putString(body, f.data(), f.size());
+      body += (char)0;
+    }
+    packet += (char)MQTT_SUBSCRIBE;
+    putLength(packet, body.size());
+    packet += body;
+    return sendPacket(packet);
+  }
+
+  uint16_t packetId() {
+    if (++nextPacketId_ == 0) nextPacketId_ = 1;
+    return nextPacketId_;
+  }
+
+  // Fill the window with envelopes from the log
+  bool sendEnvelopes() {
+    while (inflight_.size() < o_.window) {
+      records_.clear();
+      if (log_.read(readPos_, records_, o_.envelopeBytes, ENVELOPE_MAX_EVENTS) == 0) return true;
+
+      std::string payload(std::begin(CBOR_SELF_DESCRIBED), std::end(CBOR_SELF_DESCRIBED));
+      putCborHead(payload, 4, records_.size());
+      for (const LogRecord& r : records_) {
+        putCborHead(payload, 4, 2);
+        putCborHead(payload, 2, r.topic.size());
+        payload += r.topic;
+        putCborHead(payload, 2, r.payload.size());
+        payload.append((const char*)r.payload.data(), r.payload.size());
+      }
+
+      uint16_t id = packetId();
+      inflight_.push_back({id, records_.back().end, records_.size(), nowMs(), false});
+      if (!sendPacket(publishPacket(topic_, (const uint8_t*)payload.data(), payload.size(), 1, id))) return false;
+      stats.envelopes++;
+    }
+    return true;
+  }
+
+  void onAck(uint16_t packetId) {
+    for (Inflight& i : inflight_) {
+      if (i.packetId == packetId) i.acked = true;
+    }
+    // The cursor only moves over a contiguous acknowledged prefix
+    bool moved = false;
+    LogPosition end = {0, 0};
+    while (!inflight_.empty() && inflight_.front().acked) {
+      end = inflight_.front().end;
+      stats.forwarded += inflight_.front().events;
+      inflight_.pop_front();
+      moved = true;
+    }
+    if (moved) log_.acknowledge(end);
+  }
+
+  bool handlePackets() {
+    size_t pos = 0;
+    for (;;) {
+      size_t header, body;
+      int found = nextPacket(rx_, pos, header, body);
+      if (found < 0) return false;
+      if (found == 0) break;
+
+      const uint8_t* p = (const uint8_t*)rx_.data() + pos;
+      uint8_t type = p[0] & 0xF0;
+      if (type == MQTT_PUBACK && body >= 2) {
+        onAck((uint16_t)(p[header] << 8 | p[header + 1]));
+      } else if (type == MQTT_PINGRESP) {
+        pingSentMs_ = 0;
+      } else if (type == MQTT_PUBLISH && body >= 2) {
+        uint8_t qos = (p[0] >> 1) & 3;
+        size_t topicLength = (size_t)p[header] << 8 | p[header + 1];
+        size_t payloadStart = header + 2 + topicLength + (qos > 0 ? 2 : 0);
+        if (payloadStart <= header + body) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          down_.push_back({std::string((const char*)p + header + 2, topicLength),
+                           std::vector<uint8_t>(p + payloadStart, p + header + body)});
+        }
+        uint64_t one = 1;
+        if (write(downFd_, &one, sizeof(one)) < 0) return false;
+      }
+      pos += header + body;
+    }
+    rx_.erase(0, pos);
+    return true;
+  }
+
+  void session(Backoff& backoff) {
+    rx_.clear();
+    inflight_.clear();
+    pingSentMs_ = 0;
+    readPos_ = log_.cursor();
+    if (!connectSession()) {
+      fprintf(stderr, "Upstream MQTT session refused\n");
+      return;
+    }
+    backoff.reset();
+    fprintf(stderr, "Upstream connected to %s\n", o_.upstream.c_str());
+
+    std::vector<std::string> filters;
+    std::vector<Message> replay;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      filters.assign(filters_.begin(), filters_.end());
+      newFilters_.clear();
+      for (auto& s : syncs_) replay.push_back({s.first, s.second});
+      live_.clear();
+    }
+    if (!sendSubscriptions(filters)) return;
+    for (const Message& m : replay) {
+      if (!sendPacket(publishPacket(m.topic, m.payload.data(), m.payload.size(), 0, 0))) return;
+    }
+
+    while (running) {
+      if (!sendEnvelopes()) return;
+
+      pollfd fds[2] = {{link_.fd(), POLLIN, 0}, {wakeFd_, POLLIN, 0}};
+      poll(fds, 2, 1000);
+      uint32_t now = nowMs();
+
+      if (fds[1].revents & POLLIN) {
+        uint64_t count;
+        if (read(wakeFd_, &count, sizeof(count)) < 0) {
+          // Spurious wakeup
+        }
+        std::vector<Message> live;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          filters.swap(newFilters_);
+          newFilters_.clear();
+          live.swap(live_);
+        }
+        if (!sendSubscriptions(filters)) return;
+        for (const Message& m : live) {
+          if (!sendPacket(publishPacket(m.topic, m.payload.data(), m.payload.size(), 0, 0))) return;
+        }
+      }
+
+      if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && (!link_.receive(rx_) || !handlePackets())) {
+        fprintf(stderr, "Upstream connection lost\n");
+        return;
+      }
+
+      if (!inflight_.empty() && now - inflight_.front().sentMs > UPSTREAM_ACK_TIMEOUT_MS) {
+        fprintf(stderr, "Upstream stopped acknowledging, reconnecting\n");
+        return;
+      }
+      if (pingSentMs_ != 0 && now - pingSentMs_ > UPSTREAM_KEEPALIVE_MS / 2) {
+        fprintf(stderr, "Upstream stopped answering pings, reconnecting\n");
+        return;
+      }
+      if (pingSentMs_ == 0 && now - lastSendMs_ > UPSTREAM_KEEPALIVE_MS) {
+        std::string ping(1, (char)MQTT_PINGREQ);
+        ping += (char)0;
+        if (!sendPacket(ping)) return;
+        pingSentMs_ = now;
+      }
+    }
+  }
+
+  const Options& o_;
+  GatewayLog&    log_;
+  std::string    topic_;
+  UpstreamLink   link_;
+  std::thread    thread_;
+  int            wakeFd_;
+  int            downFd_;
+
+  // Upstream thread only
+  std::string            rx_;
+  std::deque<Inflight>   inflight_;
+  std::vector<LogRecord> records_;
+  LogPosition            readPos_ = {0, 0};
+  uint16_t               nextPacketId_;
+  uint32_t               lastSendMs_ = 0;
+  uint32_t               pingSentMs_ = 0;
+
+  // Shared with the event loop, under mutex_
+  std::mutex                                        mutex_;
+  std::set<std::string>                             filters_;
+  std::vector<std::string>                          newFilters_;
+  std::vector<Message>                              live_;
+  std::unordered_map<std::string, std::vector<uint8_t>> syncs_;
+  std::vector<Message>                              down_;
+};
+
+// ---- Reader connections ----
+const size_t   READER_TX_LIMIT = 256 * 1024;   ///< A reader this far behind is dropped
+const uint32_t HANDSHAKE_TIMEOUT_MS = 10000;
+
+struct Reader {
+  int      fd;
+  size_t   index;                 ///< Position in Gateway::readers_
+  bool     open = false;          ///< WebSocket upgrade done
+  bool     closing = false;
+  bool     wantWrite = false;
+  uint32_t lastSeenMs;
+  uint32_t keepAliveMs = 0;
+  std::string rx;                 ///< HTTP request, then WebSocket frames
+  std::string mqtt;               ///< Reassembled MQTT stream
+  std::string tx;
+  std::vector<std::string> filters;
+  std::vector<uint16_t>    acks;  ///< PUBACKs waiting for the log commit
+};
+
+class Gateway {
+public:
+  Gateway(const Options& o, GatewayLog* log, Upstream* upstream)
+    : o_(o), log_(log), upstream_(upstream), epoll_(epoll_create1(0)), listen_(-1) {}
+
+  bool listen() {
+    listen_ = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_ < 0) return false;
+    int one = 1;
+    int zero = 0;
+    setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(listen_, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons((uint16_t)o_.listenPort);
+    if (bind(listen_, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listen_, 1024) != 0) {
+      fprintf(stderr, "Cannot listen on port %d: %s\n", o_.listenPort, strerror(errno));
+      return false;
+    }
+    watch(listen_, &listen_, EPOLLIN);
+    if (upstream_ != nullptr) watch(upstream_->downstreamFd(), upstream_, EPOLLIN);
+    return true;
+  }
+
+  void run() {
+    std::vector<epoll_event> events(1024);
+    uint32_t lastSweep = nowMs();
+    uint32_t lastStats = lastSweep;
+    uint64_t lastIn = 0;
+    uint64_t lastForwarded = 0;
+    size_t idleRss = residentBytes();
+
+    while (running) {
+      int n = epoll_wait(epoll_, events.data(), (int)events.size(), 200);
+      for (int i = 0; i < n; i++) {
+        void* tag = events[i].data.ptr;
+        if (tag == &listen_) {
+          accept();
+        } else if (tag == upstream_) {
+          routeDownstream();
+        } else {
+          Reader* r = (Reader*)tag;
+          if (events[i].events & EPOLLOUT) flush(*r);
+          if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) receive(*r);
+        }
+      }
+
+      // Group commit: one flush for everything this iteration logged
+      commit();
+      reap();
+
+      uint32_t now = nowMs();
+      if (now - lastSweep >= 1000) {
+        sweep(now);
+        lastSweep = now;
+      }
+      if (now - lastStats >= (uint32_t)o_.statsSec * 1000) {
+        double seconds = (now - lastStats) / 1000.0;
+        uint64_t in = stats.eventsIn;
+        uint64_t forwarded = stats.forwarded;
+        size_t rss = residentBytes();
+        printf("[gateway] readers %zu, events in %.1f/s (%llu duplicates, %llu held), "
+               "forwarded %.1f/s in %llu envelopes, backlog %.1f KB, upstream %s, "
+               "RSS %.1f MB (%.1f KB/reader over idle)\n",
+               readers_.size(), (in - lastIn) / seconds,
+               (unsigned long long)stats.duplicates, (unsigned long long)stats.held,
+               (forwarded - lastForwarded) / seconds, (unsigned long long)stats.envelopes,
+               log_ ? log_->backlogBytes() / 1024.0 : 0.0,
+               upstream_ == nullptr ? "none" : stats.upstreamUp ? "up" : "down",
+               rss / 1048576.0,
+               readers_.empty() || rss < idleRss ? 0.0 : (rss - idleRss) / 1024.0 / readers_.size());
+        fflush(stdout);
+        lastStats = now;
+        lastIn = in;
+        lastForwarded = forwarded;
+      }
+    }
+
+    commit();
+  }
+
+private:
+  void watch(int fd, void* tag, uint32_t events) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.ptr = tag;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  void accept() {
+    for (;;) {
+      int fd = accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK);
+      if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          fprintf(stderr, "accept: %s\n", strerror(errno));
+        }
+        return;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      std::unique_ptr<Reader> r(new Reader());
+      r->fd = fd;
+      r->index = readers_.size();
+      r->lastSeenMs = nowMs();
+      watch(fd, r.get(), EPOLLIN);
+      readers_.push_back(std::move(r));
+    }
+  }
+
+  void close(Reader& r) {
+    if (r.closing) return;
+    r.closing = true;
+    closed_.push_back(&r);
+  }
+
+  // Free readers closed during this iteration, after nothing refers to them
+  void reap() {
+    if (closed_.empty()) return;
+    awaiting_.erase(std::remove_if(awaiting_.begin(), awaiting_.end(),
+                                   [](Reader* r) { return r->closing; }),
+                    awaiting_.end());
+    for (Reader* r : closed_) {
+      epoll_ctl(epoll_, EPOLL_CTL_DEL, r->fd, nullptr);
+      ::close(r->fd);
+      size_t index = r->index;
+      std::swap(readers_[index], readers_.back());
+      readers_[index]->index = index;
+      readers_.pop_back();
+    }
+    closed_.clear();
+  }
+
+  void send(Reader& r, const char* data, size_t length) {
+    if (r.closing) return;
+    if (r.tx.empty()) {
+      ssize_t n = ::send(r.fd, data, length, MSG_NOSIGNAL);
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        close(r);
+        return;
+      }
+      size_t sent = n < 0 ? 0 : (size_t)n;
+      data += sent;
+      length -= sent;
+      if (length == 0) return;
+    }
+    if (r.tx.size() + length > READER_TX_LIMIT) {
+      fprintf(stderr, "Reader on fd %d is not reading, dropping it\n", r.fd);
+      close(r);
+      return;
+    }
+    r.tx.append(data, length);
+    if (!r.wantWrite) {
+      r.wantWrite = true;
+      epoll_event ev = {};
+      ev.events = EPOLLIN | EPOLLOUT;
+      ev.data.ptr = &r;
+      epoll_ctl(epoll_, EPOLL_CTL_MOD, r.fd, &ev);
+    }
+  }
+
+  void sendMqtt(Reader& r, const std::string& packets) {
+    std::string frame;
+    frame.reserve(packets.size() + 10);
+    putFrameHeader(frame, WS_BINARY, packets.size());
+    frame += packets;
+    send(r, frame.data(), frame.size());
+  }
+
+  void flush(Reader& r) {
+    while (!r.tx.empty()) {
+      ssize_t n = ::send(r.fd, r.tx.data(), r.tx.size(), MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        close(r);
+        return;
+      }
+      r.tx.erase(0, (size_t)n);
+    }
+    std::string().swap(r.tx);
+    r.wantWrite = false;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &r;
+    epoll_ctl(epoll_, EPOLL_CTL_MOD, r.fd, &ev);
+  }
+
+  void receive(Reader& r) {
+    if (r.closing) return;
+    char buf[16384];
+    ssize_t n = recv(r.fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+      close(r);
+      return;
+    }
+    r.lastSeenMs = nowMs();
+    r.rx.append(buf, (size_t)n);
+
+    if (!r.open && !handshake(r)) return;
+    if (r.open && !frames(r)) {
+      close(r);
+      return;
+    }
+    // Keep idle readers small
+    if (r.rx.empty() && r.rx.capacity() > 4096) std::string().swap(r.rx);
+    if (r.mqtt.empty() && r.mqtt.capacity() > 4096) std::string().swap(r.mqtt);
+  }
+
+  static std::string header(const std::string& request, const char* name) {
+    size_t nameLength = strlen(name);
+    for (size_t line = request.find("\r\n"); line != std::string::npos; line = request.find("\r\n", line + 2)) {
+      size_t start = line + 2;
+      if (strncasecmp(request.c_str() + start, name, nameLength) != 0 || request[start + nameLength] != ':') continue;
+      size_t value = request.find_first_not_of(' ', start + nameLength + 1);
+      size_t end = request.find("\r\n", start);
+      return value == std::string::npos || value > end ? "" : request.substr(value, end - value);
+    }
+    return "";
+  }
+
+  bool handshake(Reader& r) {
+    size_t end = r.rx.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      if (r.rx.size() > 8192) close(r);
+      return false;
+    }
+    std::string request = r.rx.substr(0, end + 2);
+    r.rx.erase(0, end + 4);
+
+    std::string key = header(request, "Sec-WebSocket-Key");
+    bool pathOk = request.compare(0, 4 + o_.path.size() + 1, "GET " + o_.path + " ") == 0;
+    if (!pathOk || key.empty()) {
+      static const char reject[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+      send(r, reject, sizeof(reject) - 1);
+      close(r);
+      return false;
+    }
+
+    // Sec-WebSocket-Accept = base64(SHA-1(key + GUID))
+    std::string accept = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned digestLength = 0;
+    EVP_Digest(accept.data(), accept.size(), digest, &digestLength, EVP_sha1(), nullptr);
+    char encoded[32];
+    EVP_EncodeBlock((unsigned char*)encoded, digest, (int)digestLength);
+
+    std::string response = std::string("HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: ") + encoded + "\r\n";
+    if (header(request, "Sec-WebSocket-Protocol").find("mqtt") != std::string::npos) {
+      response += "Sec-WebSocket-Protocol: mqtt\r\n";
+    }
+    response += "\r\n";
+    send(r, response.data(), response.size());
+    r.open = true;
+    return true;
+  }
+
+  // Unmask client frames into the MQTT stream, then handle whole packets
+  bool frames(Reader& r) {
+    size_t offset = 0;
+    for (;;) {
+      size_t avail = r.rx.size() - offset;
+      if (avail < 2) break;
+      uint8_t* p = (uint8_t*)&r.rx[offset];
+      uint8_t opcode = p[0] & 0x0F;
+      if ((p[1] & 0x80) == 0) return false;            // Clients must mask
+      uint64_t length = p[1] & 0x7F;
+      size_t h = 2;
+      if (length == 126) {
+        if (avail < 4) break;
+        length = (uint64_t)p[2] << 8 | p[3];
+        h = 4;
+      } else if (length == 127) {
+        if (avail < 10) break;
+        length = 0;
+        for (int i = 0; i < 8; i++) length = length << 8 | p[2 + i];
+        h = 10;
+      }
+      if (length > MAX_PACKET_SIZE) return false;
+      if (avail < h + 4 + length) break;
+
+      const uint8_t* key = p + h;
+      uint8_t* data = p + h + 4;
+      for (size_t i = 0; i < length; i++) data[i] ^= key[i & 3];
+
+      if (opcode == WS_BINARY || opcode == WS_CONTINUATION || opcode == WS_TEXT) {
+        r.mqtt.append((const char*)data, (size_t)length);
+      } else if (opcode == WS_PING) {
+        std::string pong;
+        putFrameHeader(pong, WS_PONG, (size_t)length);
+        pong.append((const char*)data, (size_t)length);
+        send(r, pong.data(), pong.size());
+      } else if (opcode == WS_CLOSE) {
+        return false;
+      }
+      offset += h + 4 + (size_t)length;
+    }
+    r.rx.erase(0, offset);
+    return packets(r);
+  }
+
+  bool packets(Reader& r) {
+    std::string replies;
+    size_t pos = 0;
+    for (;;) {
+      size_t header, body;
+      int found = nextPacket(r.mqtt, pos, header, body);
+      if (found < 0) return false;
+      if (found == 0) break;
+
+      const uint8_t* p = (const uint8_t*)r.mqtt.data() + pos + header;
+      uint8_t first = (uint8_t)r.mqtt[pos];
+      switch (first & 0xF0) {
+        case MQTT_CONNECT: {
+          // Protocol name (6 bytes), level, flags, keepalive
+          if (body < 10) return false;
+          r.keepAliveMs = ((uint32_t)p[8] << 8 | p[9]) * 1000;
+          replies.append("\x20\x02\x00\x00", 4);
+          break;
+        }
+        case MQTT_PUBLISH:
+          if (!publish(r, first, p, body, replies)) return false;
+          break;
+        case MQTT_SUBSCRIBE & 0xF0:
+          if (!subscribe(r, p, body, replies)) return false;
+          break;
+        case MQTT_UNSUBSCRIBE & 0xF0: {
+          if (body < 2) return false;
+          for (size_t i = 2; i + 2 <= body;) {
+            size_t length = (size_t)p[i] << 8 | p[i + 1];
+            std::string filter((const char*)p + i + 2, std::min(length, body - i - 2));
+            r.filters.erase(std::remove(r.filters.begin(), r.filters.end(), filter), r.filters.end());
+            i += 2 + length;
+          }
+          replies += (char)MQTT_UNSUBACK;
+          replies += (char)2;
+          replies.append((const char*)p, 2);
+          break;
+        }
+        case MQTT_PINGREQ:
+          replies.append("\xD0\x00", 2);
+          break;
+        case MQTT_PUBACK:
+          break;
+        case MQTT_DISCONNECT:
+        default:
+          return false;
+      }
+      pos += header + body;
+    }
+    r.mqtt.erase(0, pos);
+    if (!replies.empty()) sendMqtt(r, replies);
+    return true;
+  }
+
+  bool subscribe(Reader& r, const uint8_t* p, size_t body, std::string& replies) {
+    if (body < 2) return false;
+    std::string granted;
+    for (size_t i = 2; i + 2 <= body;) {
+      size_t length = (size_t)p[i] << 8 | p[i + 1];
+      if (i + 2 + length + 1 > body) return false;
+      std::string filter((const char*)p + i + 2, length);
+      if (std::find(r.filters.begin(), r.filters.end(), filter) == r.filters.end()) r.filters.push_back(filter);
+      if (upstream_ != nullptr) upstream_->subscribe(filter);
+      granted += (char)0;
+      i += 2 + length + 1;
+    }
+    if (upstream_ != nullptr) upstream_->wake();
+    replies += (char)MQTT_SUBACK;
+    putLength(replies, 2 + granted.size());
+    replies.append((const char*)p, 2);
+    replies += granted;
+    return true;
+  }
+
+  bool publish(Reader& r, uint8_t first, const uint8_t* p, size_t body, std::string& replies) {
+    uint8_t qos = (first >> 1) & 3;
+    if (body < 2 || qos > 1) return false;
+    size_t topicLength = (size_t)p[0] << 8 | p[1];
+    size_t payloadStart = 2 + topicLength + (qos > 0 ? 2 : 0);
+    if (payloadStart > body) return false;
+    std::string topic((const char*)p + 2, topicLength);
+    uint16_t packetId = qos > 0 ? (uint16_t)(p[2 + topicLength] << 8 | p[3 + topicLength]) : 0;
+    const uint8_t* payload = p + payloadStart;
+    size_t length = body - payloadStart;
+
+    bool deferAck = false;
+    if (o_.sink) {
+      stats.eventsIn += countEnvelope(payload, length);
+    } else if (topic.compare(0, 12, "campus/room/") == 0 && std::count(topic.begin(), topic.end(), '/') == 5) {
+      if (log_->backlogBytes() > o_.maxBacklog) {
+        // No PUBACK: the reader keeps the event and sends it again
+        stats.held++;
+        return true;
+      }
+      logEvents(topic, payload, length);
+      deferAck = true;
+    } else if (upstream_ != nullptr) {
+      upstream_->forward(topic, payload, length);
+      upstream_->wake();
+    }
+
+    if (qos == 0) return true;
+    if (deferAck) {
+      if (r.acks.empty()) awaiting_.push_back(&r);
+      r.acks.push_back(packetId);
+    } else {
+      replies += (char)MQTT_PUBACK;
+      replies += (char)2;
+      replies += (char)(packetId >> 8);
+      replies += (char)packetId;
+    }
+    return true;
+  }
+
+  // Events in an envelope, when this instance is the benchmark's upstream
+  static size_t countEnvelope(const uint8_t* payload, size_t length) {
+    size_t pos = sizeof(CBOR_SELF_DESCRIBED);
+    uint8_t major;
+    uint64_t count;
+    if (length > pos && memcmp(payload, CBOR_SELF_DESCRIBED, pos) == 0 &&
+        cborHead(payload, length, pos, major, count) && major == 4) {
+      return (size_t)count;
+    }
+    return 1;
+  }
+
+  void logEvents(const std::string& topic, const uint8_t* payload, size_t length) {
+    // campus/room/{building}/{hotel}/{room}/{type}
+    size_t typeAt = topic.rfind('/');
+    std::string room = topic.substr(12, typeAt - 12);
+    const char* type = topic.c_str() + typeAt + 1;
+
+    if (!splitEvents(type, payload, length, split_)) {
+      log_->append(topic.data(), topic.size(), payload, length);
+      stats.eventsIn++;
+      return;
+    }
+
+    RecentSeqs& recent = recent_[room];
+    std::string eventTopic;
+    std::string tagged;
+    for (const SplitEvent& e : split_) {
+      stats.eventsIn++;
+      if (e.seq != 0 && recent.seen(e.seq)) {
+        stats.duplicates++;
+        continue;
+      }
+      if (e.seq != 0) recent.add(e.seq);
+
+      eventTopic.assign(topic, 0, typeAt + 1);
+      eventTopic += e.type;
+      const uint8_t* data = e.data;
+      size_t dataLength = e.length;
+      if (e.tag) {
+        tagged.assign((const char*)CBOR_SELF_DESCRIBED, sizeof(CBOR_SELF_DESCRIBED));
+        tagged.append((const char*)e.data, e.length);
+        data = (const uint8_t*)tagged.data();
+        dataLength = tagged.size();
+      }
+      log_->append(eventTopic.data(), eventTopic.size(), data, dataLength);
+    }
+  }
+
+  void commit() {
+    if (log_ != nullptr && log_->pending()) {
+      // On failure the acks stay pending and the next iteration tries again
+      if (!log_->commit()) return;
+      if (upstream_ != nullptr) upstream_->wake();
+    }
+
+    std::string replies;
+    for (Reader* r : awaiting_) {
+      replies.clear();
+      for (uint16_t id : r->acks) {
+        replies += (char)MQTT_PUBACK;
+        replies += (char)2;
+        replies += (char)(id >> 8);
+        replies += (char)id;
+      }
+      r->acks.clear();
+      sendMqtt(*r, replies);
+    }
+    awaiting_.clear();
+  }
+
+  void routeDownstream() {
+    std::vector<Message> messages;
+    upstream_->takeDownstream(messages);
+    for (const Message& m : messages) {
+      std::string packet = publishPacket(m.topic, m.payload.data(), m.payload.size(), 0, 0);
+      for (auto& r : readers_) {
+        for (const std::string& filter : r->filters) {
+          if (topicMatches(filter, m.topic)) {
+            sendMqtt(*r, packet);
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // Drop readers that stopped talking: no upgrade, or 1.5 keepalives of silence
+  void sweep(uint32_t now) {
+    for (auto& r : readers_) {
+      uint32_t limit = !r->open ? HANDSHAKE_TIMEOUT_MS
+                     : r->keepAliveMs > 0 ? r->keepAliveMs + r->keepAliveMs / 2 : 0;
+      if (limit > 0 && now - r->lastSeenMs > limit) close(*r);
+    }
+    reap();
+  }
+
+  const Options& o_;
+  GatewayLog*    log_;
+  Upstream*      upstream_;
+  int            epoll_;
+  int            listen_;
+
+  std::vector<std::unique_ptr<Reader>>       readers_;
+  std::vector<Reader*>                       closed_;
+  std::vector<Reader*>                       awaiting_;   ///< Readers with acks pending
+  std::unordered_map<std::string, RecentSeqs> recent_;    ///< By "building/hotel/room"
+  std::vector<SplitEvent>                    split_;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseOptions(argc, argv, o)) return 2;
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  std::unique_ptr<GatewayLog> log;
+  std::unique_ptr<Upstream> upstream;
+  if (!o.sink) {
+    log.reset(new GatewayLog(o.logDir, o.segmentBytes));
+    if (!log->open()) return 1;
+    upstream.reset(new Upstream(o, *log));
+    if (!upstream->start()) return 1;
+    fprintf(stderr, "Backlog of %llu bytes from the last run\n", (unsigned long long)log->backlogBytes());
+  }
+
+  Gateway gateway(o, log.get(), upstream.get());
+  if (!gateway.listen()) {
+    running = false;
+    if (upstream) upstream->join();
+    return 1;
+  }
+  printf("Gateway %s listening on port %d%s\n", o.id.c_str(), o.listenPort, o.sink ? " (sink)" : "");
+  fflush(stdout);
+
+  gateway.run();
+  if (upstream) upstream->join();
+  return 0;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file event_split.cpp
+ * @brief Splitting reader publishes into single events for the edge gateway
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "event_split.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event_encoder.h"
+
+bool cborHead(const uint8_t* p, size_t length, size_t& pos, uint8_t& major, uint64_t& arg) {
+  if (pos >= length) return false;
+  major = p[pos] >> 5;
+  uint8_t info = p[pos] & 0x1F;
+  pos++;
+  if (info < 24) {
+    arg = info;
+    return true;
+  }
+  size_t width = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : info == 27 ? 8 : 0;
+  if (width == 0 || pos + width > length) return false;
+  arg = 0;
+  for (size_t i = 0; i < width; i++) arg = arg << 8 | p[pos + i];
+  pos += width;
+  return true;
+}
+
+bool cborSkip(const uint8_t* p, size_t length, size_t& pos, int depth) {
+  uint8_t major;
+  uint64_t arg;
+  if (depth > 8 || !cborHead(p, length, pos, major, arg)) return false;
+  switch (major) {
+    case 0: case 1: case 7:
+      return true;
+    case 2: case 3:
+      if (arg > length - pos) return false;
+      pos += (size_t)arg;
+      return true;
+    case 4: case 5:
+      for (uint64_t i = 0; i < (major == 5 ? arg * 2 : arg); i++) {
+        if (!cborSkip(p, length, pos, depth + 1)) return false;
+      }
+      return true;
+    case 6:
+      return cborSkip(p, length, pos, depth + 1);
+  }
+  return false;
+}
+
+namespace {
+
+const char* const BINARY_TOPIC_TYPES[] = {"attendance", "attendance", "denied_access", "alerts"};
+
+bool splitBinaryEvent(const uint8_t* p, size_t length, size_t start, size_t end, SplitEvent& out) {
+  size_t pos = start;
+  uint8_t major;
+  uint64_t count, version, type, seq;
+  if (!cborHead(p, length, pos, major, count) || major != 4 || count < 3) return false;
+  if (!cborHead(p, length, pos, major, version) || major != 0) return false;
+  if (!cborHead(p, length, pos, major, type) || major != 0 || type > 3) return false;
+  if (!cborHead(p, length, pos, major, seq) || major != 0) return false;
+  out = {BINARY_TOPIC_TYPES[type], p + start, end - start, true, (uint32_t)seq};
+  return true;
+}
+
+bool splitBinary(const uint8_t* p, size_t length, std::vector<SplitEvent>& out) {
+  size_t outer = sizeof(CBOR_SELF_DESCRIBED);
+
+  // Anything after the top-level array is the reader's signature; it only
+  // verifies over the publish as sent, so it is kept whole
+  size_t end = outer;
+  if (!cborSkip(p, length, end) || end != length) return false;
+
+  size_t pos = outer;
+  uint8_t major;
+  uint64_t count;
+  if (!cborHead(p, length, pos, major, count) || major != 4 || pos >= length) return false;
+
+  // A batch is an array of event arrays; a single event starts with its version
+  if (p[pos] >> 5 != 4) {
+    SplitEvent event;
+    if (!splitBinaryEvent(p, length, outer, length, event)) return false;
+    out.push_back(event);
+    return true;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    size_t start = pos;
+    SplitEvent event;
+    if (!cborSkip(p, length, pos) || !splitBinaryEvent(p, length, start, pos, event)) return false;
+    out.push_back(event);
+  }
+  return true;
+}
+
+uint32_t jsonSeq(const char* begin, const char* end) {
+  static const char key[] = "\"seq\":";
+  const char* at = std::search(begin, end, key, key + sizeof(key) - 1);
+  if (at == end) return 0;
+  return (uint32_t)strtoul(at + sizeof(key) - 1, nullptr, 10);
+}
+
+bool jsonHas(const char* begin, const char* end, const char* key) {
+  return std::search(begin, end, key, key + strlen(key)) != end;
+}
+
+// Same rule as eventTopicType() in the backend
+const char* jsonType(const char* begin, const char* end) {
+  if (jsonHas(begin, end, "\"check_in\"") || jsonHas(begin, end, "\"check_out\"")) return "attendance";
+  if (jsonHas(begin, end, "\"alert_message\"")) return "alerts";
+  if (jsonHas(begin, end, "\"denial_reason\"")) return "denied_access";
+  return nullptr;
+}
+
+bool splitJsonBatch(const uint8_t* p, size_t length, std::vector<SplitEvent>& out) {
+  const char* s = (const char*)p;
+  int depth = 0;
+  bool inString = false;
+  size_t start = 0;
+  for (size_t i = 1; i < length; i++) {
+    char c = s[i];
+    if (inString) {
+      if (c == '\\') i++;
+      else if (c == '"') inString = false;
+      continue;
+    }
+    if (c == '"') {
+      inString = true;
+    } else if (c == '{') {
+      if (depth++ == 0) start = i;
+    } else if (c == '}') {
+      if (--depth == 0) {
+        const char* type = jsonType(s + start, s + i + 1);
+        if (type == nullptr) return false;
+        out.push_back({type, p + start, i + 1 - start, false, jsonSeq(s + start, s + i + 1)});
+      }
+      if (depth < 0) return false;
+    }
+  }
+  return depth == 0 && !inString;
+}
+
+} // namespace
+
+bool splitEvents(const char* type, const uint8_t* p, size_t length, std::vector<SplitEvent>& out) {
+  out.clear();
+  // A signed JSON publish (EVENT_SIGNING) only verifies as sent; splitBinary()
+  // keeps signed CBOR whole the same way
+  if (length > EVENT_SIGNATURE_SPACE_JSON && p[length - EVENT_SIGNATURE_SPACE_JSON] == '\n') return false;
+  if (length > sizeof(CBOR_SELF_DESCRIBED) && memcmp(p, CBOR_SELF_DESCRIBED, sizeof(CBOR_SELF_DESCRIBED)) == 0) {
+    return splitBinary(p, length, out);
+  }
+  size_t i = 0;
+  while (i < length && (p[i] == ' ' || p[i] == '\n' || p[i] == '\r' || p[i] == '\t')) i++;
+  if (i < length && p[i] == '[') return splitJsonBatch(p + i, length - i, out);
+  if (i >= length || p[i] != '{' || strcmp(type, "batch") == 0) return false;
+  out.push_back({type, p, length, false, jsonSeq((const char*)p, (const char*)p + length)});
+  return true;
+}
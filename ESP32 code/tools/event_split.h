@@ -0,0 +1,57 @@
+/**
+ * @file event_split.h
+ * @brief Splitting reader publishes into single events for the edge gateway
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section event_split_overview Overview
+ *
+ * A reader publishes one event, or a batch of them on .../batch, as JSON
+ * or as the CBOR of event_encoder.h. The gateway logs and deduplicates
+ * single events, so splitEvents() cuts a publish into its events without
+ * copying: each SplitEvent points into the payload.
+ *
+ * A publish signed with EVENT_SIGNING is never split, single event or
+ * batch, JSON or CBOR. Its signature covers the topic and the payload as
+ * sent, so the backend can only verify it whole. A signed JSON publish
+ * ends in "\n" and 32 hex digits; a signed CBOR one has a byte string
+ * after its top-level array.
+ */
+
+#ifndef EVENT_SPLIT_H
+#define EVENT_SPLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// ---- CBOR, as much as event payloads need ----
+const uint8_t CBOR_SELF_DESCRIBED[] = {0xD9, 0xD9, 0xF7};
+
+/**
+ * @brief Read the head of the item at pos: major type and argument
+ */
+bool cborHead(const uint8_t* p, size_t length, size_t& pos, uint8_t& major, uint64_t& arg);
+
+/**
+ * @brief Move pos past the item at pos, nested items included
+ */
+bool cborSkip(const uint8_t* p, size_t length, size_t& pos, int depth = 0);
+
+// ---- Splitting ----
+struct SplitEvent {
+  const char*    type;        ///< Topic type the backend stores it under
+  const uint8_t* data;
+  size_t         length;
+  bool           tag;         ///< Payload needs the CBOR tag in front
+  uint32_t       seq;         ///< 0: never a duplicate (telemetry, unparsed)
+};
+
+/**
+ * @brief Events in one publish on campus/room/{building}/{hotel}/{room}/{type}
+ * @return false if the payload is signed or not understood; it is then kept whole
+ */
+bool splitEvents(const char* type, const uint8_t* p, size_t length, std::vector<SplitEvent>& out);
+
+#endif // EVENT_SPLIT_H
@@ -0,0 +1,719 @@
+/**
+ * @file fleet_loadgen.cpp
+ * @brief Fleet load generator: many simulated room readers against one backend
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section fleet_loadgen_overview Overview
+ *
+ * Opens one /mqtt WebSocket session per simulated room, exactly as the
+ * ESP32 does (same MqttClient, same EventPublisher, same topic and
+ * payload encoding), and replays a check-in / check-out / denied mix at a
+ * fixed total rate. A separate /ws subscriber matches every
+ * activityUpdate entry back to the event that caused it and reports
+ * publish-to-broadcast latency percentiles, which include the backend's
+ * ingest batching, and the sustained rate of events stored.
+ *
+ * Rooms are spread over --hotels hotels (the firmware's FLOOR_NUMBER) and
+ * their sessions over --threads worker threads, each polling its own
+ * sockets. Plain ws:// only; point it at a local backend and MongoDB.
+ * --format binary sends the CBOR payload instead of JSON; the summary
+ * reports the average payload size either way, the bytes each event
+ * takes on the wire (MQTT PUBLISH inside its WebSocket frame) and
+ * publish-to-PUBACK latency percentiles from the backend's aedes broker.
+ *
+ * --dashboards N adds N more /ws clients, each subscribed to one hotel
+ * like a dashboard page, and reports the broadcast traffic each receives.
+ * The latency subscriber stays unsubscribed and sees every hotel.
+ *
+ * --no-subscriber drops the /ws side for targets that only speak /mqtt,
+ * such as edge_gateway; the acknowledged rate is then the measure.
+ *
+ *   fleet_loadgen --host 127.0.0.1 --port 3000 --rooms 800 --rate 200 --duration 60
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "config.h"
+#include "event_publisher.h"
+
+namespace {
+
+// ---- Options ----
+struct Options {
+  std::string host = "127.0.0.1";
+  int      port = 3000;
+  int      rooms = 100;
+  int      hotels = 8;
+  double   rate = 50.0;            ///< Events per second, whole fleet
+  int      duration = 60;          ///< Seconds of load
+  int      threads = 0;            ///< 0 = one per core
+  int      deniedPct = 10;         ///< Share of events that are denied cards
+  int      dashboards = 0;         ///< Hotel-subscribed /ws clients
+  bool     subscriber = true;      ///< Match broadcasts on /ws
+  PayloadFormat format = PayloadFormat::Json;
+  uint32_t seed = 1;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: fleet_loadgen [--host H] [--port P] [--rooms N] [--hotels N]\n"
+          "                     [--rate EV_PER_SEC] [--duration SEC] [--threads N]\n"
+          "                     [--denied-pct PCT] [--format json|binary] [--dashboards N]\n"
+          "                     [--no-subscriber] [--seed N]\n");
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--no-subscriber") {
+      o.subscriber = false;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--host") o.host = value;
+    else if (arg == "--port") o.port = atoi(value);
+    else if (arg == "--rooms") o.rooms = atoi(value);
+    else if (arg == "--hotels") o.hotels = atoi(value);
+    else if (arg == "--rate") o.rate = atof(value);
+    else if (arg == "--duration") o.duration = atoi(value);
+    else if (arg == "--threads") o.threads = atoi(value);
+    else if (arg == "--denied-pct") o.deniedPct = atoi(value);
+    else if (arg == "--format" && strcmp(value, "json") == 0) o.format = PayloadFormat::Json;
+    else if (arg == "--format" && strcmp(value, "binary") == 0) o.format = PayloadFormat::Binary;
+    else if (arg == "--dashboards") o.dashboards = atoi(value);
+    else if (arg == "--seed") o.seed = (uint32_t)strtoul(value, nullptr, 10);
+    else {
+      usage();
+      return false;
+    }
+  }
+  if (o.rooms < 1 || o.hotels < 1 || o.rate <= 0 || o.duration < 1 || o.dashboards < 0) {
+    usage();
+    return false;
+  }
+  if (o.threads <= 0) o.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  o.threads = std::min(o.threads, o.rooms);
+  return true;
+}
+
+typedef std::chrono::steady_clock Clock;
+const Clock::time_point startTime = Clock::now();
+
+uint64_t elapsedUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startTime).count();
+}
+
+uint32_t elapsedMs() {
+  return (uint32_t)(elapsedUs() / 1000);
+}
+
+uint32_t xorshift(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// ---- Minimal WebSocket client (RFC 6455, client side) ----
+const uint8_t WS_TEXT   = 0x1;
+const uint8_t WS_BINARY = 0x2;
+const uint8_t WS_CLOSE  = 0x8;
+const uint8_t WS_PING   = 0x9;
+const uint8_t WS_PONG   = 0xA;
+
+std::string base64(const uint8_t* data, size_t length) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t chunk = (uint32_t)data[i] << 16;
+    if (i + 1 < length) chunk |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < length) chunk |= data[i + 2];
+    out += table[(chunk >> 18) & 0x3F];
+    out += table[(chunk >> 12) & 0x3F];
+    out += i + 1 < length ? table[(chunk >> 6) & 0x3F] : '=';
+    out += i + 2 < length ? table[chunk & 0x3F] : '=';
+  }
+  return out;
+}
+
+class WsConnection {
+public:
+  typedef void (*MessageFn)(void* ctx, uint8_t opcode, const uint8_t* data, size_t length);
+
+  WsConnection() : fd_(-1), mask_(0x5A17C3E1) {}
+  ~WsConnection() { close(); }
+
+  /**
+   * @brief Connect and complete the upgrade handshake (blocking)
+   */
+  bool open(const std::string& host, int port, const char* path, const char* protocol) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) return false;
+
+    for (addrinfo* ai = result; ai != nullptr && fd_ < 0; ai = ai->ai_next) {
+      fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd_ < 0) continue;
+      if (connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0) {
+        ::close(fd_);
+        fd_ = -1;
+      }
+    }
+    freeaddrinfo(result);
+    if (fd_ < 0) return false;
+
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint8_t nonce[16];
+    for (size_t i = 0; i < sizeof(nonce); i++) nonce[i] = (uint8_t)xorshift(mask_);
+
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\n"
+      "Host: " + host + ":" + std::to_string(port) + "\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Key: " + base64(nonce, sizeof(nonce)) + "\r\n"
+      "Sec-WebSocket-Version: 13\r\n";
+    if (protocol) request += std::string("Sec-WebSocket-Protocol: ") + protocol + "\r\n";
+    request += "\r\n";
+    if (!writeAll((const uint8_t*)request.data(), request.size())) return false;
+
+    // Read the response headers; anything after them is already frame data
+    std::string response;
+    char buf[512];
+    while (response.find("\r\n\r\n") == std::string::npos) {
+      ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+      if (n <= 0 || response.size() > 8192) return false;
+      response.append(buf, (size_t)n);
+    }
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0) return false;
+
+    size_t body = response.find("\r\n\r\n") + 4;
+    rx_.assign(response.begin() + body, response.end());
+    return true;
+  }
+
+  void close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+
+  int  fd() const { return fd_; }
+  bool isOpen() const { return fd_ >= 0; }
+
+  bool send(uint8_t opcode, const uint8_t* data, size_t length) {
+    if (fd_ < 0) return false;
+
+    uint8_t header[14];
+    size_t h = 0;
+    header[h++] = 0x80 | opcode;                 // FIN
+    if (length < 126) {
+      header[h++] = 0x80 | (uint8_t)length;      // Client frames are masked
+    } else if (length < 65536) {
+      header[h++] = 0x80 | 126;
+      header[h++] = (uint8_t)(length >> 8);
+      header[h++] = (uint8_t)length;
+    } else {
+      header[h++] = 0x80 | 127;
+      for (int i = 7; i >= 0; i--) header[h++] = (uint8_t)((uint64_t)length >> (8 * i));
+    }
+    uint32_t mask = xorshift(mask_);
+    uint8_t key[4] = {(uint8_t)(mask >> 24), (uint8_t)(mask >> 16), (uint8_t)(mask >> 8), (uint8_t)mask};
+    memcpy(header + h, key, 4);
+    h += 4;
+
+    tx_.assign(header, header + h);
+    tx_.resize(h + length);
+    for (size_t i = 0; i < length; i++) tx_[h + i] = data[i] ^ key[i & 3];
+    return writeAll(tx_.data(), tx_.size());
+  }
+
+  /**
+   * @brief Read what the socket has and dispatch complete frames
+   * @return false once the connection is closed
+   */
+  bool pump(MessageFn fn, void* ctx) {
+    uint8_t buf[4096];
+    ssize_t n = recv(fd_, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    rx_.insert(rx_.end(), buf, buf + n);
+
+    size_t offset = 0;
+    for (;;) {
+      size_t avail = rx_.size() - offset;
+      if (avail < 2) break;
+      const uint8_t* p = rx_.data() + offset;
+      uint8_t opcode = p[0] & 0x0F;
+      uint64_t length = p[1] & 0x7F;
+      size_t h = 2;
+      if (length == 126) {
+        if (avail < 4) break;
+        length = (uint64_t)p[2] << 8 | p[3];
+        h = 4;
+      } else if (length == 127) {
+        if (avail < 10) break;
+        length = 0;
+        for (int i = 0; i < 8; i++) length = length << 8 | p[2 + i];
+        h = 10;
+      }
+      if (avail < h + length) break;
+
+      const uint8_t* payload = p + h;
+      if (opcode == WS_PING) {
+        send(WS_PONG, payload, (size_t)length);
+      } else if (opcode == WS_CLOSE) {
+        return false;
+      } else if (opcode == WS_TEXT || opcode == WS_BINARY || opcode == 0x0) {
+        fn(ctx, opcode, payload, (size_t)length);
+      }
+      offset += h + (size_t)length;
+    }
+    rx_.erase(rx_.begin(), rx_.begin() + offset);
+    return true;
+  }
+
+private:
+  bool writeAll(const uint8_t* data, size_t length) {
+    while (length > 0) {
+      ssize_t n = ::send(fd_, data, length, MSG_NOSIGNAL);
+      if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+      if (n <= 0) return false;
+      data += n;
+      length -= (size_t)n;
+    }
+    return true;
+  }
+
+  int                  fd_;
+  uint32_t             mask_;
+  std::vector<uint8_t> rx_;
+  std::vector<uint8_t> tx_;
+};
+
+// ---- Latency bookkeeping ----
+// Publish times per "hotel/room", matched FIFO against activityUpdate broadcasts
+std::mutex                                  pendingMutex;
+std::map<std::string, std::deque<uint64_t>> pendingSends;
+
+std::atomic<uint64_t> eventsSent(0);
+std::atomic<uint64_t> eventsRejected(0);
+std::atomic<uint64_t> sessionsUp(0);
+std::atomic<uint64_t> sessionsLost(0);
+std::atomic<uint64_t> broadcastsMatched(0);
+std::atomic<uint64_t> broadcastsUnmatched(0);
+std::atomic<uint64_t> payloadsSent(0);
+std::atomic<uint64_t> payloadBytes(0);
+std::atomic<uint64_t> eventsAcked(0);
+std::atomic<uint64_t> publishWireBytes(0);
+
+std::mutex            ackMutex;
+std::vector<uint32_t> ackLatenciesUs;          ///< Merged from the workers when they stop
+thread_local std::vector<uint32_t> workerAckLatenciesUs;
+
+struct Session;
+thread_local Session* activeSession = nullptr;
+void publishSent(Session* s);
+void publishAcked(Session* s);
+
+void onPublished(const char*, const uint8_t* payload, size_t length, bool success) {
+  if (payload == nullptr || !success) return;
+  payloadsSent++;
+  payloadBytes += length;
+  publishSent(activeSession);
+}
+void onAcked(uint16_t) {
+  eventsAcked++;
+  publishAcked(activeSession);
+}
+
+std::atomic<bool>     generating(true);
+std::atomic<bool>     running(true);
+
+std::vector<uint32_t> latenciesUs;            ///< Written by the subscriber only
+
+void recordSend(const char* hotel, const char* room) {
+  std::lock_guard<std::mutex> lock(pendingMutex);
+  pendingSends[std::string(hotel) + "/" + room].push_back(elapsedUs());
+}
+
+// ---- Simulated reader ----
+bool sessionSend(const uint8_t* data, size_t length);
+
+struct Session {
+  char          clientId[48];
+  char          hotel[12];
+  char          room[12];
+  DeviceContext ctx;
+  WsConnection  ws;
+  MqttClient    mqtt;
+  EventPublisher publisher;
+  bool          checkedIn;
+  CardUid       card;
+  Role          role;
+  uint32_t      checkedInAt;
+  std::deque<uint64_t> unacked;   ///< Send times; aedes acknowledges in order
+
+  Session(int index, int hotels, PayloadFormat format)
+    : ctx{BUILDING_ID, hotel, room},
+      mqtt(clientId, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, sessionSend),
+      publisher(ctx, mqtt),
+      checkedIn(false),
+      card(),
+      role(Role::Guest),
+      checkedInAt(0) {
+    snprintf(hotel, sizeof(hotel), "%d", index % hotels + 1);
+    snprintf(room, sizeof(room), "%d", 101 + index / hotels);
+    snprintf(clientId, sizeof(clientId), "LOADGEN_ROOM_%s_HOTEL_%s", room, hotel);
+    publisher.setPayloadFormat(format);
+    publisher.onPublished(onPublished);
+    mqtt.onAck(onAcked);
+  }
+};
+
+bool sessionSend(const uint8_t* data, size_t length) {
+  if (activeSession == nullptr || !activeSession->ws.send(WS_BINARY, data, length)) return false;
+  // Masked client frame header around each PUBLISH, retransmissions included
+  if ((data[0] & 0xF0) == 0x30) publishWireBytes += length + 2 + (length > 125 ? 2 : 0) + 4;
+  return true;
+}
+
+void publishSent(Session* s) {
+  if (s != nullptr) s->unacked.push_back(elapsedUs());
+}
+
+void publishAcked(Session* s) {
+  if (s == nullptr || s->unacked.empty()) return;
+  workerAckLatenciesUs.push_back((uint32_t)(elapsedUs() - s->unacked.front()));
+  s->unacked.pop_front();
+}
+
+void onSessionMessage(void* ctx, uint8_t opcode, const uint8_t* data, size_t length) {
+  Session* s = static_cast<Session*>(ctx);
+  if (opcode == WS_BINARY || opcode == 0x0) s->mqtt.onData(data, length, elapsedMs());
+}
+
+const Role staffRoles[] = {Role::Guest, Role::Guest, Role::Guest, Role::Housekeeping,
+                           Role::Maintenance, Role::Manager};
+
+void emit(Session& s, EventType type, uint32_t& rng) {
+  uint32_t now = elapsedMs();
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  JournalEntry entry = {0, type, s.role, s.card, (uint32_t)ts.tv_sec, 0,
+                        (uint16_t)(ts.tv_nsec / 1000000), 0};
+
+  switch (type) {
+    case EventType::CheckIn:
+      s.role = staffRoles[xorshift(rng) % (sizeof(staffRoles) / sizeof(staffRoles[0]))];
+      s.card = cardUid({(uint8_t)xorshift(rng), (uint8_t)xorshift(rng),
+                        (uint8_t)xorshift(rng), (uint8_t)xorshift(rng)});
+      entry.role = s.role;
+      entry.uid = s.card;
+      s.checkedIn = true;
+      s.checkedInAt = now;
+      break;
+    case EventType::CheckOut:
+      entry.duration = (now - s.checkedInAt) / 1000;
+      s.checkedIn = false;
+      break;
+    case EventType::Denied:
+    case EventType::Alert:
+      entry.role = type == EventType::Denied ? Role::Unknown : Role::Security;
+      entry.uid = cardUid({0xDE, 0xAD, (uint8_t)xorshift(rng), (uint8_t)xorshift(rng)});
+      break;
+  }
+
+  // Stamp before publishing: the broadcast can beat the return on loopback
+  recordSend(s.hotel, s.room);
+  if (s.publisher.record(entry, now) == RecordResult::Lost) {
+    eventsRejected++;
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    std::deque<uint64_t>& queue = pendingSends[std::string(s.hotel) + "/" + s.room];
+    if (!queue.empty()) queue.pop_back();
+    return;
+  }
+  eventsSent++;
+}
+
+void worker(const Options* o, std::vector<Session*> sessions, double rate, uint32_t seed) {
+  uint32_t rng = seed ? seed : 1;
+
+  for (Session* s : sessions) {
+    activeSession = s;
+    if (s->ws.open(o->host, o->port, "/mqtt", "mqtt") && s->mqtt.connect(elapsedMs())) {
+      sessionsUp++;
+    } else {
+      fprintf(stderr, "Session %s failed to connect\n", s->clientId);
+      s->ws.close();
+    }
+  }
+
+  std::vector<pollfd> fds(sessions.size());
+  double tokens = 0;
+  uint64_t last = elapsedUs();
+
+  while (running) {
+    for (size_t i = 0; i < sessions.size(); i++) {
+      fds[i].fd = sessions[i]->ws.fd();
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    poll(fds.data(), fds.size(), 2);
+
+    uint32_t now = elapsedMs();
+    for (size_t i = 0; i < sessions.size(); i++) {
+      Session* s = sessions[i];
+      if (!s->ws.isOpen()) continue;
+      activeSession = s;
+
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !s->ws.pump(onSessionMessage, s)) {
+        s->ws.close();
+        s->publisher.connectionLost();
+        s->unacked.clear();
+        sessionsLost++;
+        continue;
+      }
+      s->mqtt.loop(now);
+    }
+
+    if (!generating) continue;
+
+    // Fixed-rate arrivals spread over this thread's rooms
+    uint64_t nowUs = elapsedUs();
+    tokens += (double)(nowUs - last) * rate / 1e6;
+    last = nowUs;
+    while (tokens >= 1.0) {
+      tokens -= 1.0;
+      Session* s = sessions[xorshift(rng) % sessions.size()];
+      if (!s->ws.isOpen()) continue;
+      activeSession = s;
+
+      if ((int)(xorshift(rng) % 100) < o->deniedPct) {
+        // The firmware follows every denied card with a security alert
+        emit(*s, EventType::Denied, rng);
+        emit(*s, EventType::Alert, rng);
+      } else {
+        emit(*s, s->checkedIn ? EventType::CheckOut : EventType::CheckIn, rng);
+      }
+    }
+  }
+
+  activeSession = nullptr;
+  std::lock_guard<std::mutex> lock(ackMutex);
+  ackLatenciesUs.insert(ackLatenciesUs.end(), workerAckLatenciesUs.begin(), workerAckLatenciesUs.end());
+}
+
+// ---- /ws subscriber ----
+void onBroadcast(void* ctx, uint8_t opcode, const uint8_t* data, size_t length) {
+  (void)ctx;
+  if (opcode != WS_TEXT) return;
+  uint64_t now = elapsedUs();
+  std::string message((const char*)data, length);
+
+  // {"event":"activityUpdate:<hotel>","data":[{... "action":"... Room <room>", ...}, ...]}
+  // The backend batches, so one broadcast can answer events from many rooms
+  const std::string tag = "\"event\":\"activityUpdate:";
+  size_t at = message.find(tag);
+  if (at == std::string::npos) return;
+  at += tag.size();
+  std::string hotel = message.substr(at, message.find('"', at) - at);
+
+  std::lock_guard<std::mutex> lock(pendingMutex);
+  for (size_t action = message.find("\"action\":\""); action != std::string::npos;
+       action = message.find("\"action\":\"", action + 1)) {
+    size_t roomAt = message.find("Room ", action);
+    if (roomAt == std::string::npos) {
+      broadcastsUnmatched++;
+      break;
+    }
+    roomAt += 5;
+    size_t roomEnd = roomAt;
+    while (roomEnd < message.size() && message[roomEnd] != '"' && message[roomEnd] != ' ') roomEnd++;
+    std::string key = hotel + "/" + message.substr(roomAt, roomEnd - roomAt);
+
+    auto it = pendingSends.find(key);
+    if (it == pendingSends.end() || it->second.empty()) {
+      broadcastsUnmatched++;
+      continue;
+    }
+    latenciesUs.push_back((uint32_t)(now - it->second.front()));
+    it->second.pop_front();
+    broadcastsMatched++;
+  }
+}
+
+void subscriber(WsConnection* ws) {
+  pollfd fd = {ws->fd(), POLLIN, 0};
+  while (running) {
+    if (poll(&fd, 1, 10) > 0 && !ws->pump(onBroadcast, nullptr)) {
+      fprintf(stderr, "/ws subscriber disconnected\n");
+      return;
+    }
+  }
+}
+
+// ---- Hotel dashboards ----
+struct Dashboard {
+  WsConnection ws;
+  uint64_t     messages = 0;
+  uint64_t     bytes = 0;
+};
+
+void onDashboardMessage(void* ctx, uint8_t opcode, const uint8_t*, size_t length) {
+  Dashboard* d = (Dashboard*)ctx;
+  if (opcode != WS_TEXT) return;
+  d->messages++;
+  d->bytes += length;
+}
+
+void dashboardPoller(std::vector<std::unique_ptr<Dashboard>>* dashboards) {
+  std::vector<pollfd> fds;
+  for (auto& d : *dashboards) fds.push_back({d->ws.fd(), POLLIN, 0});
+  while (running) {
+    if (poll(fds.data(), fds.size(), 10) <= 0) continue;
+    for (size_t i = 0; i < fds.size(); i++) {
+      if (fds[i].fd < 0 || !(fds[i].revents & POLLIN)) continue;
+      if (!(*dashboards)[i]->ws.pump(onDashboardMessage, (*dashboards)[i].get())) {
+        fprintf(stderr, "Dashboard %zu disconnected\n", i);
+        fds[i].fd = -1;
+      }
+    }
+  }
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t index = (size_t)(p / 100.0 * (double)(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseOptions(argc, argv, o)) return 2;
+
+  WsConnection ws;
+  if (o.subscriber && !ws.open(o.host, o.port, "/ws", nullptr)) {
+    fprintf(stderr, "Cannot open ws://%s:%d/ws\n", o.host.c_str(), o.port);
+    return 1;
+  }
+  std::vector<std::unique_ptr<Dashboard>> dashboards;
+  for (int i = 0; i < o.dashboards; i++) {
+    std::unique_ptr<Dashboard> d(new Dashboard());
+    if (!d->ws.open(o.host, o.port, "/ws", nullptr)) {
+      fprintf(stderr, "Cannot open dashboard %d\n", i);
+      return 1;
+    }
+    char subscribe[64];
+    int n = snprintf(subscribe, sizeof(subscribe), "{\"action\":\"subscribe\",\"hotels\":[\"%d\"]}",
+                     i % o.hotels + 1);
+    d->ws.send(WS_TEXT, (const uint8_t*)subscribe, (size_t)n);
+    dashboards.push_back(std::move(d));
+  }
+
+  std::thread subscriberThread;
+  if (o.subscriber) subscriberThread = std::thread(subscriber, &ws);
+  std::thread dashboardThread(dashboardPoller, &dashboards);
+
+  std::vector<std::unique_ptr<Session>> sessions;
+  for (int i = 0; i < o.rooms; i++) sessions.emplace_back(new Session(i, o.hotels, o.format));
+
+  printf("Fleet: %d rooms over %d hotels, %d threads, %.1f events/s for %d s\n",
+         o.rooms, o.hotels, o.threads, o.rate, o.duration);
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < o.threads; t++) {
+    std::vector<Session*> mine;
+    for (int i = t; i < o.rooms; i += o.threads) mine.push_back(sessions[i].get());
+    double share = o.rate * (double)mine.size() / (double)o.rooms;
+    workers.emplace_back(worker, &o, mine, share, o.seed * 2654435761u + (uint32_t)t);
+  }
+
+  for (int second = 1; second <= o.duration; second++) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    printf("[%3ds] sessions %llu up / %llu lost, sent %llu, rejected %llu, acked %llu, broadcasts %llu\n",
+           second, (unsigned long long)sessionsUp, (unsigned long long)sessionsLost,
+           (unsigned long long)eventsSent, (unsigned long long)eventsRejected,
+           (unsigned long long)eventsAcked, (unsigned long long)broadcastsMatched);
+    fflush(stdout);
+  }
+
+  // Stop generating, then give the backend time to work off its queue
+  generating = false;
+  std::this_thread::sleep_for(std::chrono::seconds(3));
+  running = false;
+  for (std::thread& t : workers) t.join();
+  if (subscriberThread.joinable()) subscriberThread.join();
+  dashboardThread.join();
+
+  std::sort(latenciesUs.begin(), latenciesUs.end());
+  printf("\nEvents sent:         %llu (%llu rejected by a full inflight window or closed session)\n",
+         (unsigned long long)eventsSent, (unsigned long long)eventsRejected);
+  printf("Payload size:        %.1f bytes/event (%s)\n",
+         payloadsSent ? (double)payloadBytes / (double)payloadsSent : 0.0,
+         o.format == PayloadFormat::Binary ? "binary" : "json");
+  printf("Acknowledged:        %llu (%.1f events/s)\n",
+         (unsigned long long)eventsAcked, (double)eventsAcked / (double)o.duration);
+  printf("Wire size:           %.1f bytes/event (MQTT PUBLISH in its WebSocket frame)\n",
+         payloadsSent ? (double)publishWireBytes / (double)payloadsSent : 0.0);
+  std::sort(ackLatenciesUs.begin(), ackLatenciesUs.end());
+  printf("Publish -> PUBACK latency (ms):    p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+         percentile(ackLatenciesUs, 50) / 1000.0, percentile(ackLatenciesUs, 90) / 1000.0,
+         percentile(ackLatenciesUs, 99) / 1000.0,
+         ackLatenciesUs.empty() ? 0.0 : ackLatenciesUs.back() / 1000.0);
+  if (o.subscriber) {
+    printf("Broadcasts matched:  %llu (%llu unmatched)\n",
+           (unsigned long long)broadcastsMatched, (unsigned long long)broadcastsUnmatched);
+    printf("Sustained ingest:    %.1f events/s stored and broadcast\n",
+           (double)broadcastsMatched / (double)o.duration);
+    printf("Publish -> broadcast latency (ms): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile(latenciesUs, 50) / 1000.0, percentile(latenciesUs, 90) / 1000.0,
+           percentile(latenciesUs, 99) / 1000.0, percentile(latenciesUs, 99.9) / 1000.0,
+           latenciesUs.empty() ? 0.0 : latenciesUs.back() / 1000.0);
+  }
+
+  if (!dashboards.empty()) {
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    for (auto& d : dashboards) {
+      messages += d->messages;
+      bytes += d->bytes;
+    }
+    printf("Dashboard traffic:   %.1f messages, %.1f KB per client (%d clients, %.1f KB total)\n",
+           (double)messages / dashboards.size(), (double)bytes / 1024.0 / dashboards.size(),
+           o.dashboards, (double)bytes / 1024.0);
+  }
+  return 0;
+}
@@ -0,0 +1,371 @@
+/**
+ * @file gateway_log.cpp
+ * @brief Append-only event log of the edge gateway
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "gateway_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+
+const size_t RECORD_HEADER_SIZE = 8;
+const size_t READ_CHUNK_SIZE = 64 * 1024;
+const uint32_t MAX_RECORD_SIZE = 1024 * 1024;
+
+struct Crc32Table {
+  uint32_t entries[256];
+
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      entries[i] = c;
+    }
+  }
+};
+
+uint32_t crc32(const uint8_t* data, size_t length) {
+  static const Crc32Table table;
+  uint32_t crc = 0xFFFFFFFFu;
+  while (length--) crc = table.entries[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFu;
+}
+
+void put32(uint8_t* p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+uint32_t get32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+bool writeAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t n = ::write(fd, data, length);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+bool readAt(int fd, uint8_t* data, size_t length, uint64_t offset) {
+  while (length > 0) {
+    ssize_t n = pread(fd, data, length, (off_t)offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    length -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+  return true;
+}
+
+void syncDirectory(const std::string& dir) {
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return;
+  fsync(fd);
+  close(fd);
+}
+
+} // namespace
+
+GatewayLog::GatewayLog(const std::string& dir, uint64_t segmentBytes)
+  : dir_(dir),
+    segmentBytes_(segmentBytes),
+    fd_(-1),
+    segment_(0),
+    size_(0),
+    cursor_{0, 0},
+    readFd_(-1),
+    readSegment_(0),
+    cursorFd_(-1) {}
+
+GatewayLog::~GatewayLog() {
+  if (fd_ >= 0) close(fd_);
+  if (readFd_ >= 0) close(readFd_);
+  if (cursorFd_ >= 0) close(cursorFd_);
+}
+
+std::string GatewayLog::segmentPath(uint32_t segment) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/segment-%08u.log", segment);
+  return dir_ + name;
+}
+
+bool GatewayLog::open() {
+  if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Cannot create %s: %s\n", dir_.c_str(), strerror(errno));
+    return false;
+  }
+
+  DIR* d = opendir(dir_.c_str());
+  if (d == nullptr) return false;
+  while (dirent* entry = readdir(d)) {
+    unsigned segment;
+    char tail;
+    if (sscanf(entry->d_name, "segment-%8u.lo%c", &segment, &tail) == 2 && tail == 'g' && segment > 0) {
+      sizes_[segment] = 0;
+    }
+  }
+  closedir(d);
+
+  if (sizes_.empty()) sizes_[1] = 0;
+  for (auto& segment : sizes_) {
+    struct stat st;
+    segment.second = stat(segmentPath(segment.first).c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+  }
+
+  // Only the last segment can hold a torn record
+  segment_ = sizes_.rbegin()->first;
+  if (!recoverSegment(segment_, sizes_[segment_]) || !openSegment(segment_)) return false;
+  size_ = sizes_[segment_];
+
+  cursorFd_ = ::open((dir_ + "/cursor").c_str(), O_RDWR | O_CREAT, 0644);
+  if (cursorFd_ < 0 || !loadCursor()) return false;
+
+  // Segments before the cursor were fully forwarded before the restart
+  for (auto it = sizes_.begin(); it != sizes_.end() && it->first < cursor_.segment;) {
+    unlink(segmentPath(it->first).c_str());
+    it = sizes_.erase(it);
+  }
+  return true;
+}
+
+bool GatewayLog::recoverSegment(uint32_t segment, uint64_t& size) {
+  int fd = ::open(segmentPath(segment).c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+
+  uint64_t offset = 0;
+  std::vector<uint8_t> body;
+  for (;;) {
+    uint8_t header[RECORD_HEADER_SIZE];
+    if (offset + RECORD_HEADER_SIZE > size || !readAt(fd, header, sizeof(header), offset)) break;
+    uint32_t length = get32(header);
+    if (length < 2 || length > MAX_RECORD_SIZE || offset + RECORD_HEADER_SIZE + length > size) break;
+    body.resize(length);
+    if (!readAt(fd, body.data(), length, offset + RECORD_HEADER_SIZE)) break;
+    if (crc32(body.data(), length) != get32(header + 4)) break;
+    offset += RECORD_HEADER_SIZE + length;
+  }
+
+  if (offset != size) {
+    fprintf(stderr, "Log segment %u: dropping %llu torn bytes\n", segment,
+            (unsigned long long)(size - offset));
+    if (ftruncate(fd, (off_t)offset) != 0) {
+      close(fd);
+      return false;
+    }
+    fdatasync(fd);
+    size = offset;
+  }
+  close(fd);
+  return true;
+}
+
+bool GatewayLog::openSegment(uint32_t segment) {
+  int fd = ::open(segmentPath(segment).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open log segment %u: %s\n", segment, strerror(errno));
+    return false;
+  }
+  if (fd_ >= 0) close(fd_);
+  fd_ = fd;
+  segment_ = segment;
+  return true;
+}
+
+// ---- Writer side ----
+
+void GatewayLog::append(const char* topic, size_t topicLength, const uint8_t* payload, size_t length) {
+  size_t start = buffer_.size();
+  uint32_t bodyLength = (uint32_t)(2 + topicLength + length);
+  buffer_.resize(start + RECORD_HEADER_SIZE + bodyLength);
+
+  uint8_t* record = buffer_.data() + start;
+  uint8_t* body = record + RECORD_HEADER_SIZE;
+  body[0] = (uint8_t)(topicLength >> 8);
+  body[1] = (uint8_t)topicLength;
+  memcpy(body + 2, topic, topicLength);
+  if (length > 0) memcpy(body + 2 + topicLength, payload, length);
+
+  put32(record, bodyLength);
+  put32(record + 4, crc32(body, bodyLength));
+}
+
+bool GatewayLog::commit() {
+  if (buffer_.empty()) return true;
+
+  if (!writeAll(fd_, buffer_.data(), buffer_.size()) || fdatasync(fd_) != 0) {
+    // Cut off whatever part made it, so the retry does not leave a torn record mid-segment
+    fprintf(stderr, "Log write failed: %s\n", strerror(errno));
+    if (ftruncate(fd_, (off_t)size_) != 0) fprintf(stderr, "Log truncate failed: %s\n", strerror(errno));
+    return false;
+  }
+  size_ += buffer_.size();
+  buffer_.clear();
+
+  uint32_t sealed = segment_;
+  uint64_t sealedSize = size_;
+  bool rotated = size_ >= segmentBytes_ && openSegment(segment_ + 1);
+  if (rotated) {
+    syncDirectory(dir_);
+    size_ = 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  sizes_[sealed] = sealedSize;
+  if (rotated) sizes_[segment_] = 0;
+  return true;
+}
+
+// ---- Reader side ----
+
+int GatewayLog::readerFd(uint32_t segment) {
+  if (readFd_ >= 0 && readSegment_ == segment) return readFd_;
+  if (readFd_ >= 0) close(readFd_);
+  readFd_ = ::open(segmentPath(segment).c_str(), O_RDONLY);
+  readSegment_ = segment;
+  return readFd_;
+}
+
+size_t GatewayLog::read(LogPosition& pos, std::vector<LogRecord>& out, size_t maxBytes, size_t maxRecords) {
+  uint64_t limit;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (;;) {
+      auto it = sizes_.lower_bound(pos.segment);
+      if (it == sizes_.end()) return 0;
+      if (it->first != pos.segment) pos = {it->first, 0};
+      if (pos.offset < it->second) {
+        limit = it->second;
+        break;
+      }
+      if (std::next(it) == sizes_.end()) return 0;
+      pos = {std::next(it)->first, 0};
+    }
+  }
+
+  int fd = readerFd(pos.segment);
+  if (fd < 0) return 0;
+
+  std::vector<uint8_t> chunk((size_t)std::min<uint64_t>(limit - pos.offset, std::max(maxBytes, READ_CHUNK_SIZE)));
+  if (!readAt(fd, chunk.data(), chunk.size(), pos.offset)) return 0;
+
+  size_t count = 0;
+  size_t used = 0;
+  size_t bytes = 0;
+  while (count < maxRecords && used + RECORD_HEADER_SIZE <= chunk.size()) {
+    uint32_t length = get32(chunk.data() + used);
+    size_t recordSize = RECORD_HEADER_SIZE + length;
+    if (count > 0 && bytes + recordSize > maxBytes) break;
+
+    const uint8_t* body = chunk.data() + used + RECORD_HEADER_SIZE;
+    std::vector<uint8_t> single;
+    if (used + recordSize > chunk.size()) {
+      // Only the first record can be bigger than the chunk
+      if (count > 0 || length > MAX_RECORD_SIZE || pos.offset + recordSize > limit) break;
+      single.resize(length);
+      if (!readAt(fd, single.data(), length, pos.offset + RECORD_HEADER_SIZE)) break;
+      body = single.data();
+    }
+
+    if (length < 2 || crc32(body, length) != get32(chunk.data() + used + 4)) {
+      fprintf(stderr, "Log segment %u: bad record at %llu, skipping the rest of it\n",
+              pos.segment, (unsigned long long)(pos.offset + used));
+      pos.offset = limit;
+      return count;
+    }
+
+    size_t topicLength = (size_t)body[0] << 8 | body[1];
+    if (topicLength > length - 2) topicLength = length - 2;
+    out.emplace_back();
+    LogRecord& record = out.back();
+    record.topic.assign((const char*)body + 2, topicLength);
+    record.payload.assign(body + 2 + topicLength, body + length);
+    used += recordSize;
+    bytes += recordSize;
+    record.end = {pos.segment, pos.offset + used};
+    count++;
+  }
+
+  pos.offset += used;
+  return count;
+}
+
+bool GatewayLog::acknowledge(const LogPosition& pos) {
+  if (!saveCursor(pos)) return false;
+
+  std::vector<uint32_t> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cursor_ = pos;
+    for (auto it = sizes_.begin(); it != sizes_.end() && it->first < pos.segment;) {
+      done.push_back(it->first);
+      it = sizes_.erase(it);
+    }
+  }
+
+  for (uint32_t segment : done) {
+    if (readFd_ >= 0 && readSegment_ == segment) {
+      close(readFd_);
+      readFd_ = -1;
+    }
+    unlink(segmentPath(segment).c_str());
+  }
+  return true;
+}
+
+LogPosition GatewayLog::cursor() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cursor_;
+}
+
+uint64_t GatewayLog::backlogBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t total = 0;
+  for (auto it = sizes_.lower_bound(cursor_.segment); it != sizes_.end(); ++it) {
+    total += it->second;
+    if (it->first == cursor_.segment) total -= std::min(it->second, cursor_.offset);
+  }
+  return total;
+}
+
+// ---- Cursor file: segment, offset, CRC ----
+
+bool GatewayLog::loadCursor() {
+  uint8_t data[16];
+  cursor_ = {sizes_.begin()->first, 0};
+  if (!readAt(cursorFd_, data, sizeof(data), 0) || crc32(data, 12) != get32(data + 12)) return true;
+
+  uint64_t offset;
+  memcpy(&offset, data + 4, sizeof(offset));
+  LogPosition saved = {get32(data), offset};
+  auto it = sizes_.find(saved.segment);
+  if (it != sizes_.end() && saved.offset <= it->second) cursor_ = saved;
+  return true;
+}
+
+bool GatewayLog::saveCursor(const LogPosition& pos) {
+  uint8_t data[16];
+  put32(data, pos.segment);
+  memcpy(data + 4, &pos.offset, sizeof(pos.offset));
+  put32(data + 12, crc32(data, 12));
+  if (pwrite(cursorFd_, data, sizeof(data), 0) != (ssize_t)sizeof(data)) return false;
+  return fdatasync(cursorFd_) == 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file gateway_log.h
+ * @brief Append-only event log of the edge gateway
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section gateway_log_overview Overview
+ *
+ * The gateway acknowledges a reader's event only once it is in this log,
+ * so from then on the event survives a cloud outage or a gateway restart
+ * the same way it survived them in the reader's own journal.
+ *
+ * Records go into numbered segment files (segment-00000001.log, ...) in
+ * one directory. append() only buffers; commit() writes everything
+ * appended since the last commit with one write() and one fdatasync(),
+ * so a busy event loop pays for one flush per iteration, not per event.
+ * A segment is closed once it reaches its size limit and deleted once
+ * every record in it has been forwarded.
+ *
+ * The forwarding side reads with its own file descriptors from a
+ * position up to the last commit, and moves the cursor with
+ * acknowledge() once upstream has confirmed the records. The cursor is
+ * kept in a small file of its own; after a restart, forwarding resumes
+ * there. A record torn by a crash fails its CRC and cuts the last
+ * segment short on open().
+ *
+ * @code
+ * uint32  body length
+ * uint32  CRC-32 of the body
+ * body:   uint16 topic length, topic, payload
+ * @endcode
+ *
+ * One thread appends and commits, one thread reads and acknowledges.
+ */
+
+#ifndef GATEWAY_LOG_H
+#define GATEWAY_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct LogPosition {
+  uint32_t segment;
+  uint64_t offset;
+};
+
+/**
+ * @brief One record as read back for forwarding
+ */
+struct LogRecord {
+  std::string          topic;
+  std::vector<uint8_t> payload;
+  LogPosition          end;            ///< Position just after this record
+};
+
+class GatewayLog {
+public:
+  GatewayLog(const std::string& dir, uint64_t segmentBytes);
+  ~GatewayLog();
+
+  /**
+   * @brief Open or create the log and recover after a crash
+   */
+  bool open();
+
+  // ---- Writer side ----
+
+  /**
+   * @brief Buffer one record; nothing reaches the disk before commit()
+   */
+  void append(const char* topic, size_t topicLength, const uint8_t* payload, size_t length);
+
+  /**
+   * @brief Write and flush every appended record
+   * @return false if the disk refused them; they stay buffered for a retry
+   */
+  bool commit();
+
+  bool pending() const { return !buffer_.empty(); }
+
+  // ---- Reader side ----
+
+  /**
+   * @brief Read committed records from pos on
+   * @param pos Advanced past every record returned
+   * @return Number of records appended to out
+   */
+  size_t read(LogPosition& pos, std::vector<LogRecord>& out, size_t maxBytes, size_t maxRecords);
+
+  /**
+   * @brief Everything before pos was delivered upstream
+   */
+  bool acknowledge(const LogPosition& pos);
+
+  /**
+   * @brief First record not yet acknowledged
+   */
+  LogPosition cursor() const;
+
+  /**
+   * @brief Committed bytes not yet acknowledged
+   */
+  uint64_t backlogBytes() const;
+
+private:
+  std::string segmentPath(uint32_t segment) const;
+  bool openSegment(uint32_t segment);
+  bool recoverSegment(uint32_t segment, uint64_t& size);
+  bool loadCursor();
+  bool saveCursor(const LogPosition& pos);
+  int  readerFd(uint32_t segment);
+
+  std::string dir_;
+  uint64_t    segmentBytes_;
+
+  // Writer
+  int                  fd_;
+  uint32_t             segment_;       ///< Segment being appended to
+  uint64_t             size_;          ///< Its committed size
+  std::vector<uint8_t> buffer_;
+
+  // Shared, under mutex_
+  mutable std::mutex           mutex_;
+  std::map<uint32_t, uint64_t> sizes_; ///< Committed size of every live segment
+  LogPosition                  cursor_;
+
+  // Reader
+  int      readFd_;
+  uint32_t readSegment_;
+  int      cursorFd_;
+};
+
+#endif // GATEWAY_LOG_H
@@ -0,0 +1,342 @@
+/**
+ * @file tls_reconnect_bench.cpp
+ * @brief Reconnect latency over wss://: full TLS handshake vs resumed session
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section tls_reconnect_bench_overview Overview
+ *
+ * A TLS WebSocket stand-in for the backend runs in a thread of this
+ * process, on localhost, with a freshly generated self-signed certificate
+ * (RSA 2048 like the backend's, or --key ec for P-256). It completes the
+ * /mqtt upgrade and holds the connection until the client closes it.
+ *
+ * The client is the edge gateway's UpstreamLink. It closes and reopens
+ * the connection --reconnects times, first forgetting its TLS session
+ * before every open (cold: full handshake), then keeping it (resumed).
+ * Each reconnect is timed from connect() to the 101 response, in wall
+ * time and in the CPU time of the client thread; the stand-in's CPU time
+ * per connection is reported as well. That is run twice: TLS 1.3 with
+ * session tickets, and TLS 1.2 with session IDs (the server's cache).
+ *
+ * Loopback has no round-trip time, so the wall times here are nearly all
+ * CPU. Over a real link a TLS 1.2 resumption also saves one round trip;
+ * in TLS 1.3 both handshakes take one.
+ *
+ * Exits 1 if any cold open resumed or any resumed open did not.
+ *
+ *   tls_reconnect_bench --reconnects 500 --key rsa
+ */
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "upstream_link.h"
+
+namespace {
+
+// ---- Options ----
+struct Options {
+  int  reconnects = 200;
+  bool ec = false;                 ///< P-256 instead of RSA 2048
+};
+
+void usage() {
+  fprintf(stderr, "usage: tls_reconnect_bench [--reconnects N] [--key rsa|ec]\n");
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--reconnects") o.reconnects = atoi(value);
+    else if (arg == "--key" && strcmp(value, "rsa") == 0) o.ec = false;
+    else if (arg == "--key" && strcmp(value, "ec") == 0) o.ec = true;
+    else {
+      usage();
+      return false;
+    }
+  }
+  if (o.reconnects < 1) {
+    usage();
+    return false;
+  }
+  return true;
+}
+
+uint64_t threadCpuNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ---- Certificate for localhost ----
+X509* selfSigned(EVP_PKEY* key) {
+  X509* cert = X509_new();
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+  X509_set_pubkey(cert, key);
+  X509_NAME* name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+
+  X509V3_CTX v3;
+  X509V3_set_ctx_nodb(&v3);
+  X509V3_set_ctx(&v3, cert, cert, nullptr, nullptr, 0);
+  X509_EXTENSION* san = X509V3_EXT_conf_nid(nullptr, &v3, NID_subject_alt_name, "DNS:localhost");
+  X509_add_ext(cert, san, -1);
+  X509_EXTENSION_free(san);
+  X509_sign(cert, key, EVP_sha256());
+  return cert;
+}
+
+// ---- Stand-in backend: TLS, then the WebSocket upgrade ----
+struct Mode {
+  const char* name;
+  int         version;             ///< Highest TLS version the server accepts
+  bool        tickets;             ///< false: TLS 1.2 session IDs from the server's cache
+};
+
+const Mode MODES[] = {
+  {"TLS 1.3, session ticket", TLS1_3_VERSION, true},
+  {"TLS 1.2, session ID",     TLS1_2_VERSION, false},
+};
+
+class StandIn {
+public:
+  StandIn(EVP_PKEY* key, X509* cert, const Mode& mode) : fd_(-1), port_(0), connections_(0), cpuNs_(0) {
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx_, cert);
+    SSL_CTX_use_PrivateKey(ctx_, key);
+    SSL_CTX_set_max_proto_version(ctx_, mode.version);
+    if (!mode.tickets) SSL_CTX_set_options(ctx_, SSL_OP_NO_TICKET);
+    static const unsigned char context[] = "tls_reconnect_bench";
+    SSL_CTX_set_session_id_context(ctx_, context, sizeof(context) - 1);
+  }
+
+  ~StandIn() {
+    if (fd_ >= 0) {
+      shutdown(fd_, SHUT_RDWR);
+      thread_.join();
+      close(fd_);
+    }
+    SSL_CTX_free(ctx_);
+  }
+
+  /**
+   * @brief Listen on the first address localhost resolves to, as the client will
+   */
+  bool start() {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo("localhost", "0", &hints, &result) != 0) return false;
+    fd_ = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    bool bound = fd_ >= 0 && bind(fd_, result->ai_addr, result->ai_addrlen) == 0 && listen(fd_, 8) == 0;
+    freeaddrinfo(result);
+    if (!bound) return false;
+
+    sockaddr_storage addr;
+    socklen_t length = sizeof(addr);
+    getsockname(fd_, (sockaddr*)&addr, &length);
+    port_ = ntohs(addr.ss_family == AF_INET6 ? ((sockaddr_in6*)&addr)->sin6_port : ((sockaddr_in*)&addr)->sin_port);
+    thread_ = std::thread([this] { run(); });
+    return true;
+  }
+
+  int port() const { return port_; }
+
+  /// Stand-in CPU time per connection since the last reset
+  double cpuUsPerConnection() const {
+    return connections_ == 0 ? 0 : cpuNs_.load() / 1000.0 / connections_.load();
+  }
+
+  void reset() {
+    connections_ = 0;
+    cpuNs_ = 0;
+  }
+
+private:
+  void run() {
+    for (;;) {
+      int client = accept(fd_, nullptr, nullptr);
+      if (client < 0) return;
+      // Tickets follow the handshake in their own record; with Nagle on they
+      // would wait for the client's delayed ACK
+      int one = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      serve(client);
+      close(client);
+    }
+  }
+
+  void serve(int client) {
+    uint64_t cpu = threadCpuNs();
+    SSL* ssl = SSL_new(ctx_);
+    SSL_set_fd(ssl, client);
+    if (SSL_accept(ssl) == 1 && upgrade(ssl)) {
+      cpuNs_ += threadCpuNs() - cpu;
+      connections_++;
+      // Hold the connection until the client's close_notify
+      char buf[256];
+      while (SSL_read(ssl, buf, sizeof(buf)) > 0) {}
+      SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+  }
+
+  bool upgrade(SSL* ssl) {
+    std::string request;
+    char buf[512];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      int n = SSL_read(ssl, buf, sizeof(buf));
+      if (n <= 0 || request.size() > 8192) return false;
+      request.append(buf, (size_t)n);
+    }
+    static const char header[] = "Sec-WebSocket-Key: ";
+    size_t start = request.find(header);
+    if (start == std::string::npos) return false;
+    start += sizeof(header) - 1;
+    std::string accept = request.substr(start, request.find("\r\n", start) - start) +
+                         "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    EVP_Digest(accept.data(), accept.size(), digest, &digestLength, EVP_sha1(), nullptr);
+    char encoded[64];
+    EVP_EncodeBlock((unsigned char*)encoded, digest, (int)digestLength);
+    std::string response = std::string("HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Protocol: mqtt\r\n"
+      "Sec-WebSocket-Accept: ") + encoded + "\r\n\r\n";
+    return SSL_write(ssl, response.data(), (int)response.size()) == (int)response.size();
+  }
+
+  SSL_CTX*              ctx_;
+  int                   fd_;
+  int                   port_;
+  std::thread           thread_;
+  std::atomic<uint32_t> connections_;
+  std::atomic<uint64_t> cpuNs_;
+};
+
+// ---- Client side ----
+struct Sample {
+  double wallMs;
+  double cpuUs;
+};
+
+struct Result {
+  std::vector<Sample> samples;
+  int                 mismatched = 0;  ///< Opens that resumed when they should not, or the reverse
+  double              serverCpuUs = 0;
+};
+
+double percentile(std::vector<double> values, double p) {
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p * (values.size() - 1))];
+}
+
+bool reconnects(UpstreamLink& link, StandIn& server, int count, bool keepSession, Result& result) {
+  // Warm up, and leave a session behind for the resumed run
+  link.close();
+  if (!link.open()) return false;
+  server.reset();
+
+  for (int i = 0; i < count; i++) {
+    link.close();
+    if (!keepSession) link.forgetSession();
+    auto start = std::chrono::steady_clock::now();
+    uint64_t cpu = threadCpuNs();
+    if (!link.open()) return false;
+    Sample s = {std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+                (threadCpuNs() - cpu) / 1000.0};
+    result.samples.push_back(s);
+    if (link.resumed() != keepSession) result.mismatched++;
+  }
+  result.serverCpuUs = server.cpuUsPerConnection();
+  return true;
+}
+
+void report(const char* label, const Result& r) {
+  std::vector<double> wall, cpu;
+  for (const Sample& s : r.samples) {
+    wall.push_back(s.wallMs);
+    cpu.push_back(s.cpuUs);
+  }
+  printf("  %-8s %7.3f ms p50 %7.3f ms p99   client CPU %7.0f us p50   stand-in CPU %7.0f us mean\n", label,
+         percentile(wall, 0.50), percentile(wall, 0.99), percentile(cpu, 0.50), r.serverCpuUs);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseOptions(argc, argv, o)) return 2;
+  signal(SIGPIPE, SIG_IGN);
+
+  EVP_PKEY* key = o.ec ? EVP_EC_gen("P-256") : EVP_RSA_gen(2048);
+  X509* cert = selfSigned(key);
+
+  int failures = 0;
+  printf("Reconnect to a local wss:// stand-in, %s certificate, %d reconnects each\n",
+         o.ec ? "P-256" : "RSA 2048", o.reconnects);
+  for (const Mode& mode : MODES) {
+    StandIn server(key, cert, mode);
+    if (!server.start()) {
+      fprintf(stderr, "Cannot listen on localhost\n");
+      return 1;
+    }
+    UpstreamLink link;
+    std::string url = "wss://localhost:" + std::to_string(server.port()) + "/mqtt";
+    if (!link.parse(url) || !link.trust(cert)) return 1;
+
+    Result cold, resumed;
+    if (!reconnects(link, server, o.reconnects, false, cold) ||
+        !reconnects(link, server, o.reconnects, true, resumed)) {
+      fprintf(stderr, "%s: open() failed\n", mode.name);
+      return 1;
+    }
+    link.close();
+
+    printf("%s\n", mode.name);
+    report("cold", cold);
+    report("resumed", resumed);
+    if (cold.mismatched + resumed.mismatched != 0) {
+      printf("  %d cold opens resumed, %d resumed opens did a full handshake\n", cold.mismatched,
+             resumed.mismatched);
+      failures++;
+    }
+  }
+
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  return failures == 0 ? 0 : 1;
+}
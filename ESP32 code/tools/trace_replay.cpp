@@ -0,0 +1,1059 @@
+/**
+ * @file trace_replay.cpp
+ * @brief Replays field traces through the presence and publish path
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section trace_replay_overview Overview
+ *
+ * A reader built with ENABLE_TRACE records its polls, card lookups,
+ * events, link changes and clock settings in the "trace" partition
+ * (reader_trace.h). Read the partition back with
+ *
+ *   esptool.py read_flash 0x370000 0x20000 room202.trace
+ *
+ * and replay it:
+ *
+ *   trace_replay replay room202.trace --speed 100
+ *
+ * The replayer maps the file and feeds every poll to a PresenceTracker,
+ * answering its lookups with the roles the reader got. It checks that
+ * the tracker emits the recorded events again, field by field, and that
+ * its checked-in cards match every checkpoint. The events go on through
+ * EventPublisher, the journal and MqttClient to a SimSocket. The link
+ * follows the recorded session changes, so outages replay with the same
+ * journal backlog. --speed paces the replay against the recorded times
+ * (1 to 1000 times real time); without it, it runs as fast as it can.
+ *
+ * The summary lists mismatches and the time spent per stage: decoding
+ * the trace, the presence logic, journal and encoding per event, and the
+ * network ticks. The exit code is 1 if anything did not match, so a
+ * directory of field traces works as a regression suite.
+ *
+ * A trace that no longer begins with a reset starts at the oldest
+ * checkpoint of each reader. Denied attempts are not part of a
+ * checkpoint, so denied events in the first DENIED_WINDOW_MS after it are
+ * reported as unverified rather than compared.
+ *
+ * record writes a synthetic trace the same way the firmware does, with
+ * flapping guest cards, shift change bursts across all readers, repeated
+ * unknown cards, outages, NTP drift and a warm reset. dump prints a trace.
+ *
+ *   trace_replay record /tmp/sim.trace --readers 4 --minutes 60
+ *   trace_replay dump /tmp/sim.trace --limit 40
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "event_publisher.h"
+#include "presence.h"
+#include "reader_trace.h"
+#include "sim_transport.h"
+
+namespace {
+
+// ---- Options ----
+struct Options {
+  std::string command;
+  std::string path;
+  int      readers = 2;              ///< record
+  int      minutes = 30;             ///< record
+  size_t   sizeKb = 128;             ///< record: size of the trace partition
+  uint32_t seed = 1;                 ///< record
+  bool     reset = true;             ///< record: warm reset at 60 % of the run
+  size_t   limit = 0;                ///< dump: records to print, 0 = all
+  double   speed = 0;                ///< replay: times real time, 0 = unpaced
+  int      show = 10;                ///< replay: mismatches printed
+  PayloadFormat format = PayloadFormat::Json;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: trace_replay record TRACE [--readers N] [--minutes N] [--size KB] [--seed N]\n"
+          "                                 [--no-reset]\n"
+          "       trace_replay dump TRACE [--limit N]\n"
+          "       trace_replay replay TRACE [--speed 1-1000] [--format json|binary] [--show N]\n");
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+  if (argc < 3) {
+    usage();
+    return false;
+  }
+  o.command = argv[1];
+  o.path = argv[2];
+  for (int i = 3; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--no-reset") {
+      o.reset = false;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "--readers") o.readers = atoi(value);
+    else if (arg == "--minutes") o.minutes = atoi(value);
+    else if (arg == "--size") o.sizeKb = (size_t)atoi(value);
+    else if (arg == "--seed") o.seed = (uint32_t)strtoul(value, nullptr, 10);
+    else if (arg == "--limit") o.limit = (size_t)atoi(value);
+    else if (arg == "--speed") o.speed = atof(value);
+    else if (arg == "--show") o.show = atoi(value);
+    else if (arg == "--format" && strcmp(value, "json") == 0) o.format = PayloadFormat::Json;
+    else if (arg == "--format" && strcmp(value, "binary") == 0) o.format = PayloadFormat::Binary;
+    else {
+      usage();
+      return false;
+    }
+  }
+  if ((o.command != "record" && o.command != "dump" && o.command != "replay") ||
+      o.readers < 1 || o.readers > MAX_RFID_READERS || o.minutes < 1 || o.sizeKb < 8 ||
+      (o.speed != 0 && (o.speed < 1 || o.speed > 1000))) {
+    usage();
+    return false;
+  }
+  return true;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t nanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+uint32_t xorshift(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Exponentially distributed, for arrivals and stays
+uint64_t randomPeriodUs(uint32_t& state, double meanSec) {
+  double u = (xorshift(state) % 1000000 + 1) / 1000001.0;
+  return (uint64_t)(-log(u) * meanSec * 1e6);
+}
+
+const char* eventName(EventType type) {
+  switch (type) {
+    case EventType::CheckIn:  return "check_in";
+    case EventType::CheckOut: return "check_out";
+    case EventType::Denied:   return "denied";
+    case EventType::Alert:    return "alert";
+  }
+  return "?";
+}
+
+const char* kindName(TraceKind kind) {
+  switch (kind) {
+    case TraceKind::Boot:     return "boot";
+    case TraceKind::Poll:     return "poll";
+    case TraceKind::Lookup:   return "lookup";
+    case TraceKind::Event:    return "event";
+    case TraceKind::Link:     return "link";
+    case TraceKind::Clock:    return "clock";
+    case TraceKind::Presence: return "presence";
+    case TraceKind::Gap:      return "gap";
+  }
+  return "?";
+}
+
+std::string uidText(const CardUid& uid) {
+  char buf[2 * CARD_UID_MAX_SIZE + 1];
+  formatCardUid(uid.bytes, uid.size, buf, sizeof(buf));
+  return buf;
+}
+
+std::string eventText(const JournalEntry& e) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s %s %s x%lu at %lu.%03u", eventName(e.type), roleName(e.role),
+           uidText(e.uid).c_str(), (unsigned long)e.duration, (unsigned long)e.timestamp,
+           (unsigned)e.millis);
+  return buf;
+}
+
+std::string recordText(const TraceRecord& r) {
+  char buf[256];
+  switch (r.kind) {
+    case TraceKind::Boot:
+      snprintf(buf, sizeof(buf), "boot id %u, %u readers", r.boot.bootId, r.boot.readers);
+      return buf;
+    case TraceKind::Poll: {
+      std::string text = r.poll.count == 0 ? "-" : "";
+      for (uint8_t i = 0; i < r.poll.count; i++) text += (i ? " " : "") + uidText(r.poll.uids[i]);
+      return text;
+    }
+    case TraceKind::Lookup:
+      return uidText(r.lookup.uid) + " -> " + (r.lookup.role == ROLE_UNDECIDED ? "undecided" : roleName(r.lookup.role));
+    case TraceKind::Event:
+      return eventText(r.event);
+    case TraceKind::Link:
+      return r.up ? "up" : "down";
+    case TraceKind::Clock:
+      snprintf(buf, sizeof(buf), "epoch %.3f at mono %.3f s, %ld ppb",
+               r.clock.baseEpochUs / 1e6, r.clock.baseMonoUs / 1e6, (long)r.clock.ratePpb);
+      return buf;
+    case TraceKind::Presence: {
+      snprintf(buf, sizeof(buf), "%u cards, %lu ms elapsed:", r.presence.cards.count,
+               (unsigned long)r.presence.elapsedMs);
+      std::string text = buf;
+      for (uint8_t i = 0; i < r.presence.cards.count; i++) {
+        const PresenceSnapshot::Card& card = r.presence.cards.cards[i];
+        snprintf(buf, sizeof(buf), " %s %s %lu ms absent %u", uidText(card.uid).c_str(), roleName(card.role),
+                 (unsigned long)card.presentMs, card.absentCount);
+        text += buf;
+      }
+      for (uint8_t i = 0; i < r.presence.cards.deniedCount; i++) {
+        const PresenceSnapshot::Denied& d = r.presence.cards.denied[i];
+        snprintf(buf, sizeof(buf), " denied %s x%lu (%lu unreported) %lu ms%s%s absent %u",
+                 uidText(d.uid).c_str(), (unsigned long)d.attempts, (unsigned long)d.unreported,
+                 (unsigned long)d.windowAgeMs, d.inField ? " in field" : "", d.alerted ? " alerted" : "",
+                 d.absentCount);
+        text += buf;
+      }
+      return text;
+    }
+    case TraceKind::Gap:
+      snprintf(buf, sizeof(buf), "%lu records lost", (unsigned long)r.lost);
+      return buf;
+  }
+  return "?";
+}
+
+// ---- Trace file ----
+class MappedFile {
+public:
+  ~MappedFile() {
+    if (data_ != nullptr) munmap((void*)data_, size_);
+  }
+
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    data_ = (const uint8_t*)data;
+    size_ = (size_t)st.st_size;
+    return true;
+  }
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const uint8_t* data_ = nullptr;
+  size_t         size_ = 0;
+};
+
+// ---- Synthetic recording ----
+// The firmware's glue in esp32code.cpp, single-threaded: a poll record
+// before each update, lookups and events from inside it
+
+TraceWriter* simTrace = nullptr;
+uint8_t      simServing = 0;
+uint64_t     simNowUs = 0;
+
+Role simRole(const uint8_t* uid) {
+  switch (uid[0]) {
+    case 0x10: return Role::Guest;
+    case 0x20: return Role::Housekeeping;
+    case 0x30: return Role::Maintenance;
+    default:   return Role::Unknown;
+  }
+}
+
+Role simLookup(const uint8_t* uid, uint8_t size) {
+  TraceRecord record;
+  record.kind = TraceKind::Lookup;
+  record.reader = simServing;
+  record.monoUs = simNowUs;
+  record.lookup.uid.size = size;
+  memcpy(record.lookup.uid.bytes, uid, size);
+  record.lookup.role = simRole(uid);
+  simTrace->write(record);
+  return record.lookup.role;
+}
+
+void simEmit(const JournalEntry& entry) {
+  TraceRecord record;
+  record.kind = TraceKind::Event;
+  record.reader = simServing;
+  record.monoUs = simNowUs;
+  record.event = entry;
+  record.event.reader = simServing;
+  simTrace->write(record);
+}
+
+struct SimRoom {
+  CardUid  guest;
+  bool     guestIn = false;
+  uint64_t guestToggleUs = 0;
+  int      guestMisses = 0;        ///< Polls the guest card still fails to answer
+  CardUid  maintenance;
+  CardUid  intruder;
+  uint64_t intruderStartUs = 0;
+  int      intruderTaps = 0;
+};
+
+// Cards in the field of one reader at nowUs
+size_t simField(SimRoom& room, size_t index, uint64_t nowUs, uint64_t startUs, uint32_t& rng,
+                CardUid* uids) {
+  size_t count = 0;
+
+  if (nowUs >= room.guestToggleUs) {
+    room.guestIn = !room.guestIn;
+    room.guestToggleUs = nowUs + randomPeriodUs(rng, room.guestIn ? 720 : 240);
+  }
+  if (room.guestIn) {
+    // Card at the edge of the field: it misses polls, sometimes enough to check out
+    if (room.guestMisses == 0 && xorshift(rng) % 100 < 3) {
+      room.guestMisses = 1 + xorshift(rng) % (CARD_ABSENT_THRESHOLD + 1);
+    }
+    if (room.guestMisses > 0) {
+      room.guestMisses--;
+    } else {
+      uids[count++] = room.guest;
+    }
+  }
+
+  // Shift change every 20 minutes: the same housekeeping card and each
+  // room's maintenance card within seconds on every reader
+  uint64_t sinceStart = nowUs - startUs;
+  uint64_t shiftUs = (sinceStart + 600000000ull) % 1200000000ull;
+  uint64_t arriveUs = index * 700000ull;
+  if (shiftUs >= arriveUs && shiftUs < arriveUs + 10000000ull) {
+    uids[count++] = cardUid({0x20, 0xAA, 0xBB, 0xCC});
+    if (shiftUs < arriveUs + 6000000ull) uids[count++] = room.maintenance;
+  }
+
+  // Unknown card tapped several times: 0.7 s on, 1.5 s off
+  if (room.intruderTaps == 0 && nowUs >= room.intruderStartUs) {
+    room.intruderTaps = 1 + xorshift(rng) % 8;
+    room.intruderStartUs = nowUs;
+    room.intruder = cardUid({0xE0, (uint8_t)index, (uint8_t)xorshift(rng), (uint8_t)xorshift(rng),
+                             0x11, 0x22, 0x33});
+  }
+  if (room.intruderTaps > 0) {
+    uint64_t intoUs = nowUs - room.intruderStartUs;
+    int tap = (int)(intoUs / 2200000);
+    if (tap >= room.intruderTaps) {
+      room.intruderTaps = 0;
+      room.intruderStartUs = nowUs + randomPeriodUs(rng, 360);
+    } else if (intoUs % 2200000 < 700000) {
+      uids[count++] = room.intruder;
+    }
+  }
+  return count;
+}
+
+int record(const Options& o) {
+  const size_t size = o.sizeKb * 1024;
+  unlink(o.path.c_str());
+
+  const uint64_t epochStartUs = 1717200000ull * 1000000;
+  const double   driftPpm = 30.0;        // Crystal runs this much fast
+  const size_t   readers = (size_t)o.readers;
+  const uint64_t endUs = (uint64_t)o.minutes * 60000000ull;
+  uint64_t resetAtUs = o.reset ? endUs * 6 / 10 : UINT64_MAX;
+  uint32_t rng = o.seed ? o.seed : 1;
+
+  std::unique_ptr<FileJournalStorage> storage;
+  std::unique_ptr<TraceWriter> writer;
+  std::unique_ptr<WallClock> clock;
+  std::vector<PresenceTracker> trackers(readers, PresenceTracker(simLookup, simEmit, CARD_ABSENT_THRESHOLD));
+  std::vector<SimRoom> rooms(readers);
+  for (size_t i = 0; i < readers; i++) {
+    rooms[i].guest = cardUid({0x10, (uint8_t)i, 0x01, 0x02});
+    rooms[i].maintenance = cardUid({0x30, (uint8_t)i, 0x05, 0x06, 0x07, 0x08, 0x09});
+    rooms[i].guestToggleUs = randomPeriodUs(rng, 60);
+    rooms[i].intruderStartUs = randomPeriodUs(rng, 120);
+  }
+
+  SimLink link(o.seed, 8 * 60000, 40000);
+  uint8_t  bootId = (uint8_t)(o.seed & 0x7F);
+  uint64_t elapsedUs = 0;            // Real time since the start, across resets
+  uint64_t monoUs = 0;               // This boot's esp_timer
+  uint64_t nextNtpUs = 0;
+  uint64_t lastFlushUs = 0;
+  bool     linkUp = false;
+  bool     synced = false;
+  uint32_t rfidCheckpoint = 0;
+  uint32_t networkCheckpoint = 0;
+  size_t   firstReader = 0;
+  std::vector<PresenceSnapshot> carried;
+  bool     warm = false;
+
+  auto write = [&](TraceRecord& r) {
+    r.monoUs = monoUs;
+    writer->write(r);
+  };
+  auto epochNow = [&]() {
+    return epochStartUs + (uint64_t)((double)elapsedUs * (1.0 - driftPpm / 1e6));
+  };
+
+  for (;;) {
+    // ---- Boot ----
+    storage.reset(new FileJournalStorage(o.path.c_str(), size));
+    writer.reset(new TraceWriter(*storage));
+    if (!writer->begin(bootId, (uint8_t)readers)) {
+      fprintf(stderr, "Cannot create %s\n", o.path.c_str());
+      return 1;
+    }
+    simTrace = writer.get();
+    clock.reset(new WallClock(bootId));
+    monoUs = 300000;
+    rfidCheckpoint = networkCheckpoint = 0;
+    linkUp = false;
+
+    TraceRecord r = {};
+    r.kind = TraceKind::Boot;
+    r.boot = {bootId, (uint8_t)readers};
+    write(r);
+    if (warm) {
+      // restoreBootState(): the system clock ran on, the cards come back
+      if (synced) {
+        clock->set(epochNow(), monoUs);
+        r = {};
+        r.kind = TraceKind::Clock;
+        r.clock = clock->state();
+        write(r);
+      }
+      for (size_t i = 0; i < readers; i++) {
+        trackers[i].restore(carried[i], monoUs, 1800);
+        r = {};
+        r.kind = TraceKind::Presence;
+        r.reader = (uint8_t)i;
+        r.presence.cards = carried[i];
+        r.presence.elapsedMs = 1800;
+        write(r);
+      }
+    }
+    synced = clock->synced();
+    nextNtpUs = monoUs + 15000000;
+
+    // ---- Read cycles ----
+    while (elapsedUs < endUs && elapsedUs < resetAtUs) {
+      uint64_t sweepUs = monoUs;
+      if (writer->checkpoints() != rfidCheckpoint) {
+        rfidCheckpoint = writer->checkpoints();
+        for (size_t i = 0; i < readers; i++) {
+          r = {};
+          r.kind = TraceKind::Presence;
+          r.reader = (uint8_t)i;
+          trackers[i].save(r.presence.cards, monoUs);
+          write(r);
+        }
+      }
+
+      for (size_t n = 0; n < readers; n++) {
+        size_t i = (firstReader + n) % readers;
+        CardUid uids[MAX_PRESENT_CARDS];
+        size_t count = simField(rooms[i], i, elapsedUs, 0, rng, uids);
+        // An empty field answers in about a millisecond, each card adds one
+        monoUs += 1100 + 900 * count;
+        elapsedUs += 1100 + 900 * count;
+
+        r = {};
+        r.kind = TraceKind::Poll;
+        r.reader = (uint8_t)i;
+        r.poll.count = (uint8_t)count;
+        memcpy(r.poll.uids, uids, sizeof(CardUid) * count);
+        write(r);
+
+        simServing = (uint8_t)i;
+        simNowUs = monoUs;
+        trackers[i].update(uids, count, monoUs, clock->stamp(monoUs));
+      }
+      firstReader = (firstReader + 1) % readers;
+
+      // ---- Network task ----
+      uint32_t nowMs = (uint32_t)(elapsedUs / 1000);
+      link.update(nowMs);
+      bool up = link.up() && monoUs - 300000 > 3000000;   // WiFi join after a boot
+      if (up != linkUp) {
+        linkUp = up;
+        r = {};
+        r.kind = TraceKind::Link;
+        r.up = up;
+        write(r);
+      }
+      if (linkUp && monoUs >= nextNtpUs) {
+        // SNTP's answer is a millisecond or so off
+        clock->set(epochNow() + xorshift(rng) % 1000 - 500, monoUs);
+        synced = true;
+        r = {};
+        r.kind = TraceKind::Clock;
+        r.clock = clock->state();
+        write(r);
+        nextNtpUs = monoUs + 300000000ull;
+      }
+      if (writer->checkpoints() != networkCheckpoint) {
+        networkCheckpoint = writer->checkpoints();
+        r = {};
+        r.kind = TraceKind::Link;
+        r.up = linkUp;
+        write(r);
+        if (clock->synced()) {
+          r.kind = TraceKind::Clock;
+          r.clock = clock->state();
+          write(r);
+        }
+      }
+      if (elapsedUs - lastFlushUs >= TRACE_FLUSH_INTERVAL * 1000ull) {
+        writer->flush();
+        lastFlushUs = elapsedUs;
+      }
+
+      uint64_t nextUs = sweepUs + CARD_READ_DELAY * 1000 + (xorshift(rng) % 2500);
+      elapsedUs += nextUs - monoUs;
+      monoUs = nextUs;
+    }
+
+    writer->flush();
+    if (elapsedUs >= endUs) break;
+
+    // Warm reset: RTC memory keeps the checked-in cards, esp_timer starts over
+    printf("Warm reset at %.1f min\n", elapsedUs / 60e6);
+    carried.resize(readers);
+    for (size_t i = 0; i < readers; i++) trackers[i].save(carried[i], monoUs);
+    trackers.assign(readers, PresenceTracker(simLookup, simEmit, CARD_ABSENT_THRESHOLD));
+    elapsedUs += 1800000;
+    bootId = (uint8_t)((bootId + 1) & 0x7F);
+    warm = true;
+    resetAtUs = UINT64_MAX;
+  }
+
+  printf("Recorded %d min of %zu readers: %u sectors written, %.1f KB encoded (%.1f B/s)\n",
+         o.minutes, readers, writer->sectors(), writer->bytes() / 1024.0,
+         (double)writer->bytes() / (endUs / 1e6));
+  return writer->errors() == 0 ? 0 : 1;
+}
+
+// ---- Dump ----
+int dump(const Options& o) {
+  MappedFile file;
+  if (!file.open(o.path)) {
+    fprintf(stderr, "Cannot map %s\n", o.path.c_str());
+    return 1;
+  }
+  TraceReader reader(file.data(), file.size());
+  TraceRecord r;
+  size_t records = 0;
+  size_t kinds[16] = {};
+  uint64_t firstUs = 0;
+  while (reader.next(r)) {
+    if (records == 0) firstUs = r.monoUs;
+    kinds[(size_t)r.kind]++;
+    if (o.limit == 0 || records < o.limit) {
+      printf("%12.6f  %u  %-8s %s\n", ((int64_t)(r.monoUs - firstUs)) / 1e6, r.reader,
+             kindName(r.kind), recordText(r).c_str());
+    }
+    records++;
+  }
+  printf("\n%zu records in %zu sectors (%u cut short)", records, reader.sectors(), reader.corrupt());
+  for (size_t k = 1; k < 16; k++) {
+    if (kinds[k]) printf(", %zu %s", kinds[k], kindName((TraceKind)k));
+  }
+  printf("\n");
+  return 0;
+}
+
+// ---- Replay ----
+// Presence callbacks are plain functions, as on the device
+
+std::vector<TraceRecord::Lookup> replayLookups;   ///< Recorded for the poll being replayed
+size_t                           replayLookupAt = 0;
+uint64_t                         replayUnrecordedLookups = 0;
+std::vector<JournalEntry>        replayEmitted;
+uint8_t                          replayServing = 0;
+
+Role replayLookup(const uint8_t* uid, uint8_t size) {
+  CardUid card = {};
+  card.size = size;
+  memcpy(card.bytes, uid, size);
+  for (size_t i = replayLookupAt; i < replayLookups.size(); i++) {
+    if (sameCard(replayLookups[i].uid, card)) {
+      replayLookupAt = i + 1;
+      return replayLookups[i].role;
+    }
+  }
+  replayUnrecordedLookups++;
+  return Role::Unknown;
+}
+
+void replayEmit(const JournalEntry& entry) {
+  replayEmitted.push_back(entry);
+  replayEmitted.back().reader = replayServing;
+}
+
+EventPublisher* replayPublisher = nullptr;
+uint64_t        replayPublishes = 0;
+uint64_t        replayPublishFailures = 0;
+uint64_t        replayAcks = 0;
+
+void replayAck(uint16_t packetId) {
+  replayAcks++;
+  replayPublisher->onAck(packetId);
+}
+
+void replayPublished(const char*, const uint8_t*, size_t, bool success) {
+  if (success) {
+    replayPublishes++;
+  } else {
+    replayPublishFailures++;
+  }
+}
+
+struct Stage {
+  const char*           name;
+  std::vector<uint32_t> ns;
+  uint64_t              total = 0;
+
+  void add(uint64_t n) {
+    ns.push_back((uint32_t)std::min<uint64_t>(n, UINT32_MAX));
+    total += n;
+  }
+};
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t index = (size_t)(p / 100.0 * (double)(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+class Replayer {
+public:
+  Replayer(const Options& o, const uint8_t* image, size_t size)
+    : o_(o),
+      reader_(image, size),
+      journalStorage_(nullptr),
+      journal_(nullptr),
+      socket_(link_),
+      mqtt_(DEVICE_ID, MQTT_KEEPALIVE, WS_HEARTBEAT_TIMEOUT, SimSocket::send),
+      publisher_(rooms_, MAX_RFID_READERS, mqtt_) {
+    for (size_t i = 0; i < MAX_RFID_READERS; i++) {
+      roomNames_[i] = std::to_string(i + 1);
+      rooms_[i] = {BUILDING_ID, FLOOR_NUMBER, roomNames_[i].c_str()};
+    }
+    decode_.name = "decode";
+    presence_.name = "presence";
+    publish_.name = "journal+publish";
+    network_.name = "network tick";
+  }
+
+  ~Replayer() {
+    if (!journalPath_.empty()) unlink(journalPath_.c_str());
+  }
+
+  bool begin() {
+    if (reader_.sectors() == 0) {
+      fprintf(stderr, "No trace sectors in %s\n", o_.path.c_str());
+      return false;
+    }
+
+    // A fresh journal in the same size as the partition
+    char path[] = "/tmp/trace_replay_journal_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return false;
+    close(fd);
+    unlink(path);
+    journalPath_ = path;
+    journalStorage_.reset(new FileJournalStorage(journalPath_.c_str(), 0x10000));
+    journal_.reset(new EventJournal(*journalStorage_));
+    if (!journal_->begin()) return false;
+
+    link_.setUp(false);
+    socket_.attach(mqtt_);
+    mqtt_.onAck(replayAck);
+    replayPublisher = &publisher_;
+    publisher_.attachJournal(journal_.get());
+    publisher_.onPublished(replayPublished);
+    publisher_.setPayloadFormat(o_.format);
+
+    // Mid-ring start: every reader waits for its first checkpoint
+    startReaders(reader_.bootId(), reader_.readers(), false);
+    return true;
+  }
+
+  int run() {
+    wallStart_ = Clock::now();
+    TraceRecord r;
+    bool first = true;
+    while (next(r)) {
+      if (first) {
+        resumed_ = r.kind != TraceKind::Boot;
+        prevUs_ = r.monoUs;
+        first = false;
+      }
+      advance(r);
+
+      switch (r.kind) {
+        case TraceKind::Boot:
+          boots_++;
+          startReaders(r.boot.bootId, r.boot.readers, true);
+          setLink(false);
+          break;
+        case TraceKind::Poll:
+          poll(r);
+          break;
+        case TraceKind::Lookup:
+        case TraceKind::Event:
+          orphans_++;
+          break;
+        case TraceKind::Link:
+          setLink(r.up);
+          break;
+        case TraceKind::Clock:
+          clock_->restore(r.clock);
+          clockKnown_ = true;
+          break;
+        case TraceKind::Presence:
+          presence(r);
+          break;
+        case TraceKind::Gap:
+          gaps_++;
+          lost_ += r.lost;
+          for (ReaderSync& s : sync_) s.synced = false;
+          break;
+      }
+    }
+    // Let the last replays and PUBACKs through
+    tick(simUs_ + 2000000);
+
+    report();
+    return mismatched_ + missing_ + extra_ + diverged_ == 0 ? 0 : 1;
+  }
+
+private:
+  struct ReaderSync {
+    bool     synced;
+    bool     restorePending;     ///< Boot seen, its carried-over cards not yet
+    bool     resumed;            ///< Synced from a checkpoint, not from a reset
+    uint64_t syncedAtUs;
+  };
+
+  bool next(TraceRecord& r) {
+    if (hasAhead_) {
+      r = ahead_;
+      hasAhead_ = false;
+      return true;
+    }
+    Clock::time_point start = Clock::now();
+    bool ok = reader_.next(r);
+    if (ok) {
+      decode_.add(nanosSince(start));
+      records_++;
+    }
+    return ok;
+  }
+
+  void startReaders(uint8_t bootId, uint8_t readers, bool fromBoot) {
+    clock_.reset(new WallClock(bootId));
+    publisher_.attachClock(clock_.get());
+    clockKnown_ = fromBoot;
+    trackers_.assign(readers, PresenceTracker(replayLookup, replayEmit, CARD_ABSENT_THRESHOLD));
+    sync_.assign(readers, ReaderSync{fromBoot, fromBoot, false, 0});
+  }
+
+  // Trace time moves on: run the network task up to it and keep the pace
+  void advance(const TraceRecord& r) {
+    if (r.kind != TraceKind::Boot && r.monoUs > prevUs_) simUs_ += r.monoUs - prevUs_;
+    prevUs_ = r.monoUs;
+    tick(simUs_);
+
+    if (o_.speed <= 0) return;
+    Clock::time_point due = wallStart_ + std::chrono::microseconds((uint64_t)(simUs_ / o_.speed));
+    Clock::time_point now = Clock::now();
+    if (now < due) {
+      std::this_thread::sleep_until(due);
+    } else {
+      uint64_t lagUs = std::chrono::duration_cast<std::chrono::microseconds>(now - due).count();
+      maxLagUs_ = std::max(maxLagUs_, lagUs);
+    }
+  }
+
+  void tick(uint64_t untilUs) {
+    // Past a minute of silence the network task has long gone idle; a
+    // damaged time delta must not cost hours of ticks
+    if (untilUs > tickUs_ + 60000000ull) tickUs_ = untilUs - 60000000ull;
+    while (tickUs_ + EVENT_DRAIN_INTERVAL * 1000 <= untilUs) {
+      tickUs_ += EVENT_DRAIN_INTERVAL * 1000;
+      uint32_t nowMs = (uint32_t)(tickUs_ / 1000);
+      Clock::time_point start = Clock::now();
+      socket_.deliver(nowMs);
+      mqtt_.loop(nowMs);
+      publisher_.drain(nowMs);
+      network_.add(nanosSince(start));
+      maxPending_ = std::max(maxPending_, journal_->pending());
+    }
+  }
+
+  void setLink(bool up) {
+    if (up == link_.up()) return;
+    uint32_t nowMs = (uint32_t)(tickUs_ / 1000);
+    link_.setUp(up);
+    if (up) {
+      mqtt_.connect(nowMs);
+    } else {
+      outages_++;
+      socket_.reset();
+      publisher_.connectionLost();
+    }
+  }
+
+  void poll(const TraceRecord& r) {
+    // The poll's lookups and events follow it. Link and clock records the
+    // network task wrote in between take effect after the poll.
+    replayLookups.clear();
+    replayLookupAt = 0;
+    std::vector<JournalEntry> expected;
+    std::vector<TraceRecord> deferred;
+    TraceRecord item;
+    while (next(item)) {
+      bool ours = item.reader == r.reader &&
+                  (item.kind == TraceKind::Lookup || item.kind == TraceKind::Event);
+      if (ours && item.kind == TraceKind::Lookup) {
+        replayLookups.push_back(item.lookup);
+      } else if (ours) {
+        expected.push_back(item.event);
+      } else if (item.kind == TraceKind::Link || item.kind == TraceKind::Clock) {
+        deferred.push_back(item);
+      } else {
+        ahead_ = item;
+        hasAhead_ = true;
+        break;
+      }
+    }
+
+    if (r.reader < sync_.size() && sync_[r.reader].synced) {
+      polls_++;
+      replayServing = r.reader;
+      replayEmitted.clear();
+      Clock::time_point start = Clock::now();
+      trackers_[r.reader].update(r.poll.uids, r.poll.count, r.monoUs, clock_->stamp(r.monoUs));
+      presence_.add(nanosSince(start));
+
+      compare(r, expected);
+      for (const JournalEntry& e : replayEmitted) {
+        uint32_t nowMs = (uint32_t)(tickUs_ / 1000);
+        start = Clock::now();
+        publisher_.record(e, nowMs);
+        publish_.add(nanosSince(start));
+        journaled_++;
+      }
+    } else {
+      skippedPolls_++;
+    }
+
+    for (const TraceRecord& d : deferred) {
+      if (d.kind == TraceKind::Link) {
+        setLink(d.up);
+      } else {
+        clock_->restore(d.clock);
+        clockKnown_ = true;
+      }
+    }
+  }
+
+  void compare(const TraceRecord& poll, const std::vector<JournalEntry>& expected) {
+    const ReaderSync& s = sync_[poll.reader];
+    bool denialsKnown = !s.resumed || poll.monoUs - s.syncedAtUs >= DENIED_WINDOW_MS * 1000ull;
+    recorded_ += expected.size();
+    replayed_ += replayEmitted.size();
+
+    for (size_t i = 0; i < std::max(expected.size(), replayEmitted.size()); i++) {
+      const JournalEntry* want = i < expected.size() ? &expected[i] : nullptr;
+      const JournalEntry* got = i < replayEmitted.size() ? &replayEmitted[i] : nullptr;
+      const JournalEntry* any = want ? want : got;
+      if (!denialsKnown && (any->type == EventType::Denied || any->type == EventType::Alert)) {
+        unverified_++;
+        continue;
+      }
+      if (want && got && sameEvent(*want, *got)) {
+        matched_++;
+        continue;
+      }
+      if (want && got) {
+        mismatched_++;
+      } else if (want) {
+        missing_++;
+      } else {
+        extra_++;
+      }
+      if (shown_++ < o_.show) {
+        printf("Mismatch at %.3f s, reader %u: recorded %s, replayed %s\n", simUs_ / 1e6, poll.reader,
+               want ? eventText(*want).c_str() : "nothing", got ? eventText(*got).c_str() : "nothing");
+      }
+    }
+  }
+
+  bool sameEvent(const JournalEntry& a, const JournalEntry& b) const {
+    if (a.type != b.type || a.role != b.role || !sameCard(a.uid, b.uid) || a.duration != b.duration) {
+      return false;
+    }
+    return !clockKnown_ || (a.timestamp == b.timestamp && a.millis == b.millis);
+  }
+
+  void presence(const TraceRecord& r) {
+    if (r.reader >= sync_.size()) return;
+    ReaderSync& s = sync_[r.reader];
+    if (!s.synced || s.restorePending) {
+      trackers_[r.reader].restore(r.presence.cards, r.monoUs, r.presence.elapsedMs);
+      s.resumed = !s.restorePending;
+      s.synced = true;
+      s.restorePending = false;
+      s.syncedAtUs = r.monoUs;
+      return;
+    }
+
+    // A checkpoint of a reader we follow: the tracker must agree with it
+    checkpoints_++;
+    PresenceSnapshot ours;
+    trackers_[r.reader].save(ours, r.monoUs);
+    const PresenceSnapshot& recorded = r.presence.cards;
+    bool same = ours.count == recorded.count && ours.deniedCount == recorded.deniedCount;
+    for (uint8_t i = 0; same && i < ours.count; i++) {
+      const PresenceSnapshot::Card& a = ours.cards[i];
+      const PresenceSnapshot::Card& b = recorded.cards[i];
+      // A snapshot keeps whole milliseconds, so a tracker restored from one may be 1 ms short
+      uint32_t slack = a.presentMs > b.presentMs ? a.presentMs - b.presentMs : b.presentMs - a.presentMs;
+      same = sameCard(a.uid, b.uid) && a.role == b.role && slack <= 1 && a.absentCount == b.absentCount;
+    }
+    for (uint8_t i = 0; same && i < ours.deniedCount; i++) {
+      const PresenceSnapshot::Denied& a = ours.denied[i];
+      const PresenceSnapshot::Denied& b = recorded.denied[i];
+      same = sameCard(a.uid, b.uid) && a.windowAgeMs == b.windowAgeMs && a.attempts == b.attempts &&
+             a.unreported == b.unreported && a.absentCount == b.absentCount && a.inField == b.inField &&
+             a.alerted == b.alerted;
+    }
+    if (!same) {
+      diverged_++;
+      if (shown_++ < o_.show) {
+        printf("Checkpoint at %.3f s, reader %u: recorded %u cards and %u denied, replay has %u and %u\n",
+               simUs_ / 1e6, r.reader, recorded.count, recorded.deniedCount, ours.count, ours.deniedCount);
+      }
+      trackers_[r.reader].restore(r.presence.cards, r.monoUs, 0);
+    }
+  }
+
+  void printStage(Stage& stage, uint64_t wallNs) {
+    std::sort(stage.ns.begin(), stage.ns.end());
+    printf("  %-16s %10zu  %8.2f  %8.2f  %8.2f  %9.1f  %5.1f%%\n", stage.name, stage.ns.size(),
+           percentile(stage.ns, 50) / 1000.0, percentile(stage.ns, 99) / 1000.0,
+           stage.ns.empty() ? 0.0 : stage.ns.back() / 1000.0, stage.total / 1e6,
+           wallNs ? 100.0 * stage.total / wallNs : 0.0);
+  }
+
+  void report() {
+    uint64_t wallNs = nanosSince(wallStart_);
+    double traceSec = simUs_ / 1e6;
+    printf("\nTrace:       %zu sectors (%u cut short), %llu records, %.1f min, %llu resets, %s\n",
+           reader_.sectors(), reader_.corrupt(), (unsigned long long)records_, traceSec / 60.0,
+           (unsigned long long)boots_, resumed_ ? "starts mid-ring" : "starts at a reset");
+    printf("Replay:      %.2f s wall, %.0fx real time (%s), max lag %.1f ms\n", wallNs / 1e9,
+           wallNs ? traceSec / (wallNs / 1e9) : 0.0,
+           o_.speed > 0 ? (std::to_string((int)o_.speed) + "x paced").c_str() : "unpaced",
+           maxLagUs_ / 1000.0);
+    printf("Polls:       %llu replayed, %llu before a checkpoint, %llu gaps (%llu records lost)\n",
+           (unsigned long long)polls_, (unsigned long long)skippedPolls_, (unsigned long long)gaps_,
+           (unsigned long long)lost_);
+    printf("Events:      %llu recorded, %llu replayed: %llu matched, %llu differ, %llu missing, "
+           "%llu extra, %llu unverified\n",
+           (unsigned long long)recorded_, (unsigned long long)replayed_, (unsigned long long)matched_,
+           (unsigned long long)mismatched_, (unsigned long long)missing_, (unsigned long long)extra_,
+           (unsigned long long)unverified_);
+    printf("Checkpoints: %llu compared, %llu diverged; %llu lookups not in the trace, %llu stray records\n",
+           (unsigned long long)checkpoints_, (unsigned long long)diverged_,
+           (unsigned long long)replayUnrecordedLookups, (unsigned long long)orphans_);
+    printf("Publish:     %llu journaled, %llu publishes (%llu failed), %llu acked, %llu outages, "
+           "backlog max %zu, %zu left\n",
+           (unsigned long long)journaled_, (unsigned long long)replayPublishes,
+           (unsigned long long)replayPublishFailures, (unsigned long long)replayAcks,
+           (unsigned long long)outages_, maxPending_, journal_->pending());
+    printf("\n  %-16s %10s  %8s  %8s  %8s  %9s  %6s\n", "stage (us)", "calls", "p50", "p99", "max",
+           "total ms", "wall");
+    printStage(decode_, wallNs);
+    printStage(presence_, wallNs);
+    printStage(publish_, wallNs);
+    printStage(network_, wallNs);
+  }
+
+  const Options& o_;
+  TraceReader    reader_;
+  TraceRecord    ahead_;
+  bool           hasAhead_ = false;
+  bool           resumed_ = false;
+
+  std::unique_ptr<WallClock>       clock_;
+  bool                             clockKnown_ = false;
+  std::vector<PresenceTracker>     trackers_;
+  std::vector<ReaderSync>          sync_;
+
+  std::string                         journalPath_;
+  std::unique_ptr<FileJournalStorage> journalStorage_;
+  std::unique_ptr<EventJournal>       journal_;
+  std::string                         roomNames_[MAX_RFID_READERS];
+  DeviceContext                       rooms_[MAX_RFID_READERS];
+  SimLink                             link_;
+  SimSocket                           socket_;
+  MqttClient                          mqtt_;
+  EventPublisher                      publisher_;
+
+  Clock::time_point wallStart_;
+  uint64_t prevUs_ = 0;
+  uint64_t simUs_ = 0;           ///< Trace time replayed, across resets
+  uint64_t tickUs_ = 0;
+  uint64_t maxLagUs_ = 0;
+  size_t   maxPending_ = 0;
+
+  Stage decode_, presence_, publish_, network_;
+  uint64_t records_ = 0, boots_ = 0, polls_ = 0, skippedPolls_ = 0, gaps_ = 0, lost_ = 0;
+  uint64_t recorded_ = 0, replayed_ = 0, matched_ = 0, mismatched_ = 0, missing_ = 0, extra_ = 0;
+  uint64_t unverified_ = 0, checkpoints_ = 0, diverged_ = 0, orphans_ = 0;
+  uint64_t journaled_ = 0, outages_ = 0;
+  int      shown_ = 0;
+};
+
+int replay(const Options& o) {
+  MappedFile file;
+  if (!file.open(o.path)) {
+    fprintf(stderr, "Cannot map %s\n", o.path.c_str());
+    return 1;
+  }
+  std::unique_ptr<Replayer> replayer(new Replayer(o, file.data(), file.size()));
+  if (!replayer->begin()) return 1;
+  return replayer->run();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  if (!parseOptions(argc, argv, o)) return 2;
+  if (o.command == "record") return record(o);
+  if (o.command == "dump") return dump(o);
+  return replay(o);
+}
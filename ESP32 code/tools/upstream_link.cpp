@@ -0,0 +1,269 @@
+/**
+ * @file upstream_link.cpp
+ * @brief WebSocket client over TCP or TLS, with TLS session resumption
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "upstream_link.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+UpstreamLink::UpstreamLink()
+  : fd_(-1), tls_(false), resumed_(false), ctx_(nullptr), ssl_(nullptr), session_(nullptr),
+    mask_(0x2545F491) {}
+
+UpstreamLink::~UpstreamLink() {
+  close();
+  forgetSession();
+  if (ctx_ != nullptr) SSL_CTX_free(ctx_);
+}
+
+bool UpstreamLink::parse(const std::string& url) {
+  size_t scheme = url.find("://");
+  if (scheme == std::string::npos) return false;
+  tls_ = url.compare(0, scheme, "wss") == 0;
+  if (!tls_ && url.compare(0, scheme, "ws") != 0) return false;
+  size_t hostStart = scheme + 3;
+  size_t pathStart = url.find('/', hostStart);
+  std::string authority = url.substr(hostStart, pathStart - hostStart);
+  path_ = pathStart == std::string::npos ? "/" : url.substr(pathStart);
+  size_t colon = authority.rfind(':');
+  host_ = colon == std::string::npos ? authority : authority.substr(0, colon);
+  port_ = colon == std::string::npos ? (tls_ ? "443" : "80") : authority.substr(colon + 1);
+  if (host_.empty()) return false;
+
+  if (tls_) {
+    ctx_ = SSL_CTX_new(TLS_client_method());
+    if (ctx_ == nullptr) return false;
+    SSL_CTX_set_default_verify_paths(ctx_);
+    SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, nullptr);
+
+    // Sessions go to onNewSession(), not to OpenSSL's own cache
+    SSL_CTX_set_app_data(ctx_, this);
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx_, onNewSession);
+  }
+  return true;
+}
+
+bool UpstreamLink::trust(X509* ca) {
+  return ctx_ != nullptr && X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx_), ca) == 1;
+}
+
+int UpstreamLink::onNewSession(SSL* ssl, SSL_SESSION* session) {
+  UpstreamLink* link = (UpstreamLink*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  if (link->session_ != nullptr) SSL_SESSION_free(link->session_);
+  link->session_ = session;
+  return 1;                            // The reference is ours now
+}
+
+void UpstreamLink::forgetSession() {
+  if (session_ != nullptr) SSL_SESSION_free(session_);
+  session_ = nullptr;
+}
+
+bool UpstreamLink::open() {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &result) != 0) return false;
+  for (addrinfo* ai = result; ai != nullptr && fd_ < 0; ai = ai->ai_next) {
+    fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd_ >= 0 && connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+  freeaddrinfo(result);
+  if (fd_ < 0) return false;
+
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  timeval timeout = {10, 0};
+  setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  resumed_ = false;
+  if (tls_) {
+    ssl_ = SSL_new(ctx_);
+    SSL_set_fd(ssl_, fd_);
+    SSL_set_tlsext_host_name(ssl_, host_.c_str());
+    SSL_set1_host(ssl_, host_.c_str());
+    if (session_ != nullptr) SSL_set_session(ssl_, session_);
+    if (SSL_connect(ssl_) != 1) {
+      fprintf(stderr, "Upstream TLS handshake failed\n");
+      // A session the server choked on is not offered again
+      forgetSession();
+      close();
+      return false;
+    }
+    resumed_ = SSL_session_reused(ssl_) == 1;
+  }
+
+  uint8_t nonce[16];
+  for (uint8_t& b : nonce) b = (uint8_t)next();
+  char key[32];
+  EVP_EncodeBlock((unsigned char*)key, nonce, sizeof(nonce));
+  std::string request = "GET " + path_ + " HTTP/1.1\r\n"
+    "Host: " + host_ + "\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: " + key + "\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Sec-WebSocket-Protocol: mqtt\r\n\r\n";
+  if (!writeAll((const uint8_t*)request.data(), request.size())) {
+    close();
+    return false;
+  }
+
+  std::string response;
+  char buf[512];
+  while (response.find("\r\n\r\n") == std::string::npos) {
+    int n = readSome((uint8_t*)buf, sizeof(buf));
+    if (n <= 0 || response.size() > 8192) {
+      close();
+      return false;
+    }
+    response.append(buf, (size_t)n);
+  }
+  if (response.compare(0, 12, "HTTP/1.1 101") != 0) {
+    fprintf(stderr, "Upstream refused the WebSocket upgrade: %.40s\n", response.c_str());
+    close();
+    return false;
+  }
+  rx_.assign(response, response.find("\r\n\r\n") + 4, std::string::npos);
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+void UpstreamLink::close() {
+  if (ssl_ != nullptr) {
+    // Without a close_notify, SSL_free() marks the session as not resumable
+    if (SSL_is_init_finished(ssl_)) SSL_shutdown(ssl_);
+    SSL_free(ssl_);
+    ssl_ = nullptr;
+  }
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+  rx_.clear();
+}
+
+bool UpstreamLink::send(const std::string& data, uint8_t opcode) {
+  std::string frame;
+  frame.reserve(data.size() + 14);
+  frame += (char)(0x80 | opcode);
+  if (data.size() < 126) {
+    frame += (char)(0x80 | data.size());
+  } else if (data.size() < 65536) {
+    frame += (char)(0x80 | 126);
+    frame += (char)(data.size() >> 8);
+    frame += (char)data.size();
+  } else {
+    frame += (char)(0x80 | 127);
+    for (int i = 7; i >= 0; i--) frame += (char)((uint64_t)data.size() >> (8 * i));
+  }
+  uint32_t m = next();
+  uint8_t key[4] = {(uint8_t)(m >> 24), (uint8_t)(m >> 16), (uint8_t)(m >> 8), (uint8_t)m};
+  frame.append((const char*)key, 4);
+  size_t start = frame.size();
+  frame += data;
+  for (size_t i = 0; i < data.size(); i++) frame[start + i] ^= key[i & 3];
+  return writeAll((const uint8_t*)frame.data(), frame.size());
+}
+
+bool UpstreamLink::receive(std::string& mqtt) {
+  uint8_t buf[16384];
+  for (;;) {
+    int n = readSome(buf, sizeof(buf));
+    if (n == 0) return false;
+    if (n < 0) break;
+    rx_.append((const char*)buf, (size_t)n);
+  }
+
+  size_t offset = 0;
+  for (;;) {
+    size_t avail = rx_.size() - offset;
+    if (avail < 2) break;
+    const uint8_t* p = (const uint8_t*)rx_.data() + offset;
+    uint8_t opcode = p[0] & 0x0F;
+    uint64_t length = p[1] & 0x7F;
+    size_t h = 2;
+    if (length == 126) {
+      if (avail < 4) break;
+      length = (uint64_t)p[2] << 8 | p[3];
+      h = 4;
+    } else if (length == 127) {
+      if (avail < 10) break;
+      length = 0;
+      for (int i = 0; i < 8; i++) length = length << 8 | p[2 + i];
+      h = 10;
+    }
+    if (length > UPSTREAM_MAX_FRAME) return false;
+    if (avail < h + length) break;
+
+    if (opcode == WS_BINARY || opcode == WS_CONTINUATION) mqtt.append((const char*)p + h, (size_t)length);
+    else if (opcode == WS_PING) send(std::string((const char*)p + h, (size_t)length), WS_PONG);
+    else if (opcode == WS_CLOSE) return false;
+    offset += h + (size_t)length;
+  }
+  rx_.erase(0, offset);
+  return true;
+}
+
+uint32_t UpstreamLink::next() {
+  mask_ ^= mask_ << 13;
+  mask_ ^= mask_ >> 17;
+  mask_ ^= mask_ << 5;
+  return mask_;
+}
+
+int UpstreamLink::readSome(uint8_t* buf, size_t size) {
+  if (ssl_ != nullptr) {
+    int n = SSL_read(ssl_, buf, (int)size);
+    if (n > 0) return n;
+    int error = SSL_get_error(ssl_, n);
+    return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ? -1 : 0;
+  }
+  ssize_t n = recv(fd_, buf, size, 0);
+  if (n > 0) return (int)n;
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : 0;
+}
+
+bool UpstreamLink::writeAll(const uint8_t* data, size_t length) {
+  while (length > 0) {
+    int n;
+    if (ssl_ != nullptr) {
+      n = SSL_write(ssl_, data, (int)length);
+      if (n <= 0) {
+        int error = SSL_get_error(ssl_, n);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) return false;
+        n = 0;
+      }
+    } else {
+      ssize_t sent = ::send(fd_, data, length, MSG_NOSIGNAL);
+      if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+      n = sent < 0 ? 0 : (int)sent;
+    }
+    if (n == 0) {
+      pollfd p = {fd_, POLLOUT, 0};
+      if (poll(&p, 1, 10000) <= 0) return false;
+      continue;
+    }
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
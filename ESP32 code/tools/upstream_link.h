@@ -0,0 +1,108 @@
+/**
+ * @file upstream_link.h
+ * @brief WebSocket client over TCP or TLS, with TLS session resumption
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section upstream_link_overview Overview
+ *
+ * The edge gateway's connection to the backend: TCP, TLS for wss:// URLs,
+ * then the WebSocket upgrade with the "mqtt" subprotocol. Frames are sent
+ * masked, as a client must, and received binary payloads are appended to
+ * a byte string for the MQTT parser.
+ *
+ * Every TLS session the server hands out (a TLS 1.3 ticket, or a TLS 1.2
+ * session ID or ticket) is kept in RAM, and the next open() offers it. A
+ * server that still knows it skips the certificate exchange and the key
+ * agreement's signature; one that does not falls back to a full
+ * handshake. resumed() tells which one the last open() got.
+ * tls_reconnect_bench measures the difference.
+ */
+
+#ifndef UPSTREAM_LINK_H
+#define UPSTREAM_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <openssl/ssl.h>
+
+// ---- WebSocket opcodes ----
+const uint8_t WS_CONTINUATION = 0x0;
+const uint8_t WS_TEXT         = 0x1;
+const uint8_t WS_BINARY       = 0x2;
+const uint8_t WS_CLOSE        = 0x8;
+const uint8_t WS_PING         = 0x9;
+const uint8_t WS_PONG         = 0xA;
+
+const size_t UPSTREAM_MAX_FRAME = 1024 * 1024;  ///< Larger frames end the connection
+
+class UpstreamLink {
+public:
+  UpstreamLink();
+  ~UpstreamLink();
+
+  /**
+   * @brief Take the server URL, ws://HOST[:PORT]/PATH or wss://...
+   */
+  bool parse(const std::string& url);
+
+  /**
+   * @brief Accept certificates issued by ca, on top of the system's roots
+   */
+  bool trust(X509* ca);
+
+  /**
+   * @brief Connect, handshake (resuming the last TLS session if any) and upgrade
+   */
+  bool open();
+  void close();
+
+  int  fd() const { return fd_; }
+
+  /**
+   * @brief The last open() resumed a TLS session
+   */
+  bool resumed() const { return resumed_; }
+
+  /**
+   * @brief Forget the kept TLS session; the next open() does a full handshake
+   */
+  void forgetSession();
+
+  /**
+   * @brief Send one masked frame
+   */
+  bool send(const std::string& data, uint8_t opcode = WS_BINARY);
+
+  /**
+   * @brief Read what is available and append the binary payloads to mqtt
+   * @return false once the connection is gone
+   */
+  bool receive(std::string& mqtt);
+
+private:
+  static int onNewSession(SSL* ssl, SSL_SESSION* session);
+
+  uint32_t next();
+
+  // >0 bytes read, 0 closed, -1 nothing available
+  int  readSome(uint8_t* buf, size_t size);
+  bool writeAll(const uint8_t* data, size_t length);
+
+  int          fd_;
+  bool         tls_;
+  bool         resumed_;
+  std::string  host_;
+  std::string  port_;
+  std::string  path_;
+  SSL_CTX*     ctx_;
+  SSL*         ssl_;
+  SSL_SESSION* session_;               ///< Offered on the next open()
+  uint32_t     mask_;
+  std::string  rx_;
+};
+
+#endif // UPSTREAM_LINK_H
@@ -0,0 +1,246 @@
+/**
+ * @file uid_index.h
+ * @brief Fixed-capacity hashed index of authorized RFID card UIDs
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section uid_index_overview Overview
+ *
+ * Open-addressing (linear probing) hash table keyed by the raw card UID.
+ * Supports the 4, 7 and 10 byte UIDs defined by ISO14443A. The table is a
+ * plain array sized at compile time, so it never touches the heap and the
+ * baked-in user list can be built entirely by the compiler (see
+ * makeUidIndex()) and placed in flash.
+ *
+ * Roles are stored as a one-byte Role code instead of a string pointer;
+ * roleName() converts back to the text the backend expects.
+ */
+
+#ifndef UID_INDEX_H
+#define UID_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CARD_UID_MAX_SIZE 10        ///< Longest ISO14443A UID (triple size)
+
+// ---- Roles ----
+enum class Role : uint8_t {
+  Unknown     = 0,
+  Guest       = 1,
+  Manager     = 2,
+  Maintenance = 3,
+  Housekeeping = 4,
+  Security    = 5
+};
+
+/**
+ * @brief Role name as sent to the backend ("Guest", "Manager", ...)
+ */
+inline const char* roleName(Role role) {
+  switch (role) {
+    case Role::Guest:        return "Guest";
+    case Role::Manager:      return "Manager";
+    case Role::Maintenance:  return "Maintenance";
+    case Role::Housekeeping: return "Housekeeping";
+    case Role::Security:     return "Security";
+    default:                 return "Unknown";
+  }
+}
+
+// ---- Card UID ----
+struct CardUid {
+  uint8_t size;
+  uint8_t bytes[CARD_UID_MAX_SIZE];
+};
+
+/**
+ * @brief Build a CardUid from a byte list, e.g. cardUid({0xAF, 0x4D, 0x99, 0x1F})
+ */
+template <size_t N>
+constexpr CardUid cardUid(const uint8_t (&bytes)[N]) {
+  static_assert(N == 4 || N == 7 || N == 10, "UID must be 4, 7 or 10 bytes");
+  CardUid uid{};
+  uid.size = N;
+  for (size_t i = 0; i < N; i++) uid.bytes[i] = bytes[i];
+  return uid;
+}
+
+inline bool sameCard(const CardUid& a, const CardUid& b) {
+  if (a.size != b.size) return false;
+  for (uint8_t i = 0; i < a.size; i++) {
+    if (a.bytes[i] != b.bytes[i]) return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Format a UID as uppercase hex into buf (needs 2 * size + 1 bytes)
+ * @return Number of characters written (excluding terminator)
+ */
+inline size_t formatCardUid(const uint8_t* uid, uint8_t size, char* buf, size_t bufSize) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t n = 0;
+  for (uint8_t i = 0; i < size && n + 2 < bufSize; i++) {
+    buf[n++] = hex[uid[i] >> 4];
+    buf[n++] = hex[uid[i] & 0x0F];
+  }
+  if (bufSize > 0) buf[n] = '\0';
+  return n;
+}
+
+// ---- Authorized user entry ----
+struct UserAuth {
+  CardUid uid;
+  Role    role;
+};
+
+// ---- Hash index ----
+template <size_t Capacity>
+class UidIndex {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "UidIndex capacity must be a power of two");
+
+public:
+  constexpr UidIndex() : slots_{}, count_(0) {}
+
+  /**
+   * @brief Insert or update a card
+   * @return false if the UID size is invalid or the table is full
+   */
+  constexpr bool insert(const uint8_t* uid, uint8_t size, Role role) {
+    if (!validSize(size)) return false;
+
+    size_t pos = hash(uid, size) & kMask;
+    for (size_t probe = 0; probe < Capacity; probe++) {
+      Slot& slot = slots_[pos];
+      if (slot.size == 0) {
+        // Keep at least one empty slot so failed lookups always terminate
+        if (count_ + 1 >= Capacity) return false;
+        slot.size = size;
+        slot.role = static_cast<uint8_t>(role);
+        for (uint8_t i = 0; i < size; i++) slot.uid[i] = uid[i];
+        count_++;
+        return true;
+      }
+      if (matches(slot, uid, size)) {
+        slot.role = static_cast<uint8_t>(role);
+        return true;
+      }
+      pos = (pos + 1) & kMask;
+    }
+    return false;
+  }
+
+  constexpr bool insert(const CardUid& uid, Role role) {
+    return insert(uid.bytes, uid.size, role);
+  }
+
+  /**
+   * @brief Remove a card
+   * @return false if the card was not in the table
+   */
+  constexpr bool remove(const uint8_t* uid, uint8_t size) {
+    if (!validSize(size)) return false;
+
+    size_t hole = hash(uid, size) & kMask;
+    for (;;) {
+      if (slots_[hole].size == 0) return false;
+      if (matches(slots_[hole], uid, size)) break;
+      hole = (hole + 1) & kMask;
+    }
+
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole so lookups never need tombstones
+    size_t next = (hole + 1) & kMask;
+    while (slots_[next].size != 0) {
+      size_t home = hash(slots_[next].uid, slots_[next].size) & kMask;
+      if (((next - home) & kMask) >= ((next - hole) & kMask)) {
+        slots_[hole] = slots_[next];
+        hole = next;
+      }
+      next = (next + 1) & kMask;
+    }
+    slots_[hole].size = 0;
+    count_--;
+    return true;
+  }
+
+  constexpr void clear() {
+    for (size_t i = 0; i < Capacity; i++) slots_[i].size = 0;
+    count_ = 0;
+  }
+
+  /**
+   * @brief Look up a card
+   * @return The card's role, or Role::Unknown if it is not authorized
+   */
+  constexpr Role lookup(const uint8_t* uid, uint8_t size) const {
+    if (!validSize(size)) return Role::Unknown;
+
+    size_t pos = hash(uid, size) & kMask;
+    for (size_t probe = 0; probe < Capacity; probe++) {
+      const Slot& slot = slots_[pos];
+      if (slot.size == 0) return Role::Unknown;
+      if (matches(slot, uid, size)) return static_cast<Role>(slot.role);
+      pos = (pos + 1) & kMask;
+    }
+    return Role::Unknown;
+  }
+
+  constexpr size_t size() const { return count_; }
+  static constexpr size_t capacity() { return Capacity; }
+
+private:
+  struct Slot {
+    uint8_t size;                      ///< 0 = empty
+    uint8_t role;
+    uint8_t uid[CARD_UID_MAX_SIZE];
+  };
+
+  static constexpr size_t kMask = Capacity - 1;
+
+  static constexpr bool validSize(uint8_t size) {
+    return size == 4 || size == 7 || size == 10;
+  }
+
+  // FNV-1a; UIDs are close to random already, this just mixes in the length
+  static constexpr uint32_t hash(const uint8_t* uid, uint8_t size) {
+    uint32_t h = 2166136261u ^ size;
+    for (uint8_t i = 0; i < size; i++) {
+      h ^= uid[i];
+      h *= 16777619u;
+    }
+    return h;
+  }
+
+  static constexpr bool matches(const Slot& slot, const uint8_t* uid, uint8_t size) {
+    if (slot.size != size) return false;
+    for (uint8_t i = 0; i < size; i++) {
+      if (slot.uid[i] != uid[i]) return false;
+    }
+    return true;
+  }
+
+  Slot   slots_[Capacity];
+  size_t count_;
+};
+
+/**
+ * @brief Build an index from a user table at compile time
+ *
+ * @code
+ * constexpr UserAuth users[] = { {cardUid({0xAF, 0x4D, 0x99, 0x1F}), Role::Maintenance} };
+ * constexpr auto index = makeUidIndex<64>(users);
+ * @endcode
+ */
+template <size_t Capacity, size_t N>
+constexpr UidIndex<Capacity> makeUidIndex(const UserAuth (&users)[N]) {
+  static_assert(N < Capacity, "UID index capacity too small for user table");
+  UidIndex<Capacity> index;
+  for (size_t i = 0; i < N; i++) index.insert(users[i].uid, users[i].role);
+  return index;
+}
+
+#endif // UID_INDEX_H
@@ -0,0 +1,109 @@
+/**
+ * @file wall_clock.cpp
+ * @brief Monotonic event clock disciplined by NTP
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ */
+
+#include "wall_clock.h"
+
+namespace {
+
+// An error this much larger than CLOCK_MAX_DRIFT_PPB could build up over
+// the interval is a clock step (first real sync after a bad one), not
+// oscillator drift
+const int64_t CLOCK_STEP_US = 1000000;
+
+} // namespace
+
+WallClock::WallClock(uint8_t bootId)
+  : seq_(0), baseMonoUs_(0), baseEpochUs_(0), ratePpb_(0), bootId_(bootId & 0x7F) {}
+
+uint64_t WallClock::project(uint64_t baseEpochUs, uint64_t baseMonoUs,
+                            int32_t ratePpb, uint64_t monoUs) {
+  int64_t dt = (int64_t)(monoUs - baseMonoUs);
+  return baseEpochUs + dt + dt * ratePpb / 1000000000;
+}
+
+void WallClock::set(uint64_t epochUs, uint64_t monoUs) {
+  uint32_t seq = seq_.load(std::memory_order_relaxed);
+  int32_t rate = ratePpb_;
+
+  if (seq != 0) {
+    int64_t dt = (int64_t)(monoUs - baseMonoUs_);
+    int64_t error = (int64_t)(epochUs - project(baseEpochUs_, baseMonoUs_, ratePpb_, monoUs));
+    int64_t stepUs = dt * CLOCK_MAX_DRIFT_PPB / 1000000000 + CLOCK_STEP_US;
+    if (dt >= (int64_t)CLOCK_MIN_RATE_INTERVAL_US && error > -stepUs && error < stepUs) {
+      int64_t corrected = rate + error * 1000000000 / dt;
+      if (corrected > CLOCK_MAX_DRIFT_PPB) corrected = CLOCK_MAX_DRIFT_PPB;
+      if (corrected < -CLOCK_MAX_DRIFT_PPB) corrected = -CLOCK_MAX_DRIFT_PPB;
+      rate = (int32_t)corrected;
+    }
+  }
+
+  seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  baseMonoUs_ = monoUs;
+  baseEpochUs_ = epochUs;
+  ratePpb_ = rate;
+  seq_.store(seq + 2, std::memory_order_release);
+}
+
+void WallClock::restore(const ClockState& state) {
+  uint32_t seq = seq_.load(std::memory_order_relaxed);
+  seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  baseMonoUs_ = state.baseMonoUs;
+  baseEpochUs_ = state.baseEpochUs;
+  ratePpb_ = state.ratePpb;
+  seq_.store(seq + 2, std::memory_order_release);
+}
+
+ClockState WallClock::state() const {
+  for (;;) {
+    uint32_t seq = seq_.load(std::memory_order_acquire);
+    if (seq == 0) return {0, 0, 0};
+    if (seq & 1) continue;
+
+    ClockState state = {baseMonoUs_, baseEpochUs_, ratePpb_};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq_.load(std::memory_order_relaxed) == seq) return state;
+  }
+}
+
+uint64_t WallClock::epochUs(uint64_t monoUs) const {
+  for (;;) {
+    uint32_t seq = seq_.load(std::memory_order_acquire);
+    if (seq == 0) return 0;
+    if (seq & 1) continue;
+
+    uint64_t baseMonoUs = baseMonoUs_;
+    uint64_t baseEpochUs = baseEpochUs_;
+    int32_t ratePpb = ratePpb_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq_.load(std::memory_order_relaxed) == seq) {
+      return project(baseEpochUs, baseMonoUs, ratePpb, monoUs);
+    }
+  }
+}
+
+EventTime WallClock::stamp(uint64_t monoUs) const {
+  uint64_t epoch = epochUs(monoUs);
+  if (epoch != 0) return {(uint32_t)(epoch / 1000000), (uint16_t)(epoch / 1000 % 1000)};
+
+  uint32_t seconds = (uint32_t)(monoUs / 1000000);
+  return {UNSYNCED_STAMP | ((uint32_t)bootId_ << UNSYNCED_BOOT_SHIFT) | (seconds & UNSYNCED_SECONDS_MASK),
+          (uint16_t)(monoUs / 1000 % 1000)};
+}
+
+uint64_t WallClock::resolve(const EventTime& time) const {
+  if ((time.timestamp & UNSYNCED_STAMP) == 0) {
+    return (uint64_t)time.timestamp * 1000000 + (uint64_t)time.millis * 1000;
+  }
+  if (((time.timestamp >> UNSYNCED_BOOT_SHIFT) & 0x7F) != bootId_) return 0;
+
+  uint64_t monoUs = (uint64_t)(time.timestamp & UNSYNCED_SECONDS_MASK) * 1000000 +
+                    (uint64_t)time.millis * 1000;
+  return epochUs(monoUs);
+}
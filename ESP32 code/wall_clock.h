@@ -0,0 +1,115 @@
+/**
+ * @file wall_clock.h
+ * @brief Monotonic event clock disciplined by NTP
+ * @author Hardware Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * @section wall_clock_overview Overview
+ *
+ * Every event is stamped once, when its read cycle runs, from a 64-bit
+ * monotonic microsecond clock (esp_timer on the ESP32). The wall time is
+ * derived from that clock, not read from the system clock again: each NTP
+ * sync sets the offset, and from the second sync on, the error against
+ * the previous one also corrects the rate. A crystal that is 20 ppm off
+ * would drift 72 ms per NTP_SYNC_INTERVAL. With the correction the error
+ * stays within about three times what each NTP answer is off by
+ * (tests/clock_drift_test.cpp).
+ *
+ * Cards are read from the first milliseconds after boot, long before NTP
+ * answers. Until the clock is set, stamp() returns the seconds since boot,
+ * tagged with UNSYNCED_STAMP and a 7-bit boot id. Once NTP has synced,
+ * resolve() turns such a stamp into Unix time. A stamp from an earlier
+ * boot cannot be resolved and comes back as 0.
+ *
+ * The network task calls set(); any task may read. Readers retry if a
+ * sync lands while they read (sequence lock), they never block.
+ */
+
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <stdint.h>
+#include <atomic>
+
+#define UNSYNCED_STAMP 0x80000000u    ///< Stamp flag: boot-relative seconds, not Unix time
+#define UNSYNCED_BOOT_SHIFT 24
+#define UNSYNCED_SECONDS_MASK 0x00FFFFFFu
+
+#define CLOCK_MAX_DRIFT_PPB 500000    ///< Rate corrections are clamped to +-500 ppm
+#define CLOCK_MIN_RATE_INTERVAL_US 60000000ull  ///< Shorter sync gaps only set the offset
+
+/**
+ * @brief Time of an event: Unix seconds (or an unsynced stamp) and milliseconds
+ */
+struct EventTime {
+  uint32_t timestamp;
+  uint16_t millis;
+};
+
+/**
+ * @brief Everything epochUs() depends on, as recorded in a field trace
+ */
+struct ClockState {
+  uint64_t baseMonoUs;
+  uint64_t baseEpochUs;
+  int32_t  ratePpb;
+};
+
+class WallClock {
+public:
+  explicit WallClock(uint8_t bootId);
+
+  /**
+   * @brief Clock set by NTP, or carried over a warm reset
+   * @param epochUs Current Unix time (us)
+   * @param monoUs  Monotonic time (us) at the same instant
+   */
+  void set(uint64_t epochUs, uint64_t monoUs);
+
+  /**
+   * @brief Take over a state read with state(), rate included (trace replay)
+   */
+  void restore(const ClockState& state);
+
+  /**
+   * @brief Current offset and rate; all zero before the clock is set
+   */
+  ClockState state() const;
+
+  bool synced() const { return seq_.load(std::memory_order_acquire) != 0; }
+
+  uint8_t bootId() const { return bootId_; }
+
+  /**
+   * @brief Current rate correction in parts per billion
+   */
+  int32_t driftPpb() const { return ratePpb_; }
+
+  /**
+   * @brief Unix time (us) at a monotonic instant, or 0 before the clock is set
+   */
+  uint64_t epochUs(uint64_t monoUs) const;
+
+  /**
+   * @brief Time of an event happening at monoUs
+   */
+  EventTime stamp(uint64_t monoUs) const;
+
+  /**
+   * @brief Unix time (us) of an event; 0 if it cannot be known (yet)
+   */
+  uint64_t resolve(const EventTime& time) const;
+
+private:
+  static uint64_t project(uint64_t baseEpochUs, uint64_t baseMonoUs,
+                          int32_t ratePpb, uint64_t monoUs);
+
+  std::atomic<uint32_t> seq_;         ///< Odd while set() writes, 0 until first set
+  uint64_t              baseMonoUs_;
+  uint64_t              baseEpochUs_;
+  int32_t               ratePpb_;
+  uint8_t               bootId_;
+};
+
+#endif // WALL_CLOCK_H
@@ -22,7 +22,8 @@ export function useHotelData(hotelId: string) {
 
       setHotel(hotelData);
       setRooms(roomsData);
-      setActivities(activitiesData);
+      // The newest page; older activity is behind nextCursor
+      setActivities(activitiesData.items);
     } catch (err) {
       setError(err instanceof Error ? err.message : 'Failed to fetch hotel data');
       console.error('Error fetching hotel data:', err);
@@ -51,6 +51,7 @@ export interface Alert {
   role: string;
   alert_message: string;
   triggered_at: string;
+  attempts?: number;
   room: string;
 }
 
@@ -60,6 +61,7 @@ export interface DeniedAccess {
   role: string;
   denial_reason: string;
   attempted_at: string;
+  attempts?: number;
   room: string;
 }
 
@@ -72,6 +74,27 @@ export interface Activity {
   time: string;
 }
 
+export interface OccupancyBucket {
+  room: string;
+  role: string;
+  start: string;
+  dwell: number;
+  checkIns: number;
+  checkOuts: number;
+}
+
+// One page of an event list; nextCursor is null on the last page
+export interface Page<T> {
+  items: T[];
+  nextCursor: string | null;
+}
+
+export interface PageOptions {
+  limit?: number;        // Rows, at most 1000 (the server's default is 200)
+  before?: string;       // nextCursor of the previous page
+  room?: string;         // Not on activity
+}
+
 export interface User {
   hotelId: string;
   id: string;
@@ -95,6 +118,22 @@ export interface Card {
 
 class ApiService {
   private async request<T>(endpoint: string, options?: RequestInit): Promise<T> {
+    const response = await this.send(endpoint, options);
+    return response.json();
+  }
+
+  // Event lists are paged by the server; follow nextCursor for older rows
+  private async requestPage<T>(endpoint: string, page?: PageOptions): Promise<Page<T>> {
+    const params = new URLSearchParams();
+    if (page?.limit) params.set('limit', String(page.limit));
+    if (page?.before) params.set('before', page.before);
+    if (page?.room) params.set('room', page.room);
+    const query = params.toString();
+    const response = await this.send(query ? `${endpoint}?${query}` : endpoint);
+    return { items: await response.json(), nextCursor: response.headers.get('X-Next-Cursor') };
+  }
+
+  private async send(endpoint: string, options?: RequestInit): Promise<Response> {
     const url = `${API_BASE_URL}${endpoint}`;
     
     try {
@@ -110,7 +149,7 @@ class ApiService {
         throw new Error(`API request failed: ${response.status} ${response.statusText}`);
       }
 
-      return response.json();
+      return response;
     } catch (error) {
       console.error(`API request failed for ${endpoint}:`, error);
       throw new Error(`Failed to connect to server. Please ensure the backend server is running on ${API_BASE_URL}`);
@@ -139,18 +178,22 @@ class ApiService {
   }
 
   // Attendance endpoints
-  async getAttendance(hotelId: string): Promise<Attendance[]> {
-    return this.request<Attendance[]>(`/api/attendance/${hotelId}`);
+  async getAttendance(hotelId: string, page?: PageOptions): Promise<Page<Attendance>> {
+    return this.requestPage<Attendance>(`/api/attendance/${hotelId}`, page);
+  }
+
+  async getOccupancy(hotelId: string, period: 'hour' | 'day' = 'day'): Promise<OccupancyBucket[]> {
+    return this.request<OccupancyBucket[]>(`/api/occupancy/${hotelId}?period=${period}`);
   }
 
   // Alert endpoints
-  async getAlerts(hotelId: string): Promise<Alert[]> {
-    return this.request<Alert[]>(`/api/alerts/${hotelId}`);
+  async getAlerts(hotelId: string, page?: PageOptions): Promise<Page<Alert>> {
+    return this.requestPage<Alert>(`/api/alerts/${hotelId}`, page);
   }
 
   // Denied access endpoints
-  async getDeniedAccess(hotelId: string): Promise<DeniedAccess[]> {
-    return this.request<DeniedAccess[]>(`/api/denied_access/${hotelId}`);
+  async getDeniedAccess(hotelId: string, page?: PageOptions): Promise<Page<DeniedAccess>> {
+    return this.requestPage<DeniedAccess>(`/api/denied_access/${hotelId}`, page);
   }
 
   // User endpoints
@@ -164,8 +207,8 @@ class ApiService {
   }
 
   // Activity endpoints
-  async getActivity(hotelId: string): Promise<Activity[]> {
-    return this.request<Activity[]>(`/api/activity/${hotelId}`);
+  async getActivity(hotelId: string, page?: PageOptions): Promise<Page<Activity>> {
+    return this.requestPage<Activity>(`/api/activity/${hotelId}`, page);
   }
 }
 
@@ -62,6 +62,7 @@ class SocketService {
           clearTimeout(this.reconnectTimer);
           this.reconnectTimer = null;
         }
+        this.sendSubscriptions();
       };
 
       this.socket.onclose = (event: CloseEvent) => {
@@ -96,7 +97,10 @@ class SocketService {
           const eventName = data.event || data.type;
           const listeners = this.eventListeners.get(eventName);
           if (listeners) {
-            listeners.forEach(callback => callback(data.data || data));
+            // Batched broadcasts carry an array of updates
+            const payload = data.data || data;
+            const items = Array.isArray(payload) ? payload : [payload];
+            listeners.forEach(callback => items.forEach(item => callback(item)));
           }
         } catch (error) {
           console.error('Error parsing socket message:', error);
@@ -151,7 +155,10 @@ class SocketService {
           const eventName = data.event || data.type;
           const listeners = this.eventListeners.get(eventName);
           if (listeners) {
-            listeners.forEach(callback => callback(data.data || data));
+            // Batched broadcasts carry an array of updates
+            const payload = data.data || data;
+            const items = Array.isArray(payload) ? payload : [payload];
+            listeners.forEach(callback => items.forEach(item => callback(item)));
           }
         } catch (error) {
           console.error('Error parsing SSE message:', error);
@@ -253,6 +260,8 @@ class SocketService {
       this.connectSSE(hotelId);
     } else if (!this.socket) {
       this.connect();
+    } else {
+      this.sendSubscriptions();
     }
   }
 
@@ -280,6 +289,8 @@ class SocketService {
       this.connectSSE(hotelId);
     } else if (!this.socket) {
       this.connect();
+    } else {
+      this.sendSubscriptions();
     }
   }
 
@@ -294,6 +305,19 @@ class SocketService {
     }
   }
 
+  // The server only sends a WebSocket client the hotels it subscribed to
+  private sendSubscriptions(): void {
+    if (!this.socket || this.socket.readyState !== WebSocket.OPEN) return;
+    const hotels = new Set<string>();
+    this.eventListeners.forEach((_, eventName) => {
+      const separator = eventName.indexOf(':');
+      if (separator > 0) hotels.add(eventName.slice(separator + 1));
+    });
+    if (hotels.size > 0) {
+      this.socket.send(JSON.stringify({ action: 'subscribe', hotels: Array.from(hotels) }));
+    }
+  }
+
   // Generic event listeners
   on(event: string, callback: (...args: any[]) => void): void {
     if (!this.socket) {
@@ -0,0 +1,204 @@
+/**
+ * @file attendance-bench.js
+ * @brief Query latency of the attendance endpoints at production volume
+ * @author Development Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * Seeds a separate database with attendance rows and occupancy rollups,
+ * creates the indexes Backend/index.js declares, and times the queries
+ * behind /api/attendance and /api/occupancy against their unindexed,
+ * unbounded predecessors.
+ *
+ *   MONGO_URL=mongodb://127.0.0.1:27017 node scripts/attendance-bench.js --rows 10000000
+ *
+ * Options: --rows N (10000000), --hotels N (5), --rooms N per hotel (200),
+ * --days N of history (365), --reuse to skip seeding an existing database.
+ */
+
+const path = require('path');
+const mongoose = require(require.resolve('mongoose', { paths: [path.join(__dirname, '..', 'Backend')] }));
+
+const args = process.argv.slice(2);
+function option(name, fallback) {
+    const i = args.indexOf(`--${name}`);
+    return i >= 0 && args[i + 1] ? Number(args[i + 1]) : fallback;
+}
+
+const ROWS = option('rows', 10000000);
+const HOTELS = option('hotels', 5);
+const ROOMS = option('rooms', 200);
+const DAYS = option('days', 365);
+const REUSE = args.includes('--reuse');
+const SEED_BATCH = 10000;
+const PAGE = 200;
+const RUNS = 20;
+const DAY_MS = 24 * 3600 * 1000;
+const ROLES = ['Guest', 'Guest', 'Guest', 'Housekeeping', 'Maintenance', 'Manager'];
+
+// Must match the schema indexes in Backend/index.js
+const INDEXES = {
+    attendances: [
+        { hotelId: 1, createdAt: -1, _id: -1 },
+        { hotelId: 1, room: 1, createdAt: -1, _id: -1 },
+    ],
+    occupancies: [
+        [{ hotelId: 1, period: 1, start: 1, room: 1, role: 1 }, { unique: true }],
+    ],
+};
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.round((p / 100) * (sorted.length - 1)))];
+}
+
+async function time(label, runs, fn) {
+    const ms = [];
+    let rows = 0;
+    for (let i = 0; i < runs; i++) {
+        const start = process.hrtime.bigint();
+        rows = await fn(i);
+        ms.push(Number(process.hrtime.bigint() - start) / 1e6);
+    }
+    ms.sort((a, b) => a - b);
+    console.log(`${label.padEnd(44)} ${String(rows).padStart(8)} rows  ` +
+        `p50 ${percentile(ms, 50).toFixed(1).padStart(9)} ms  p99 ${percentile(ms, 99).toFixed(1).padStart(9)} ms`);
+}
+
+async function seed(db) {
+    await db.dropDatabase();
+    const attendances = db.collection('attendances');
+    const endMs = Date.now();
+    let seq = 0;
+    const startedMs = Date.now();
+
+    for (let done = 0; done < ROWS; done += SEED_BATCH) {
+        const docs = [];
+        for (let i = 0; i < Math.min(SEED_BATCH, ROWS - done); i++) {
+            const n = done + i;
+            // Rows arrive in time order, as they do at ingest
+            const createdAt = new Date(endMs - DAYS * DAY_MS + Math.floor((n / ROWS) * DAYS * DAY_MS));
+            const checkIn = n % 2 === 0;
+            const doc = {
+                hotelId: String(1 + (n % HOTELS)),
+                card_uid: (0x10000000 + (n % 50000)).toString(16).toUpperCase(),
+                role: ROLES[n % ROLES.length],
+                room: String(101 + ((n >> 1) % ROOMS)),
+                seq: seq++,
+                createdAt,
+                updatedAt: createdAt,
+            };
+            if (checkIn) doc.check_in = createdAt.toISOString();
+            else {
+                doc.check_out = createdAt.toISOString();
+                doc.duration = 600 + (n % 36000);
+            }
+            docs.push(doc);
+        }
+        await attendances.insertMany(docs, { ordered: false });
+        if ((done / SEED_BATCH) % 100 === 0) {
+            process.stdout.write(`\rSeeded ${done + docs.length} rows (${((Date.now() - startedMs) / 1000).toFixed(0)} s)`);
+        }
+    }
+    console.log('');
+
+    // Rollups in the shape ingest maintains, summed per check-out bucket.
+    // Only their count and layout matter for the query timings.
+    for (const [period, unit] of [['hour', 'hour'], ['day', 'day']]) {
+        await attendances.aggregate([
+            { $match: { check_out: { $exists: true } } },
+            { $group: {
+                _id: {
+                    hotelId: '$hotelId', room: '$room', role: '$role',
+                    start: { $dateTrunc: { date: '$createdAt', unit } },
+                },
+                dwell: { $sum: '$duration' },
+                checkOuts: { $sum: 1 },
+            } },
+            { $project: {
+                _id: 0, hotelId: '$_id.hotelId', room: '$_id.room', role: '$_id.role',
+                start: '$_id.start', period: { $literal: period }, dwell: 1, checkOuts: 1, checkIns: '$checkOuts',
+            } },
+            { $merge: { into: 'occupancies' } },
+        ], { allowDiskUse: true }).toArray();
+    }
+    console.log(`Seeded in ${((Date.now() - startedMs) / 1000).toFixed(0)} s`);
+}
+
+async function main() {
+    const url = process.env.MONGO_URL || 'mongodb://127.0.0.1:27017';
+    await mongoose.connect(url, { dbName: 'rfid_attendance_bench' });
+    const db = mongoose.connection.db;
+    if (!REUSE) await seed(db);
+
+    const attendances = db.collection('attendances');
+    const occupancies = db.collection('occupancies');
+    const total = await attendances.estimatedDocumentCount();
+    const rollups = await occupancies.estimatedDocumentCount();
+    console.log(`${total} attendance rows, ${rollups} rollup rows, ${HOTELS} hotels of ${ROOMS} rooms\n`);
+
+    const hotelId = '1';
+    const room = '150';
+    const monthAgo = new Date(Date.now() - 30 * DAY_MS);
+
+    // ---- Before: no indexes, whole collections ----
+    for (const name of Object.keys(INDEXES)) await db.collection(name).dropIndexes();
+    console.log('Without indexes');
+    await time('  first page, sorted scan', 3, async () =>
+        (await attendances.find({ hotelId }).sort({ createdAt: -1, _id: -1 }).limit(PAGE).toArray()).length);
+    await time('  30 days of daily dwell from raw rows', 3, async () =>
+        (await attendances.aggregate([
+            { $match: { hotelId, createdAt: { $gte: monthAgo }, check_out: { $exists: true } } },
+            { $group: { _id: { room: '$room', role: '$role', day: { $dateTrunc: { date: '$createdAt', unit: 'day' } } },
+                dwell: { $sum: '$duration' } } },
+        ], { allowDiskUse: true }).toArray()).length);
+
+    // ---- After ----
+    for (const [name, specs] of Object.entries(INDEXES)) {
+        for (const spec of specs) {
+            const [keys, options] = Array.isArray(spec) ? spec : [spec, {}];
+            await db.collection(name).createIndex(keys, options);
+        }
+    }
+    console.log('\nWith indexes');
+    await time('  first page', RUNS, async () =>
+        (await attendances.find({ hotelId }).sort({ createdAt: -1, _id: -1 }).limit(PAGE + 1).toArray()).length);
+
+    // Walk 500 pages with the cursor, then compare the last one with skip()
+    let cursor = null;
+    const walkMs = [];
+    for (let page = 0; page < 500; page++) {
+        const query = { hotelId };
+        if (cursor) {
+            query.$or = [
+                { createdAt: { $lt: cursor.createdAt } },
+                { createdAt: cursor.createdAt, _id: { $lt: cursor._id } },
+            ];
+        }
+        const start = process.hrtime.bigint();
+        const rows = await attendances.find(query).sort({ createdAt: -1, _id: -1 }).limit(PAGE + 1).toArray();
+        walkMs.push(Number(process.hrtime.bigint() - start) / 1e6);
+        if (rows.length <= PAGE) break;
+        cursor = rows[PAGE - 1];
+    }
+    walkMs.sort((a, b) => a - b);
+    console.log(`${'  keyset pages 1-' + walkMs.length}`.padEnd(45) + `${String(PAGE).padStart(8)} rows  ` +
+        `p50 ${percentile(walkMs, 50).toFixed(1).padStart(9)} ms  p99 ${percentile(walkMs, 99).toFixed(1).padStart(9)} ms`);
+    await time(`  offset page ${walkMs.length} with skip()`, 3, async () =>
+        (await attendances.find({ hotelId }).sort({ createdAt: -1, _id: -1 })
+            .skip((walkMs.length - 1) * PAGE).limit(PAGE + 1).toArray()).length);
+
+    await time('  first page of one room', RUNS, async () =>
+        (await attendances.find({ hotelId, room }).sort({ createdAt: -1, _id: -1 }).limit(PAGE + 1).toArray()).length);
+    await time('  30 days of daily dwell from rollups', RUNS, async () =>
+        (await occupancies.find({ hotelId, period: 'day', start: { $gte: monthAgo } }).sort({ start: 1 }).toArray()).length);
+    await time('  48 hours of hourly dwell for one room', RUNS, async () =>
+        (await occupancies.find({ hotelId, period: 'hour', start: { $gte: new Date(Date.now() - 2 * DAY_MS) }, room })
+            .sort({ start: 1 }).toArray()).length);
+
+    await mongoose.disconnect();
+}
+
+main().catch((err) => {
+    console.error(err);
+    process.exit(1);
+});
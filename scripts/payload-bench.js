@@ -0,0 +1,119 @@
+/**
+ * @file payload-bench.js
+ * @brief Backend decode time of reader events: CBOR against JSON
+ * @author Development Team
+ * @version 1.0.0
+ * @date 2024
+ *
+ * Builds reader events in the CBOR layout of the firmware's
+ * event_encoder.h, and the same events as the JSON readers send (the
+ * decoder's output, stringified). Then times Backend/binary_payload.js
+ * decodeBinaryPayload() against JSON.parse() on them, as
+ * handleRoomPublish() calls them: single events, and batches of
+ * PUBLISH_BATCH_MAX. The firmware side is bench/event_encoder_bench.cpp.
+ *
+ *   node scripts/payload-bench.js --events 100000
+ *
+ * Options: --events N (100000), --batch N events per batch (8),
+ * --runs N timed passes (20).
+ */
+
+const { decodeBinaryPayload } = require('../Backend/binary_payload');
+
+const args = process.argv.slice(2);
+function option(name, fallback) {
+    const i = args.indexOf(`--${name}`);
+    return i >= 0 && args[i + 1] ? Number(args[i + 1]) : fallback;
+}
+
+const EVENTS = option('events', 100000);
+const BATCH = option('batch', 8);
+const RUNS = option('runs', 20);
+const BINARY_PAYLOAD_VERSION = 1;
+
+// ---- CBOR, as encodeBinaryPayload() writes it ----
+function head(major, arg) {
+    if (arg < 24) return Buffer.from([(major << 5) | arg]);
+    if (arg < 0x100) return Buffer.from([(major << 5) | 24, arg]);
+    if (arg < 0x10000) return Buffer.from([(major << 5) | 25, arg >> 8, arg & 0xff]);
+    if (arg < 0x100000000) {
+        const b = Buffer.alloc(5);
+        b[0] = (major << 5) | 26;
+        b.writeUInt32BE(arg, 1);
+        return b;
+    }
+    const b = Buffer.alloc(9);
+    b[0] = (major << 5) | 27;
+    b.writeBigUInt64BE(BigInt(arg), 1);
+    return b;
+}
+
+function eventFields(n) {
+    const type = n % 10 < 4 ? 0 : n % 10 < 8 ? 1 : n % 10 < 9 ? 2 : 3;
+    const uid = n % 3 === 0
+        ? Buffer.from([0x04, 0x5a, 0x2c, (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff, 0x80])
+        : Buffer.from([0xaf, (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff]);
+    const role = type >= 2 ? 0 : 1 + (n % 4);
+    const fields = [BINARY_PAYLOAD_VERSION, type, n + 1, uid, role, 1735381800120 + n * 1000];
+    if (type !== 0) fields.push(type === 1 ? 600 + (n % 36000) : 1 + (n % 5));
+    return fields;
+}
+
+function encodeEvent(fields) {
+    const parts = [head(4, fields.length)];
+    for (const f of fields) {
+        if (Buffer.isBuffer(f)) parts.push(head(2, f.length), f);
+        else parts.push(head(0, f));
+    }
+    return Buffer.concat(parts);
+}
+
+const TAG = Buffer.from([0xd9, 0xd9, 0xf7]);
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.round((p / 100) * (sorted.length - 1)))];
+}
+
+// Time per event over RUNS passes of every payload
+function time(label, payloads, eventsPer, decode) {
+    let sink = 0;
+    for (const p of payloads) sink += decode(p) ? 1 : 0;   // Warm up
+    const ns = [];
+    for (let run = 0; run < RUNS; run++) {
+        const start = process.hrtime.bigint();
+        for (const p of payloads) sink += decode(p) ? 1 : 0;
+        ns.push(Number(process.hrtime.bigint() - start) / (payloads.length * eventsPer));
+    }
+    ns.sort((a, b) => a - b);
+    const bytes = payloads.reduce((sum, p) => sum + p.length, 0) / (payloads.length * eventsPer);
+    console.log(`${label.padEnd(24)} ${bytes.toFixed(1).padStart(7)} B/event  ` +
+        `p50 ${(percentile(ns, 50) / 1000).toFixed(2).padStart(6)} us  ` +
+        `p99 ${(percentile(ns, 99) / 1000).toFixed(2).padStart(6)} us per event`);
+    return sink;
+}
+
+function main() {
+    const fields = [];
+    for (let n = 0; n < EVENTS; n++) fields.push(eventFields(n));
+
+    const single = fields.map((f) => Buffer.concat([TAG, encodeEvent(f)]));
+    const batches = [];
+    for (let i = 0; i + BATCH <= fields.length; i += BATCH) {
+        const events = fields.slice(i, i + BATCH).map(encodeEvent);
+        batches.push(Buffer.concat([TAG, head(4, BATCH), ...events]));
+    }
+
+    // The same events as JSON, from the decoder so both sides carry the same fields
+    const singleJson = single.map((p) => Buffer.from(JSON.stringify(decodeBinaryPayload(p))));
+    const batchJson = batches.map((p) => Buffer.from(JSON.stringify(decodeBinaryPayload(p))));
+
+    console.log(`${EVENTS} events, ${RUNS} runs\n`);
+    console.log('Single events');
+    time('  CBOR decode', single, 1, decodeBinaryPayload);
+    time('  JSON.parse', singleJson, 1, (p) => JSON.parse(p.toString()));
+    console.log(`\nBatches of ${BATCH}`);
+    time('  CBOR decode', batches, BATCH, decodeBinaryPayload);
+    time('  JSON.parse', batchJson, BATCH, (p) => JSON.parse(p.toString()));
+}
+
+main();